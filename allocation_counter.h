@@ -0,0 +1,81 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef ALLOCATION_COUNTER_H_
+#define ALLOCATION_COUNTER_H_
+
+#include <atomic>
+#include <cstdint>
+
+namespace led_driver {
+
+// Counts heap allocations made by the threads which opt in, to check that
+// steady-state paths don't allocate. Allocations are only counted in builds
+// with `--define allocation_checks=true`, by the replacement `operator new` in
+// `:allocation_counter_check`, which only checks and benchmarks link. In other
+// builds, every call here compiles to nothing and `count()` is zero.
+class AllocationCounter {
+ public:
+#if defined(LED_DRIVER_ALLOCATION_CHECKS)
+  static constexpr bool kEnabled = true;
+#else
+  static constexpr bool kEnabled = false;
+#endif
+
+  // Starts or stops counting the calling thread's allocations.
+  static void SetCounting(bool counting) {
+    if (kEnabled) {
+      counting_ = counting;
+    }
+  }
+  static bool counting() { return kEnabled && counting_; }
+
+  // Allocations counted so far, by all threads.
+  static uint64_t count() {
+    return kEnabled ? count_.load(std::memory_order_relaxed) : 0;
+  }
+
+  // Counts an allocation by the calling thread, if it is counting. Only for
+  // the replacement `operator new`.
+  static void Count() {
+    if (counting()) {
+      count_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  // Stops counting the calling thread's allocations within a scope, such as
+  // for handling an occasional command.
+  class Pause {
+   public:
+    Pause() : counting_(counting()) { SetCounting(false); }
+    ~Pause() { SetCounting(counting_); }
+
+   private:
+    const bool counting_;
+  };
+
+ private:
+  static inline thread_local bool counting_ = false;
+  static inline std::atomic<uint64_t> count_{0};
+};
+
+}  // namespace led_driver
+
+#endif  // ALLOCATION_COUNTER_H_
@@ -0,0 +1,181 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "alsa_audio_source.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+
+#define CHECK_ALSA(call, message)                                       \
+  do {                                                                  \
+    int error = (call);                                                 \
+    if (error < 0) {                                                    \
+      std::cerr << message << ": " << snd_strerror(error) << std::endl; \
+      return false;                                                     \
+    }                                                                   \
+  } while (0)
+
+namespace led_driver {
+
+namespace {
+// How long to wait for a period before checking whether we've been stopped.
+constexpr int kWaitTimeoutMs = 100;
+}  // namespace
+
+AlsaAudioSource::~AlsaAudioSource() {
+  Stop();
+  if (pcm_ != nullptr) {
+    snd_pcm_close(pcm_);
+  }
+}
+
+bool AlsaAudioSource::Initialize() {
+  CHECK_ALSA(snd_pcm_open(&pcm_, device_name_.c_str(), SND_PCM_STREAM_CAPTURE,
+                          0),
+             "Failed to open ALSA device " << device_name_);
+
+  snd_pcm_hw_params_t *hw_params;
+  snd_pcm_hw_params_alloca(&hw_params);
+  CHECK_ALSA(snd_pcm_hw_params_any(pcm_, hw_params),
+             "Failed to read hardware parameters");
+  CHECK_ALSA(snd_pcm_hw_params_set_access(pcm_, hw_params,
+                                          SND_PCM_ACCESS_MMAP_INTERLEAVED),
+             "Device doesn't support interleaved mmap access");
+  CHECK_ALSA(
+      snd_pcm_hw_params_set_format(pcm_, hw_params, SND_PCM_FORMAT_FLOAT_LE),
+      "Device doesn't support float samples");
+  CHECK_ALSA(snd_pcm_hw_params_set_channels(pcm_, hw_params,
+                                            options_.channel_count),
+             "Failed to set channel count");
+
+  rate_ = options_.sampling_rate;
+  CHECK_ALSA(snd_pcm_hw_params_set_rate_near(pcm_, hw_params, &rate_, nullptr),
+             "Failed to set sampling rate");
+  if (static_cast<int>(rate_) != options_.sampling_rate) {
+    std::cerr << "ALSA device is running at " << rate_ << " Hz instead of "
+              << options_.sampling_rate << " Hz" << std::endl;
+  }
+
+  period_frames_ = options_.fragment_frames;
+  CHECK_ALSA(snd_pcm_hw_params_set_period_size_near(pcm_, hw_params,
+                                                    &period_frames_, nullptr),
+             "Failed to set period size");
+
+  snd_pcm_uframes_t buffer_frames = std::max<snd_pcm_uframes_t>(
+      2 * period_frames_,
+      absl::ToDoubleSeconds(options_.target_latency) * rate_);
+  CHECK_ALSA(snd_pcm_hw_params_set_buffer_size_near(pcm_, hw_params,
+                                                    &buffer_frames),
+             "Failed to set buffer size");
+  CHECK_ALSA(snd_pcm_hw_params(pcm_, hw_params),
+             "Failed to apply hardware parameters");
+
+  snd_pcm_sw_params_t *sw_params;
+  snd_pcm_sw_params_alloca(&sw_params);
+  CHECK_ALSA(snd_pcm_sw_params_current(pcm_, sw_params),
+             "Failed to read software parameters");
+  CHECK_ALSA(snd_pcm_sw_params_set_avail_min(pcm_, sw_params, period_frames_),
+             "Failed to set minimum available frames");
+  CHECK_ALSA(snd_pcm_sw_params(pcm_, sw_params),
+             "Failed to apply software parameters");
+
+  std::cout << "Configured ALSA capture with period=" << period_frames_
+            << " frames, buffer=" << buffer_frames << " frames" << std::endl;
+  return true;
+}
+
+bool AlsaAudioSource::Start() {
+  if (running_.exchange(true)) {
+    return true;
+  }
+  CHECK_ALSA(snd_pcm_start(pcm_), "Failed to start capture");
+  capture_thread_ = std::thread(&AlsaAudioSource::CaptureThread, this);
+  return true;
+}
+
+void AlsaAudioSource::Stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  capture_thread_.join();
+  snd_pcm_drop(pcm_);
+}
+
+bool AlsaAudioSource::DeliverAvailable() {
+  snd_pcm_sframes_t available = snd_pcm_avail_update(pcm_);
+  if (available < 0) {
+    CHECK_ALSA(snd_pcm_recover(pcm_, available, 1),
+               "Failed to recover from capture error");
+    CHECK_ALSA(snd_pcm_start(pcm_), "Failed to restart capture");
+    return true;
+  }
+
+  while (available >= static_cast<snd_pcm_sframes_t>(period_frames_)) {
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset;
+    snd_pcm_uframes_t frames = period_frames_;
+    CHECK_ALSA(snd_pcm_mmap_begin(pcm_, &areas, &offset, &frames),
+               "Failed to map capture buffer");
+
+    // Interleaved, so all channels share the first area.
+    const float *samples = reinterpret_cast<const float *>(
+        static_cast<const uint8_t *>(areas[0].addr) +
+        (areas[0].first + offset * areas[0].step) / 8);
+    batcher_.Push(
+        absl::Span<const float>(samples, frames * options_.channel_count));
+
+    snd_pcm_sframes_t committed = snd_pcm_mmap_commit(pcm_, offset, frames);
+    if (committed < 0 || static_cast<snd_pcm_uframes_t>(committed) != frames) {
+      CHECK_ALSA(snd_pcm_recover(pcm_, committed < 0 ? committed : -EPIPE, 1),
+                 "Failed to recover from commit error");
+      return true;
+    }
+    available -= frames;
+  }
+
+  snd_pcm_sframes_t delay;
+  if (snd_pcm_delay(pcm_, &delay) == 0) {
+    latency_us_.store(delay * 1000000ll / rate_, std::memory_order_relaxed);
+  }
+  return true;
+}
+
+void AlsaAudioSource::CaptureThread() {
+  while (running_.load()) {
+    int result = snd_pcm_wait(pcm_, kWaitTimeoutMs);
+    if (result < 0) {
+      if (snd_pcm_recover(pcm_, result, 1) < 0 || snd_pcm_start(pcm_) < 0) {
+        std::cerr << "Failed to recover from ALSA wait error: "
+                  << snd_strerror(result) << std::endl;
+        return;
+      }
+      continue;
+    }
+    if (result == 0) {
+      continue;
+    }
+    if (!DeliverAvailable()) {
+      return;
+    }
+  }
+}
+
+}  // namespace led_driver
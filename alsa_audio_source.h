@@ -0,0 +1,85 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef ALSA_AUDIO_SOURCE_H_
+#define ALSA_AUDIO_SOURCE_H_
+
+#include <alsa/asoundlib.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "audio_source.h"
+
+namespace led_driver {
+
+// Captures audio directly from an ALSA device, reading samples in place from
+// the device's mmap'd ring rather than copying them through `snd_pcm_readi`.
+class AlsaAudioSource : public AudioSourceInterface {
+ public:
+  AlsaAudioSource(std::string device_name, AudioSourceOptions options,
+                  SampleCallbackType sample_callback)
+      : device_name_(std::move(device_name)),
+        options_(std::move(options)),
+        batcher_(options_.callback_batch_frames * options_.channel_count,
+                 std::move(sample_callback)) {}
+
+  ~AlsaAudioSource() override;
+
+  bool Initialize() override;
+  bool Start() override;
+  void Stop() override;
+
+  absl::Duration GetLatency() const override {
+    int64_t latency_us = latency_us_.load(std::memory_order_relaxed);
+    if (latency_us < 0) {
+      return absl::InfiniteDuration();
+    }
+    return absl::Microseconds(latency_us);
+  }
+
+  uint64_t GetCallbackCount() const override {
+    return batcher_.callback_count();
+  }
+
+ private:
+  void CaptureThread();
+
+  // Delivers every complete period available in the mmap'd ring. Returns
+  // false on an unrecoverable error.
+  bool DeliverAvailable();
+
+  std::string device_name_;
+  AudioSourceOptions options_;
+  SampleBatcher batcher_;
+
+  snd_pcm_t *pcm_ = nullptr;
+  snd_pcm_uframes_t period_frames_ = 0;
+  unsigned int rate_ = 0;
+
+  std::atomic<bool> running_{false};
+  std::atomic<int64_t> latency_us_{-1};
+  std::thread capture_thread_;
+};
+
+}  // namespace led_driver
+
+#endif  // ALSA_AUDIO_SOURCE_H_
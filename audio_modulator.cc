@@ -0,0 +1,190 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "audio_modulator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <utility>
+
+#include "absl/strings/str_split.h"
+#include "absl/time/clock.h"
+
+namespace led_driver {
+
+bool AudioModulator::ParseModes(const std::string &modes, Config *config) {
+  for (absl::string_view mode :
+       absl::StrSplit(modes, ',', absl::SkipWhitespace())) {
+    if (mode == "pulse") {
+      config->pulse = true;
+    } else if (mode == "hue") {
+      config->hue_shift = true;
+    } else if (mode == "strobe") {
+      config->strobe = true;
+    } else {
+      std::cerr << "Unknown audio modulation: " << mode << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+AudioModulator::AudioModulator(Config config,
+                               std::shared_ptr<SpectralAnalyzer> analyzer)
+    : config_(std::move(config)),
+      analyzer_(std::move(analyzer)),
+      report_timer_(
+          std::max<int64_t>(
+              absl::ToInt64Milliseconds(config_.latency_report_period), 1),
+          absl::ToUnixMillis(absl::Now())) {}
+
+absl::Time AudioModulator::EventTime(const SpectralFeatures &features,
+                                     int64_t event_stream_ns) {
+  return absl::FromUnixNanos(features.timestamp_ns -
+                             (features.stream_time_ns - event_stream_ns));
+}
+
+AudioModulator::Modulation AudioModulator::Prepare(absl::Time now) {
+  Modulation modulation;
+  modulation.identity = true;
+  const SpectralFeatures features = analyzer_->Read();
+  if (features.analysis_count == 0) {
+    return modulation;
+  }
+
+  if (features.beat_count != beat_count_ ||
+      features.onset_count != onset_count_) {
+    const int64_t event_stream_ns =
+        features.beat_count != beat_count_
+            ? features.last_beat_ns
+            : features.last_onset_ns;
+    if (pending_event_time_ == absl::InfinitePast()) {
+      pending_event_time_ = EventTime(features, event_stream_ns);
+    }
+  }
+  beat_count_ = features.beat_count;
+  onset_count_ = features.onset_count;
+
+  const float elapsed_s =
+      last_apply_time_ == absl::InfinitePast()
+          ? 0.0f
+          : absl::ToDoubleSeconds(now - last_apply_time_);
+  last_apply_time_ = now;
+  const float decay_s = absl::ToDoubleSeconds(config_.pulse_decay);
+
+  float brightness = 1.0f;
+  if (config_.pulse && features.beat_count > 0) {
+    const float since_beat = absl::ToDoubleSeconds(
+        now - EventTime(features, features.last_beat_ns));
+    const float envelope = std::exp(-std::max(since_beat, 0.0f) / decay_s);
+    float level = envelope;
+    if (config_.pulse_band >= 0 && config_.pulse_band < features.num_bands) {
+      level = std::max(level, config_.pulse_band_mix *
+                                  features.band_energy[config_.pulse_band]);
+    }
+    brightness *= (1.0f - config_.pulse_depth) + config_.pulse_depth * level;
+  }
+  if (config_.strobe) {
+    const bool gate_open =
+        features.onset_count > 0 &&
+        now - EventTime(features, features.last_onset_ns) <
+            config_.strobe_duration;
+    if (!gate_open) {
+      brightness *= config_.strobe_floor;
+    }
+  }
+
+  // Build a fixed-point color matrix combining the hue rotation and the
+  // brightness, so that each pixel costs a single matrix multiply.
+  float matrix[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+  if (config_.hue_shift) {
+    const float target = config_.hue_step_degrees * features.beat_count;
+    hue_degrees_ += (target - hue_degrees_) *
+                    (1.0f - std::exp(-elapsed_s / decay_s));
+
+    // Rotation about the grey axis.
+    const float angle = hue_degrees_ * static_cast<float>(M_PI / 180);
+    const float c = std::cos(angle);
+    const float s = std::sin(angle) * std::sqrt(1.0f / 3);
+    const float t = (1.0f - c) / 3;
+    const float rotation[3][3] = {{c + t, t - s, t + s},
+                                  {t + s, c + t, t - s},
+                                  {t - s, t + s, c + t}};
+    std::copy(&rotation[0][0], &rotation[0][0] + 9, &matrix[0][0]);
+  }
+
+  for (int row = 0; row < 3; ++row) {
+    for (int column = 0; column < 3; ++column) {
+      modulation.matrix[row][column] =
+          static_cast<int32_t>(std::lround(matrix[row][column] * brightness *
+                                           256));
+      modulation.identity &=
+          modulation.matrix[row][column] == (row == column ? 256 : 0);
+    }
+  }
+  return modulation;
+}
+
+void AudioModulator::Modulate(const Modulation &modulation,
+                              absl::Span<uint8_t> pixels) {
+  if (modulation.identity) {
+    return;
+  }
+
+  const auto &fixed = modulation.matrix;
+  for (size_t i = 0; i + 3 <= pixels.size(); i += 3) {
+    const int32_t r = pixels[i];
+    const int32_t g = pixels[i + 1];
+    const int32_t b = pixels[i + 2];
+    for (int row = 0; row < 3; ++row) {
+      const int32_t value =
+          (fixed[row][0] * r + fixed[row][1] * g + fixed[row][2] * b) >> 8;
+      pixels[i + row] = static_cast<uint8_t>(std::clamp(value, 0, 255));
+    }
+  }
+}
+
+void AudioModulator::FrameShown(absl::Time now,
+                                absl::Duration source_latency) {
+  if (pending_event_time_ != absl::InfinitePast()) {
+    absl::Duration latency = now - pending_event_time_;
+    if (source_latency != absl::InfiniteDuration()) {
+      latency += source_latency;
+    }
+    ++latency_count_;
+    latency_sum_ += latency;
+    latency_max_ = std::max(latency_max_, latency);
+    pending_event_time_ = absl::InfinitePast();
+  }
+
+  if (config_.latency_report_period > absl::ZeroDuration() &&
+      report_timer_.IsDue(absl::ToUnixMillis(now)) && latency_count_ > 0) {
+    std::cout << "Audio-to-light latency: mean "
+              << absl::FormatDuration(latency_sum_ / latency_count_)
+              << ", max " << absl::FormatDuration(latency_max_) << " over "
+              << latency_count_ << " events" << std::endl;
+    latency_count_ = 0;
+    latency_sum_ = absl::ZeroDuration();
+    latency_max_ = absl::ZeroDuration();
+  }
+}
+
+}  // namespace led_driver
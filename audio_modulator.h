@@ -0,0 +1,131 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef AUDIO_MODULATOR_H_
+#define AUDIO_MODULATOR_H_
+
+#include <cstdint>
+
+#include <memory>
+#include <string>
+
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "periodic.h"
+#include "spectral_analyzer.h"
+
+namespace led_driver {
+
+// Modulates outgoing LED frames with features read straight from a
+// `SpectralAnalyzer`, so that beats reach the LEDs without waiting for the
+// visualizer to render, be captured and be sampled.
+class AudioModulator {
+ public:
+  struct Config {
+    // Brightness pulses on beats. Between beats the brightness falls to
+    // `1 - pulse_depth`, or to the energy of `pulse_band` scaled by
+    // `pulse_band_mix`, whichever is brighter.
+    bool pulse = false;
+    float pulse_depth = 0.6f;
+    absl::Duration pulse_decay = absl::Milliseconds(150);
+    int pulse_band = 0;
+    float pulse_band_mix = 0.5f;
+
+    // Hue rotation by `hue_step_degrees` on each beat, eased in over
+    // `pulse_decay`.
+    bool hue_shift = false;
+    float hue_step_degrees = 30.0f;
+
+    // Strobe gate: after each onset the frame is shown at full brightness for
+    // `strobe_duration`, and otherwise at `strobe_floor`.
+    bool strobe = false;
+    absl::Duration strobe_duration = absl::Milliseconds(30);
+    float strobe_floor = 0.0f;
+
+    // Period at which to log the audio-to-light latency; zero to disable.
+    absl::Duration latency_report_period = absl::Seconds(10);
+  };
+
+  // Parses a comma-separated list of "pulse", "hue" and "strobe" into
+  // `config`. Returns false if an entry isn't recognized.
+  static bool ParseModes(const std::string &modes, Config *config);
+
+  AudioModulator(Config config, std::shared_ptr<SpectralAnalyzer> analyzer);
+
+  // Whether any modulation is enabled.
+  bool enabled() const {
+    return config_.pulse || config_.hue_shift || config_.strobe;
+  }
+
+  // A fixed-point color matrix, combining the hue rotation and brightness.
+  struct Modulation {
+    int32_t matrix[3][3];
+    bool identity;
+  };
+
+  // Modulates `pixels`, a buffer of RGB triplets, in place. `now` is the time
+  // the frame is expected to be shown.
+  void Apply(absl::Span<uint8_t> pixels, absl::Time now) {
+    Modulate(Prepare(now), pixels);
+  }
+
+  // `Apply` in two steps, for frames processed in parallel segments: once per
+  // frame, advances the modulation to `now`; then modulates each segment.
+  Modulation Prepare(absl::Time now);
+  static void Modulate(const Modulation &modulation,
+                       absl::Span<uint8_t> pixels);
+
+  // Records that the frame last passed to `Apply` was shown at `now`. Beats
+  // and onsets first applied to that frame contribute an audio-to-light
+  // latency measurement: the time from the analysis which detected them to
+  // `now`, plus the latency reported by the audio source.
+  void FrameShown(absl::Time now, absl::Duration source_latency);
+
+ private:
+  // Returns the wall time of an event at `event_stream_ns` in the stream,
+  // according to `features`.
+  static absl::Time EventTime(const SpectralFeatures &features,
+                              int64_t event_stream_ns);
+
+  const Config config_;
+  std::shared_ptr<SpectralAnalyzer> analyzer_;
+
+  // The beat and onset counts seen by the previous frame.
+  uint64_t beat_count_ = 0;
+  uint64_t onset_count_ = 0;
+
+  // The hue rotation currently applied, in degrees.
+  float hue_degrees_ = 0.0f;
+  absl::Time last_apply_time_ = absl::InfinitePast();
+
+  // Publication time of the analysis which detected an event first applied to
+  // the current frame, if any.
+  absl::Time pending_event_time_ = absl::InfinitePast();
+
+  // Latency measurements since the last report.
+  Periodic<int64_t> report_timer_;
+  int latency_count_ = 0;
+  absl::Duration latency_sum_;
+  absl::Duration latency_max_;
+};
+
+}  // namespace led_driver
+
+#endif  // AUDIO_MODULATOR_H_
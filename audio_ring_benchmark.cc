@@ -0,0 +1,165 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Compares the cost of handing audio callbacks to the render loop through a
+// mutex-guarded queue of vectors against the lock-free `SpscRingBuffer`. When
+// built with `--define allocation_checks=true`, also counts the heap
+// allocations made on the audio thread by each, and exits non-zero if the ring
+// allocates in steady state.
+
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "allocation_counter.h"
+#include "spsc_ring_buffer.h"
+
+ABSL_FLAG(int, callbacks, 200000, "Number of audio callbacks to simulate");
+ABSL_FLAG(int, frames_per_callback, 64,
+          "Audio frames delivered by each callback");
+ABSL_FLAG(int, channel_count, 2, "Audio channel count");
+ABSL_FLAG(int, ring_capacity, 1 << 16, "Capacity of the ring, in samples");
+ABSL_FLAG(int, drain_period_us, 0,
+          "Period at which the simulated render loop drains the samples. The "
+          "callbacks run faster than real time, so the default of zero drains "
+          "continuously to keep the ring from overflowing");
+
+namespace led_driver {
+
+namespace {
+
+struct Result {
+  absl::Duration callback_time;
+  uint64_t allocations;
+};
+
+// Runs `callback` on a producer thread while `drain` runs periodically on
+// this thread, as the render loop would.
+template <typename CallbackType, typename DrainType>
+Result Run(absl::Span<const float> samples, CallbackType callback,
+           DrainType drain) {
+  const int callbacks = absl::GetFlag(FLAGS_callbacks);
+  const absl::Duration drain_period =
+      absl::Microseconds(absl::GetFlag(FLAGS_drain_period_us));
+  std::atomic<bool> done{false};
+  Result result;
+
+  std::thread producer([&]() {
+    const uint64_t allocations_before = AllocationCounter::count();
+    AllocationCounter::SetCounting(true);
+    const absl::Time start = absl::Now();
+    for (int i = 0; i < callbacks; ++i) {
+      callback(samples);
+    }
+    result.callback_time = (absl::Now() - start) / callbacks;
+    AllocationCounter::SetCounting(false);
+    result.allocations = AllocationCounter::count() - allocations_before;
+    done.store(true);
+  });
+
+  while (!done.load()) {
+    drain();
+    if (drain_period > absl::ZeroDuration()) {
+      absl::SleepFor(drain_period);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  drain();
+  return result;
+}
+
+void Report(const char *name, const Result &result) {
+  std::cout << name << ": "
+            << absl::ToDoubleMicroseconds(result.callback_time) * 1000
+            << " ns per callback";
+  if (AllocationCounter::kEnabled) {
+    std::cout << ", "
+              << static_cast<double>(result.allocations) /
+                     absl::GetFlag(FLAGS_callbacks)
+              << " allocations per callback";
+  }
+  std::cout << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  absl::ParseCommandLine(argc, argv);
+  if (!AllocationCounter::kEnabled) {
+    std::cout << "Allocations aren't counted or checked without --define "
+                 "allocation_checks=true"
+              << std::endl;
+  }
+
+  std::vector<float> samples(absl::GetFlag(FLAGS_frames_per_callback) *
+                                 absl::GetFlag(FLAGS_channel_count),
+                             0.5f);
+  float sink = 0;
+
+  std::mutex queue_mutex;
+  std::queue<std::vector<float>> queue;
+  Result queue_result = Run(
+      samples,
+      [&](absl::Span<const float> samples) {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queue.push(std::vector<float>(samples.begin(), samples.end()));
+      },
+      [&]() {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        while (!queue.empty()) {
+          sink += queue.front()[0];
+          queue.pop();
+        }
+      });
+  Report("Mutex-guarded queue", queue_result);
+
+  SpscRingBuffer<float> ring(absl::GetFlag(FLAGS_ring_capacity));
+  Result ring_result = Run(
+      samples,
+      [&](absl::Span<const float> samples) { ring.Write(samples); },
+      [&]() {
+        ring.Drain([&](absl::Span<const float> span) { sink += span[0]; });
+      });
+  Report("SPSC ring", ring_result);
+  std::cout << "Ring overflowed " << ring.overflow_writes() << " times ("
+            << ring.overflow_values() << " samples)" << std::endl;
+
+  std::cout << "(checksum " << sink << ")" << std::endl;
+  if (AllocationCounter::kEnabled && ring_result.allocations != 0) {
+    std::cerr << "SPSC ring allocated on the audio thread" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+}  // namespace led_driver
+
+extern "C" {
+int main(int argc, char *argv[]) { return led_driver::main(argc, argv); }
+}
@@ -0,0 +1,54 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "audio_source.h"
+
+#include <algorithm>
+
+namespace led_driver {
+
+void SampleBatcher::Push(absl::Span<const float> samples) {
+  const size_t batch_samples = batch_.capacity();
+  if (batch_samples == 0) {
+    Deliver(samples);
+    return;
+  }
+
+  while (!samples.empty()) {
+    // Forward whole batches straight from the input when nothing is pending.
+    if (batch_.empty() && samples.size() >= batch_samples) {
+      Deliver(samples.subspan(0, batch_samples));
+      samples.remove_prefix(batch_samples);
+      continue;
+    }
+
+    const size_t length =
+        std::min(samples.size(), batch_samples - batch_.size());
+    batch_.insert(batch_.end(), samples.begin(), samples.begin() + length);
+    samples.remove_prefix(length);
+
+    if (batch_.size() == batch_samples) {
+      Deliver(batch_);
+      batch_.clear();
+    }
+  }
+}
+
+}  // namespace led_driver
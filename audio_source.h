@@ -0,0 +1,105 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef AUDIO_SOURCE_H_
+#define AUDIO_SOURCE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+
+namespace led_driver {
+
+// Buffering options common to all audio sources.
+struct AudioSourceOptions {
+  int sampling_rate = 44100;
+  int channel_count = 2;
+
+  // Requested size of each fragment (PulseAudio) or period (ALSA) delivered by
+  // the backend, in frames. Smaller fragments lower the latency at the cost of
+  // more wakeups.
+  int fragment_frames = 256;
+
+  // Requested upper bound on the audio buffered by the backend.
+  absl::Duration target_latency = absl::Milliseconds(20);
+
+  // Number of frames to accumulate before invoking the sample callback. Zero
+  // delivers each fragment as soon as it arrives.
+  int callback_batch_frames = 0;
+};
+
+// Interface for sources of interleaved float PCM samples.
+struct AudioSourceInterface {
+  // Receives interleaved samples. Invoked on the source's own thread; must not
+  // block.
+  using SampleCallbackType = std::function<void(absl::Span<const float>)>;
+
+  virtual ~AudioSourceInterface() {}
+
+  virtual bool Initialize() = 0;
+  virtual bool Start() = 0;
+  virtual void Stop() = 0;
+
+  // The most recently measured delay between audio arriving at the source and
+  // it being delivered to the callback, or `absl::InfiniteDuration()` if it
+  // hasn't been measured yet.
+  virtual absl::Duration GetLatency() const = 0;
+
+  // The number of times the sample callback has been invoked.
+  virtual uint64_t GetCallbackCount() const = 0;
+};
+
+// Accumulates interleaved samples into fixed-size batches before forwarding
+// them to a callback, trading latency for fewer wakeups downstream. The batch
+// buffer is preallocated, so `Push` never allocates.
+class SampleBatcher {
+ public:
+  using SampleCallbackType = AudioSourceInterface::SampleCallbackType;
+
+  // If `batch_samples` is zero, samples are forwarded as they are pushed.
+  SampleBatcher(int batch_samples, SampleCallbackType callback)
+      : callback_(std::move(callback)) {
+    batch_.reserve(batch_samples);
+  }
+
+  void Push(absl::Span<const float> samples);
+
+  uint64_t callback_count() const {
+    return callback_count_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  void Deliver(absl::Span<const float> samples) {
+    callback_(samples);
+    callback_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  SampleCallbackType callback_;
+  std::vector<float> batch_;
+  std::atomic<uint64_t> callback_count_{0};
+};
+
+}  // namespace led_driver
+
+#endif  // AUDIO_SOURCE_H_
@@ -0,0 +1,59 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "audio_source_factory.h"
+
+#include <iostream>
+
+#include "alsa_audio_source.h"
+#include "file_audio_source.h"
+#include "pulseaudio_interface.h"
+
+namespace led_driver {
+
+std::shared_ptr<AudioSourceInterface> CreateAudioSource(
+    const AudioSourceConfig &config,
+    AudioSourceInterface::SampleCallbackType sample_callback) {
+  std::shared_ptr<AudioSourceInterface> source;
+  if (config.type == "pulseaudio") {
+    source = std::make_shared<PulseAudioInterface>(
+        config.pulseaudio_server, config.device, "input_stream",
+        config.options, std::move(sample_callback));
+  } else if (config.type == "alsa") {
+    source = std::make_shared<AlsaAudioSource>(
+        config.device.empty() ? "default" : config.device, config.options,
+        std::move(sample_callback));
+  } else if (config.type == "file") {
+    source = std::make_shared<FileAudioSource>(
+        config.file, config.loop, config.options, std::move(sample_callback));
+  } else {
+    std::cerr << "Unknown audio source type: " << config.type << std::endl;
+    return nullptr;
+  }
+
+  if (!source->Initialize()) {
+    std::cerr << "Failed to initialize " << config.type << " audio source"
+              << std::endl;
+    return nullptr;
+  }
+  return source;
+}
+
+}  // namespace led_driver
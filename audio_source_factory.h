@@ -0,0 +1,56 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef AUDIO_SOURCE_FACTORY_H_
+#define AUDIO_SOURCE_FACTORY_H_
+
+#include <memory>
+#include <string>
+
+#include "audio_source.h"
+
+namespace led_driver {
+
+struct AudioSourceConfig {
+  // One of "pulseaudio", "alsa" or "file".
+  std::string type = "pulseaudio";
+
+  // PulseAudio server to connect to; empty for the default.
+  std::string pulseaudio_server;
+
+  // PulseAudio source or ALSA device to capture from.
+  std::string device;
+
+  // WAV or raw float file to replay, and whether to loop it.
+  std::string file;
+  bool loop = true;
+
+  AudioSourceOptions options;
+};
+
+// Creates and initializes the audio source described by `config`. Returns
+// nullptr on failure.
+std::shared_ptr<AudioSourceInterface> CreateAudioSource(
+    const AudioSourceConfig &config,
+    AudioSourceInterface::SampleCallbackType sample_callback);
+
+}  // namespace led_driver
+
+#endif  // AUDIO_SOURCE_FACTORY_H_
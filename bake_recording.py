@@ -0,0 +1,87 @@
+# LED Suit Driver - Embedded host driver software for Kevin's LED suit controller.
+# Copyright (C) 2019-2020 Kevin Balke
+#
+# This file is part of LED Suit Driver.
+#
+# LED Suit Driver is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# LED Suit Driver is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+
+# Samples a sequence of images through an LED mapping, producing raw RGB frames
+# for `led_recording_tool --bake_input`. For example:
+#
+#   bake_recording.py --mapping_file=mapping.binaryproto \
+#       --images='loop/*.png' --output=- |
+#     led_recording_tool --bake_input=- --fps=30 --output=loop.ledrec
+
+import glob
+import sys
+
+import pygame
+from led_driver.led_mapping_pb2 import Mapping
+from absl import app
+from absl import flags
+
+flags.DEFINE_string("mapping_file", "mapping.binaryproto",
+                    "File containing the LED mapping")
+flags.DEFINE_string("images", None,
+                    "Glob of the images to bake, sampled in sorted order")
+flags.mark_flag_as_required("images")
+flags.DEFINE_string("output", None, "File to write frames to; - for stdout")
+flags.mark_flag_as_required("output")
+flags.DEFINE_integer("num_leds", 900, "LEDs per frame")
+flags.DEFINE_integer("repeat", 1, "Number of times to repeat the sequence")
+
+FLAGS = flags.FLAGS
+
+
+def LoadMapping(path):
+    mapping = Mapping()
+    with open(path, "rb") as mapping_file:
+        mapping.ParseFromString(mapping_file.read())
+    return [(sample.x, sample.y) for sample in mapping.samples]
+
+
+def SampleImage(image, samples, num_leds):
+    # Sample at the same positions led_driver does on the captured raster.
+    width, height = image.get_size()
+    frame = bytearray(num_leds * 3)
+    for index, (x, y) in enumerate(samples[:num_leds]):
+        color = image.get_at((int(x * (width - 1)), int(y * (height - 1))))
+        frame[index * 3:index * 3 + 3] = bytes((color.r, color.g, color.b))
+    return bytes(frame)
+
+
+def main(argv):
+    samples = LoadMapping(FLAGS.mapping_file)
+    paths = sorted(glob.glob(FLAGS.images))
+    if not paths:
+        print("No images match", FLAGS.images, file=sys.stderr)
+        return 1
+
+    frames = [
+        SampleImage(pygame.image.load(path), samples, FLAGS.num_leds)
+        for path in paths
+    ]
+
+    output = (sys.stdout.buffer
+              if FLAGS.output == "-" else open(FLAGS.output, "wb"))
+    for _ in range(FLAGS.repeat):
+        for frame in frames:
+            output.write(frame)
+    output.flush()
+    print("Sampled", len(frames), "images", file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    app.run(main)
@@ -0,0 +1,188 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "boot_sequence.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "allocation_counter.h"
+
+extern "C" {
+#include <time.h>
+#include <unistd.h>
+}
+
+namespace led_driver {
+namespace {
+
+int64_t BoottimeNs() {
+  timespec now;
+  clock_gettime(CLOCK_BOOTTIME, &now);
+  return now.tv_sec * int64_t{1000000000} + now.tv_nsec;
+}
+
+// The process's start time on CLOCK_BOOTTIME, from /proc, so that loading and
+// static initialization count too. Returns zero if it can't be read.
+int64_t ProcessStartNs() {
+  std::ifstream stat_file("/proc/self/stat");
+  std::string stat((std::istreambuf_iterator<char>(stat_file)),
+                   std::istreambuf_iterator<char>());
+  // The command name is in parentheses and may contain spaces; the start time
+  // is the 20th field after it, in clock ticks since boot.
+  const size_t name_end = stat.rfind(')');
+  if (name_end == std::string::npos) {
+    return 0;
+  }
+  std::istringstream fields(stat.substr(name_end + 1));
+  std::string field;
+  for (int i = 0; i < 20 && fields >> field; ++i) {
+  }
+  int64_t start_ticks;
+  if (!(fields >> start_ticks)) {
+    return 0;
+  }
+  return start_ticks * int64_t{1000000000} / sysconf(_SC_CLK_TCK);
+}
+
+}  // namespace
+
+bool BootSequence::Initialize() {
+  start_ns_ = ProcessStartNs();
+  if (start_ns_ <= 0 || start_ns_ > BoottimeNs()) {
+    std::cerr << "Couldn't determine the process start time; startup times "
+                 "are from now"
+              << std::endl;
+    start_ns_ = BoottimeNs();
+  }
+
+  if (!options_.recording.empty()) {
+    reader_ = LedRecordingReader::Create(options_.recording);
+    if (reader_ == nullptr) {
+      return false;
+    }
+    if (reader_->stage() != LedRecordingFormat::kStageInput) {
+      std::cerr << "Boot recording " << options_.recording
+                << " holds corrected output; bake it with "
+                   "led_recording_tool --raw"
+                << std::endl;
+      return false;
+    }
+    if (reader_->frame_length() != layer_->back().size()) {
+      std::cerr << "Boot recording " << options_.recording << " has "
+                << reader_->frame_length() << " bytes per frame, not "
+                << layer_->back().size() << std::endl;
+      return false;
+    }
+    if (!reader_->Next()) {
+      std::cerr << "Boot recording " << options_.recording << " is empty"
+                << std::endl;
+      return false;
+    }
+  } else {
+    EffectEngine::Config effect_config;
+    effect_config.effect = options_.effect;
+    effect_engine_ = EffectEngine::Create(effect_config, coordinates_);
+    if (effect_engine_ == nullptr) {
+      return false;
+    }
+  }
+  coordinates_.clear();
+  coordinates_.shrink_to_fit();
+  return true;
+}
+
+int64_t BootSequence::SinceStartNs() const {
+  return BoottimeNs() - start_ns_;
+}
+
+void BootSequence::Render(float seconds, absl::Span<uint8_t> frame) {
+  if (reader_ != nullptr) {
+    // Shows the first frame due at or after now, looping at the end.
+    const absl::Duration position = absl::Seconds(seconds - loop_start_);
+    while (reader_->timestamp() < position) {
+      if (!reader_->Next()) {
+        reader_->Rewind();
+        reader_->Next();
+        loop_start_ = seconds;
+        break;
+      }
+    }
+    std::copy(reader_->frame().begin(), reader_->frame().end(),
+              frame.begin());
+  } else {
+    effect_engine_->Render(seconds, frame);
+  }
+
+  const int64_t live_ns = live_ns_.load();
+  if (live_ns == 0) {
+    return;
+  }
+  if (fade_start_ < 0.0f) {
+    fade_start_ = seconds;
+  }
+  const float crossfade_seconds = absl::ToDoubleSeconds(options_.crossfade);
+  const float opacity =
+      crossfade_seconds > 0.0f
+          ? 1.0f - (seconds - fade_start_) / crossfade_seconds
+          : 0.0f;
+  if (opacity > 0.0f) {
+    layer_->set_opacity(opacity);
+    return;
+  }
+  // Stops rendering the layer too.
+  layer_->set_enabled(false);
+  if (crossfaded_) {
+    return;
+  }
+  crossfaded_ = true;
+  AllocationCounter::Pause pause;
+  std::cout << "startup live_ms=" << live_ns / 1000000
+            << " crossfaded_ms=" << SinceStartNs() / 1000000 << std::endl;
+}
+
+void BootSequence::CheckCapture(absl::Span<const uint8_t> frame) {
+  if (live()) {
+    return;
+  }
+  const int threshold = options_.lit_threshold;
+  const bool lit = std::any_of(frame.begin(), frame.end(),
+                               [threshold](uint8_t value) {
+                                 return value > threshold;
+                               });
+  lit_frames_ = lit ? lit_frames_ + 1 : 0;
+  if (lit_frames_ >= options_.live_frames) {
+    live_ns_.store(SinceStartNs());
+  }
+}
+
+bool BootSequence::Receive(absl::Span<const uint8_t> led_data) {
+  if (!first_light_) {
+    first_light_ = true;
+    AllocationCounter::Pause pause;
+    std::cout << "startup first_light_ms=" << SinceStartNs() / 1000000
+              << " since_boot_ms=" << BoottimeNs() / 1000000 << std::endl;
+  }
+  return true;
+}
+
+}  // namespace led_driver
@@ -0,0 +1,128 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef BOOT_SEQUENCE_H_
+#define BOOT_SEQUENCE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "effect_engine.h"
+#include "led_compositor.h"
+#include "led_frame_sink.h"
+#include "led_recording.h"
+
+namespace led_driver {
+
+// Lights the suit from the first output frame, before the visualizer stack is
+// up, with a baked animation or an effect on a layer above the capture. Once
+// the capture has shown a few lit frames in a row, the layer fades out over
+// the live capture and is disabled. As a sink on the output, it also reports
+// the time from process start to the first frame sent and to live capture, as
+// `startup` metric lines.
+class BootSequence : public LedFrameSinkInterface {
+ public:
+  struct Options {
+    // Recording to loop, of RGB frames like the capture's, as baked with
+    // `led_recording_tool --raw`. Recordings of corrected output, such as
+    // from `--record_file`, are rejected, since the output would correct them
+    // again. Takes precedence over `effect`.
+    std::string recording;
+
+    // Effect to render when there's no recording.
+    std::string effect = "plasma";
+
+    absl::Duration crossfade = absl::Seconds(1);
+
+    // Consecutive captured frames with any LED channel above `lit_threshold`
+    // after which the capture counts as live. Frames captured before the
+    // visualizer draws are black.
+    int live_frames = 3;
+    int lit_threshold = 16;
+  };
+
+  template <typename... A>
+  static std::shared_ptr<BootSequence> Create(A &&... args) {
+    auto boot = std::shared_ptr<BootSequence>(
+        new BootSequence(std::forward<A>(args)...));
+    if (!boot->Initialize()) {
+      return nullptr;
+    }
+    return boot;
+  }
+
+  // Renders the boot layer's frame at `seconds` since output started, and
+  // fades the layer once the capture is live. For
+  // `LedOutputLoop::AddRenderedLayer`. Never allocates.
+  void Render(float seconds, absl::Span<uint8_t> frame);
+
+  // Checks a frame sampled from the capture for signs of life. Called on the
+  // capture thread.
+  void CheckCapture(absl::Span<const uint8_t> frame);
+
+  // Notes the first frame sent.
+  bool Receive(absl::Span<const uint8_t> led_data) override;
+
+  bool live() const { return live_ns_.load() != 0; }
+
+ private:
+  BootSequence(std::shared_ptr<LedLayer> layer,
+               std::vector<std::pair<float, float>> coordinates,
+               Options options)
+      : layer_(std::move(layer)),
+        coordinates_(std::move(coordinates)),
+        options_(std::move(options)) {}
+
+  bool Initialize();
+
+  // Nanoseconds since the process started.
+  int64_t SinceStartNs() const;
+
+  const std::shared_ptr<LedLayer> layer_;
+  std::vector<std::pair<float, float>> coordinates_;
+  const Options options_;
+
+  std::shared_ptr<LedRecordingReader> reader_;
+  std::shared_ptr<EffectEngine> effect_engine_;
+  // Where the recording's current loop started, in seconds of output.
+  float loop_start_ = 0.0f;
+
+  // The process's start time on CLOCK_BOOTTIME.
+  int64_t start_ns_ = 0;
+  bool first_light_ = false;
+
+  // Set on the capture thread.
+  int lit_frames_ = 0;
+  std::atomic<int64_t> live_ns_{0};
+
+  // When the crossfade started, in seconds of output; negative until then.
+  float fade_start_ = -1.0f;
+  bool crossfaded_ = false;
+};
+
+}  // namespace led_driver
+
+#endif  // BOOT_SEQUENCE_H_
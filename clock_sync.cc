@@ -0,0 +1,394 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "clock_sync.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "absl/time/clock.h"
+#include "network_protocol.h"
+
+extern "C" {
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+}
+
+namespace led_driver {
+
+namespace {
+constexpr char kMagic[4] = {'L', 'C', 'S', '1'};
+constexpr uint8_t kTypeRequest = 1;
+constexpr uint8_t kTypeReply = 2;
+
+// Magic, type, a 24 bit sequence number, then t1 (and t2 and t3 in replies).
+constexpr size_t kRequestLength = 16;
+constexpr size_t kReplyLength = 32;
+constexpr size_t kT1Offset = 8;
+constexpr size_t kT2Offset = 16;
+constexpr size_t kT3Offset = 24;
+
+constexpr int kServePollTimeoutMs = 100;
+
+// Exchanges needed before the estimate is used, and before drift is fitted.
+constexpr int kMinSamples = 4;
+constexpr int kMinDriftSamples = 8;
+constexpr int64_t kMinDriftSpanNs = 2000000000;
+
+void WriteInt64(int64_t value, uint8_t *data) {
+  for (int i = 0; i < 8; ++i) {
+    data[i] = static_cast<uint64_t>(value) >> (56 - 8 * i);
+  }
+}
+
+int64_t ReadInt64(const uint8_t *data) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i) {
+    value = (value << 8) | data[i];
+  }
+  return static_cast<int64_t>(value);
+}
+
+bool ParseHostPort(const std::string &server, sockaddr_in *address) {
+  std::vector<std::string> parts = absl::StrSplit(server, ':');
+  int port;
+  if (parts.size() != 2 || !absl::SimpleAtoi(parts[1], &port)) {
+    std::cerr << "Invalid clock sync server \"" << server
+              << "\", expected host:port" << std::endl;
+    return false;
+  }
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  addrinfo *result = nullptr;
+  int error = getaddrinfo(parts[0].c_str(), nullptr, &hints, &result);
+  if (error != 0 || result == nullptr) {
+    std::cerr << "Failed to resolve " << parts[0] << ": "
+              << gai_strerror(error) << std::endl;
+    return false;
+  }
+  memcpy(address, result->ai_addr, sizeof(*address));
+  address->sin_port = htons(port);
+  freeaddrinfo(result);
+  return true;
+}
+}  // namespace
+
+int64_t MonotonicNowNs() {
+  timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+ClockSyncServer::~ClockSyncServer() {
+  running_.store(false);
+  if (serve_thread_.joinable()) {
+    serve_thread_.join();
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+bool ClockSyncServer::Initialize() {
+  fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0) {
+    std::cerr << "Failed to create clock sync socket: " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port_);
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(fd_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) <
+      0) {
+    std::cerr << "Failed to bind clock sync port " << port_ << ": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+
+  std::cout << "Serving clock sync on UDP port " << port_ << std::endl;
+  running_.store(true);
+  serve_thread_ = std::thread(&ClockSyncServer::ServeThread, this);
+  return true;
+}
+
+void ClockSyncServer::ServeThread() {
+  uint8_t packet[kReplyLength];
+  while (running_.load()) {
+    pollfd poll_fd = {fd_, POLLIN, 0};
+    if (poll(&poll_fd, 1, kServePollTimeoutMs) <= 0) {
+      continue;
+    }
+
+    sockaddr_in client_address;
+    socklen_t client_address_length = sizeof(client_address);
+    ssize_t length = recvfrom(fd_, packet, sizeof(packet), MSG_DONTWAIT,
+                              reinterpret_cast<sockaddr *>(&client_address),
+                              &client_address_length);
+    const int64_t receive_ns = clock_();
+    if (length != kRequestLength || memcmp(packet, kMagic, sizeof(kMagic)) ||
+        packet[4] != kTypeRequest) {
+      continue;
+    }
+
+    packet[4] = kTypeReply;
+    WriteInt64(receive_ns, packet + kT2Offset);
+    WriteInt64(clock_(), packet + kT3Offset);
+    sendto(fd_, packet, kReplyLength, MSG_DONTWAIT,
+           reinterpret_cast<sockaddr *>(&client_address),
+           client_address_length);
+  }
+}
+
+ClockSyncClient::~ClockSyncClient() {
+  running_.store(false);
+  if (sync_thread_.joinable()) {
+    sync_thread_.join();
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+bool ClockSyncClient::Initialize() {
+  sockaddr_in address;
+  if (!ParseHostPort(server_, &address)) {
+    return false;
+  }
+  fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0 || connect(fd_, reinterpret_cast<sockaddr *>(&address),
+                         sizeof(address)) < 0) {
+    std::cerr << "Failed to connect to clock sync server " << server_ << ": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+
+  samples_.resize(std::max(options_.window, kMinDriftSamples));
+  Estimate estimate;
+  memset(&estimate, 0, sizeof(estimate));
+  estimate_.Publish(estimate);
+
+  running_.store(true);
+  sync_thread_ = std::thread(&ClockSyncClient::SyncThread, this);
+  return true;
+}
+
+int64_t ClockSyncClient::ToMasterNs(int64_t local_ns) const {
+  const Estimate estimate = estimate_.Read();
+  return local_ns + estimate.offset_ns +
+         static_cast<int64_t>(estimate.drift *
+                              (local_ns - estimate.reference_ns));
+}
+
+int64_t ClockSyncClient::ToLocalNs(int64_t master_ns) const {
+  const Estimate estimate = estimate_.Read();
+  const int64_t delta = master_ns - estimate.offset_ns - estimate.reference_ns;
+  return estimate.reference_ns +
+         static_cast<int64_t>(delta / (1.0 + estimate.drift));
+}
+
+bool ClockSyncClient::Exchange(uint32_t sequence, Sample *sample) {
+  uint8_t packet[kReplyLength];
+  memcpy(packet, kMagic, sizeof(kMagic));
+  packet[4] = kTypeRequest;
+  packet[5] = sequence >> 16;
+  packet[6] = sequence >> 8;
+  packet[7] = sequence;
+  const int64_t t1 = MonotonicNowNs();
+  WriteInt64(t1, packet + kT1Offset);
+  if (send(fd_, packet, kRequestLength, 0) < 0) {
+    return false;
+  }
+
+  const int64_t deadline = t1 + absl::ToInt64Nanoseconds(options_.timeout);
+  while (true) {
+    const int64_t remaining_ms = (deadline - MonotonicNowNs()) / 1000000;
+    pollfd poll_fd = {fd_, POLLIN, 0};
+    if (remaining_ms < 0 ||
+        poll(&poll_fd, 1, static_cast<int>(remaining_ms) + 1) <= 0) {
+      return false;
+    }
+    uint8_t reply[kReplyLength];
+    ssize_t length = recv(fd_, reply, sizeof(reply), MSG_DONTWAIT);
+    const int64_t t4 = MonotonicNowNs();
+    if (length != kReplyLength || memcmp(reply, kMagic, sizeof(kMagic)) ||
+        reply[4] != kTypeReply || memcmp(reply + 5, packet + 5, 3) ||
+        ReadInt64(reply + kT1Offset) != t1) {
+      // A late reply to an earlier request.
+      continue;
+    }
+
+    const int64_t t2 = ReadInt64(reply + kT2Offset);
+    const int64_t t3 = ReadInt64(reply + kT3Offset);
+    sample->local_ns = t1 + (t4 - t1) / 2;
+    sample->offset_ns = ((t2 - t1) + (t3 - t4)) / 2;
+    sample->round_trip_ns = (t4 - t1) - (t3 - t2);
+    return true;
+  }
+}
+
+void ClockSyncClient::UpdateEstimate() {
+  int64_t min_round_trip = INT64_MAX;
+  int64_t reference_ns = INT64_MIN;
+  for (size_t i = 0; i < num_samples_; ++i) {
+    min_round_trip = std::min(min_round_trip, samples_[i].round_trip_ns);
+    reference_ns = std::max(reference_ns, samples_[i].local_ns);
+  }
+
+  // Exchanges delayed by queueing give asymmetric, and so wrong, offsets.
+  const int64_t max_round_trip =
+      min_round_trip + std::max<int64_t>(min_round_trip / 2, 50000);
+  double sum_x = 0;
+  double sum_y = 0;
+  double sum_xx = 0;
+  double sum_xy = 0;
+  int count = 0;
+  int64_t first_ns = INT64_MAX;
+  for (size_t i = 0; i < num_samples_; ++i) {
+    const Sample &sample = samples_[i];
+    if (sample.round_trip_ns > max_round_trip) {
+      continue;
+    }
+    const double x = sample.local_ns - reference_ns;
+    const double y = sample.offset_ns;
+    sum_x += x;
+    sum_y += y;
+    sum_xx += x * x;
+    sum_xy += x * y;
+    first_ns = std::min(first_ns, sample.local_ns);
+    ++count;
+  }
+
+  Estimate estimate;
+  estimate.synchronized = num_samples_ >= kMinSamples;
+  estimate.reference_ns = reference_ns;
+  estimate.round_trip_ns = min_round_trip;
+  estimate.samples = count;
+  estimate.drift = 0;
+  const double denominator = count * sum_xx - sum_x * sum_x;
+  if (count >= kMinDriftSamples &&
+      reference_ns - first_ns >= kMinDriftSpanNs && denominator > 0) {
+    estimate.drift = (count * sum_xy - sum_x * sum_y) / denominator;
+    estimate.offset_ns =
+        static_cast<int64_t>((sum_y - estimate.drift * sum_x) / count);
+  } else {
+    estimate.offset_ns = static_cast<int64_t>(sum_y / count);
+  }
+  estimate_.Publish(estimate);
+}
+
+void ClockSyncClient::SyncThread() {
+  Periodic<int64_t> report_timer(
+      std::max<int64_t>(absl::ToInt64Milliseconds(options_.report_period), 1),
+      absl::ToUnixMillis(absl::Now()));
+  uint32_t sequence = 0;
+  int failures = 0;
+  while (running_.load()) {
+    const absl::Time start = absl::Now();
+    Sample sample;
+    if (Exchange(++sequence, &sample)) {
+      samples_[next_sample_] = sample;
+      next_sample_ = (next_sample_ + 1) % samples_.size();
+      num_samples_ = std::min(num_samples_ + 1, samples_.size());
+      UpdateEstimate();
+    } else {
+      ++failures;
+    }
+
+    if (options_.report_period > absl::ZeroDuration() &&
+        report_timer.IsDue(absl::ToUnixMillis(absl::Now()))) {
+      const Estimate estimate = estimate_.Read();
+      std::cout << "Clock sync: offset " << estimate.offset_ns / 1000
+                << " us, drift " << estimate.drift * 1e6 << " ppm, round trip "
+                << estimate.round_trip_ns / 1000 << " us, " << failures
+                << " exchanges lost" << std::endl;
+      failures = 0;
+    }
+
+    absl::SleepFor(options_.interval - (absl::Now() - start));
+  }
+}
+
+FramePresenter::FramePresenter(std::shared_ptr<ClockSyncClient> clock_sync,
+                               Options options)
+    : clock_sync_(std::move(clock_sync)),
+      options_(std::move(options)),
+      report_timer_(std::max<int64_t>(
+                        absl::ToInt64Milliseconds(options_.report_period), 1),
+                    absl::ToUnixMillis(absl::Now())) {}
+
+void FramePresenter::Present(absl::optional<uint32_t> timecode) {
+  if (timecode.has_value() && clock_sync_ != nullptr &&
+      clock_sync_->estimate().synchronized) {
+    const int64_t master_now_ns = clock_sync_->MasterNowNs();
+    const int64_t presentation_ns =
+        network_protocol::FromDdpTimecode(*timecode, master_now_ns);
+    const int64_t delay_ns = presentation_ns - master_now_ns;
+    if (delay_ns <= absl::ToInt64Nanoseconds(options_.max_delay)) {
+      if (delay_ns > 0) {
+        std::this_thread::sleep_until(std::chrono::steady_clock::time_point(
+            std::chrono::nanoseconds(
+                clock_sync_->ToLocalNs(presentation_ns))));
+      } else {
+        ++late_;
+      }
+      const int64_t skew_ns = clock_sync_->MasterNowNs() - presentation_ns;
+      skew_sum_ns_ += std::abs(skew_ns);
+      skew_max_ns_ = std::max(skew_max_ns_, std::abs(skew_ns));
+      ++presented_;
+    } else {
+      ++unscheduled_;
+    }
+  } else {
+    ++unscheduled_;
+  }
+
+  if (options_.report_period > absl::ZeroDuration() &&
+      report_timer_.IsDue(absl::ToUnixMillis(absl::Now()))) {
+    std::cout << "Presentation: skew mean "
+              << (presented_ > 0 ? skew_sum_ns_ / presented_ / 1000 : 0)
+              << " us, max " << skew_max_ns_ / 1000 << " us, " << late_
+              << " late, " << unscheduled_ << " unscheduled of "
+              << presented_ + unscheduled_ << " frames" << std::endl;
+    skew_sum_ns_ = 0;
+    skew_max_ns_ = 0;
+    presented_ = 0;
+    late_ = 0;
+    unscheduled_ = 0;
+  }
+}
+
+}  // namespace led_driver
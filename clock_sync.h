@@ -0,0 +1,205 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef CLOCK_SYNC_H_
+#define CLOCK_SYNC_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "periodic.h"
+#include "seqlock.h"
+
+namespace led_driver {
+
+// A lightweight NTP-style protocol for synchronizing the frame clocks of
+// several nodes over UDP. Times are nanoseconds on each node's monotonic
+// clock; the master's clock is the shared timebase.
+//
+// A client sends a request stamped with its send time t1; the master stamps
+// its receive time t2 and reply time t3; the client stamps the reply's arrival
+// t4. Each exchange yields an offset, ((t2 - t1) + (t3 - t4)) / 2, and a round
+// trip delay, (t4 - t1) - (t3 - t2).
+
+// Returns the local monotonic clock, in nanoseconds.
+int64_t MonotonicNowNs();
+
+// Answers clock requests on its own thread.
+class ClockSyncServer {
+ public:
+  using ClockType = std::function<int64_t()>;
+
+  template <typename... A>
+  static std::shared_ptr<ClockSyncServer> Create(A &&... args) {
+    auto server = std::shared_ptr<ClockSyncServer>(
+        new ClockSyncServer(std::forward<A>(args)...));
+    if (!server->Initialize()) {
+      return nullptr;
+    }
+    return server;
+  }
+
+  ~ClockSyncServer();
+
+ private:
+  // `clock` is the master clock, in nanoseconds. It may be replaced to
+  // simulate offset and drift between nodes on one machine.
+  explicit ClockSyncServer(int port, ClockType clock = MonotonicNowNs)
+      : port_(port), clock_(std::move(clock)) {}
+
+  bool Initialize();
+  void ServeThread();
+
+  const int port_;
+  const ClockType clock_;
+  int fd_ = -1;
+  std::atomic<bool> running_{false};
+  std::thread serve_thread_;
+};
+
+// Tracks the master's clock. Exchanges are made periodically on the client's
+// own thread. The offset is estimated from the exchanges with the shortest
+// round trips, which suffered the least queueing, and the drift from a least
+// squares fit of their offsets over time. The estimate can be read from any
+// thread without blocking.
+class ClockSyncClient {
+ public:
+  struct Options {
+    absl::Duration interval = absl::Milliseconds(200);
+    absl::Duration timeout = absl::Milliseconds(100);
+
+    // Number of exchanges the estimate is made from.
+    int window = 64;
+
+    // Period at which to log the estimate; zero to disable.
+    absl::Duration report_period = absl::Seconds(10);
+  };
+
+  struct Estimate {
+    // Whether enough exchanges have been made to trust the estimate.
+    bool synchronized;
+
+    // The master's clock minus the local clock at `reference_ns` local time,
+    // and its rate of change.
+    int64_t reference_ns;
+    int64_t offset_ns;
+    double drift;
+
+    // The shortest round trip in the window.
+    int64_t round_trip_ns;
+    int samples;
+  };
+
+  // `server` is the master's `host:port`.
+  template <typename... A>
+  static std::shared_ptr<ClockSyncClient> Create(A &&... args) {
+    auto client = std::shared_ptr<ClockSyncClient>(
+        new ClockSyncClient(std::forward<A>(args)...));
+    if (!client->Initialize()) {
+      return nullptr;
+    }
+    return client;
+  }
+
+  ~ClockSyncClient();
+
+  Estimate estimate() const { return estimate_.Read(); }
+
+  // Converts between the local clock and the master's clock.
+  int64_t ToMasterNs(int64_t local_ns) const;
+  int64_t ToLocalNs(int64_t master_ns) const;
+
+  int64_t MasterNowNs() const { return ToMasterNs(MonotonicNowNs()); }
+
+ private:
+  struct Sample {
+    int64_t local_ns;
+    int64_t offset_ns;
+    int64_t round_trip_ns;
+  };
+
+  ClockSyncClient(std::string server, Options options)
+      : server_(std::move(server)), options_(std::move(options)) {}
+
+  bool Initialize();
+  void SyncThread();
+
+  // Makes one exchange. Returns false if no reply arrived.
+  bool Exchange(uint32_t sequence, Sample *sample);
+  void UpdateEstimate();
+
+  const std::string server_;
+  const Options options_;
+  int fd_ = -1;
+
+  // The most recent exchanges, as a ring.
+  std::vector<Sample> samples_;
+  size_t next_sample_ = 0;
+  size_t num_samples_ = 0;
+
+  SeqlockSnapshot<Estimate> estimate_;
+  std::atomic<bool> running_{false};
+  std::thread sync_thread_;
+};
+
+// Holds frames until the master clock reaches their presentation time, so that
+// every node latches a frame at the same instant, and reports how far from
+// that instant each frame was released.
+class FramePresenter {
+ public:
+  struct Options {
+    // Frames further ahead than this are shown at once, as the timecode or
+    // the clock estimate is likely wrong.
+    absl::Duration max_delay = absl::Seconds(1);
+
+    // Period at which to log the presentation skew; zero to disable.
+    absl::Duration report_period = absl::Seconds(10);
+  };
+
+  // Frames are shown as they arrive while `clock_sync` is null or
+  // unsynchronized.
+  FramePresenter(std::shared_ptr<ClockSyncClient> clock_sync, Options options);
+
+  // Waits until the DDP `timecode` on the master clock.
+  void Present(absl::optional<uint32_t> timecode);
+
+ private:
+  std::shared_ptr<ClockSyncClient> clock_sync_;
+  const Options options_;
+
+  Periodic<int64_t> report_timer_;
+  int64_t skew_sum_ns_ = 0;
+  int64_t skew_max_ns_ = 0;
+  int presented_ = 0;
+  int late_ = 0;
+  int unscheduled_ = 0;
+};
+
+}  // namespace led_driver
+
+#endif  // CLOCK_SYNC_H_
@@ -0,0 +1,268 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "control_channel.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+
+extern "C" {
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+}
+
+namespace led_driver {
+
+namespace {
+bool MakeAddress(const std::string &path, sockaddr_un *address) {
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address->sun_path)) {
+    std::cerr << "Control socket path is too long: " << path << std::endl;
+    return false;
+  }
+  strncpy(address->sun_path, path.c_str(), sizeof(address->sun_path) - 1);
+  return true;
+}
+
+// Splits a "<sequence> <payload>" datagram.
+bool ParseMessage(absl::string_view message, uint32_t *sequence,
+                  absl::string_view *payload) {
+  auto separator = message.find(' ');
+  if (separator == absl::string_view::npos) {
+    return false;
+  }
+  if (!absl::SimpleAtoi(message.substr(0, separator), sequence)) {
+    return false;
+  }
+  *payload = message.substr(separator + 1);
+  return true;
+}
+
+// Whether a server is bound to `address`: connecting to a socket file which
+// nothing is bound to any more is refused.
+bool ServerListening(const sockaddr_un &address) {
+  const int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return false;
+  }
+  const bool listening =
+      connect(fd, reinterpret_cast<const sockaddr *>(&address),
+              sizeof(address)) == 0 ||
+      errno != ECONNREFUSED;
+  close(fd);
+  return listening;
+}
+}  // namespace
+
+bool ControlChannelServer::Initialize() {
+  sockaddr_un address;
+  if (!MakeAddress(path_, &address)) {
+    return false;
+  }
+
+  fd_ = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd_ < 0) {
+    std::cerr << "Failed to create control socket: " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+
+  auto bind_error = [this, &address]() {
+    return bind(fd_, reinterpret_cast<sockaddr *>(&address),
+                sizeof(address)) < 0
+               ? errno
+               : 0;
+  };
+  int error = bind_error();
+  // Replaces a socket left behind by an instance which has exited, but not
+  // one which is still running.
+  if (error == EADDRINUSE && !ServerListening(address)) {
+    unlink(path_.c_str());
+    error = bind_error();
+  }
+  if (error != 0) {
+    std::cerr << "Failed to bind control socket " << path_ << ": "
+              << (error == EADDRINUSE ? "another instance is listening on it"
+                                      : strerror(error))
+              << std::endl;
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  bound_ = true;
+
+  std::cout << "Listening for commands on " << path_ << std::endl;
+  return true;
+}
+
+ControlChannelServer::~ControlChannelServer() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  // Only the path this server bound is its own to remove.
+  if (bound_) {
+    unlink(path_.c_str());
+  }
+}
+
+int ControlChannelServer::Poll(const CommandHandlerType &handler) {
+  int handled = 0;
+  while (true) {
+    sockaddr_un client_address;
+    socklen_t client_address_length = sizeof(client_address);
+    ssize_t length =
+        recvfrom(fd_, buffer_.data(), buffer_.size(), 0,
+                 reinterpret_cast<sockaddr *>(&client_address),
+                 &client_address_length);
+    if (length < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        std::cerr << "Failed to read from control socket: " << strerror(errno)
+                  << std::endl;
+      }
+      return handled;
+    }
+
+    uint32_t sequence;
+    absl::string_view command;
+    if (!ParseMessage(absl::string_view(buffer_.data(), length), &sequence,
+                      &command)) {
+      std::cerr << "Dropping malformed control message" << std::endl;
+      continue;
+    }
+
+    std::string reply = absl::StrCat(sequence, " ", handler(command));
+    if (reply.size() > kControlMessageMaxLength) {
+      reply.resize(kControlMessageMaxLength);
+    }
+    ++handled;
+
+    if (sendto(fd_, reply.data(), reply.size(), MSG_DONTWAIT,
+               reinterpret_cast<sockaddr *>(&client_address),
+               client_address_length) < 0) {
+      std::cerr << "Failed to acknowledge control message: " << strerror(errno)
+                << std::endl;
+    }
+  }
+}
+
+bool ControlChannelClient::Initialize() {
+  fd_ = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0) {
+    std::cerr << "Failed to create control socket: " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+
+  // Autobind to an abstract address so that the server can reply to us.
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (bind(fd_, reinterpret_cast<sockaddr *>(&address),
+           sizeof(sa_family_t)) < 0) {
+    std::cerr << "Failed to bind control socket: " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+ControlChannelClient::~ControlChannelClient() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+bool ControlChannelClient::Send(absl::string_view command,
+                                std::string *reply) {
+  sockaddr_un server_address;
+  if (!MakeAddress(server_path_, &server_address)) {
+    return false;
+  }
+
+  const uint32_t sequence = ++sequence_;
+  std::string message = absl::StrCat(sequence, " ", command);
+  if (message.size() > kControlMessageMaxLength) {
+    std::cerr << "Control command is too long: " << command << std::endl;
+    return false;
+  }
+
+  const absl::Time start_time = absl::Now();
+  if (sendto(fd_, message.data(), message.size(), 0,
+             reinterpret_cast<sockaddr *>(&server_address),
+             sizeof(server_address)) < 0) {
+    // The server isn't running; callers are expected to fall back.
+    return false;
+  }
+
+  const absl::Time deadline = start_time + timeout_;
+  while (true) {
+    const absl::Duration remaining = deadline - absl::Now();
+    if (remaining <= absl::ZeroDuration()) {
+      std::cerr << "Timed out waiting for acknowledgement of \"" << command
+                << "\"" << std::endl;
+      return false;
+    }
+
+    pollfd poll_fd = {fd_, POLLIN, 0};
+    int result = poll(&poll_fd, 1, absl::ToInt64Milliseconds(remaining) + 1);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "Failed to wait for acknowledgement: " << strerror(errno)
+                << std::endl;
+      return false;
+    }
+    if (result == 0) {
+      continue;
+    }
+
+    ssize_t length = recv(fd_, buffer_.data(), buffer_.size(), 0);
+    if (length < 0) {
+      continue;
+    }
+
+    uint32_t reply_sequence;
+    absl::string_view payload;
+    if (!ParseMessage(absl::string_view(buffer_.data(), length),
+                      &reply_sequence, &payload) ||
+        reply_sequence != sequence) {
+      // Stale acknowledgement of a command that previously timed out.
+      continue;
+    }
+
+    last_round_trip_ = absl::Now() - start_time;
+    if (reply != nullptr) {
+      *reply = std::string(payload);
+    }
+    return true;
+  }
+}
+
+}  // namespace led_driver
@@ -0,0 +1,122 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef CONTROL_CHANNEL_H_
+#define CONTROL_CHANNEL_H_
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+
+namespace led_driver {
+
+// Maximum length of a command or reply datagram, in bytes.
+constexpr size_t kControlMessageMaxLength = 256;
+
+// Receives text commands over a Unix datagram socket and acknowledges each one
+// with a reply. The socket is non-blocking, so `Poll` can be called from a
+// render loop.
+//
+// Datagrams have the form "<sequence> <command>", and replies have the form
+// "<sequence> <reply>".
+class ControlChannelServer {
+ public:
+  // Handles a single command, returning the reply to send to the client.
+  using CommandHandlerType = std::function<std::string(absl::string_view)>;
+
+  template <typename... A>
+  static std::shared_ptr<ControlChannelServer> Create(A &&... args) {
+    auto server = std::shared_ptr<ControlChannelServer>(
+        new ControlChannelServer(std::forward<A>(args)...));
+    if (!server->Initialize()) {
+      return nullptr;
+    }
+    return server;
+  }
+
+  ~ControlChannelServer();
+
+  // Handles all pending commands without blocking. Returns the number of
+  // commands handled.
+  int Poll(const CommandHandlerType &handler);
+
+  // The file descriptor of the underlying socket, for use with `poll`/`epoll`.
+  int fd() const { return fd_; }
+
+ private:
+  ControlChannelServer(std::string path) : path_(std::move(path)) {}
+
+  bool Initialize();
+
+  std::string path_;
+  int fd_ = -1;
+  // Whether the socket was bound to `path_`, which is then removed on
+  // destruction.
+  bool bound_ = false;
+  std::array<char, kControlMessageMaxLength> buffer_;
+};
+
+// Sends text commands to a `ControlChannelServer` and waits for the
+// acknowledgements.
+class ControlChannelClient {
+ public:
+  template <typename... A>
+  static std::shared_ptr<ControlChannelClient> Create(A &&... args) {
+    auto client = std::shared_ptr<ControlChannelClient>(
+        new ControlChannelClient(std::forward<A>(args)...));
+    if (!client->Initialize()) {
+      return nullptr;
+    }
+    return client;
+  }
+
+  ~ControlChannelClient();
+
+  // Sends `command` and waits up to the configured timeout for the
+  // acknowledgement. Returns false if the server isn't listening or didn't
+  // reply in time. If `reply` is non-null, the reply is written to it.
+  bool Send(absl::string_view command, std::string *reply = nullptr);
+
+  // The round trip time of the last acknowledged command.
+  absl::Duration last_round_trip() const { return last_round_trip_; }
+
+ private:
+  ControlChannelClient(std::string server_path, absl::Duration timeout)
+      : server_path_(std::move(server_path)), timeout_(timeout) {}
+
+  bool Initialize();
+
+  std::string server_path_;
+  absl::Duration timeout_;
+  int fd_ = -1;
+  uint32_t sequence_ = 0;
+  absl::Duration last_round_trip_ = absl::ZeroDuration();
+  std::array<char, kControlMessageMaxLength> buffer_;
+};
+
+}  // namespace led_driver
+
+#endif  // CONTROL_CHANNEL_H_
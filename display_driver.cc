@@ -20,9 +20,13 @@
 
 #include "display_driver.h"
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
 #include <sstream>
 
+#include "simd_uint8x16.h"
+
 #define CHECK_RETURN(value)                                                    \
   do {                                                                         \
     if (!(value)) {                                                            \
@@ -31,8 +35,38 @@
   } while (0)
 
 namespace led_driver {
+constexpr int CountingDisplayBus::kClocksPerByte;
+constexpr int CountingDisplayBus::kClocksPerTransaction;
 constexpr int DisplayDriver::kDisplayWidth;
 constexpr int DisplayDriver::kDisplayHeight;
+constexpr int DisplayDriver::kPageCount;
+
+namespace {
+// Bus clocks taken by writing `bytes` bytes in one transaction.
+int WriteClocks(int bytes) {
+  return CountingDisplayBus::kClocksPerTransaction +
+         CountingDisplayBus::kClocksPerByte * bytes;
+}
+
+// Bus clocks taken by sending a window: a command setting its page and column
+// addresses, then its data, each behind a control byte.
+int WindowClocks(int pages, int columns) {
+  return WriteClocks(1 + 2 * 3) + WriteClocks(1 + pages * columns);
+}
+
+// Thresholds for ordered dithering, as indices into an 8x8 Bayer matrix.
+constexpr uint8_t kBayer8[8][8] = {
+    {0, 32, 8, 40, 2, 34, 10, 42},  {48, 16, 56, 24, 50, 18, 58, 26},
+    {12, 44, 4, 36, 14, 46, 6, 38}, {60, 28, 52, 20, 62, 30, 54, 22},
+    {3, 35, 11, 43, 1, 33, 9, 41},  {51, 19, 59, 27, 49, 17, 57, 25},
+    {15, 47, 7, 39, 13, 45, 5, 37}, {63, 31, 55, 23, 61, 29, 53, 21},
+};
+
+// Gray level of an RGB pixel, with Rec. 601 weights summing to 256.
+uint8_t Luma(const uint8_t *rgb) {
+  return (77 * rgb[0] + 150 * rgb[1] + 29 * rgb[2] + 128) >> 8;
+}
+} // namespace
 
 bool DisplayDriver::SendCommand(Command command) const {
   return SendCommand(absl::Span<const Command>({command}));
@@ -47,25 +81,97 @@ bool DisplayDriver::SendCommand(absl::Span<const Command> commands) const {
                                command.arguments.begin(),
                                command.arguments.end());
   }
-  return i2c_bus_->Write(kDeviceAddress, command_buffer_data);
+  return bus_->Write(kDeviceAddress, command_buffer_data);
 }
 
-bool DisplayDriver::SendData(absl::Span<const uint8_t> data) const {
+bool DisplayDriver::SendWindow(int first_page, int last_page,
+                               ColumnSpan columns) const {
+  CHECK_RETURN(SendCommand({
+      {CommandId::kPageAddr,
+       {static_cast<uint8_t>(first_page), static_cast<uint8_t>(last_page)}},
+      {CommandId::kColumnAddr,
+       {static_cast<uint8_t>(columns.begin),
+        static_cast<uint8_t>(columns.end - 1)}},
+  }));
+  // In horizontal addressing mode, the display fills the window a page at a
+  // time.
   std::vector<uint8_t> data_send_buffer;
+  data_send_buffer.reserve(1 + (last_page - first_page + 1) *
+                                   (columns.end - columns.begin));
   data_send_buffer.push_back(0x40);
-  data_send_buffer.insert(data_send_buffer.end(), data.begin(), data.end());
-  return i2c_bus_->Write(kDeviceAddress, data_send_buffer);
+  for (int page = first_page; page <= last_page; ++page) {
+    auto row = display_buffer_.begin() + page * kDisplayWidth;
+    data_send_buffer.insert(data_send_buffer.end(), row + columns.begin,
+                            row + columns.end);
+  }
+  return bus_->Write(kDeviceAddress, data_send_buffer);
 }
 
-bool DisplayDriver::Update() const {
-  CHECK_RETURN(SendCommand({
-      {CommandId::kPageAddr, {0, 0xFF}},
-      {CommandId::kColumnAddr, {0, kDisplayWidth - 1}},
-  }));
-  return SendData(display_buffer_);
+bool DisplayDriver::Update() {
+  // Each window covers a run of pages and the columns changed in any of them.
+  // Splitting the changes into more windows sends fewer unchanged bytes, at the
+  // cost of a command per window. cost[end] is the least time in which the
+  // changes to pages [0, end) can be sent, with the last window starting at
+  // window_start[end], or window_start[end] == end if page end - 1 is sent by
+  // no window.
+  std::array<int, kPageCount + 1> cost;
+  std::array<int, kPageCount + 1> window_start;
+  cost[0] = 0;
+  window_start[0] = 0;
+  for (int end = 1; end <= kPageCount; ++end) {
+    if (dirty_[end - 1].begin >= dirty_[end - 1].end) {
+      cost[end] = cost[end - 1];
+      window_start[end] = end;
+      continue;
+    }
+    cost[end] = std::numeric_limits<int>::max();
+    ColumnSpan columns = {kDisplayWidth, 0};
+    for (int start = end - 1; start >= 0; --start) {
+      columns.begin = std::min(columns.begin, dirty_[start].begin);
+      columns.end = std::max(columns.end, dirty_[start].end);
+      const int window_cost =
+          cost[start] + WindowClocks(end - start, columns.end - columns.begin);
+      if (window_cost < cost[end]) {
+        cost[end] = window_cost;
+        window_start[end] = start;
+      }
+    }
+  }
+
+  for (int end = kPageCount; end > 0;) {
+    const int start = window_start[end];
+    if (start == end) {
+      --end;
+      continue;
+    }
+    ColumnSpan columns = {kDisplayWidth, 0};
+    for (int page = start; page < end; ++page) {
+      columns.begin = std::min(columns.begin, dirty_[page].begin);
+      columns.end = std::max(columns.end, dirty_[page].end);
+    }
+    CHECK_RETURN(SendWindow(start, end - 1, columns));
+    for (int page = start; page < end; ++page) {
+      dirty_[page] = {kDisplayWidth, 0};
+    }
+    end = start;
+  }
+  return true;
+}
+
+void DisplayDriver::Invalidate() {
+  std::fill(dirty_.begin(), dirty_.end(), ColumnSpan{0, kDisplayWidth});
 }
 
-bool DisplayDriver::Initialize() const {
+void DisplayDriver::MarkDirty(int byte_offset) {
+  ColumnSpan &span = dirty_[byte_offset / kDisplayWidth];
+  const int column = byte_offset % kDisplayWidth;
+  span.begin = std::min(span.begin, column);
+  span.end = std::max(span.end, column + 1);
+}
+
+bool DisplayDriver::Initialize() {
+  // The display's memory is undefined until it is first written.
+  Invalidate();
   return SendCommand({
       {CommandId::kDisplayOff, {}},
       {CommandId::kSetDisplayClockDiv, {0x80}},
@@ -98,7 +204,12 @@ bool DisplayDriver::RenderImage(absl::Span<const uint8_t> image) {
     return false;
   }
 
-  std::copy(image.begin(), image.end(), display_buffer_.begin());
+  for (size_t i = 0; i < image.size(); ++i) {
+    if (display_buffer_[i] != image[i]) {
+      display_buffer_[i] = image[i];
+      MarkDirty(i);
+    }
+  }
   return true;
 }
 
@@ -110,17 +221,11 @@ bool DisplayDriver::DrawPixel(int x, int y, Color color) {
   if (x < 0 || x >= kDisplayWidth || y < 0 || y >= kDisplayHeight) {
     return false;
   }
-  constexpr int kBlockWidth = 4;
-  constexpr int kBlockHeight = 8;
-  constexpr int kBlockCountX = kDisplayWidth / kBlockWidth;
-  constexpr int kBlockCountY = kDisplayHeight / kBlockHeight;
-
-  int block_index = (x / kBlockWidth) + kBlockCountX * (y / kBlockHeight);
-  int block_pixel_index = kBlockHeight * (x % kBlockWidth) + (y % kBlockHeight);
-  int bit_offset =
-      block_index * (kBlockWidth * kBlockHeight) + block_pixel_index;
-  int byte_offset = bit_offset / 8;
-  bit_offset %= 8;
+  // The display's memory holds a byte for each column of each page of eight
+  // rows, with the top row in the low bit.
+  const int byte_offset = x + kDisplayWidth * (y / 8);
+  const int bit_offset = y % 8;
+  const uint8_t previous = display_buffer_[byte_offset];
   switch (color) {
   case Color::kBlack:
     display_buffer_[byte_offset] &= ~(1 << bit_offset);
@@ -132,11 +237,112 @@ bool DisplayDriver::DrawPixel(int x, int y, Color color) {
     display_buffer_[byte_offset] ^= (1 << bit_offset);
     break;
   }
+  if (display_buffer_[byte_offset] != previous) {
+    MarkDirty(byte_offset);
+  }
+  return true;
+}
+
+bool DisplayDriver::Blit(absl::Span<const uint8_t> image, int width,
+                         int height, int stride, int channels, int x, int y,
+                         Dither dither, int threshold) {
+  if ((channels != 1 && channels != 3) || width < 0 || height < 0 ||
+      stride < width * channels) {
+    return false;
+  }
+  if (height > 0 && image.size() < static_cast<size_t>(height - 1) * stride +
+                                       width * channels) {
+    return false;
+  }
+  const int first_column = std::max(x, 0);
+  const int end_column = std::min(x + width, kDisplayWidth);
+  const int first_row = std::max(y, 0);
+  const int end_row = std::min(y + height, kDisplayHeight);
+  if (first_column >= end_column || first_row >= end_row) {
+    return true;
+  }
+  const int columns = end_column - first_column;
+
+  // The threshold of each pixel of a page, by row and by column from
+  // `first_column`. The Bayer matrix repeats every eight columns, so these
+  // repeat every sixteen.
+  const uint8_t fixed_threshold = std::min(std::max(threshold, 0), 255);
+  std::array<std::array<uint8_t, 16>, 8> thresholds;
+  std::array<Uint8x16, 8> threshold_vectors;
+  for (int bit = 0; bit < 8; ++bit) {
+    for (int lane = 0; lane < 16; ++lane) {
+      thresholds[bit][lane] =
+          dither == kOrdered
+              ? kBayer8[bit][(first_column + lane) % 8] * 4 + 2
+              : fixed_threshold;
+    }
+    threshold_vectors[bit] = Load16(thresholds[bit].data());
+  }
+
+  // RGB rows are converted to gray first, a page at a time.
+  std::array<uint8_t, 8 * kDisplayWidth> gray;
+  std::array<uint8_t, kDisplayWidth> packed;
+  for (int page = first_row / 8; page <= (end_row - 1) / 8; ++page) {
+    const int first_bit = std::max(first_row - page * 8, 0);
+    const int end_bit = std::min(end_row - page * 8, 8);
+    std::array<const uint8_t *, 8> rows;
+    uint8_t row_mask = 0;
+    for (int bit = first_bit; bit < end_bit; ++bit) {
+      const uint8_t *source = image.data() + (page * 8 + bit - y) * stride +
+                              (first_column - x) * channels;
+      if (channels == 3) {
+        uint8_t *row = gray.data() + bit * kDisplayWidth;
+        for (int i = 0; i < columns; ++i) {
+          row[i] = Luma(source + 3 * i);
+        }
+        source = row;
+      }
+      rows[bit] = source;
+      row_mask |= 1 << bit;
+    }
+
+    // Each byte gathers a column of the page's rows, so sixteen columns are
+    // packed at once by comparing sixteen pixels of each row.
+    uint8_t *page_bytes =
+        display_buffer_.data() + page * kDisplayWidth + first_column;
+    const Uint8x16 keep = Splat16(static_cast<uint8_t>(~row_mask));
+    int i = 0;
+    for (; i + 16 <= columns; i += 16) {
+      Uint8x16 bits = And16(Load16(page_bytes + i), keep);
+      for (int bit = first_bit; bit < end_bit; ++bit) {
+        bits = Or16(bits, And16(Greater16(Load16(rows[bit] + i),
+                                          threshold_vectors[bit]),
+                                Splat16(1 << bit)));
+      }
+      Store16(packed.data() + i, bits);
+    }
+    for (; i < columns; ++i) {
+      uint8_t bits = page_bytes[i] & ~row_mask;
+      for (int bit = first_bit; bit < end_bit; ++bit) {
+        if (rows[bit][i] > thresholds[bit][i % 16]) {
+          bits |= 1 << bit;
+        }
+      }
+      packed[i] = bits;
+    }
+
+    for (i = 0; i < columns; ++i) {
+      if (page_bytes[i] != packed[i]) {
+        page_bytes[i] = packed[i];
+        MarkDirty(page * kDisplayWidth + first_column + i);
+      }
+    }
+  }
   return true;
 }
 
 void DisplayDriver::Clear() {
-  std::fill(display_buffer_.begin(), display_buffer_.end(), 0);
+  for (size_t i = 0; i < display_buffer_.size(); ++i) {
+    if (display_buffer_[i] != 0) {
+      display_buffer_[i] = 0;
+      MarkDirty(i);
+    }
+  }
 }
 
 } // namespace led_driver
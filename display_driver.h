@@ -23,7 +23,9 @@
 
 #include <array>
 #include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -31,28 +33,110 @@
 #include "absl/types/span.h"
 
 namespace led_driver {
+
+// The bus the display is attached to.
+struct DisplayBusInterface {
+  virtual ~DisplayBusInterface() {}
+
+  // Writes `data` to the device at `address` in one transaction.
+  virtual bool Write(uint8_t address, const std::vector<uint8_t> &data) = 0;
+};
+
+class I2cDisplayBus : public DisplayBusInterface {
+public:
+  explicit I2cDisplayBus(std::shared_ptr<i2c::Bus> i2c_bus)
+      : i2c_bus_(std::move(i2c_bus)) {}
+
+  bool Write(uint8_t address, const std::vector<uint8_t> &data) override {
+    return i2c_bus_->Write(address, data);
+  }
+
+private:
+  std::shared_ptr<i2c::Bus> i2c_bus_;
+};
+
+// Stand-in for the I2C bus which sends nothing, and only counts the bytes and
+// transactions written, so that the time the display would take to update can
+// be measured without one.
+class CountingDisplayBus : public DisplayBusInterface {
+public:
+  // Bus clocks taken by each byte, eight bits and an acknowledge, and by each
+  // transaction beyond its data: the start and stop conditions and the address
+  // byte.
+  constexpr static int kClocksPerByte = 9;
+  constexpr static int kClocksPerTransaction = 2 + kClocksPerByte;
+
+  bool Write(uint8_t /*address*/, const std::vector<uint8_t> &data) override {
+    ++transactions_;
+    bytes_ += data.size();
+    return true;
+  }
+
+  int64_t transactions() const { return transactions_; }
+  int64_t bytes() const { return bytes_; }
+  // Time the writes so far would have taken on a bus clocked at `clock_hz`.
+  double Seconds(int clock_hz) const {
+    return static_cast<double>(kClocksPerTransaction * transactions_ +
+                               kClocksPerByte * bytes_) /
+           clock_hz;
+  }
+  void Reset() {
+    transactions_ = 0;
+    bytes_ = 0;
+  }
+
+private:
+  int64_t transactions_ = 0;
+  int64_t bytes_ = 0;
+};
+
+// Drives a 128x32 SSD1306 OLED. Drawing only modifies a copy of the display's
+// memory; Update() then sends the pages and columns which have changed since
+// the last update.
 class DisplayDriver {
 public:
   enum Color { kWhite = 0, kBlack, kInvert };
+  // How Blit() chooses the pixels to light.
+  enum Dither {
+    // Pixels brighter than the threshold are lit.
+    kThreshold = 0,
+    // Pixels are compared against an 8x8 Bayer matrix fixed to the display,
+    // which shades flat areas; the threshold is unused.
+    kOrdered,
+  };
 
-  DisplayDriver(std::shared_ptr<i2c::Bus> i2c_bus)
-      : i2c_bus_(std::move(i2c_bus)) {
-    Clear();
+  DisplayDriver(std::shared_ptr<DisplayBusInterface> bus)
+      : bus_(std::move(bus)) {
+    Invalidate();
   }
+  DisplayDriver(std::shared_ptr<i2c::Bus> i2c_bus)
+      : DisplayDriver(std::make_shared<I2cDisplayBus>(std::move(i2c_bus))) {}
   DisplayDriver(std::string i2c_dev)
       : DisplayDriver(std::make_shared<i2c::Bus>(i2c_dev)) {}
 
-  bool Initialize() const;
+  bool Initialize();
   bool RenderImage(absl::Span<const uint8_t> image);
   bool RenderImage(const std::vector<uint8_t> image);
   std::pair<int, int> GetSize() const;
   bool DrawPixel(int x, int y, Color color);
+  // Draws a `width` x `height` image of 8-bit gray pixels, or of RGB pixels if
+  // `channels` is 3, whose rows are `stride` bytes apart, with its top-left
+  // corner at (x, y) on the display. The parts of the image off the display
+  // are left out, and the rest of the display is left as it was.
+  bool Blit(absl::Span<const uint8_t> image, int width, int height, int stride,
+            int channels, int x, int y, Dither dither, int threshold);
   void Clear();
-  bool Update() const;
+  // Sends the parts of the display which have changed, choosing the windows
+  // to send them in which take the least time on the bus.
+  bool Update();
+  // Marks the whole display as changed, so that the next Update() sends all
+  // of it.
+  void Invalidate();
 
 private:
   constexpr static int kDisplayWidth = 128;
   constexpr static int kDisplayHeight = 32;
+  constexpr static int kPageCount = kDisplayHeight / 8;
   constexpr static uint8_t kDeviceAddress = 0x3c;
 
   enum class CommandId : uint8_t {
@@ -95,12 +179,21 @@ private:
     std::vector<uint8_t> arguments;
   };
 
+  // Columns [begin, end) of a page which have changed; empty if begin >= end.
+  struct ColumnSpan {
+    int begin;
+    int end;
+  };
+
   bool SendCommand(Command command) const;
   bool SendCommand(absl::Span<const Command> commands) const;
-  bool SendData(absl::Span<const uint8_t> data) const;
+  // Sends pages [first_page, last_page] of columns [begin, end) as one window.
+  bool SendWindow(int first_page, int last_page, ColumnSpan columns) const;
+  void MarkDirty(int byte_offset);
 
-  std::shared_ptr<i2c::Bus> i2c_bus_;
-  std::array<uint8_t, kDisplayWidth * kDisplayHeight / 8> display_buffer_;
+  std::shared_ptr<DisplayBusInterface> bus_;
+  std::array<uint8_t, kDisplayWidth * kDisplayHeight / 8> display_buffer_{};
+  std::array<ColumnSpan, kPageCount> dirty_;
 };
 } // namespace led_driver
 
@@ -0,0 +1,331 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Measures how much of the I2C bus each OLED update takes, sending only the
+// pages and columns which have changed against sending the whole display, on
+// animations like those in py_display_driver.py. Also times drawing each frame
+// a pixel at a time against blitting it. The display is driven through a
+// stand-in bus which also emulates the display's memory, and exits non-zero if
+// what the display would show ever differs from what was drawn, or if blitting
+// images of either format, at any offset, differs from drawing them a pixel at
+// a time.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "display_driver.h"
+
+ABSL_FLAG(int, frames, 600, "Frames to draw per animation");
+ABSL_FLAG(int, i2c_hz, 400000, "I2C bus clock to estimate update times at");
+
+namespace led_driver {
+
+namespace {
+
+constexpr int kWidth = 128;
+constexpr int kHeight = 32;
+constexpr double kPi = 3.14159265358979323846;
+
+// Counts what is written like CountingDisplayBus, and also applies it to an
+// emulation of the display's memory in horizontal addressing mode.
+class EmulatedDisplayBus : public CountingDisplayBus {
+public:
+  EmulatedDisplayBus() : memory_(kWidth * kHeight / 8, 0) {}
+
+  bool Write(uint8_t address, const std::vector<uint8_t> &data) override {
+    CountingDisplayBus::Write(address, data);
+    if (data.empty()) {
+      return false;
+    }
+    if (data[0] == 0x40) {
+      for (size_t i = 1; i < data.size(); ++i) {
+        memory_[page_ * kWidth + column_] = data[i];
+        if (++column_ > last_column_) {
+          column_ = first_column_;
+          if (++page_ > last_page_) {
+            page_ = first_page_;
+          }
+        }
+      }
+      return true;
+    }
+    for (size_t i = 1; i < data.size(); ++i) {
+      switch (data[i]) {
+      case 0x21:
+        column_ = first_column_ = data[i + 1];
+        last_column_ = data[i + 2];
+        i += 2;
+        break;
+      case 0x22:
+        page_ = first_page_ = data[i + 1];
+        last_page_ = data[i + 2];
+        i += 2;
+        break;
+      default:
+        std::cerr << "Unexpected command " << static_cast<int>(data[i])
+                  << std::endl;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool Lit(int x, int y) const {
+    return memory_[(y / 8) * kWidth + x] & (1 << (y % 8));
+  }
+
+private:
+  std::vector<uint8_t> memory_;
+  int first_page_ = 0;
+  int last_page_ = kHeight / 8 - 1;
+  int first_column_ = 0;
+  int last_column_ = kWidth - 1;
+  int page_ = 0;
+  int column_ = 0;
+};
+
+// Whether pixel (x, y) of a 5x7 glyph chosen by `character` is lit; stands in
+// for text.
+bool Glyph(uint32_t character, int x, int y) {
+  if (x < 0 || x >= 5 || y < 0 || y >= 7) {
+    return false;
+  }
+  uint32_t bits = (character + 1) * 2654435761u;
+  bits ^= bits >> 13;
+  bits *= 0x5bd1e995u;
+  return (bits >> ((x * 7 + y) % 32)) & 1;
+}
+
+struct Animation {
+  const char *name;
+  std::function<bool(int frame, int x, int y)> lit;
+};
+
+std::vector<Animation> Animations() {
+  return {
+      // A line of text scrolled across the middle of the display, a pixel a
+      // frame, as ScrollText() does.
+      {"scroll",
+       [](int frame, int x, int y) {
+         const int u = x + frame % 200;
+         return Glyph(u / 6, u % 6, y - 12);
+       }},
+      // A ring and bar moved around a circle, as DrawRotating() does.
+      {"rotate",
+       [](int frame, int x, int y) {
+         const double angle = 2 * kPi * frame / 60;
+         const double dx = x - (64 + 6 * std::cos(angle));
+         const double dy = y - (16 + 6 * std::sin(angle));
+         const double radius = std::sqrt(dx * dx + dy * dy);
+         return (radius >= 8 && radius <= 11) ||
+                (std::abs(dx) <= 24 && std::abs(dy) <= 1);
+       }},
+      // A fixed label with a counter beside it.
+      {"counter",
+       [](int frame, int x, int y) {
+         if (x < 60) {
+           return Glyph(100 + x / 6, x % 6, y - 1);
+         }
+         int digit = 3 - (x - 100) / 6;
+         if (x < 100 || digit < 0) {
+           return false;
+         }
+         int value = frame;
+         while (digit-- > 0) {
+           value /= 10;
+         }
+         return Glyph(value % 10, (x - 100) % 6, y - 1);
+       }},
+      // The whole display inverted every frame.
+      {"flash", [](int frame, int x, int y) { return (frame + x + y) % 2; }},
+  };
+}
+
+// Draws `frames` frames of `animation`, either a pixel at a time, as the
+// Python demos did, or with Blit(), and reports the bus time per update. Sends
+// the whole display every frame if `full`.
+bool Run(const Animation &animation, int frames, bool full, bool blit) {
+  auto bus = std::make_shared<EmulatedDisplayBus>();
+  DisplayDriver display_driver(bus);
+  std::vector<uint8_t> image(kWidth * kHeight);
+  absl::Duration cpu_time;
+  bool ok = true;
+  for (int frame = 0; frame < frames; ++frame) {
+    for (int y = 0; y < kHeight; ++y) {
+      for (int x = 0; x < kWidth; ++x) {
+        image[y * kWidth + x] = animation.lit(frame, x, y) ? 255 : 0;
+      }
+    }
+
+    const absl::Time start = absl::Now();
+    if (blit) {
+      display_driver.Blit(image, kWidth, kHeight, kWidth, 1, 0, 0,
+                          DisplayDriver::kThreshold, 128);
+    } else {
+      for (int x = 0; x < kWidth; ++x) {
+        for (int y = 0; y < kHeight; ++y) {
+          display_driver.DrawPixel(x, y,
+                                   image[y * kWidth + x] > 128
+                                       ? DisplayDriver::Color::kWhite
+                                       : DisplayDriver::Color::kBlack);
+        }
+      }
+    }
+    if (full) {
+      display_driver.Invalidate();
+    }
+    if (!display_driver.Update()) {
+      std::cerr << "Update failed" << std::endl;
+      return false;
+    }
+    cpu_time += absl::Now() - start;
+
+    for (int x = 0; x < kWidth && ok; ++x) {
+      for (int y = 0; y < kHeight && ok; ++y) {
+        if (bus->Lit(x, y) != animation.lit(frame, x, y)) {
+          std::cerr << animation.name << " frame " << frame << ": pixel " << x
+                    << ", " << y << " wasn't sent" << std::endl;
+          ok = false;
+        }
+      }
+    }
+  }
+
+  const double bus_ms =
+      bus->Seconds(absl::GetFlag(FLAGS_i2c_hz)) * 1e3 / frames;
+  std::cout << animation.name << (full ? " full" : " partial")
+            << (blit ? ", blit: " : ", pixels: ")
+            << static_cast<double>(bus->bytes()) / frames << " bytes, "
+            << static_cast<double>(bus->transactions()) / frames
+            << " transactions, " << bus_ms << " ms on the bus ("
+            << 1e3 / bus_ms << " fps), "
+            << absl::ToDoubleMicroseconds(cpu_time) / frames
+            << " us drawing per frame" << std::endl;
+  return ok;
+}
+
+// Blits random images of `channels` channels at offsets all around and off the
+// display, and checks each against drawing the same pixels one at a time.
+bool CheckBlit(int channels, DisplayDriver::Dither dither) {
+  constexpr int kImageWidth = 150;
+  constexpr int kImageHeight = 45;
+  constexpr int kPadding = 7;
+  constexpr int kStride = kImageWidth * 3 + kPadding;
+  std::vector<uint8_t> image(kImageHeight * kStride);
+  uint32_t noise = 12345;
+  for (uint8_t &value : image) {
+    noise = noise * 1664525u + 1013904223u;
+    value = noise >> 24;
+  }
+  static const uint8_t kBayer8[8][8] = {
+      {0, 32, 8, 40, 2, 34, 10, 42},  {48, 16, 56, 24, 50, 18, 58, 26},
+      {12, 44, 4, 36, 14, 46, 6, 38}, {60, 28, 52, 20, 62, 30, 54, 22},
+      {3, 35, 11, 43, 1, 33, 9, 41},  {51, 19, 59, 27, 49, 17, 57, 25},
+      {15, 47, 7, 39, 13, 45, 5, 37}, {63, 31, 55, 23, 61, 29, 53, 21},
+  };
+
+  auto blitted_bus = std::make_shared<EmulatedDisplayBus>();
+  auto drawn_bus = std::make_shared<EmulatedDisplayBus>();
+  DisplayDriver blitted(blitted_bus);
+  DisplayDriver drawn(drawn_bus);
+  for (int offset_y = -kImageHeight; offset_y <= kHeight; offset_y += 3) {
+    for (int offset_x = -kImageWidth; offset_x <= kWidth; offset_x += 5) {
+      const int width = kImageWidth - (offset_x & 15);
+      const int height = kImageHeight - (offset_y & 7);
+      const int threshold = (offset_x * 7 + offset_y * 3) & 255;
+      if (!blitted.Blit(image, width, height, kStride, channels, offset_x,
+                        offset_y, dither, threshold)) {
+        std::cerr << "Blit failed" << std::endl;
+        return false;
+      }
+      for (int y = std::max(offset_y, 0);
+           y < std::min(offset_y + height, kHeight); ++y) {
+        for (int x = std::max(offset_x, 0);
+             x < std::min(offset_x + width, kWidth); ++x) {
+          const uint8_t *pixel = image.data() + (y - offset_y) * kStride +
+                                 (x - offset_x) * channels;
+          const int value =
+              channels == 3
+                  ? (77 * pixel[0] + 150 * pixel[1] + 29 * pixel[2] + 128) >>
+                        8
+                  : pixel[0];
+          const int pixel_threshold =
+              dither == DisplayDriver::kOrdered
+                  ? kBayer8[y % 8][x % 8] * 4 + 2
+                  : threshold;
+          drawn.DrawPixel(x, y,
+                          value > pixel_threshold
+                              ? DisplayDriver::Color::kWhite
+                              : DisplayDriver::Color::kBlack);
+        }
+      }
+      if (!blitted.Update() || !drawn.Update()) {
+        return false;
+      }
+      for (int y = 0; y < kHeight; ++y) {
+        for (int x = 0; x < kWidth; ++x) {
+          if (blitted_bus->Lit(x, y) != drawn_bus->Lit(x, y)) {
+            std::cerr << channels << "-channel blit at " << offset_x << ", "
+                      << offset_y << " differs at pixel " << x << ", " << y
+                      << std::endl;
+            return false;
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  absl::ParseCommandLine(argc, argv);
+  const int frames = absl::GetFlag(FLAGS_frames);
+  bool ok = true;
+  for (const Animation &animation : Animations()) {
+    ok &= Run(animation, frames, true, false);
+    ok &= Run(animation, frames, false, false);
+    ok &= Run(animation, frames, false, true);
+  }
+  for (int channels : {1, 3}) {
+    for (DisplayDriver::Dither dither :
+         {DisplayDriver::kThreshold, DisplayDriver::kOrdered}) {
+      if (!CheckBlit(channels, dither)) {
+        ok = false;
+      }
+    }
+  }
+  std::cout << "Blit checks " << (ok ? "passed" : "failed") << std::endl;
+  return ok ? 0 : 1;
+}
+} // namespace led_driver
+
+extern "C" {
+int main(int argc, char *argv[]) { return led_driver::main(argc, argv); }
+}
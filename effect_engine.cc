@@ -0,0 +1,248 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "effect_engine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "simd_float4.h"
+
+namespace led_driver {
+namespace {
+constexpr float kTwoPi = 6.2831853f;
+
+struct PaletteStop {
+  float position;
+  uint8_t color[3];
+};
+
+// Palettes wrap around: the last stop blends back into the first, so that
+// cycling through them is seamless.
+const std::vector<PaletteStop> &GetPaletteStops(const std::string &name) {
+  static const std::vector<PaletteStop> kRainbow = {
+      {0.0f, {255, 0, 0}},   {1 / 6.0f, {255, 255, 0}}, {2 / 6.0f, {0, 255, 0}},
+      {3 / 6.0f, {0, 255, 255}}, {4 / 6.0f, {0, 0, 255}},
+      {5 / 6.0f, {255, 0, 255}}};
+  static const std::vector<PaletteStop> kFire = {
+      {0.0f, {0, 0, 0}},       {0.3f, {160, 0, 0}},
+      {0.5f, {255, 80, 0}},    {0.7f, {255, 200, 20}},
+      {0.8f, {255, 255, 160}}, {0.9f, {160, 20, 0}}};
+  static const std::vector<PaletteStop> kOcean = {
+      {0.0f, {0, 0, 40}},      {0.3f, {0, 40, 160}},
+      {0.55f, {0, 180, 200}},  {0.7f, {150, 255, 240}},
+      {0.85f, {0, 100, 180}}};
+  static const std::vector<PaletteStop> kForest = {
+      {0.0f, {0, 30, 0}},     {0.35f, {20, 140, 10}},
+      {0.6f, {150, 220, 20}}, {0.8f, {60, 100, 0}}};
+  static const std::vector<PaletteStop> kNone;
+
+  if (name == "rainbow") return kRainbow;
+  if (name == "fire") return kFire;
+  if (name == "ocean") return kOcean;
+  if (name == "forest") return kForest;
+  return kNone;
+}
+}  // namespace
+
+std::shared_ptr<EffectEngine> EffectEngine::Create(
+    Config config, const std::vector<std::pair<float, float>> &coordinates) {
+  auto engine = std::shared_ptr<EffectEngine>(
+      new EffectEngine(std::move(config), coordinates));
+  if (!engine->Initialize()) {
+    return nullptr;
+  }
+  return engine;
+}
+
+EffectEngine::EffectEngine(
+    Config config, const std::vector<std::pair<float, float>> &coordinates)
+    : config_(std::move(config)),
+      effect_(Effect::PLASMA),
+      num_leds_(coordinates.size()) {
+  const int padded = (num_leds_ + 3) & ~3;
+  x_.resize(padded, 0.0f);
+  y_.resize(padded, 0.0f);
+  order_.resize(padded, 0.0f);
+  field_.resize(padded, 0.0f);
+  level_.resize(padded, 1.0f);
+  for (int i = 0; i < num_leds_; ++i) {
+    x_[i] = coordinates[i].first;
+    y_[i] = coordinates[i].second;
+    order_[i] = static_cast<float>(i) / std::max(num_leds_, 1);
+  }
+}
+
+bool EffectEngine::Initialize() {
+  if (config_.effect == "gradient") {
+    effect_ = Effect::GRADIENT;
+  } else if (config_.effect == "plasma") {
+    effect_ = Effect::PLASMA;
+  } else if (config_.effect == "noise") {
+    effect_ = Effect::NOISE;
+  } else if (config_.effect == "chase") {
+    effect_ = Effect::CHASE;
+  } else if (config_.effect == "palette") {
+    effect_ = Effect::PALETTE;
+  } else {
+    std::cerr << "Unknown effect: " << config_.effect << std::endl;
+    return false;
+  }
+
+  const std::vector<PaletteStop> &stops = GetPaletteStops(config_.palette);
+  if (stops.empty()) {
+    std::cerr << "Unknown palette: " << config_.palette << std::endl;
+    return false;
+  }
+  for (int i = 0; i < 256; ++i) {
+    const float position = i / 256.0f;
+    size_t next = 0;
+    while (next < stops.size() && stops[next].position <= position) {
+      ++next;
+    }
+    const PaletteStop &from = stops[(next + stops.size() - 1) % stops.size()];
+    const PaletteStop &to = stops[next % stops.size()];
+    float span = to.position - from.position;
+    float offset = position - from.position;
+    if (span <= 0) span += 1.0f;
+    if (offset < 0) offset += 1.0f;
+    const float blend = offset / span;
+    for (int channel = 0; channel < 3; ++channel) {
+      palette_[i][channel] = static_cast<uint8_t>(std::lround(
+          from.color[channel] +
+          (to.color[channel] - from.color[channel]) * blend));
+    }
+  }
+  return true;
+}
+
+void EffectEngine::EvaluateField(float seconds) {
+  const float t = seconds * config_.speed;
+  const Float4 scale = Splat4(config_.scale);
+  const int padded = x_.size();
+
+  switch (effect_) {
+    case Effect::GRADIENT:
+      for (int i = 0; i < padded; i += 4) {
+        const Float4 x = Load4(&x_[i]);
+        const Float4 y = Load4(&y_[i]);
+        Store4(&field_[i], (x + y) * Splat4(0.5f) * scale +
+                               Splat4(0.2f * t));
+      }
+      break;
+
+    case Effect::PLASMA: {
+      const Float4 phase0 = Splat4(0.3f * t);
+      const Float4 phase1 = Splat4(-0.23f * t);
+      const Float4 phase2 = Splat4(0.17f * t);
+      const Float4 phase3 = Splat4(-0.41f * t);
+      for (int i = 0; i < padded; i += 4) {
+        const Float4 x = Load4(&x_[i]) * scale;
+        const Float4 y = Load4(&y_[i]) * scale;
+        const Float4 sum =
+            SinTurns4(MultiplyAdd4(x, Splat4(1.5f), phase0)) +
+            SinTurns4(MultiplyAdd4(y, Splat4(1.7f), phase1)) +
+            SinTurns4(x + y + phase2) +
+            SinTurns4(MultiplyAdd4(MultiplyAdd4(x, x, y * y), Splat4(2.0f),
+                                   phase3));
+        Store4(&field_[i], MultiplyAdd4(sum, Splat4(0.125f), Splat4(0.5f)));
+      }
+      break;
+    }
+
+    case Effect::NOISE: {
+      // Octaves of sine waves along unrelated directions, which together look
+      // like smooth value noise without needing a lattice.
+      constexpr int kOctaves = 4;
+      constexpr float kDirectionX[kOctaves] = {0.82f, -0.37f, 0.96f, -0.61f};
+      constexpr float kDirectionY[kOctaves] = {0.57f, 0.93f, -0.28f, -0.79f};
+      constexpr float kDrift[kOctaves] = {0.11f, -0.17f, 0.23f, -0.31f};
+      for (int i = 0; i < padded; i += 4) {
+        const Float4 x = Load4(&x_[i]) * scale;
+        const Float4 y = Load4(&y_[i]) * scale;
+        Float4 sum = Splat4(0.0f);
+        float frequency = 1.3f;
+        float amplitude = 0.25f;
+        for (int octave = 0; octave < kOctaves; ++octave) {
+          const Float4 along =
+              MultiplyAdd4(x, Splat4(kDirectionX[octave] * frequency),
+                           y * Splat4(kDirectionY[octave] * frequency));
+          sum = MultiplyAdd4(
+              SinTurns4(along + Splat4(kDrift[octave] * t + 0.37f * octave)),
+              Splat4(amplitude), sum);
+          frequency *= 2.1f;
+          amplitude *= 0.5f;
+        }
+        Store4(&field_[i], sum + Splat4(0.5f));
+      }
+      break;
+    }
+
+    case Effect::CHASE: {
+      const Float4 count = Splat4(std::max(config_.chase_count, 1));
+      const Float4 offset = Splat4(-0.5f * t);
+      const Float4 tail = Splat4(1.0f / std::max(config_.chase_tail, 0.01f));
+      const Float4 zero = Splat4(0.0f);
+      const Float4 one = Splat4(1.0f);
+      for (int i = 0; i < padded; i += 4) {
+        const Float4 order = Load4(&order_[i]);
+        // Distance behind the nearest chaser, in chaser spacings.
+        const Float4 behind = Fract4(one - Fract4(order * count + offset));
+        Store4(&level_[i], Max4(zero, one - behind * tail));
+        Store4(&field_[i], order);
+      }
+      break;
+    }
+
+    case Effect::PALETTE:
+      for (int i = 0; i < padded; i += 4) {
+        Store4(&field_[i], Load4(&y_[i]) * Splat4(0.1f) * scale);
+      }
+      break;
+  }
+}
+
+void EffectEngine::Render(float seconds, absl::Span<uint8_t> frame) {
+  EvaluateField(seconds);
+
+  // Offset into the palette, wrapped to keep precision over long runs.
+  const float cycle = config_.palette_speed * seconds;
+  const Float4 palette_offset = Splat4(cycle - std::floor(cycle));
+  const Float4 palette_size = Splat4(255.99f);
+  for (size_t i = 0; i < field_.size(); i += 4) {
+    Store4(&field_[i],
+           Fract4(Load4(&field_[i]) + palette_offset) * palette_size);
+  }
+
+  // Palette lookups are scalar; there's no gather on NEON.
+  const float brightness = config_.brightness * 256.0f;
+  const int count = std::min<int>(num_leds_, frame.size() / 3);
+  for (int i = 0; i < count; ++i) {
+    const auto &color = palette_[static_cast<int>(field_[i]) & 0xFF];
+    const int level =
+        std::min(static_cast<int>(level_[i] * brightness), 256);
+    for (int channel = 0; channel < 3; ++channel) {
+      frame[i * 3 + channel] = (color[channel] * level) >> 8;
+    }
+  }
+}
+
+}  // namespace led_driver
@@ -0,0 +1,101 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef EFFECT_ENGINE_H_
+#define EFFECT_ENGINE_H_
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/types/span.h"
+
+namespace led_driver {
+
+// Evaluates procedural patterns directly at the LED mapping coordinates, four
+// LEDs at a time, with no raster to render or sample.
+class EffectEngine {
+ public:
+  struct Config {
+    // One of "gradient", "plasma", "noise", "chase" or "palette".
+    std::string effect = "plasma";
+
+    // One of "rainbow", "fire", "ocean" or "forest".
+    std::string palette = "rainbow";
+
+    // Animation rate, and spatial frequency, relative to the defaults.
+    float speed = 1.0f;
+    float scale = 1.0f;
+
+    // Palette cycles per second.
+    float palette_speed = 0.05f;
+
+    // For "chase": the number of chasers along the LED chain, and the length
+    // of each tail as a fraction of the spacing between them.
+    int chase_count = 3;
+    float chase_tail = 0.3f;
+
+    float brightness = 1.0f;
+  };
+
+  // Coordinates are normalized to [0, 1], as in the mapping, and are given in
+  // LED order.
+  static std::shared_ptr<EffectEngine> Create(
+      Config config, const std::vector<std::pair<float, float>> &coordinates);
+
+  // Renders the effect at time `seconds` into `frame`, one RGB triplet per
+  // coordinate. Never allocates.
+  void Render(float seconds, absl::Span<uint8_t> frame);
+
+  int num_leds() const { return num_leds_; }
+
+ private:
+  enum class Effect { GRADIENT, PLASMA, NOISE, CHASE, PALETTE };
+
+  EffectEngine(Config config,
+               const std::vector<std::pair<float, float>> &coordinates);
+
+  bool Initialize();
+
+  // Fills `field_` with palette positions, in turns, and, for effects which
+  // modulate it, `level_` with brightness.
+  void EvaluateField(float seconds);
+
+  const Config config_;
+  Effect effect_;
+
+  // Coordinates and LED order, in [0, 1), padded to a multiple of four.
+  int num_leds_;
+  std::vector<float> x_;
+  std::vector<float> y_;
+  std::vector<float> order_;
+
+  std::vector<float> field_;
+  std::vector<float> level_;
+
+  std::array<std::array<uint8_t, 3>, 256> palette_;
+};
+
+}  // namespace led_driver
+
+#endif  // EFFECT_ENGINE_H_
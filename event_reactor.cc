@@ -0,0 +1,489 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "event_reactor.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+extern "C" {
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+}
+
+namespace led_driver {
+namespace {
+
+constexpr int kMaxEvents = 16;
+
+}  // namespace
+
+bool EventReactor::Initialize() {
+  tick_ns_ = std::max<int64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(options_.tick)
+          .count(),
+      1);
+  heads_.fill(kNoTimerIndex);
+  current_tick_ = ToNs(Clock::now()) / tick_ns_;
+
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    std::cerr << "Failed to create epoll instance: " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd_ < 0) {
+    std::cerr << "Failed to create timerfd: " << strerror(errno) << std::endl;
+    return false;
+  }
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd_ < 0) {
+    std::cerr << "Failed to create eventfd: " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u64 = kTimerTag;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &event) != 0) {
+    std::cerr << "Failed to watch timerfd: " << strerror(errno) << std::endl;
+    return false;
+  }
+  event.data.u64 = kWakeTag;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event) != 0) {
+    std::cerr << "Failed to watch eventfd: " << strerror(errno) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+EventReactor::~EventReactor() {
+  for (int fd : {inotify_fd_, wake_fd_, timer_fd_, epoll_fd_}) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+int64_t EventReactor::ToNs(Clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             time.time_since_epoch())
+      .count();
+}
+
+EventReactor::TimerId EventReactor::AddDeadline(Clock::time_point deadline,
+                                                TimerCallbackType callback) {
+  return AddTimer(ToNs(deadline), 0, std::move(callback));
+}
+
+EventReactor::TimerId EventReactor::AddTimer(Clock::duration period,
+                                             TimerCallbackType callback) {
+  const int64_t period_ns = std::max<int64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(period).count(),
+      1);
+  return AddTimer(ToNs(Clock::now()) + period_ns, period_ns,
+                  std::move(callback));
+}
+
+EventReactor::TimerId EventReactor::AddTimer(int64_t deadline_ns,
+                                             int64_t period_ns,
+                                             TimerCallbackType callback) {
+  int index;
+  if (!free_timers_.empty()) {
+    index = free_timers_.back();
+    free_timers_.pop_back();
+  } else {
+    index = timers_.size();
+    timers_.emplace_back();
+    // So that freeing the timer doesn't allocate.
+    free_timers_.reserve(timers_.size());
+  }
+  Timer &timer = timers_[index];
+  timer.deadline_ns = deadline_ns;
+  timer.period_ns = period_ns;
+  ++timer.generation;
+  timer.active = true;
+  timer.running = false;
+  timer.cancelled = false;
+  timer.rescheduled = false;
+  timer.callback = std::move(callback);
+  Insert(index);
+  return (static_cast<TimerId>(timer.generation) << 32) |
+         static_cast<uint32_t>(index);
+}
+
+int EventReactor::Find(TimerId id) const {
+  const uint32_t index = id & 0xFFFFFFFF;
+  if (index >= timers_.size()) {
+    return kNoTimerIndex;
+  }
+  const Timer &timer = timers_[index];
+  if (!timer.active || timer.generation != (id >> 32)) {
+    return kNoTimerIndex;
+  }
+  return index;
+}
+
+bool EventReactor::Reschedule(TimerId id, Clock::time_point deadline) {
+  const int index = Find(id);
+  if (index == kNoTimerIndex || timers_[index].cancelled) {
+    return false;
+  }
+  Timer &timer = timers_[index];
+  timer.deadline_ns = ToNs(deadline);
+  if (timer.running) {
+    timer.rescheduled = true;
+  } else {
+    Unlink(index);
+    Insert(index);
+  }
+  return true;
+}
+
+void EventReactor::Cancel(TimerId id) {
+  const int index = Find(id);
+  if (index == kNoTimerIndex) {
+    return;
+  }
+  if (timers_[index].running) {
+    timers_[index].cancelled = true;
+  } else {
+    Unlink(index);
+    Free(index);
+  }
+}
+
+void EventReactor::Free(int index) {
+  Timer &timer = timers_[index];
+  timer.active = false;
+  timer.callback = nullptr;
+  free_timers_.push_back(index);
+}
+
+void EventReactor::Link(int index, int list) {
+  Timer &timer = timers_[index];
+  timer.list = list;
+  timer.previous = kNoTimerIndex;
+  timer.next = heads_[list];
+  if (timer.next != kNoTimerIndex) {
+    timers_[timer.next].previous = index;
+  }
+  heads_[list] = index;
+}
+
+void EventReactor::Unlink(int index) {
+  Timer &timer = timers_[index];
+  if (timer.list == kNoList) {
+    return;
+  }
+  if (timer.previous != kNoTimerIndex) {
+    timers_[timer.previous].next = timer.next;
+  } else {
+    heads_[timer.list] = timer.next;
+  }
+  if (timer.next != kNoTimerIndex) {
+    timers_[timer.next].previous = timer.previous;
+  }
+  timer.list = kNoList;
+  timer.previous = kNoTimerIndex;
+  timer.next = kNoTimerIndex;
+}
+
+void EventReactor::Insert(int index) {
+  // Timers which are already due go in the current slot, to be found by the
+  // next `Advance`.
+  const int64_t tick =
+      std::max(timers_[index].deadline_ns / tick_ns_, current_tick_);
+  Link(index, tick % kSlots);
+}
+
+void EventReactor::Advance(int64_t now_ns) {
+  const int64_t now_tick = now_ns / tick_ns_;
+  // Past one turn of the wheel, every slot has been visited.
+  const int64_t last_tick =
+      std::min(std::max(now_tick, current_tick_), current_tick_ + kSlots - 1);
+  for (int64_t tick = current_tick_; tick <= last_tick; ++tick) {
+    int index = heads_[tick % kSlots];
+    while (index != kNoTimerIndex) {
+      const int next = timers_[index].next;
+      if (timers_[index].deadline_ns <= now_ns) {
+        Unlink(index);
+        Link(index, kExpiredList);
+      }
+      index = next;
+    }
+  }
+  current_tick_ = std::max(now_tick, current_tick_);
+}
+
+int EventReactor::RunExpired(int64_t now_ns) {
+  int count = 0;
+  while (heads_[kExpiredList] != kNoTimerIndex) {
+    const int index = heads_[kExpiredList];
+    Unlink(index);
+    timers_[index].running = true;
+    timers_[index].callback();
+    ++count;
+
+    Timer &timer = timers_[index];
+    timer.running = false;
+    if (timer.cancelled) {
+      Free(index);
+    } else if (timer.rescheduled) {
+      timer.rescheduled = false;
+      Insert(index);
+    } else if (timer.period_ns > 0) {
+      timer.deadline_ns += timer.period_ns;
+      if (timer.deadline_ns <= now_ns) {
+        timer.deadline_ns +=
+            ((now_ns - timer.deadline_ns) / timer.period_ns + 1) *
+            timer.period_ns;
+      }
+      Insert(index);
+    } else {
+      Free(index);
+    }
+  }
+  return count;
+}
+
+void EventReactor::Arm() {
+  // The first slot from the current one holding a timer due in that slot's
+  // tick holds the earliest deadline, unless the wheel holds only timers a
+  // turn or more away, in which case the timerfd fires at the end of the
+  // turn to look again.
+  int64_t deadline_ns = 0;
+  bool any = false;
+  for (int64_t tick = current_tick_; tick < current_tick_ + kSlots; ++tick) {
+    for (int index = heads_[tick % kSlots]; index != kNoTimerIndex;
+         index = timers_[index].next) {
+      any = true;
+      const int64_t timer_deadline_ns = timers_[index].deadline_ns;
+      if (timer_deadline_ns / tick_ns_ <= tick &&
+          (deadline_ns == 0 || timer_deadline_ns < deadline_ns)) {
+        deadline_ns = timer_deadline_ns;
+      }
+    }
+    if (deadline_ns != 0) {
+      break;
+    }
+  }
+  if (deadline_ns == 0 && any) {
+    deadline_ns = (current_tick_ + kSlots) * tick_ns_;
+  }
+  deadline_ns = std::max<int64_t>(deadline_ns, any ? 1 : 0);
+  if (deadline_ns == armed_ns_) {
+    return;
+  }
+
+  // A zero time disarms the timerfd, and a past one fires it at once.
+  itimerspec spec = {};
+  spec.it_value.tv_sec = deadline_ns / 1000000000;
+  spec.it_value.tv_nsec = deadline_ns % 1000000000;
+  if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) != 0) {
+    std::cerr << "Failed to arm timerfd: " << strerror(errno) << std::endl;
+    return;
+  }
+  armed_ns_ = deadline_ns;
+}
+
+bool EventReactor::AddFd(int fd, uint32_t events, FdCallbackType callback) {
+  for (const Handler &handler : handlers_) {
+    if (handler.fd == fd) {
+      std::cerr << "Descriptor " << fd << " is already watched" << std::endl;
+      return false;
+    }
+  }
+  epoll_event event = {};
+  event.events = events;
+  event.data.u64 = static_cast<uint64_t>(fd);
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+    std::cerr << "Failed to watch descriptor " << fd << ": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+  handlers_.push_back({fd, std::move(callback)});
+  return true;
+}
+
+void EventReactor::RemoveFd(int fd) {
+  for (Handler &handler : handlers_) {
+    if (handler.fd == fd) {
+      epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+      // Left in place until the dispatch in progress, if any, is done with
+      // it.
+      handler.fd = -1;
+      handlers_removed_ = true;
+      return;
+    }
+  }
+}
+
+bool EventReactor::AddWatch(const std::string &path, uint32_t mask,
+                            WatchCallbackType callback) {
+  if (inotify_fd_ < 0) {
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd_ < 0) {
+      std::cerr << "Failed to create inotify instance: " << strerror(errno)
+                << std::endl;
+      return false;
+    }
+    if (!AddFd(inotify_fd_, EPOLLIN,
+               [this](uint32_t /*events*/) { HandleInotify(); })) {
+      close(inotify_fd_);
+      inotify_fd_ = -1;
+      return false;
+    }
+  }
+  const int watch = inotify_add_watch(inotify_fd_, path.c_str(), mask);
+  if (watch < 0) {
+    std::cerr << "Failed to watch " << path << ": " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  watches_.emplace_back(watch, std::move(callback));
+  return true;
+}
+
+void EventReactor::HandleInotify() {
+  while (true) {
+    const ssize_t length =
+        read(inotify_fd_, inotify_buffer_.data(), inotify_buffer_.size());
+    if (length <= 0) {
+      return;
+    }
+    const char *position = inotify_buffer_.data();
+    while (position < inotify_buffer_.data() + length) {
+      const auto *event = reinterpret_cast<const inotify_event *>(position);
+      const absl::string_view name =
+          event->len > 0 ? absl::string_view(event->name)
+                         : absl::string_view();
+      for (size_t i = 0; i < watches_.size(); ++i) {
+        if (watches_[i].first == event->wd) {
+          watches_[i].second(event->mask, name);
+        }
+      }
+      position += sizeof(inotify_event) + event->len;
+    }
+  }
+}
+
+void EventReactor::Post(TimerCallbackType callback) {
+  {
+    std::lock_guard<std::mutex> lock(posted_mutex_);
+    posted_.push_back(std::move(callback));
+  }
+  Wake();
+}
+
+int EventReactor::RunPosted() {
+  {
+    std::lock_guard<std::mutex> lock(posted_mutex_);
+    if (posted_.empty()) {
+      return 0;
+    }
+    std::swap(posted_, running_posted_);
+  }
+  for (const TimerCallbackType &callback : running_posted_) {
+    callback();
+  }
+  const int count = running_posted_.size();
+  running_posted_.clear();
+  return count;
+}
+
+void EventReactor::Wake() {
+  const uint64_t one = 1;
+  // Only fails if the counter would overflow, when a wakeup is pending
+  // anyway.
+  (void)!write(wake_fd_, &one, sizeof(one));
+}
+
+void EventReactor::Stop() {
+  stop_.store(true);
+  Wake();
+}
+
+void EventReactor::Run() {
+  while (!stop_.load()) {
+    RunOnce(Clock::duration(-1));
+  }
+}
+
+int EventReactor::RunOnce(Clock::duration timeout) {
+  Arm();
+
+  int timeout_ms = -1;
+  if (timeout >= Clock::duration::zero()) {
+    // Rounded up, so that a short timeout doesn't spin.
+    timeout_ms = std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+  }
+  std::array<epoll_event, kMaxEvents> events;
+  const int ready = epoll_wait(epoll_fd_, events.data(), events.size(),
+                               timeout_ms);
+  if (ready < 0 && errno != EINTR) {
+    std::cerr << "Failed to wait for events: " << strerror(errno)
+              << std::endl;
+    return 0;
+  }
+  ++wakeups_;
+
+  int count = 0;
+  for (int i = 0; i < ready; ++i) {
+    const uint64_t tag = events[i].data.u64;
+    uint64_t value;
+    if (tag == kTimerTag) {
+      (void)!read(timer_fd_, &value, sizeof(value));
+      armed_ns_ = 0;
+    } else if (tag == kWakeTag) {
+      (void)!read(wake_fd_, &value, sizeof(value));
+    } else {
+      for (Handler &handler : handlers_) {
+        if (handler.fd == static_cast<int>(tag)) {
+          handler.callback(events[i].events);
+          ++count;
+          break;
+        }
+      }
+    }
+  }
+
+  const int64_t now_ns = ToNs(Clock::now());
+  Advance(now_ns);
+  count += RunExpired(now_ns);
+  count += RunPosted();
+
+  if (handlers_removed_) {
+    handlers_.erase(
+        std::remove_if(handlers_.begin(), handlers_.end(),
+                       [](const Handler &handler) { return handler.fd < 0; }),
+        handlers_.end());
+    handlers_removed_ = false;
+  }
+  return count;
+}
+
+}  // namespace led_driver
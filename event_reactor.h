@@ -0,0 +1,243 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef EVENT_REACTOR_H_
+#define EVENT_REACTOR_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace led_driver {
+
+// Runs timers, file descriptor handlers and inotify watches on one thread,
+// which sleeps in `epoll_wait` between them. Timers are kept in a timer wheel
+// and the next one to expire arms a timerfd at its exact deadline, so they
+// fire with the kernel's timer resolution rather than `epoll_wait`'s
+// millisecond timeout, and the thread only wakes when something is due.
+//
+// Everything but `Post`, `Stop` and `Wake` must be called on the thread which
+// runs the reactor, or before it runs. Adding timers and handlers allocates,
+// but running, rescheduling and cancelling timers and dispatching events
+// don't.
+class EventReactor {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Identifies a timer. Ids aren't reused, so cancelling a timer which has
+  // already expired is harmless.
+  using TimerId = uint64_t;
+  static constexpr TimerId kNoTimer = 0;
+
+  using TimerCallbackType = std::function<void()>;
+  // Receives the `epoll` events which are ready on the descriptor.
+  using FdCallbackType = std::function<void(uint32_t events)>;
+  // Receives the `inotify` event mask and, for watched directories, the name
+  // of the entry the event is about.
+  using WatchCallbackType =
+      std::function<void(uint32_t mask, absl::string_view name)>;
+
+  struct Options {
+    // Width of a slot of the timer wheel. Timers expire at their exact
+    // deadlines; this only trades the number of slots scanned to find the
+    // next deadline against the timers which share a slot.
+    Clock::duration tick = std::chrono::milliseconds(1);
+  };
+
+  template <typename... A>
+  static std::shared_ptr<EventReactor> Create(A &&... args) {
+    auto reactor = std::shared_ptr<EventReactor>(
+        new EventReactor(std::forward<A>(args)...));
+    if (!reactor->Initialize()) {
+      return nullptr;
+    }
+    return reactor;
+  }
+
+  ~EventReactor();
+
+  EventReactor(const EventReactor &) = delete;
+  EventReactor &operator=(const EventReactor &) = delete;
+
+  // Calls `callback` once at `deadline`, or as soon as possible if it has
+  // passed.
+  TimerId AddDeadline(Clock::time_point deadline, TimerCallbackType callback);
+
+  // Calls `callback` every `period`, starting one period from now. If the
+  // thread was busy past one or more expiries, `callback` runs once, and the
+  // next expiry is the first period boundary still ahead, rather than the
+  // missed periods being run back to back.
+  TimerId AddTimer(Clock::duration period, TimerCallbackType callback);
+
+  // Moves a pending or running timer's next expiry to `deadline`, without
+  // allocating. A periodic timer continues its period from there. Returns
+  // false if the timer has expired or been cancelled.
+  bool Reschedule(TimerId id, Clock::time_point deadline);
+
+  // Stops a timer. May be called from the timer's own callback.
+  void Cancel(TimerId id);
+
+  // Calls `callback` whenever any of `events` (`EPOLLIN` and so on) are ready
+  // on `fd`, which the caller continues to own. Returns false if `fd` can't
+  // be watched or already is.
+  bool AddFd(int fd, uint32_t events, FdCallbackType callback);
+
+  // Stops watching `fd`. May be called from its own callback.
+  void RemoveFd(int fd);
+
+  // Calls `callback` for `inotify` events in `mask` (`IN_CLOSE_WRITE` and so
+  // on) on `path`. Returns false if `path` can't be watched.
+  bool AddWatch(const std::string &path, uint32_t mask,
+                WatchCallbackType callback);
+
+  // Runs `callback` on the reactor's thread. Safe to call from any thread,
+  // but allocates.
+  void Post(TimerCallbackType callback);
+
+  // Wakes the reactor's thread without running anything. Safe to call from
+  // any thread, including signal handlers.
+  void Wake();
+
+  // Makes `Run` return once the callbacks in progress have returned. Safe to
+  // call from any thread, including signal handlers, and before `Run`.
+  void Stop();
+  bool stopped() const { return stop_.load(); }
+
+  // Dispatches events until `Stop` is called.
+  void Run();
+
+  // Waits up to `timeout` for events, dispatches them, and returns the number
+  // of callbacks run. A negative timeout waits indefinitely.
+  int RunOnce(Clock::duration timeout);
+
+  int64_t wakeups() const { return wakeups_; }
+
+ private:
+  // The number of slots in the timer wheel. Timers further out than one turn
+  // of the wheel share slots with nearer ones, and are skipped over until
+  // their turn comes round.
+  static constexpr int kSlots = 256;
+  static constexpr int kNoTimerIndex = -1;
+  // The list of timers which have expired and are waiting to run.
+  static constexpr int kExpiredList = kSlots;
+  static constexpr int kNoList = -1;
+
+  // Tags for the `epoll` data of the reactor's own descriptors. Handlers
+  // added with `AddFd` are tagged with their descriptor.
+  static constexpr uint64_t kTimerTag = ~uint64_t{0};
+  static constexpr uint64_t kWakeTag = ~uint64_t{0} - 1;
+
+  struct Timer {
+    // Nanoseconds on the steady clock.
+    int64_t deadline_ns;
+    int64_t period_ns;
+    // Generation, which makes up the high bits of the timer's id.
+    uint32_t generation = 0;
+    // The list the timer is on, and its neighbours there.
+    int list = kNoList;
+    int previous = kNoTimerIndex;
+    int next = kNoTimerIndex;
+    // Whether the timer is allocated, whether its callback is running, and
+    // whether it was cancelled or rescheduled while running.
+    bool active = false;
+    bool running = false;
+    bool cancelled = false;
+    bool rescheduled = false;
+    TimerCallbackType callback;
+  };
+
+  struct Handler {
+    // -1 once removed, until the handlers are next compacted.
+    int fd = -1;
+    FdCallbackType callback;
+  };
+
+  EventReactor() : EventReactor(Options()) {}
+  explicit EventReactor(Options options) : options_(options) {}
+
+  bool Initialize();
+
+  static int64_t ToNs(Clock::time_point time);
+
+  TimerId AddTimer(int64_t deadline_ns, int64_t period_ns,
+                   TimerCallbackType callback);
+  // Finds the timer with id `id`, or returns `kNoTimerIndex`.
+  int Find(TimerId id) const;
+  void Free(int index);
+
+  void Link(int index, int list);
+  void Unlink(int index);
+  // Puts the timer in the slot for its deadline.
+  void Insert(int index);
+
+  // Moves every timer which is due at `now_ns` onto the expired list, and
+  // advances the wheel to `now_ns`.
+  void Advance(int64_t now_ns);
+  // Runs the expired timers. Returns the number run.
+  int RunExpired(int64_t now_ns);
+  // Arms the timerfd for the earliest pending deadline.
+  void Arm();
+
+  void HandleInotify();
+  int RunPosted();
+
+  const Options options_;
+  int64_t tick_ns_ = 0;
+  int epoll_fd_ = -1;
+  int timer_fd_ = -1;
+  int wake_fd_ = -1;
+  int inotify_fd_ = -1;
+
+  // Deques, so that callbacks stay put while they run even if they add more.
+  std::deque<Timer> timers_;
+  std::vector<int> free_timers_;
+  // Heads of the wheel's slot lists and of the expired list.
+  std::array<int, kSlots + 1> heads_;
+  // The tick the wheel has advanced to.
+  int64_t current_tick_ = 0;
+  // The deadline the timerfd is armed for, or zero if disarmed.
+  int64_t armed_ns_ = 0;
+
+  std::deque<Handler> handlers_;
+  bool handlers_removed_ = false;
+  std::deque<std::pair<int, WatchCallbackType>> watches_;
+  alignas(8) std::array<char, 4096> inotify_buffer_;
+
+  std::mutex posted_mutex_;
+  std::vector<TimerCallbackType> posted_;
+  std::vector<TimerCallbackType> running_posted_;
+
+  std::atomic<bool> stop_{false};
+  int64_t wakeups_ = 0;
+};
+
+}  // namespace led_driver
+
+#endif  // EVENT_REACTOR_H_
@@ -0,0 +1,238 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Measures how late each way of waiting wakes for a deadline: the reactor's
+// timerfd, `sleep_until`, a condition variable, and `epoll_wait`'s millisecond
+// timeout, which the loops polled with before. Also measures how long a wakeup
+// from another thread takes to arrive through the reactor's eventfd against a
+// condition variable. Run with --priority on the Pi to see the latencies the
+// real-time threads get.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "event_reactor.h"
+#include "realtime.h"
+
+extern "C" {
+#include <sys/epoll.h>
+#include <unistd.h>
+}
+
+ABSL_FLAG(int, iterations, 1000, "Wakeups to measure for each method");
+ABSL_FLAG(int, period_us, 2000, "Time between deadlines");
+ABSL_FLAG(int, cpu, -1, "CPU to pin the waiting thread to; -1 for any");
+ABSL_FLAG(int, priority, 0,
+          "SCHED_FIFO priority of the waiting thread; zero for the default "
+          "scheduler");
+
+namespace led_driver {
+
+namespace {
+
+using Clock = EventReactor::Clock;
+
+double ToMicroseconds(Clock::duration duration) {
+  return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+// Prints the distribution of `latencies`, which it sorts.
+void Report(const char *name, std::vector<Clock::duration> *latencies) {
+  std::sort(latencies->begin(), latencies->end());
+  Clock::duration sum{0};
+  for (const Clock::duration latency : *latencies) {
+    sum += latency;
+  }
+  const size_t count = latencies->size();
+  std::cout << name << ": mean " << ToMicroseconds(sum / count) << " us, p50 "
+            << ToMicroseconds((*latencies)[count / 2]) << " us, p99 "
+            << ToMicroseconds((*latencies)[count * 99 / 100]) << " us, max "
+            << ToMicroseconds(latencies->back()) << " us" << std::endl;
+}
+
+// Waits for `iterations` deadlines `period` apart with `wait`, which returns
+// once the deadline it's given has passed, and records how late it woke.
+template <typename F>
+std::vector<Clock::duration> MeasureDeadlines(int iterations,
+                                              Clock::duration period,
+                                              F &&wait) {
+  std::vector<Clock::duration> latencies;
+  latencies.reserve(iterations);
+  Clock::time_point deadline = Clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    deadline += period;
+    wait(deadline);
+    const Clock::time_point now = Clock::now();
+    latencies.push_back(now - deadline);
+    if (now > deadline + period) {
+      deadline = now;
+    }
+  }
+  return latencies;
+}
+
+// Wakes the measuring thread `iterations` times from another thread with
+// `wake`, which is given the time the wakeup was sent, and records how long
+// each took to arrive as reported by `wait`, which returns the send time of
+// the wakeup it received.
+template <typename W, typename R>
+std::vector<Clock::duration> MeasureCrossThread(int iterations,
+                                                Clock::duration period,
+                                                W &&wake, R &&wait) {
+  std::vector<Clock::duration> latencies;
+  latencies.reserve(iterations);
+  std::thread waker([&]() {
+    for (int i = 0; i < iterations; ++i) {
+      std::this_thread::sleep_for(period);
+      wake(Clock::now());
+    }
+  });
+  for (int i = 0; i < iterations; ++i) {
+    const Clock::time_point sent = wait();
+    latencies.push_back(Clock::now() - sent);
+  }
+  waker.join();
+  return latencies;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  absl::ParseCommandLine(argc, argv);
+
+  ThreadSchedule schedule;
+  schedule.cpu = absl::GetFlag(FLAGS_cpu);
+  schedule.priority = absl::GetFlag(FLAGS_priority);
+  ApplyThreadSchedule("reactor_bench", schedule);
+
+  const int iterations = std::max(absl::GetFlag(FLAGS_iterations), 1);
+  const Clock::duration period =
+      std::chrono::microseconds(std::max(absl::GetFlag(FLAGS_period_us), 1));
+
+  auto reactor = EventReactor::Create();
+  if (reactor == nullptr) {
+    std::cerr << "Failed to create reactor" << std::endl;
+    return 1;
+  }
+
+  std::cout << "Deadline wakeups, " << iterations << " every "
+            << ToMicroseconds(period) << " us" << std::endl;
+
+  // A periodic timer, rescheduled to each deadline, so that it's never
+  // freed.
+  bool fired = false;
+  const EventReactor::TimerId timer =
+      reactor->AddTimer(std::chrono::hours(1), [&]() { fired = true; });
+  const int64_t reactor_wakeups = reactor->wakeups();
+  auto latencies =
+      MeasureDeadlines(iterations, period, [&](Clock::time_point deadline) {
+        fired = false;
+        reactor->Reschedule(timer, deadline);
+        while (!fired) {
+          reactor->RunOnce(Clock::duration(-1));
+        }
+      });
+  Report("Reactor timerfd", &latencies);
+  std::cout << "Reactor woke " << reactor->wakeups() - reactor_wakeups
+            << " times for " << iterations << " deadlines" << std::endl;
+
+  latencies =
+      MeasureDeadlines(iterations, period, [](Clock::time_point deadline) {
+        std::this_thread::sleep_until(deadline);
+      });
+  Report("sleep_until", &latencies);
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  latencies =
+      MeasureDeadlines(iterations, period, [&](Clock::time_point deadline) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (Clock::now() < deadline) {
+          condition.wait_until(lock, deadline);
+        }
+      });
+  Report("Condition variable", &latencies);
+
+  const int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  latencies =
+      MeasureDeadlines(iterations, period, [&](Clock::time_point deadline) {
+        epoll_event event;
+        Clock::time_point now;
+        while ((now = Clock::now()) < deadline) {
+          epoll_wait(epoll_fd, &event, 1,
+                     std::chrono::ceil<std::chrono::milliseconds>(deadline -
+                                                                  now)
+                         .count());
+        }
+      });
+  close(epoll_fd);
+  Report("epoll_wait timeout", &latencies);
+
+  std::cout << "Cross-thread wakeups" << std::endl;
+
+  std::atomic<Clock::rep> sent_ticks{0};
+  latencies = MeasureCrossThread(
+      iterations, period,
+      [&](Clock::time_point sent) {
+        sent_ticks.store(sent.time_since_epoch().count());
+        reactor->Wake();
+      },
+      [&]() {
+        Clock::rep ticks;
+        while ((ticks = sent_ticks.exchange(0)) == 0) {
+          reactor->RunOnce(Clock::duration(-1));
+        }
+        return Clock::time_point(Clock::duration(ticks));
+      });
+  Report("Reactor eventfd", &latencies);
+
+  std::vector<Clock::time_point> sent_times;
+  latencies = MeasureCrossThread(
+      iterations, period,
+      [&](Clock::time_point sent) {
+        std::lock_guard<std::mutex> lock(mutex);
+        sent_times.push_back(sent);
+        condition.notify_one();
+      },
+      [&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [&]() { return !sent_times.empty(); });
+        const Clock::time_point sent = sent_times.front();
+        sent_times.erase(sent_times.begin());
+        return sent;
+      });
+  Report("Condition variable notify", &latencies);
+
+  reactor->Cancel(timer);
+  return 0;
+}
+}  // namespace led_driver
+
+extern "C" {
+int main(int argc, char *argv[]) { return led_driver::main(argc, argv); }
+}
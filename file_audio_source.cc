@@ -0,0 +1,215 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "file_audio_source.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "absl/strings/match.h"
+#include "absl/time/clock.h"
+
+namespace led_driver {
+
+namespace {
+constexpr uint16_t kWavFormatPcm = 1;
+constexpr uint16_t kWavFormatFloat = 3;
+constexpr uint16_t kWavFormatExtensible = 0xFFFE;
+
+template <typename T>
+T ReadLittleEndian(const uint8_t *data) {
+  T value = 0;
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    value |= static_cast<T>(data[i]) << (8 * i);
+  }
+  return value;
+}
+}  // namespace
+
+FileAudioSource::~FileAudioSource() { Stop(); }
+
+bool FileAudioSource::Initialize() {
+  std::ifstream file(path_, std::ios::binary);
+  if (!file) {
+    std::cerr << "Failed to open audio file " << path_ << std::endl;
+    return false;
+  }
+  std::vector<uint8_t> contents((std::istreambuf_iterator<char>(file)),
+                                std::istreambuf_iterator<char>());
+
+  if (absl::EndsWithIgnoreCase(path_, ".wav")) {
+    if (!LoadWav(contents)) {
+      return false;
+    }
+  } else {
+    samples_.resize(contents.size() / sizeof(float));
+    memcpy(samples_.data(), contents.data(), samples_.size() * sizeof(float));
+  }
+
+  // Drop any trailing partial frame.
+  samples_.resize(samples_.size() -
+                  samples_.size() % options_.channel_count);
+  if (samples_.empty()) {
+    std::cerr << "Audio file " << path_ << " contains no samples" << std::endl;
+    return false;
+  }
+
+  std::cout << "Loaded "
+            << samples_.size() / options_.channel_count /
+                   static_cast<float>(options_.sampling_rate)
+            << " s of audio from " << path_ << std::endl;
+  return true;
+}
+
+bool FileAudioSource::LoadWav(const std::vector<uint8_t> &contents) {
+  if (contents.size() < 12 || memcmp(contents.data(), "RIFF", 4) != 0 ||
+      memcmp(contents.data() + 8, "WAVE", 4) != 0) {
+    std::cerr << path_ << " is not a WAV file" << std::endl;
+    return false;
+  }
+
+  uint16_t format = 0;
+  uint16_t channels = 0;
+  uint32_t sampling_rate = 0;
+  uint16_t bits_per_sample = 0;
+  const uint8_t *data = nullptr;
+  size_t data_length = 0;
+
+  size_t offset = 12;
+  while (offset + 8 <= contents.size()) {
+    const uint8_t *chunk = contents.data() + offset;
+    const size_t chunk_length =
+        std::min<size_t>(ReadLittleEndian<uint32_t>(chunk + 4),
+                         contents.size() - offset - 8);
+    if (memcmp(chunk, "fmt ", 4) == 0 && chunk_length >= 16) {
+      format = ReadLittleEndian<uint16_t>(chunk + 8);
+      channels = ReadLittleEndian<uint16_t>(chunk + 10);
+      sampling_rate = ReadLittleEndian<uint32_t>(chunk + 12);
+      bits_per_sample = ReadLittleEndian<uint16_t>(chunk + 22);
+      if (format == kWavFormatExtensible && chunk_length >= 26) {
+        // The real format is the first two bytes of the subformat GUID.
+        format = ReadLittleEndian<uint16_t>(chunk + 32);
+      }
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      data = chunk + 8;
+      data_length = chunk_length;
+    }
+    // Chunks are padded to an even length.
+    offset += 8 + chunk_length + (chunk_length & 1);
+  }
+
+  if (data == nullptr || channels == 0) {
+    std::cerr << path_ << " is missing its format or data chunk" << std::endl;
+    return false;
+  }
+  if (static_cast<int>(sampling_rate) != options_.sampling_rate) {
+    std::cerr << path_ << " is sampled at " << sampling_rate
+              << " Hz, but will be played as " << options_.sampling_rate
+              << " Hz" << std::endl;
+  }
+
+  std::vector<float> file_samples;
+  if (format == kWavFormatPcm && bits_per_sample == 16) {
+    file_samples.resize(data_length / 2);
+    for (size_t i = 0; i < file_samples.size(); ++i) {
+      file_samples[i] =
+          static_cast<int16_t>(ReadLittleEndian<uint16_t>(data + 2 * i)) /
+          32768.0f;
+    }
+  } else if (format == kWavFormatFloat && bits_per_sample == 32) {
+    file_samples.resize(data_length / 4);
+    memcpy(file_samples.data(), data, file_samples.size() * sizeof(float));
+  } else {
+    std::cerr << path_ << " has unsupported sample format " << format << " ("
+              << bits_per_sample << " bits)" << std::endl;
+    return false;
+  }
+
+  // Remix to the configured channel count: average down to mono, or repeat the
+  // channels of the file across the output channels.
+  const size_t frames = file_samples.size() / channels;
+  samples_.resize(frames * options_.channel_count);
+  for (size_t frame = 0; frame < frames; ++frame) {
+    const float *input = &file_samples[frame * channels];
+    float *output = &samples_[frame * options_.channel_count];
+    if (options_.channel_count == 1) {
+      float sum = 0;
+      for (int channel = 0; channel < channels; ++channel) {
+        sum += input[channel];
+      }
+      output[0] = sum / channels;
+    } else {
+      for (int channel = 0; channel < options_.channel_count; ++channel) {
+        output[channel] = input[channel % channels];
+      }
+    }
+  }
+  return true;
+}
+
+bool FileAudioSource::Start() {
+  if (running_.exchange(true)) {
+    return true;
+  }
+  finished_.store(false);
+  playback_thread_ = std::thread(&FileAudioSource::PlaybackThread, this);
+  return true;
+}
+
+void FileAudioSource::Stop() {
+  running_.store(false);
+  if (playback_thread_.joinable()) {
+    playback_thread_.join();
+  }
+}
+
+void FileAudioSource::PlaybackThread() {
+  const size_t fragment_samples =
+      options_.fragment_frames * options_.channel_count;
+  const absl::Duration fragment_duration =
+      absl::Seconds(options_.fragment_frames) / options_.sampling_rate;
+
+  size_t position = 0;
+  absl::Time next_deadline = absl::Now() + fragment_duration;
+  while (running_.load()) {
+    // Pace against absolute deadlines so that delivery doesn't drift.
+    absl::SleepFor(next_deadline - absl::Now());
+    next_deadline += fragment_duration;
+
+    const size_t length =
+        std::min(fragment_samples, samples_.size() - position);
+    batcher_.Push(absl::Span<const float>(&samples_[position], length));
+    position += length;
+
+    if (position == samples_.size()) {
+      if (!loop_) {
+        finished_.store(true);
+        running_.store(false);
+        return;
+      }
+      position = 0;
+    }
+  }
+}
+
+}  // namespace led_driver
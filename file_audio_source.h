@@ -0,0 +1,88 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef FILE_AUDIO_SOURCE_H_
+#define FILE_AUDIO_SOURCE_H_
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio_source.h"
+
+namespace led_driver {
+
+// Replays a WAV file, or a file of raw interleaved 32-bit float samples, in
+// real time. Each fragment is delivered at the time it would have finished
+// arriving from a live source, so downstream timing matches live capture.
+//
+// WAV files may contain 16-bit integer or 32-bit float samples. Raw files are
+// assumed to already match the configured sampling rate and channel count.
+class FileAudioSource : public AudioSourceInterface {
+ public:
+  FileAudioSource(std::string path, bool loop, AudioSourceOptions options,
+                  SampleCallbackType sample_callback)
+      : path_(std::move(path)),
+        loop_(loop),
+        options_(std::move(options)),
+        batcher_(options_.callback_batch_frames * options_.channel_count,
+                 std::move(sample_callback)) {}
+
+  ~FileAudioSource() override;
+
+  bool Initialize() override;
+  bool Start() override;
+  void Stop() override;
+
+  absl::Duration GetLatency() const override {
+    return absl::Seconds(options_.fragment_frames) / options_.sampling_rate;
+  }
+
+  uint64_t GetCallbackCount() const override {
+    return batcher_.callback_count();
+  }
+
+  // Whether the file has been played to the end. Never true when looping.
+  bool finished() const { return finished_.load(); }
+
+ private:
+  // Loads a WAV file into `samples_`, converting it to the configured channel
+  // count.
+  bool LoadWav(const std::vector<uint8_t> &contents);
+
+  void PlaybackThread();
+
+  std::string path_;
+  bool loop_;
+  AudioSourceOptions options_;
+  SampleBatcher batcher_;
+
+  // The whole file, as interleaved float samples.
+  std::vector<float> samples_;
+
+  std::atomic<bool> running_{false};
+  std::atomic<bool> finished_{false};
+  std::thread playback_thread_;
+};
+
+}  // namespace led_driver
+
+#endif  // FILE_AUDIO_SOURCE_H_
@@ -0,0 +1,195 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "frame_rate_governor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <utility>
+
+extern "C" {
+#include <time.h>
+}
+
+namespace led_driver {
+namespace {
+
+int64_t ProcessCpuTimeNs() {
+  struct timespec time;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+  return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+double ToSeconds(FrameRateGovernor::Clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+}  // namespace
+
+FrameRateGovernor::FrameRateGovernor(int num_leds, Options options)
+    : options_(std::move(options)),
+      min_period_(std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(
+              1.0 / std::max(options_.max_fps, 1)))),
+      fps_(options_.max_fps),
+      previous_frame_(num_leds * 3, 0) {
+  const Clock::time_point now = Clock::now();
+  hold_until_ = now + absl::ToChronoNanoseconds(options_.hold);
+  last_update_ = now;
+  estimate_start_ = now;
+  estimate_cpu_ns_ = ProcessCpuTimeNs();
+
+  Estimate estimate;
+  memset(&estimate, 0, sizeof(estimate));
+  estimate.fps = options_.max_fps;
+  estimate_.Publish(estimate);
+}
+
+bool FrameRateGovernor::Receive(absl::Span<const uint8_t> led_data) {
+  const Clock::time_point now = Clock::now();
+  const size_t length = std::min(led_data.size(), previous_frame_.size());
+
+  uint64_t difference = 0;
+  uint64_t total = 0;
+  for (size_t i = 0; i < length; ++i) {
+    difference += std::abs(led_data[i] - previous_frame_[i]);
+    total += led_data[i];
+  }
+  memcpy(previous_frame_.data(), led_data.data(), length);
+  const float motion =
+      has_previous_frame_ && length > 0
+          ? static_cast<float>(difference) / length
+          : 0.0f;
+  has_previous_frame_ = true;
+
+  const float led_milliamps =
+      total / 255.0f * options_.led_channel_current_ma +
+      previous_frame_.size() / 3 * options_.led_idle_current_ma;
+
+  PollAudio();
+  if (motion >= options_.motion_threshold) {
+    Boost(now);
+  }
+  const float activity = std::min(
+      1.0f, std::max(motion / options_.motion_threshold,
+                     audio_energy_ / options_.energy_threshold));
+  Update(now, activity);
+
+  ++estimate_frames_;
+  motion_sum_ += motion;
+  audio_energy_sum_ += audio_energy_;
+  led_watts_sum_ += led_milliamps / 1000 * options_.led_voltage;
+  if (now - estimate_start_ >=
+      absl::ToChronoNanoseconds(options_.estimate_period)) {
+    UpdateEstimate(now);
+  }
+  return true;
+}
+
+bool FrameRateGovernor::PollAudio() {
+  if (options_.analyzer == nullptr) {
+    return false;
+  }
+  const SpectralFeatures features = options_.analyzer->Read();
+  if (features.analysis_count == 0) {
+    return false;
+  }
+  audio_energy_ = features.rms;
+  const bool event = features.onset_count != onset_count_ ||
+                     features.beat_count != beat_count_;
+  onset_count_ = features.onset_count;
+  beat_count_ = features.beat_count;
+  if (!event) {
+    return false;
+  }
+  const bool raised = fps() < options_.max_fps;
+  Boost(Clock::now());
+  return raised;
+}
+
+FrameRateGovernor::Clock::duration FrameRateGovernor::period() const {
+  return std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(1.0 / std::max(fps(), 1.0f)));
+}
+
+void FrameRateGovernor::WaitForNextFrame(
+    Clock::time_point previous_frame) const {
+  while (true) {
+    const Clock::time_point next_frame = previous_frame + period();
+    const Clock::time_point now = Clock::now();
+    if (now >= next_frame) {
+      return;
+    }
+    // Sleeps no longer than the shortest period, so that a rise in the rate
+    // takes effect at once.
+    std::this_thread::sleep_until(std::min(next_frame, now + min_period_));
+  }
+}
+
+void FrameRateGovernor::Boost(Clock::time_point now) {
+  hold_until_ = now + absl::ToChronoNanoseconds(options_.hold);
+  last_update_ = now;
+  fps_.store(options_.max_fps, std::memory_order_relaxed);
+}
+
+void FrameRateGovernor::Update(Clock::time_point now, float activity) {
+  const double elapsed = ToSeconds(now - last_update_);
+  last_update_ = now;
+  if (now < hold_until_) {
+    return;
+  }
+  const float target =
+      options_.min_fps + (options_.max_fps - options_.min_fps) * activity;
+  float fps_now = fps();
+  if (target >= fps_now) {
+    fps_now = target;
+  } else {
+    const double ramp_down =
+        std::max(absl::ToDoubleSeconds(options_.ramp_down), 1e-3);
+    fps_now = target + (fps_now - target) * std::exp(-elapsed / ramp_down);
+  }
+  fps_.store(fps_now, std::memory_order_relaxed);
+}
+
+void FrameRateGovernor::UpdateEstimate(Clock::time_point now) {
+  const int64_t cpu_ns = ProcessCpuTimeNs();
+  const double seconds = ToSeconds(now - estimate_start_);
+
+  Estimate estimate;
+  estimate.fps = estimate_frames_ / seconds;
+  estimate.motion = motion_sum_ / estimate_frames_;
+  estimate.audio_energy = audio_energy_sum_ / estimate_frames_;
+  estimate.cpu_load = (cpu_ns - estimate_cpu_ns_) / 1e9 / seconds;
+  estimate.cpu_watts = estimate.cpu_load * options_.cpu_watts_per_core;
+  estimate.led_watts = led_watts_sum_ / estimate_frames_;
+  estimate_.Publish(estimate);
+
+  estimate_start_ = now;
+  estimate_cpu_ns_ = cpu_ns;
+  estimate_frames_ = 0;
+  motion_sum_ = 0;
+  audio_energy_sum_ = 0;
+  led_watts_sum_ = 0;
+}
+
+}  // namespace led_driver
@@ -0,0 +1,154 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef FRAME_RATE_GOVERNOR_H_
+#define FRAME_RATE_GOVERNOR_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "led_frame_sink.h"
+#include "seqlock.h"
+#include "spectral_analyzer.h"
+
+namespace led_driver {
+
+// Scales the capture and output frame rates with the content, to save battery
+// during static scenes. As a sink on the LED output, measures the motion
+// between frames in LED space, and the power the LEDs draw; the output loop
+// also polls it for audio onsets and beats between frames. Motion, onsets and
+// beats ramp the rate to `max_fps` at once, and hold it there for `hold`;
+// after that it decays towards a rate in proportion to the activity, down to
+// `min_fps` for a static, silent scene.
+class FrameRateGovernor : public LedFrameSinkInterface {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Options {
+    int min_fps = 15;
+    int max_fps = 60;
+
+    // Mean absolute change per channel between frames, out of 255, which
+    // counts as full motion.
+    float motion_threshold = 2.0f;
+
+    // Audio RMS level which counts as full activity.
+    float energy_threshold = 0.1f;
+
+    // How long to stay at `max_fps` after motion or an onset.
+    absl::Duration hold = absl::Seconds(1);
+
+    // Time constant of the decay towards a lower rate.
+    absl::Duration ramp_down = absl::Seconds(2);
+
+    // Optional audio analysis to watch for energy, onsets and beats.
+    std::shared_ptr<SpectralAnalyzer> analyzer;
+
+    // Power model. LED current is taken as linear in the channel values sent,
+    // and CPU power as linear in the process's CPU load.
+    float led_voltage = 5.0f;
+    float led_channel_current_ma = 20.0f;
+    float led_idle_current_ma = 1.0f;
+    float cpu_watts_per_core = 0.8f;
+
+    // How often `estimate` is updated.
+    absl::Duration estimate_period = absl::Seconds(1);
+  };
+
+  // The governor's rate, and the power drawn, averaged over the last
+  // estimate period.
+  struct Estimate {
+    float fps;
+    float motion;
+    float audio_energy;
+    // Process CPU time per wall time, in cores.
+    float cpu_load;
+    float cpu_watts;
+    float led_watts;
+  };
+
+  FrameRateGovernor(int num_leds, Options options);
+
+  // Measures motion and LED power from the frame sent. Called on the output
+  // thread.
+  bool Receive(absl::Span<const uint8_t> led_data) override;
+
+  // Checks the audio analysis for onsets and beats. Returns true if the rate
+  // was raised, so that a sleeping loop should start the next frame now.
+  // Called on the output thread.
+  bool PollAudio();
+
+  // The current target rate. Thread safe.
+  float fps() const { return fps_.load(std::memory_order_relaxed); }
+  Clock::duration period() const;
+
+  // Whether `PollAudio` can raise the rate.
+  bool watches_audio() const { return options_.analyzer != nullptr; }
+
+  // The period at `max_fps`.
+  Clock::duration min_period() const { return min_period_; }
+
+  // Sleeps until a period after `previous_frame`, waking early if the rate
+  // rises meanwhile. Thread safe; used to pace capture.
+  void WaitForNextFrame(Clock::time_point previous_frame) const;
+
+  Estimate estimate() const { return estimate_.Read(); }
+
+ private:
+  // Raises the rate to `max_fps` and holds it from `now`.
+  void Boost(Clock::time_point now);
+
+  // Moves the rate towards that for `activity`, in [0, 1].
+  void Update(Clock::time_point now, float activity);
+
+  void UpdateEstimate(Clock::time_point now);
+
+  const Options options_;
+  const Clock::duration min_period_;
+  std::atomic<float> fps_;
+
+  // Output thread state.
+  std::vector<uint8_t> previous_frame_;
+  bool has_previous_frame_ = false;
+  uint64_t onset_count_ = 0;
+  uint64_t beat_count_ = 0;
+  float audio_energy_ = 0.0f;
+  Clock::time_point hold_until_;
+  Clock::time_point last_update_;
+
+  // Accumulated over the estimate period.
+  Clock::time_point estimate_start_;
+  int64_t estimate_cpu_ns_ = 0;
+  int estimate_frames_ = 0;
+  double motion_sum_ = 0;
+  double audio_energy_sum_ = 0;
+  double led_watts_sum_ = 0;
+
+  SeqlockSnapshot<Estimate> estimate_;
+};
+
+}  // namespace led_driver
+
+#endif  // FRAME_RATE_GOVERNOR_H_
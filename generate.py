@@ -91,8 +91,17 @@ def GenerateSampling():
     )
 
 
-def GeneratePointsOfInterest():
+# Radius of the outermost eye ring, plus the radius of an LED.
+eye_radius = 60 * 2 + 16
+
+
+def GenerateRegionsOfInterest():
+    # (center, radius, weight) for each region of interest.
     return [
-        left_eye_center,
-        right_eye_center,
+        (left_eye_center, eye_radius, 1.0),
+        (right_eye_center, eye_radius, 1.0),
     ]
+
+
+def GeneratePointsOfInterest():
+    return [center for center, _, _ in GenerateRegionsOfInterest()]
@@ -0,0 +1,241 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Validates `FrameRateGovernor` against a replayed show. The recording is
+// played through the output loop, without the LEDs, first at the fixed frame
+// rate and then governed, optionally with the show's audio from a file. Each
+// pass reports the frames sent, the process CPU time they took and the
+// estimated LED power.
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <utility>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "file_audio_source.h"
+#include "frame_rate_governor.h"
+#include "led_compositor.h"
+#include "led_output.h"
+#include "led_output_loop.h"
+#include "led_recording.h"
+#include "spectral_analyzer.h"
+
+extern "C" {
+#include <time.h>
+}
+
+ABSL_FLAG(std::string, recording, "", "LED recording of the show to replay");
+ABSL_FLAG(std::string, audio_file, "",
+          "WAV file of the show's audio, to govern on onsets too");
+ABSL_FLAG(double, seconds, 30, "How long to replay in each pass");
+ABSL_FLAG(int, max_fps, 60, "Fixed frame rate, and the governor's highest");
+ABSL_FLAG(int, min_fps, 15, "The governor's lowest frame rate");
+ABSL_FLAG(float, motion_threshold, 2.0f, "The governor's motion threshold");
+
+namespace led_driver {
+namespace {
+
+int64_t ProcessCpuTimeNs() {
+  struct timespec time;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+  return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+// Renders the recording's frames at their timestamps, looping it.
+class RecordingReplay {
+ public:
+  explicit RecordingReplay(std::shared_ptr<LedRecordingReader> reader)
+      : reader_(std::move(reader)) {
+    reader_->Next();
+  }
+
+  void Render(float seconds, absl::Span<uint8_t> frame) {
+    while (reader_->timestamp() + offset_ < absl::Seconds(seconds)) {
+      const absl::Duration last_timestamp = reader_->timestamp();
+      if (!reader_->Next()) {
+        if (last_timestamp == absl::ZeroDuration()) {
+          break;
+        }
+        offset_ += last_timestamp;
+        reader_->Rewind();
+        reader_->Next();
+      }
+    }
+    const absl::Span<const uint8_t> recorded = reader_->frame();
+    std::copy(recorded.begin(),
+              recorded.begin() + std::min(recorded.size(), frame.size()),
+              frame.begin());
+  }
+
+ private:
+  std::shared_ptr<LedRecordingReader> reader_;
+  absl::Duration offset_;
+};
+
+struct PassResult {
+  int64_t frames = 0;
+  double cpu_seconds = 0;
+  double led_watts = 0;
+};
+
+bool RunPass(bool governed, std::shared_ptr<SpectralAnalyzer> analyzer,
+             PassResult *result) {
+  auto reader = LedRecordingReader::Create(absl::GetFlag(FLAGS_recording));
+  if (reader == nullptr) {
+    return false;
+  }
+  const int num_leds = reader->frame_length() / LedOutput::kLedChannels;
+
+  LedOutput::Options output_options;
+  output_options.num_leds = num_leds;
+  auto led_output = std::make_shared<LedOutput>(nullptr, output_options);
+
+  // The governor measures power in both passes, but only sets the rate in
+  // the governed one.
+  FrameRateGovernor::Options governor_options;
+  governor_options.min_fps = absl::GetFlag(FLAGS_min_fps);
+  governor_options.max_fps = absl::GetFlag(FLAGS_max_fps);
+  governor_options.motion_threshold = absl::GetFlag(FLAGS_motion_threshold);
+  governor_options.analyzer = analyzer;
+  governor_options.estimate_period = absl::Seconds(1);
+  auto governor =
+      std::make_shared<FrameRateGovernor>(num_leds, governor_options);
+  led_output->AddSink(governor);
+
+  // Counts the frames sent and accumulates their estimated power.
+  struct PassMeter : public LedFrameSinkInterface {
+    bool Receive(absl::Span<const uint8_t>) override {
+      ++frames;
+      if (governor->estimate().fps > 0) {
+        led_watts_sum += governor->estimate().led_watts;
+      }
+      return true;
+    }
+    std::shared_ptr<FrameRateGovernor> governor;
+    int64_t frames = 0;
+    double led_watts_sum = 0;
+  };
+  auto meter = std::make_shared<PassMeter>();
+  meter->governor = governor;
+  led_output->AddSink(meter);
+
+  auto compositor = std::make_shared<LedCompositor>(num_leds);
+  auto layer = compositor->AddLayer("replay", LedLayer::Settings());
+  LedOutputLoop::Options loop_options;
+  loop_options.fps = absl::GetFlag(FLAGS_max_fps);
+  loop_options.report_period = absl::ZeroDuration();
+  if (governed) {
+    loop_options.governor = governor;
+  }
+  auto output_loop =
+      LedOutputLoop::Create(compositor, led_output, loop_options);
+  if (output_loop == nullptr) {
+    return false;
+  }
+  auto replay = std::make_shared<RecordingReplay>(std::move(reader));
+  output_loop->AddRenderedLayer(
+      layer, [replay](float seconds, absl::Span<uint8_t> frame) {
+        replay->Render(seconds, frame);
+      });
+
+  const int64_t cpu_start_ns = ProcessCpuTimeNs();
+  std::thread stop_thread([&output_loop]() {
+    std::this_thread::sleep_for(
+        std::chrono::duration<double>(absl::GetFlag(FLAGS_seconds)));
+    output_loop->Stop();
+  });
+  const int status = output_loop->Run();
+  stop_thread.join();
+
+  result->frames = meter->frames;
+  result->cpu_seconds = (ProcessCpuTimeNs() - cpu_start_ns) / 1e9;
+  result->led_watts =
+      meter->frames > 0 ? meter->led_watts_sum / meter->frames : 0;
+  return status == 0;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  absl::ParseCommandLine(argc, argv);
+
+  std::shared_ptr<SpectralAnalyzer> analyzer;
+  std::shared_ptr<FileAudioSource> audio_source;
+  if (!absl::GetFlag(FLAGS_audio_file).empty()) {
+    AudioSourceOptions audio_options;
+    SpectralAnalyzer::Config analyzer_config;
+    analyzer_config.sampling_rate = audio_options.sampling_rate;
+    analyzer_config.channel_count = audio_options.channel_count;
+    analyzer = SpectralAnalyzer::Create(analyzer_config);
+    if (analyzer == nullptr) {
+      return 1;
+    }
+    audio_source = std::make_shared<FileAudioSource>(
+        absl::GetFlag(FLAGS_audio_file), true, audio_options,
+        [analyzer](absl::Span<const float> samples) {
+          analyzer->Process(samples);
+        });
+    if (!audio_source->Initialize() || !audio_source->Start()) {
+      std::cerr << "Failed to start audio file" << std::endl;
+      return 1;
+    }
+  }
+
+  PassResult fixed;
+  PassResult governed;
+  if (!RunPass(false, analyzer, &fixed) ||
+      !RunPass(true, analyzer, &governed)) {
+    std::cerr << "Failed to replay " << absl::GetFlag(FLAGS_recording)
+              << std::endl;
+    return 1;
+  }
+
+  const double seconds = absl::GetFlag(FLAGS_seconds);
+  for (const auto &pass : {std::make_pair("Fixed", fixed),
+                           std::make_pair("Governed", governed)}) {
+    std::cout << pass.first << ": " << pass.second.frames / seconds
+              << " fps, CPU " << 100 * pass.second.cpu_seconds / seconds
+              << "% of a core, LEDs " << pass.second.led_watts << " W"
+              << std::endl;
+  }
+  if (fixed.cpu_seconds > 0) {
+    std::cout << "Governed pass used "
+              << 100 * (1 - governed.cpu_seconds / fixed.cpu_seconds)
+              << "% less CPU time for "
+              << 100 * (1 - static_cast<double>(governed.frames) /
+                                fixed.frames)
+              << "% fewer frames" << std::endl;
+  }
+  if (audio_source != nullptr) {
+    audio_source->Stop();
+  }
+  return 0;
+}
+
+}  // namespace led_driver
+
+extern "C" {
+int main(int argc, char *argv[]) { return led_driver::main(argc, argv); }
+}
@@ -0,0 +1,166 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Runs the output path as `led_driver --realtime` does, without the LEDs: a
+// capture layer published from another thread, an effect layer, the
+// compositor, the output stages and the tap and network sinks. Heap
+// allocations on the output and capture threads are counted once warmed up,
+// and any allocation fails the check with a non-zero exit status.
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "allocation_counter.h"
+#include "effect_engine.h"
+#include "led_compositor.h"
+#include "led_output.h"
+#include "led_output_loop.h"
+#include "led_sampler.h"
+#include "led_tap.h"
+#include "network_output_sink.h"
+
+ABSL_FLAG(int, num_leds, 900, "LEDs to drive");
+ABSL_FLAG(int, fps, 240, "Frame rate to run the output loop at");
+ABSL_FLAG(int, warmup_frames, 120,
+          "Frames after which allocations are counted");
+ABSL_FLAG(double, seconds, 5, "How long to run for after warming up");
+
+namespace led_driver {
+
+int main(int argc, char *argv[]) {
+  absl::ParseCommandLine(argc, argv);
+  if (!AllocationCounter::kEnabled) {
+    std::cerr << "FAIL: build with --define allocation_checks=true to count "
+                 "allocations"
+              << std::endl;
+    return 1;
+  }
+
+  const int num_leds = absl::GetFlag(FLAGS_num_leds);
+  const int warmup_frames = absl::GetFlag(FLAGS_warmup_frames);
+  std::vector<std::pair<float, float>> coordinates;
+  for (int i = 0; i < num_leds; ++i) {
+    coordinates.emplace_back(0.5f + 0.45f * std::cos(i * 0.1f),
+                             0.5f + 0.45f * std::sin(i * 0.13f));
+  }
+
+  LedOutput::Options output_options;
+  output_options.num_leds = num_leds;
+  auto led_output = std::make_shared<LedOutput>(nullptr, output_options);
+  auto tap_writer = LedTapWriter::Create(
+      "/led_allocation_check", num_leds * LedOutput::kLedChannels,
+      LedTapFormat::kStageOutput);
+  NetworkOutputSink::Options sink_options;
+  if (tap_writer == nullptr ||
+      !NetworkOutputSink::ParseDestinations("127.0.0.1:4048",
+                                            &sink_options.destinations)) {
+    return 1;
+  }
+  auto network_sink = NetworkOutputSink::Create(num_leds, sink_options);
+  if (network_sink == nullptr) {
+    return 1;
+  }
+  led_output->AddSink(tap_writer);
+  led_output->AddSink(network_sink);
+
+  auto compositor = std::make_shared<LedCompositor>(num_leds);
+  LedLayer::Settings capture_settings;
+  auto capture_layer = compositor->AddLayer("capture", capture_settings);
+  LedLayer::Settings effect_settings;
+  effect_settings.priority = 10;
+  effect_settings.opacity = 0.5f;
+  effect_settings.blend_mode = BlendMode::ADD;
+  auto effect_layer = compositor->AddLayer("effect", effect_settings);
+  auto effect_engine = EffectEngine::Create(EffectEngine::Config(),
+                                            coordinates);
+  if (effect_engine == nullptr) {
+    return 1;
+  }
+
+  LedOutputLoop::Options loop_options;
+  loop_options.fps = absl::GetFlag(FLAGS_fps);
+  loop_options.report_period = absl::Seconds(1);
+  loop_options.count_allocations_after_frames = warmup_frames;
+  loop_options.fail_on_allocation = true;
+  auto output_loop =
+      LedOutputLoop::Create(compositor, led_output, loop_options);
+  if (output_loop == nullptr) {
+    return 1;
+  }
+  output_loop->AddRenderedLayer(
+      effect_layer, [effect_engine](float seconds, absl::Span<uint8_t> frame) {
+        effect_engine->Render(seconds, frame);
+      });
+
+  // Stands in for the capture thread, sampling a changing image.
+  std::atomic<bool> stop{false};
+  std::thread capture_thread([&]() {
+    const int width = 100;
+    const int height = 100;
+    std::vector<uint8_t> image(width * height * 3);
+    const LedSampler sampler(
+        LedSampler::ScaleCoordinates(coordinates, width, height));
+    for (int frame = 0; !stop.load(); ++frame) {
+      if (frame == warmup_frames) {
+        AllocationCounter::SetCounting(true);
+      }
+      for (size_t i = 0; i < image.size(); ++i) {
+        image[i] = (i + frame) & 0xFF;
+      }
+      sampler.Sample(image, width * 3, capture_layer->back());
+      capture_layer->Publish();
+      std::this_thread::sleep_for(std::chrono::milliseconds(16));
+    }
+  });
+
+  std::thread stop_thread([&]() {
+    std::this_thread::sleep_for(std::chrono::duration<double>(
+        absl::GetFlag(FLAGS_seconds) +
+        static_cast<double>(warmup_frames) / absl::GetFlag(FLAGS_fps)));
+    output_loop->Stop();
+  });
+  const int status = output_loop->Run();
+  output_loop->Stop();
+  stop.store(true);
+  stop_thread.join();
+  capture_thread.join();
+
+  if (status != 0 || AllocationCounter::count() != 0) {
+    std::cerr << "FAIL: " << AllocationCounter::count()
+              << " allocations in steady state" << std::endl;
+    return 1;
+  }
+  std::cout << "PASS: no allocations in steady state" << std::endl;
+  return 0;
+}
+
+}  // namespace led_driver
+
+extern "C" {
+int main(int argc, char *argv[]) { return led_driver::main(argc, argv); }
+}
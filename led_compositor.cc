@@ -0,0 +1,301 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "led_compositor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "simd_uint8x16.h"
+
+namespace led_driver {
+namespace {
+uint64_t PackRegion(int offset, int count) {
+  return (static_cast<uint64_t>(static_cast<uint32_t>(offset)) << 32) |
+         static_cast<uint32_t>(count);
+}
+
+void BlendReplace(uint8_t *output, const uint8_t *layer, size_t length,
+                  uint16_t alpha) {
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    Store16(output + i, Lerp16(Load16(output + i), Load16(layer + i), alpha));
+  }
+  for (; i < length; ++i) {
+    output[i] = Lerp8(output[i], layer[i], alpha);
+  }
+}
+
+void BlendAdd(uint8_t *output, const uint8_t *layer, size_t length,
+              uint16_t alpha) {
+  const Uint8x16 zero = Splat16(0);
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    Store16(output + i, AddSaturate16(Load16(output + i),
+                                      Lerp16(zero, Load16(layer + i), alpha)));
+  }
+  for (; i < length; ++i) {
+    output[i] = AddSaturate8(output[i], Lerp8(0, layer[i], alpha));
+  }
+}
+
+void BlendMultiply(uint8_t *output, const uint8_t *layer, size_t length,
+                   uint16_t alpha) {
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    const Uint8x16 below = Load16(output + i);
+    Store16(output + i,
+            Lerp16(below, Multiply16(below, Load16(layer + i)), alpha));
+  }
+  for (; i < length; ++i) {
+    output[i] = Lerp8(output[i], Multiply8(output[i], layer[i]), alpha);
+  }
+}
+}  // namespace
+
+bool ParseBlendMode(absl::string_view name, BlendMode *mode) {
+  if (name == "replace") {
+    *mode = BlendMode::REPLACE;
+  } else if (name == "add") {
+    *mode = BlendMode::ADD;
+  } else if (name == "multiply") {
+    *mode = BlendMode::MULTIPLY;
+  } else if (name == "mask") {
+    *mode = BlendMode::MASK;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char *BlendModeName(BlendMode mode) {
+  switch (mode) {
+    case BlendMode::REPLACE:
+      return "replace";
+    case BlendMode::ADD:
+      return "add";
+    case BlendMode::MULTIPLY:
+      return "multiply";
+    case BlendMode::MASK:
+      return "mask";
+  }
+  return "unknown";
+}
+
+LedLayer::LedLayer(std::string name, size_t frame_length, Settings settings)
+    : name_(std::move(name)),
+      priority_(settings.priority),
+      opacity_(settings.opacity),
+      blend_mode_(settings.blend_mode),
+      enabled_(settings.enabled),
+      region_(PackRegion(0, -1)) {
+  for (auto &buffer : buffers_) {
+    buffer.resize(frame_length, 0);
+  }
+}
+
+void LedLayer::Publish() {
+  const uint8_t previous =
+      middle_.exchange(back_index_ | kFresh, std::memory_order_acq_rel);
+  back_index_ = previous & kIndexMask;
+}
+
+absl::Span<const uint8_t> LedLayer::Acquire() {
+  if (middle_.load(std::memory_order_relaxed) & kFresh) {
+    const uint8_t previous =
+        middle_.exchange(front_index_, std::memory_order_acq_rel);
+    front_index_ = previous & kIndexMask;
+    has_frame_ = true;
+  }
+  if (!has_frame_) {
+    return {};
+  }
+  return buffers_[front_index_];
+}
+
+void LedLayer::SetRegion(int offset, int count) {
+  region_.store(PackRegion(std::max(offset, 0), count));
+}
+
+LedCompositor::LedCompositor(int num_leds)
+    : num_leds_(num_leds), mask_(num_leds * kLedChannels, 0) {}
+
+std::shared_ptr<LedLayer> LedCompositor::AddLayer(const std::string &name,
+                                                  LedLayer::Settings settings) {
+  auto layer =
+      std::make_shared<LedLayer>(name, num_leds_ * kLedChannels, settings);
+  layers_.push_back(layer);
+  order_.push_back(layer.get());
+  return layer;
+}
+
+std::shared_ptr<LedLayer> LedCompositor::GetLayer(
+    absl::string_view name) const {
+  for (const auto &layer : layers_) {
+    if (layer->name() == name) {
+      return layer;
+    }
+  }
+  return nullptr;
+}
+
+void LedCompositor::Composite(absl::Span<uint8_t> output) {
+  std::fill(output.begin(), output.end(), 0);
+
+  // Insertion sort, which is stable, so that layers of equal priority
+  // composite in the order they were added, and doesn't allocate.
+  for (size_t i = 1; i < order_.size(); ++i) {
+    LedLayer *layer = order_[i];
+    const int priority = layer->priority();
+    size_t j = i;
+    for (; j > 0 && order_[j - 1]->priority() > priority; --j) {
+      order_[j] = order_[j - 1];
+    }
+    order_[j] = layer;
+  }
+
+  for (LedLayer *layer : order_) {
+    if (!layer->enabled()) {
+      continue;
+    }
+    const uint16_t alpha = static_cast<uint16_t>(
+        std::clamp(layer->opacity(), 0.0f, 1.0f) * 256 + 0.5f);
+    const absl::Span<const uint8_t> frame = layer->Acquire();
+    if (alpha == 0 || frame.empty()) {
+      continue;
+    }
+
+    const uint64_t region = layer->region_.load();
+    const int offset = std::min<int>(region >> 32, num_leds_);
+    const int count = static_cast<int32_t>(region & 0xFFFFFFFF);
+    // Subtracts rather than adds, since `offset + count` may overflow.
+    const int end = count < 0 || count > num_leds_ - offset
+                        ? num_leds_
+                        : offset + count;
+    if (end <= offset) {
+      continue;
+    }
+    const size_t start = offset * kLedChannels;
+    const size_t length = (end - offset) * kLedChannels;
+    uint8_t *out = output.data() + start;
+    const uint8_t *in = frame.data() + start;
+
+    switch (layer->blend_mode()) {
+      case BlendMode::REPLACE:
+        BlendReplace(out, in, length, alpha);
+        break;
+      case BlendMode::ADD:
+        BlendAdd(out, in, length, alpha);
+        break;
+      case BlendMode::MULTIPLY:
+        BlendMultiply(out, in, length, alpha);
+        break;
+      case BlendMode::MASK:
+        // Expand each LED's brightest channel across its channels, then
+        // multiply by that.
+        for (size_t i = 0; i < length; i += kLedChannels) {
+          const uint8_t level =
+              std::max(std::max(in[i], in[i + 1]), in[i + 2]);
+          memset(&mask_[i], level, kLedChannels);
+        }
+        BlendMultiply(out, mask_.data(), length, alpha);
+        break;
+    }
+  }
+}
+
+std::string LedCompositor::HandleCommand(absl::string_view command) {
+  std::vector<absl::string_view> words =
+      absl::StrSplit(command, ' ', absl::SkipWhitespace());
+  if (words.empty()) {
+    return "error: empty command";
+  }
+
+  if (words[0] == "layers") {
+    std::string reply;
+    for (const auto &layer : layers_) {
+      const uint64_t region = layer->region_.load();
+      absl::StrAppend(&reply, reply.empty() ? "" : "; ", layer->name(), " ",
+                      layer->enabled() ? "on" : "off", " priority=",
+                      layer->priority(), " opacity=", layer->opacity(),
+                      " blend=", BlendModeName(layer->blend_mode()),
+                      " region=", static_cast<int32_t>(region >> 32), "+",
+                      static_cast<int32_t>(region & 0xFFFFFFFF));
+    }
+    return reply;
+  }
+
+  if (words.size() < 2) {
+    return absl::StrCat("error: ", words[0], " requires a layer");
+  }
+  auto layer = GetLayer(words[1]);
+  if (layer == nullptr) {
+    return absl::StrCat("error: no layer ", words[1]);
+  }
+
+  if (words[0] == "enable" || words[0] == "disable") {
+    layer->set_enabled(words[0] == "enable");
+    return "ok";
+  }
+  if (words[0] == "opacity") {
+    float opacity;
+    // SimpleAtof accepts "nan" and "inf", which no opacity can be.
+    if (words.size() != 3 || !absl::SimpleAtof(words[2], &opacity) ||
+        !std::isfinite(opacity)) {
+      return "error: usage: opacity <layer> <0-1>";
+    }
+    layer->set_opacity(std::clamp(opacity, 0.0f, 1.0f));
+    return "ok";
+  }
+  if (words[0] == "blend") {
+    BlendMode mode;
+    if (words.size() != 3 || !ParseBlendMode(words[2], &mode)) {
+      return "error: usage: blend <layer> replace|add|multiply|mask";
+    }
+    layer->set_blend_mode(mode);
+    return "ok";
+  }
+  if (words[0] == "priority") {
+    int priority;
+    if (words.size() != 3 || !absl::SimpleAtoi(words[2], &priority)) {
+      return "error: usage: priority <layer> <priority>";
+    }
+    layer->set_priority(priority);
+    return "ok";
+  }
+  if (words[0] == "region") {
+    int offset;
+    int count;
+    if (words.size() != 4 || !absl::SimpleAtoi(words[2], &offset) ||
+        !absl::SimpleAtoi(words[3], &count)) {
+      return "error: usage: region <layer> <offset> <count>";
+    }
+    layer->SetRegion(offset, count);
+    return "ok";
+  }
+  return absl::StrCat("error: unknown command ", words[0]);
+}
+
+}  // namespace led_driver
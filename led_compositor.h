@@ -0,0 +1,158 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef LED_COMPOSITOR_H_
+#define LED_COMPOSITOR_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+
+namespace led_driver {
+
+enum class BlendMode : int {
+  // Blends the layer over the layers below by its opacity.
+  REPLACE,
+  // Adds the layer to the layers below, saturating.
+  ADD,
+  // Multiplies the layers below by the layer.
+  MULTIPLY,
+  // Scales the layers below by the brightest channel of each of the layer's
+  // LEDs, so the layer acts as a stencil.
+  MASK,
+};
+
+// Parses and names blend modes: "replace", "add", "multiply" and "mask".
+bool ParseBlendMode(absl::string_view name, BlendMode *mode);
+const char *BlendModeName(BlendMode mode);
+
+// One source of LED frames in the compositor. A single producer thread writes
+// frames with `back` and `Publish`; the compositor reads the latest published
+// frame without either side blocking. Settings may be changed from any thread,
+// and take effect from the next composite.
+class LedLayer {
+ public:
+  struct Settings {
+    int priority = 0;
+    float opacity = 1.0f;
+    BlendMode blend_mode = BlendMode::REPLACE;
+    bool enabled = true;
+  };
+
+  LedLayer(std::string name, size_t frame_length, Settings settings);
+
+  const std::string &name() const { return name_; }
+
+  // Producer side. Write the next frame into `back()`, then publish it. The
+  // back buffer's contents are undefined after publishing.
+  absl::Span<uint8_t> back() { return absl::MakeSpan(buffers_[back_index_]); }
+  void Publish();
+
+  void set_priority(int priority) { priority_.store(priority); }
+  void set_opacity(float opacity) { opacity_.store(opacity); }
+  void set_blend_mode(BlendMode mode) { blend_mode_.store(mode); }
+  void set_enabled(bool enabled) { enabled_.store(enabled); }
+
+  // Restricts the layer to `count` LEDs starting at `offset`; the LEDs
+  // outside are left to the layers below. A negative count means all LEDs
+  // from `offset` onwards.
+  void SetRegion(int offset, int count);
+
+  int priority() const { return priority_.load(); }
+  float opacity() const { return opacity_.load(); }
+  BlendMode blend_mode() const { return blend_mode_.load(); }
+  bool enabled() const { return enabled_.load(); }
+
+ private:
+  friend class LedCompositor;
+
+  // Consumer side. Returns the latest published frame, or an empty span if
+  // nothing has been published yet.
+  absl::Span<const uint8_t> Acquire();
+
+  static constexpr uint8_t kFresh = 0x4;
+  static constexpr uint8_t kIndexMask = 0x3;
+
+  const std::string name_;
+
+  // Triple buffer. `middle_` holds the index of the buffer between the
+  // producer and the consumer, and whether it is fresh.
+  std::array<std::vector<uint8_t>, 3> buffers_;
+  uint8_t back_index_ = 0;
+  std::atomic<uint8_t> middle_{1};
+  uint8_t front_index_ = 2;
+  bool has_frame_ = false;
+
+  std::atomic<int> priority_;
+  std::atomic<float> opacity_;
+  std::atomic<BlendMode> blend_mode_;
+  std::atomic<bool> enabled_;
+  // Region, in LEDs, packed so that it changes atomically.
+  std::atomic<uint64_t> region_;
+};
+
+// Blends a stack of layers into one LED frame, from the lowest priority to the
+// highest.
+class LedCompositor {
+ public:
+  static constexpr int kLedChannels = 3;
+
+  explicit LedCompositor(int num_leds);
+
+  // Adds a layer. Layers must all be added before compositing begins.
+  std::shared_ptr<LedLayer> AddLayer(const std::string &name,
+                                     LedLayer::Settings settings);
+
+  // Returns the layer named `name`, or nullptr.
+  std::shared_ptr<LedLayer> GetLayer(absl::string_view name) const;
+
+  // Composites the layers into `output`, which must hold `num_leds()` RGB
+  // triplets. Never allocates or blocks.
+  void Composite(absl::Span<uint8_t> output);
+
+  // Handles a control command, returning the reply:
+  //   layers                        Lists the layers and their settings.
+  //   enable|disable <layer>
+  //   opacity <layer> <0-1>
+  //   blend <layer> <mode>
+  //   priority <layer> <priority>
+  //   region <layer> <offset> <count>
+  std::string HandleCommand(absl::string_view command);
+
+  int num_leds() const { return num_leds_; }
+
+ private:
+  const int num_leds_;
+  std::vector<std::shared_ptr<LedLayer>> layers_;
+
+  // Layers in compositing order, and scratch for mask expansion. Preallocated.
+  std::vector<LedLayer *> order_;
+  std::vector<uint8_t> mask_;
+};
+
+}  // namespace led_driver
+
+#endif  // LED_COMPOSITOR_H_
@@ -30,12 +30,38 @@
 
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "absl/types/span.h"
+#include "allocation_counter.h"
+#include "audio_modulator.h"
+#include "audio_source_factory.h"
+#include "boot_sequence.h"
+#include "clock_sync.h"
+#include "effect_engine.h"
+#include "event_reactor.h"
+#include "frame_rate_governor.h"
+#include "led_compositor.h"
 #include "led_driver/led_mapping.pb.h"
-#include "pixel_utils.h"
+#include "led_output.h"
+#include "led_output_loop.h"
+#include "led_recording.h"
+#include "led_sampler.h"
+#include "led_tap.h"
+#include "multi_spi_output.h"
+#include "network_input_source.h"
+#include "network_output_sink.h"
+#include "periodic.h"
 #include "projectm_controller.h"
+#include "real_fft.h"
+#include "realtime.h"
+#include "spectral_analyzer.h"
 #include "spi_driver.h"
+#include "thermal_monitor.h"
+#include "thread_pool.h"
 #include "vc_capture_source.h"
 #include "visual_interest_processor.h"
 
@@ -63,10 +89,29 @@ bool AbslParseFlag(const absl::string_view text, LedIntensity *intensity,
 
 ABSL_FLAG(std::string, mapping_file, "mapping.binaryproto",
           "File containing the LED mapping");
+ABSL_FLAG(int, num_leds, 0,
+          "Number of LEDs to drive; zero to drive one for each mapping sample");
+ABSL_FLAG(int, led_threads, 1,
+          "Threads to sample and process each LED frame on, counting the "
+          "capture and output threads themselves; more pay off from a few "
+          "thousand LEDs");
+ABSL_FLAG(int, segment_leds, 4096,
+          "LEDs in each segment of a frame processed in parallel");
+ABSL_FLAG(std::string, spi_devices, "",
+          "Comma-separated SPI devices to drive, as "
+          "device[:offset:count[:mode[:speed_hz]]], each sending its segment "
+          "of the mapping on a thread of its own; empty for /dev/spidev0.0 "
+          "alone. Devices named loopback* only simulate a bus");
+ABSL_FLAG(bool, spi_barrier, true,
+          "With --spi_devices, start each frame on every device at once, and "
+          "wait for all of them to latch it before the next");
 ABSL_FLAG(LedIntensity, intensity, LedIntensity(1.0f),
           "Scale factor for LED intensity");
 ABSL_FLAG(bool, enable_projectm_controller, true,
           "Whether to enable the ProjectM Controller");
+ABSL_FLAG(std::string, projectm_control_socket, "/tmp/projectm_control.sock",
+          "Control socket of the renderer. If the renderer isn't listening on "
+          "it, presets are advanced by sending keystrokes with xdo instead");
 ABSL_FLAG(ssize_t, calculation_period_ms, 1000,
           "Period in milliseconds for calculating the visual interest of a "
           "visualizer frame");
@@ -81,6 +126,9 @@ ABSL_FLAG(float, visual_interest_threshold, 10,
 ABSL_FLAG(ssize_t, cooldown_duration, 10,
           "Calculation periods to wait after advancing the preset before "
           "beginning to calculate the moving average");
+ABSL_FLAG(bool, use_points_of_interest, true,
+          "Whether to restrict the visual interest calculation to the points "
+          "of interest in the mapping, when it has any");
 ABSL_FLAG(int, raster_width, 100, "Width of the source raster, in pixels");
 ABSL_FLAG(int, raster_height, 100, "Height of the source raster, in pixels");
 ABSL_FLAG(int, raster_x, 100, "X position of the source raster, in pixels");
@@ -96,6 +144,166 @@ ABSL_FLAG(int, indicate_progress, 0,
 ABSL_FLAG(int, clamp_threshold, 0,
           "Pixel values with norm below this threshold will be clamped to 0.");
 
+ABSL_FLAG(std::string, audio_modulation, "",
+          "Comma-separated audio-reactive modulations to apply to the LEDs, "
+          "from pulse, hue and strobe. Empty to disable");
+ABSL_FLAG(std::string, audio_source, "pulseaudio",
+          "Audio source for modulation: pulseaudio, alsa or file");
+ABSL_FLAG(std::string, pulseaudio_server, "",
+          "PulseAudio server to connect to");
+ABSL_FLAG(std::string, pulseaudio_source, "",
+          "PulseAudio source device to capture audio from");
+ABSL_FLAG(std::string, alsa_device, "default",
+          "ALSA device to capture audio from when --audio_source=alsa");
+ABSL_FLAG(std::string, audio_file, "",
+          "WAV or raw float file to replay when --audio_source=file");
+ABSL_FLAG(bool, audio_file_loop, true,
+          "Whether to loop the file when --audio_source=file");
+ABSL_FLAG(int, audio_fragment_frames, 128,
+          "Requested audio fragment size, in frames");
+ABSL_FLAG(int, audio_target_latency_ms, 10,
+          "Requested upper bound on audio buffered by the source");
+ABSL_FLAG(int, audio_fft_size, 1024,
+          "FFT size for audio analysis; a power of two from 8 to 65536");
+ABSL_FLAG(int, audio_hop_size, 256,
+          "Samples between audio analyses, up to --audio_fft_size; zero for "
+          "half of it. Smaller hops detect beats sooner");
+ABSL_FLAG(float, pulse_depth, 0.6f,
+          "Fraction of the brightness modulated by --audio_modulation=pulse");
+ABSL_FLAG(int, pulse_decay_ms, 150,
+          "Decay time constant of beat pulses and hue shifts");
+ABSL_FLAG(float, hue_step_degrees, 30.0f,
+          "Hue rotation per beat for --audio_modulation=hue");
+ABSL_FLAG(int, strobe_duration_ms, 30,
+          "Time the strobe gate stays open after each onset");
+ABSL_FLAG(int, audio_latency_report_period_s, 10,
+          "Period at which to log the audio-to-light latency; 0 to disable");
+
+ABSL_FLAG(std::string, effect, "",
+          "If set, renders this procedural effect directly to the LEDs instead "
+          "of capturing the display: gradient, plasma, noise, chase or "
+          "palette");
+ABSL_FLAG(std::string, effect_palette, "rainbow",
+          "Palette for --effect: rainbow, fire, ocean or forest");
+ABSL_FLAG(float, effect_speed, 1.0f, "Animation rate of --effect");
+ABSL_FLAG(float, effect_scale, 1.0f, "Spatial frequency of --effect");
+ABSL_FLAG(float, effect_palette_speed, 0.05f,
+          "Palette cycles per second for --effect");
+ABSL_FLAG(std::string, effect_blend, "replace",
+          "How --effect blends over the capture: replace, add, multiply or "
+          "mask");
+ABSL_FLAG(float, effect_opacity, 1.0f, "Opacity of --effect");
+ABSL_FLAG(bool, capture, true,
+          "Whether to capture the display. Without capture, only effects and "
+          "indicators are shown, without an X server or projectM");
+ABSL_FLAG(int, output_fps, 60, "Rate at which frames are sent to the LEDs");
+ABSL_FLAG(std::string, boot_recording, "",
+          "Raw recording, as baked with led_recording_tool --raw, to loop "
+          "from the first output frame until the capture is live");
+ABSL_FLAG(std::string, boot_effect, "",
+          "Effect to show from the first output frame until the capture is "
+          "live, when there's no --boot_recording; empty for none");
+ABSL_FLAG(int, boot_crossfade_ms, 1000,
+          "Crossfade from the boot animation to the live capture");
+ABSL_FLAG(int, boot_live_frames, 3,
+          "Consecutive lit captured frames after which the capture counts as "
+          "live");
+ABSL_FLAG(int, capture_retry_ms, 500,
+          "With a boot animation, period at which to retry setting up the "
+          "capture until the display is up");
+ABSL_FLAG(std::string, control_socket, "/tmp/led_driver_control.sock",
+          "Unix socket to accept layer commands on; empty to disable");
+
+ABSL_FLAG(bool, network_input, false,
+          "Whether to accept LED frames over DDP, Art-Net and E1.31. Network "
+          "frames are shown over the capture and effect while they arrive");
+ABSL_FLAG(std::string, network_bind_address, "0.0.0.0",
+          "Address to receive network LED frames on");
+ABSL_FLAG(int, ddp_port, 4048, "UDP port for DDP; zero to disable");
+ABSL_FLAG(int, artnet_port, 6454, "UDP port for Art-Net; zero to disable");
+ABSL_FLAG(int, e131_port, 5568, "UDP port for E1.31; zero to disable");
+ABSL_FLAG(int, artnet_universe, 0, "Art-Net universe holding the first LED");
+ABSL_FLAG(int, e131_universe, 1, "E1.31 universe holding the first LED");
+ABSL_FLAG(int, network_universe_channels, 510,
+          "Channels used from each Art-Net or E1.31 universe");
+ABSL_FLAG(int, network_timeout_ms, 2000,
+          "Time without network frames after which the layers below are "
+          "shown again");
+ABSL_FLAG(std::string, network_output, "",
+          "Remote controllers to send the corrected LED frames to as DDP, as a "
+          "comma-separated list of host[:port[:offset:count[:remote_offset]]], "
+          "in LEDs. Remote controllers run `led_player --network_input`");
+ABSL_FLAG(int, network_output_keyframe_interval, 30,
+          "Frames between complete frames sent to remote controllers; other "
+          "frames only send the packets which changed");
+ABSL_FLAG(int, clock_sync_port, 0,
+          "UDP port to serve this node's clock on, as the master of other "
+          "nodes; zero to disable");
+ABSL_FLAG(std::string, clock_sync_server, "",
+          "host:port of the master node's clock. If set, frames are sent on "
+          "the master's frame boundaries");
+ABSL_FLAG(int, presentation_delay_ms, 0,
+          "With --network_output, how far ahead frames are sent to remote "
+          "controllers. The local output is delayed to match, so every node "
+          "latches each frame together");
+ABSL_FLAG(std::string, record_file, "",
+          "If set, records every frame sent to the LEDs to this file, for "
+          "playback with led_player");
+ABSL_FLAG(int, record_keyframe_interval, 60,
+          "Frames between keyframes in --record_file");
+ABSL_FLAG(std::string, led_tap, "",
+          "Name of a shared memory object, such as /led_driver_tap, to publish "
+          "the latest frames to for observers such as mapping_generator.py");
+ABSL_FLAG(std::string, led_tap_stage, "input",
+          "Frames published to --led_tap: \"input\" for RGB before color "
+          "correction, or \"output\" for exactly what is sent to the LEDs");
+ABSL_FLAG(bool, governor, false,
+          "Scale the capture and output rates with the motion on the LEDs, "
+          "between --governor_min_fps and --output_fps, to save battery");
+ABSL_FLAG(int, governor_min_fps, 15, "Frame rate of a static scene");
+ABSL_FLAG(float, governor_motion_threshold, 2.0f,
+          "Mean change per channel between frames, out of 255, which raises "
+          "the rate to --output_fps");
+ABSL_FLAG(int, governor_hold_ms, 1000,
+          "How long to hold --output_fps after motion or an audio onset");
+ABSL_FLAG(int, governor_ramp_down_ms, 2000,
+          "Time constant of the decay to a lower rate");
+ABSL_FLAG(bool, governor_audio, false,
+          "Also raise the rate on audio onsets and beats, and with the audio "
+          "energy, captured with the --audio_source flags");
+ABSL_FLAG(bool, thermal, false,
+          "Shed work as the SoC heats up, before the firmware throttles the "
+          "clock: capture at --thermal_capture_fps, then pause the visual "
+          "interest analysis");
+ABSL_FLAG(std::string, thermal_sysfs_root, "/sys",
+          "Root of the sysfs tree to read the temperature and clock from");
+ABSL_FLAG(float, thermal_shed_celsius, 70.0f,
+          "Temperature at which to start shedding work");
+ABSL_FLAG(float, thermal_step_celsius, 2.5f,
+          "Rise in temperature which sheds each further level of work");
+ABSL_FLAG(int, thermal_capture_fps, 30,
+          "Capture rate once the temperature passes --thermal_shed_celsius");
+
+ABSL_FLAG(bool, realtime, false,
+          "Lock memory, run the capture, output and analysis threads with the "
+          "schedules below, and report heap allocations made in steady state");
+ABSL_FLAG(int, capture_thread_cpu, 2,
+          "With --realtime, CPU to pin the capture thread to; -1 for any");
+ABSL_FLAG(int, capture_thread_priority, 70,
+          "With --realtime, SCHED_FIFO priority of the capture thread; zero "
+          "for the default scheduler");
+ABSL_FLAG(int, output_thread_cpu, 3,
+          "With --realtime, CPU to pin the output (SPI) thread to; -1 for any");
+ABSL_FLAG(int, output_thread_priority, 80,
+          "With --realtime, SCHED_FIFO priority of the output thread");
+ABSL_FLAG(int, analysis_thread_cpu, 2,
+          "With --realtime, CPU to pin the visual interest thread to");
+ABSL_FLAG(int, analysis_thread_priority, 10,
+          "With --realtime, SCHED_FIFO priority of the visual interest thread");
+ABSL_FLAG(bool, fail_on_allocation, false,
+          "With --realtime, exit as soon as a heap allocation is made in "
+          "steady state. Needs a build with --define allocation_checks=true");
+
 ABSL_FLAG(bool, override, false, "Override LED colors.");
 ABSL_FLAG(int, override_color, 0x770000, "Color to override all LEDs with");
 ABSL_FLAG(int, override_num_leds, 10, "Number of LEDs to override");
@@ -107,138 +315,196 @@ namespace led_driver {
 
 namespace {
 
-const std::string kDevice = "/dev/spidev0.0";
-constexpr SpiDriver::ClockPolarity kClockPolarity =
-    SpiDriver::ClockPolarity::IDLE_LOW;
-constexpr SpiDriver::ClockPhase kClockPhase =
-    SpiDriver::ClockPhase::SAMPLE_LEADING;
-constexpr int kBitsPerWord = 8;
-constexpr int kSpeedHz = 15600000;
-constexpr int kDelayUs = 0;
+// Color of the status layer's progress indicator.
+constexpr uint32_t kStatusColor = 0x640000;
+
+// Frames after which, with --realtime, every per-frame buffer should have been
+// allocated.
+constexpr int kRealtimeWarmupFrames = 120;
 
-using Coordinate = std::pair<ssize_t, ssize_t>;
+ThreadSchedule GetThreadSchedule(int cpu, int priority) {
+  ThreadSchedule schedule;
+  schedule.cpu = cpu;
+  schedule.priority = priority;
+  return schedule;
+}
 
 }  // namespace
 
-class SpiImageBufferReceiver : public ImageBufferReceiverInterface {
+// Samples each captured frame at the mapping coordinates into the capture
+// layer.
+class SamplingImageBufferReceiver : public ImageBufferReceiverInterface {
  public:
-  SpiImageBufferReceiver(std::shared_ptr<SpiDriver> spi_driver,
-                         std::vector<Coordinate> coordinates,
-                         LedIntensity intensity, int flicker_threshold,
-                         float flicker_ratio, int clamp_threshold)
-      : spi_driver_(std::move(spi_driver)),
-        coordinates_(std::move(coordinates)),
-        intensity_(intensity),
-        flicker_threshold_(flicker_threshold),
-        flicker_ratio_(flicker_ratio),
-        clamp_threshold_(clamp_threshold) {}
-  void Receive(std::shared_ptr<ImageBuffer> image_buffer) override {
-    std::vector<uint8_t> output_buffer_;
-    output_buffer_.resize(kLedBufferLength + 2, 0);
-
-    // LED data address + mode.
-    output_buffer_[0] = 0x80;
-    output_buffer_[1] = 0x00;
-
-    auto end_iter = output_buffer_.begin() + 2;
-
-    for (const auto coordinate : coordinates_) {
-      ssize_t pixel_index = coordinate.first * kLedChannels +
-                            coordinate.second * image_buffer->row_stride;
+  // If `boot` is set, it's shown each sampled frame to decide when the
+  // capture is live.
+  SamplingImageBufferReceiver(std::shared_ptr<LedLayer> layer,
+                              LedSampler sampler,
+                              std::shared_ptr<BootSequence> boot)
+      : layer_(std::move(layer)),
+        sampler_(std::move(sampler)),
+        boot_(std::move(boot)) {}
 
-      absl::Span<uint8_t> pixel{image_buffer->buffer.data() + pixel_index,
-                                kLedChannels};
-      bool draw = false;
-      for (auto value : pixel) {
-        if (value >= clamp_threshold_) draw = true;
-      }
-
-      if (draw) {
-        // Copy pixel from the sampling location to the end of the
-        // output buffer
-        std::copy(image_buffer->buffer.begin() + pixel_index,
-                  image_buffer->buffer.begin() + pixel_index + kLedChannels,
-                  end_iter);
-      }
-
-      end_iter += 3;
+  void Receive(std::shared_ptr<ImageBuffer> image_buffer) override {
+    sampler_.Sample(image_buffer->buffer, image_buffer->row_stride,
+                    layer_->back());
+    if (boot_ != nullptr) {
+      boot_->CheckCapture(layer_->back());
     }
-
-    FullWhiteCompensate(
-        absl::Span<uint8_t>(&output_buffer_[2], output_buffer_.size() - 2));
-
-    ScalePixelValues(&(output_buffer_[2]), intensity_.intensity, kNumLeds);
-    corrector_.CorrectPixelsInPlace(&(output_buffer_[2]), kNumLeds);
-    TransposeRedGreen(&(output_buffer_[2]), kNumLeds);
-    spi_driver_->Transfer(output_buffer_);
+    layer_->Publish();
   }
 
  private:
-  void FullWhiteCompensate(absl::Span<uint8_t> output_buffer) {
-    ++flicker_counter_;
+  std::shared_ptr<LedLayer> layer_;
+  const LedSampler sampler_;
+  const std::shared_ptr<BootSequence> boot_;
+};
 
-    int num_over_threshold = 0;
-    for (int i = 0; i < kLedBufferLength; ++i) {
-      if (output_buffer[i] > flicker_threshold_) {
-        ++num_over_threshold;
-      }
-    }
+LedLayer::Settings LayerSettings(int priority, float opacity,
+                                 BlendMode blend_mode, bool enabled) {
+  LedLayer::Settings settings;
+  settings.priority = priority;
+  settings.opacity = opacity;
+  settings.blend_mode = blend_mode;
+  settings.enabled = enabled;
+  return settings;
+}
 
-    if (num_over_threshold >
-        static_cast<int>(kLedBufferLength * flicker_ratio_)) {
-      for (int i = 0; i < kNumLeds; ++i) {
-        if ((i & kFlickerModulus) != (flicker_counter_ & kFlickerModulus)) {
-          memset(&output_buffer[i * kLedChannels], 0, kLedChannels);
-        }
-      }
-    }
+// Fills `count` LEDs of `layer` from `offset` with `color`, restricts the layer
+// to them and enables it.
+void ShowOnLayer(LedLayer *layer, uint32_t color, int offset, int count) {
+  absl::Span<uint8_t> frame = layer->back();
+  std::fill(frame.begin(), frame.end(), 0);
+  const int num_leds = frame.size() / LedOutput::kLedChannels;
+  offset = std::clamp(offset, 0, num_leds);
+  count = std::clamp(count, 0, num_leds - offset);
+  for (int i = offset; i < offset + count; ++i) {
+    frame[i * 3] = (color >> 16) & 0xFF;
+    frame[i * 3 + 1] = (color >> 8) & 0xFF;
+    frame[i * 3 + 2] = color & 0xFF;
   }
+  layer->Publish();
+  layer->SetRegion(offset, count);
+  layer->set_enabled(true);
+}
 
-  constexpr static ssize_t kNumLeds = 900;
-  constexpr static ssize_t kLedChannels = 3;
-  constexpr static ssize_t kLedBufferLength = kNumLeds * kLedChannels;
-  constexpr static uint32_t kFlickerModulus = 0x3;
-  std::shared_ptr<SpiDriver> spi_driver_;
-  std::vector<Coordinate> coordinates_;
-  LedIntensity intensity_;
-  int flicker_threshold_;
-  float flicker_ratio_;
-  int flicker_counter_;
-  int clamp_threshold_;
+// Handles the commands for the override and status layers:
+//   override <color> [count] [offset]   Shows a color, as hex RGB.
+//   override off
+//   status <count>                      Lights the first LEDs, as progress.
+//   status off
+bool HandleIndicatorCommand(LedLayer *override_layer, LedLayer *status_layer,
+                            absl::string_view command, std::string *reply) {
+  std::vector<absl::string_view> words =
+      absl::StrSplit(command, ' ', absl::SkipWhitespace());
+  if (words.empty() || (words[0] != "override" && words[0] != "status")) {
+    return false;
+  }
+  LedLayer *layer = words[0] == "override" ? override_layer : status_layer;
+  if (words.size() == 2 && words[1] == "off") {
+    layer->set_enabled(false);
+    *reply = "ok";
+    return true;
+  }
 
-  const ColorCorrector corrector_{
-      {.gamma = {2.8f, 2.8f, 2.8f},
-       .peak_brightness = {(390.0f + 420.0f) / 2, (660.0f + 720.0f) / 2,
-                           (180.0f + 200.0f) / 2}}};
-};
+  if (words[0] == "status") {
+    int count;
+    if (words.size() != 2 || !absl::SimpleAtoi(words[1], &count)) {
+      *reply = "error: usage: status <count>|off";
+      return true;
+    }
+    ShowOnLayer(layer, kStatusColor, 0, count);
+    *reply = "ok";
+    return true;
+  }
+
+  uint32_t color;
+  int count = layer->back().size() / LedOutput::kLedChannels;
+  int offset = 0;
+  if (words.size() < 2 || words.size() > 4 ||
+      !absl::SimpleHexAtoi(words[1], &color) ||
+      (words.size() > 2 && !absl::SimpleAtoi(words[2], &count)) ||
+      (words.size() > 3 && !absl::SimpleAtoi(words[3], &offset))) {
+    *reply = "error: usage: override <rrggbb> [count] [offset]|off";
+    return true;
+  }
+  ShowOnLayer(layer, color, offset, count);
+  *reply = "ok";
+  return true;
+}
 
 int main(int argc, char *argv[]) {
   absl::ParseCommandLine(argc, argv);
 
+  const bool realtime = absl::GetFlag(FLAGS_realtime);
+  if (realtime && !LockMemory()) {
+    return 1;
+  }
+  if (absl::GetFlag(FLAGS_fail_on_allocation) &&
+      !AllocationCounter::kEnabled) {
+    std::cerr << "--fail_on_allocation needs a build with --define "
+                 "allocation_checks=true"
+              << std::endl;
+    return 1;
+  }
+  const int audio_fft_size = absl::GetFlag(FLAGS_audio_fft_size);
+  if (!RealFft::IsValidSize(audio_fft_size)) {
+    std::cerr << "--audio_fft_size must be a power of two from "
+              << RealFft::kMinSize << " to " << RealFft::kMaxSize << ", not "
+              << audio_fft_size << std::endl;
+    return 1;
+  }
+  const int audio_hop_size = absl::GetFlag(FLAGS_audio_hop_size);
+  if (audio_hop_size < 0 || audio_hop_size > audio_fft_size) {
+    std::cerr << "--audio_hop_size must be from 0 to --audio_fft_size, not "
+              << audio_hop_size << std::endl;
+    return 1;
+  }
+
   std::ifstream mapping_file;
   mapping_file.open(absl::GetFlag(FLAGS_mapping_file));
   ledsuit::mapping::Mapping mapping;
   mapping.ParseFromIstream(&mapping_file);
 
-  std::vector<Coordinate> coordinates;
+  std::vector<std::pair<float, float>> mapping_coordinates;
   for (const auto &sample : mapping.samples()) {
     if (!(sample.has_x() && sample.has_y())) {
       std::cerr << "Sample missing component";
       continue;
     }
-    coordinates.emplace_back(
-        static_cast<ssize_t>(sample.x() *
-                             (absl::GetFlag(FLAGS_raster_width) - 1)),
-        static_cast<ssize_t>(sample.y() *
-                             (absl::GetFlag(FLAGS_raster_height) - 1)));
+    mapping_coordinates.emplace_back(sample.x(), sample.y());
+  }
+  const int num_leds = absl::GetFlag(FLAGS_num_leds) > 0
+                           ? absl::GetFlag(FLAGS_num_leds)
+                           : mapping_coordinates.size();
+  if (num_leds == 0) {
+    std::cerr << "No LEDs to drive; the mapping has no samples, and "
+                 "--num_leds isn't set"
+              << std::endl;
+    return 1;
   }
 
-  auto spi_driver = SpiDriver::Create(kDevice, kClockPolarity, kClockPhase,
-                                      kBitsPerWord, kSpeedHz, kDelayUs);
+  std::vector<MultiSpiOutput::Device> spi_devices;
+  if (!absl::GetFlag(FLAGS_spi_devices).empty()) {
+    if (!MultiSpiOutput::ParseDevices(absl::GetFlag(FLAGS_spi_devices),
+                                      &spi_devices)) {
+      return 1;
+    }
+    if (absl::GetFlag(FLAGS_blank_display) || absl::GetFlag(FLAGS_override) ||
+        absl::GetFlag(FLAGS_indicate_progress) > 0) {
+      std::cerr << "--blank_display, --override and --indicate_progress only "
+                   "drive /dev/spidev0.0, and can't be used with --spi_devices"
+                << std::endl;
+      return 1;
+    }
+  }
+  std::shared_ptr<SpiDriver> spi_driver;
+  if (spi_devices.empty()) {
+    spi_driver = CreateLedSpiDriver();
+  }
 
   if (absl::GetFlag(FLAGS_blank_display)) {
     std::cout << "Clearing display" << std::endl;
-    std::vector<uint8_t> empty_raster(3 * 900 + 2, 0);
+    std::vector<uint8_t> empty_raster(3 * num_leds + 2, 0);
     empty_raster[0] = 0x80;
     empty_raster[1] = 0x00;
     spi_driver->Transfer(empty_raster);
@@ -285,7 +551,11 @@ int main(int argc, char *argv[]) {
 
       int offset = 0;
 
-      do {
+      auto reactor = EventReactor::Create();
+      if (reactor == nullptr) {
+        return 1;
+      }
+      reactor->AddTimer(std::chrono::milliseconds(50), [&]() {
         std::copy(color_raster.begin(), color_raster.end(),
                   marching_raster.begin());
 
@@ -298,9 +568,8 @@ int main(int argc, char *argv[]) {
 
         spi_driver->Transfer(marching_raster);
         offset = (offset + 1) % kIntervalLength;
-
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
-      } while (true);
+      });
+      reactor->Run();
 
     } else {
       spi_driver->Transfer(color_raster);
@@ -311,9 +580,9 @@ int main(int argc, char *argv[]) {
   int indicate_progress = absl::GetFlag(FLAGS_indicate_progress);
   if (indicate_progress > 0) {
     std::cout << "Indicating progress" << std::endl;
-    std::vector<uint8_t> empty_raster(3 * 900 + 2, 0);
+    std::vector<uint8_t> empty_raster(3 * num_leds + 2, 0);
     int index = 0;
-    while (indicate_progress--) {
+    while (indicate_progress-- > 0 && index < num_leds) {
       empty_raster[2 + index * 3] = 100;
       ++index;
     }
@@ -323,27 +592,407 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
-  if (spi_driver == nullptr) {
+  if (spi_devices.empty() && spi_driver == nullptr) {
     std::cerr << "Failed to create SPI driver" << std::endl;
     return 1;
   }
 
-  auto image_buffer_receiver = std::make_shared<SpiImageBufferReceiver>(
-      spi_driver, coordinates, absl::GetFlag(FLAGS_intensity),
-      absl::GetFlag(FLAGS_flicker_threshold),
-      absl::GetFlag(FLAGS_flicker_ratio), absl::GetFlag(FLAGS_clamp_threshold));
+  std::shared_ptr<AudioModulator> audio_modulator;
+  std::shared_ptr<AudioSourceInterface> audio_source;
+  std::shared_ptr<SpectralAnalyzer> analyzer;
+  const bool governor_enabled = absl::GetFlag(FLAGS_governor);
+  if (!absl::GetFlag(FLAGS_audio_modulation).empty() ||
+      (governor_enabled && absl::GetFlag(FLAGS_governor_audio))) {
+    AudioSourceConfig audio_config;
+    audio_config.type = absl::GetFlag(FLAGS_audio_source);
+    audio_config.pulseaudio_server = absl::GetFlag(FLAGS_pulseaudio_server);
+    audio_config.device = (audio_config.type == "alsa")
+                              ? absl::GetFlag(FLAGS_alsa_device)
+                              : absl::GetFlag(FLAGS_pulseaudio_source);
+    audio_config.file = absl::GetFlag(FLAGS_audio_file);
+    audio_config.loop = absl::GetFlag(FLAGS_audio_file_loop);
+    audio_config.options.fragment_frames =
+        absl::GetFlag(FLAGS_audio_fragment_frames);
+    audio_config.options.target_latency =
+        absl::Milliseconds(absl::GetFlag(FLAGS_audio_target_latency_ms));
+
+    SpectralAnalyzer::Config analyzer_config;
+    analyzer_config.sampling_rate = audio_config.options.sampling_rate;
+    analyzer_config.channel_count = audio_config.options.channel_count;
+    analyzer_config.fft_size = audio_fft_size;
+    analyzer_config.hop_size = audio_hop_size;
+    analyzer = SpectralAnalyzer::Create(analyzer_config);
+    if (analyzer == nullptr) {
+      std::cerr << "Failed to create audio analyzer" << std::endl;
+      return 1;
+    }
+
+    // The analyzer runs directly on the audio source's thread.
+    audio_source = CreateAudioSource(
+        audio_config, [analyzer](absl::Span<const float> samples) {
+          analyzer->Process(samples);
+        });
+    if (audio_source == nullptr || !audio_source->Start()) {
+      std::cerr << "Failed to start audio source" << std::endl;
+      return 1;
+    }
+  }
+  if (!absl::GetFlag(FLAGS_audio_modulation).empty()) {
+    AudioModulator::Config modulator_config;
+    if (!AudioModulator::ParseModes(absl::GetFlag(FLAGS_audio_modulation),
+                                    &modulator_config)) {
+      return 1;
+    }
+    modulator_config.pulse_depth = absl::GetFlag(FLAGS_pulse_depth);
+    modulator_config.pulse_decay =
+        absl::Milliseconds(absl::GetFlag(FLAGS_pulse_decay_ms));
+    modulator_config.hue_step_degrees = absl::GetFlag(FLAGS_hue_step_degrees);
+    modulator_config.strobe_duration =
+        absl::Milliseconds(absl::GetFlag(FLAGS_strobe_duration_ms));
+    modulator_config.latency_report_period =
+        absl::Seconds(absl::GetFlag(FLAGS_audio_latency_report_period_s));
+    audio_modulator =
+        std::make_shared<AudioModulator>(modulator_config, analyzer);
+  }
+
+  std::shared_ptr<ClockSyncServer> clock_sync_server;
+  if (absl::GetFlag(FLAGS_clock_sync_port) > 0) {
+    clock_sync_server =
+        ClockSyncServer::Create(absl::GetFlag(FLAGS_clock_sync_port));
+    if (clock_sync_server == nullptr) {
+      std::cerr << "Failed to create clock sync server" << std::endl;
+      return 1;
+    }
+  }
+  std::shared_ptr<ClockSyncClient> clock_sync;
+  if (!absl::GetFlag(FLAGS_clock_sync_server).empty()) {
+    clock_sync = ClockSyncClient::Create(absl::GetFlag(FLAGS_clock_sync_server),
+                                         ClockSyncClient::Options());
+    if (clock_sync == nullptr) {
+      std::cerr << "Failed to create clock sync client" << std::endl;
+      return 1;
+    }
+  }
+  const absl::Duration presentation_delay =
+      absl::Milliseconds(absl::GetFlag(FLAGS_presentation_delay_ms));
+
+  std::shared_ptr<ThreadPool> thread_pool;
+  if (absl::GetFlag(FLAGS_led_threads) > 1) {
+    ThreadSchedule pool_schedule;
+    if (realtime) {
+      pool_schedule.priority = absl::GetFlag(FLAGS_output_thread_priority);
+    }
+    thread_pool = std::make_shared<ThreadPool>(
+        absl::GetFlag(FLAGS_led_threads), pool_schedule);
+  }
+
+  std::shared_ptr<MultiSpiOutput> spi_output;
+  if (!spi_devices.empty()) {
+    MultiSpiOutput::Options spi_options;
+    spi_options.devices = spi_devices;
+    spi_options.barrier = absl::GetFlag(FLAGS_spi_barrier);
+    if (realtime) {
+      spi_options.thread_schedule.priority =
+          absl::GetFlag(FLAGS_output_thread_priority);
+    }
+    spi_output = MultiSpiOutput::Create(num_leds, spi_options);
+    if (spi_output == nullptr) {
+      std::cerr << "Failed to create SPI outputs" << std::endl;
+      return 1;
+    }
+  }
+
+  LedOutput::Options output_options;
+  output_options.num_leds = num_leds;
+  output_options.spi_output = spi_output;
+  output_options.thread_pool = thread_pool;
+  output_options.segment_leds = absl::GetFlag(FLAGS_segment_leds);
+  output_options.intensity = absl::GetFlag(FLAGS_intensity).intensity;
+  output_options.flicker_threshold = absl::GetFlag(FLAGS_flicker_threshold);
+  output_options.flicker_ratio = absl::GetFlag(FLAGS_flicker_ratio);
+  output_options.audio_modulator = audio_modulator;
+  output_options.audio_source = audio_source;
+  if (!absl::GetFlag(FLAGS_network_output).empty()) {
+    output_options.presentation_delay = presentation_delay;
+  }
+  auto led_output = std::make_shared<LedOutput>(spi_driver, output_options);
+
+  std::shared_ptr<FrameRateGovernor> governor;
+  if (governor_enabled) {
+    if (clock_sync != nullptr) {
+      std::cerr << "--governor can't be used with --clock_sync_server, since "
+                   "synchronized nodes share a frame rate"
+                << std::endl;
+      return 1;
+    }
+    FrameRateGovernor::Options governor_options;
+    governor_options.min_fps = absl::GetFlag(FLAGS_governor_min_fps);
+    governor_options.max_fps = absl::GetFlag(FLAGS_output_fps);
+    governor_options.motion_threshold =
+        absl::GetFlag(FLAGS_governor_motion_threshold);
+    governor_options.hold =
+        absl::Milliseconds(absl::GetFlag(FLAGS_governor_hold_ms));
+    governor_options.ramp_down =
+        absl::Milliseconds(absl::GetFlag(FLAGS_governor_ramp_down_ms));
+    governor_options.analyzer = analyzer;
+    governor = std::make_shared<FrameRateGovernor>(led_output->num_leds(),
+                                                   governor_options);
+    led_output->AddSink(governor);
+  }
+
+  if (!absl::GetFlag(FLAGS_record_file).empty()) {
+    auto recording_writer = LedRecordingWriter::Create(
+        absl::GetFlag(FLAGS_record_file),
+        led_output->num_leds() * LedOutput::kLedChannels,
+        absl::GetFlag(FLAGS_record_keyframe_interval),
+        LedRecordingFormat::kStageOutput);
+    if (recording_writer == nullptr) {
+      std::cerr << "Failed to create recording" << std::endl;
+      return 1;
+    }
+    led_output->AddSink(recording_writer);
+  }
+
+  if (!absl::GetFlag(FLAGS_network_output).empty()) {
+    NetworkOutputSink::Options sink_options;
+    if (!NetworkOutputSink::ParseDestinations(
+            absl::GetFlag(FLAGS_network_output), &sink_options.destinations)) {
+      return 1;
+    }
+    sink_options.keyframe_interval =
+        absl::GetFlag(FLAGS_network_output_keyframe_interval);
+    sink_options.presentation_delay = presentation_delay;
+    if (clock_sync != nullptr) {
+      sink_options.clock = [clock_sync]() { return clock_sync->MasterNowNs(); };
+    }
+    auto network_sink =
+        NetworkOutputSink::Create(led_output->num_leds(), sink_options);
+    if (network_sink == nullptr) {
+      std::cerr << "Failed to create network output" << std::endl;
+      return 1;
+    }
+    led_output->AddSink(network_sink);
+  }
+
+  if (!absl::GetFlag(FLAGS_led_tap).empty()) {
+    const std::string stage = absl::GetFlag(FLAGS_led_tap_stage);
+    if (stage != "input" && stage != "output") {
+      std::cerr << "Unknown --led_tap_stage " << stage << std::endl;
+      return 1;
+    }
+    auto tap_writer = LedTapWriter::Create(
+        absl::GetFlag(FLAGS_led_tap),
+        led_output->num_leds() * LedOutput::kLedChannels,
+        stage == "input" ? LedTapFormat::kStageInput
+                         : LedTapFormat::kStageOutput);
+    if (tap_writer == nullptr) {
+      std::cerr << "Failed to create LED tap" << std::endl;
+      return 1;
+    }
+    if (stage == "input") {
+      led_output->AddInputSink(tap_writer);
+    } else {
+      led_output->AddSink(tap_writer);
+    }
+  }
+
+  auto compositor = std::make_shared<LedCompositor>(led_output->num_leds());
+  const bool capture = absl::GetFlag(FLAGS_capture);
+  auto capture_layer = compositor->AddLayer(
+      "capture", LayerSettings(0, 1.0f, BlendMode::REPLACE, capture));
+  std::shared_ptr<LedLayer> effect_layer;
+  std::shared_ptr<EffectEngine> effect_engine;
+  if (!absl::GetFlag(FLAGS_effect).empty()) {
+    EffectEngine::Config effect_config;
+    effect_config.effect = absl::GetFlag(FLAGS_effect);
+    effect_config.palette = absl::GetFlag(FLAGS_effect_palette);
+    effect_config.speed = absl::GetFlag(FLAGS_effect_speed);
+    effect_config.scale = absl::GetFlag(FLAGS_effect_scale);
+    effect_config.palette_speed = absl::GetFlag(FLAGS_effect_palette_speed);
+    effect_engine = EffectEngine::Create(effect_config, mapping_coordinates);
+    if (effect_engine == nullptr) {
+      std::cerr << "Failed to create effect engine" << std::endl;
+      return 1;
+    }
 
-  if (image_buffer_receiver == nullptr) {
-    std::cerr << "Failed to create image buffer receiver" << std::endl;
+    BlendMode effect_blend;
+    if (!ParseBlendMode(absl::GetFlag(FLAGS_effect_blend), &effect_blend)) {
+      std::cerr << "Unknown blend mode: " << absl::GetFlag(FLAGS_effect_blend)
+                << std::endl;
+      return 1;
+    }
+    effect_layer = compositor->AddLayer(
+        "effect", LayerSettings(10, absl::GetFlag(FLAGS_effect_opacity),
+                                effect_blend, true));
+  }
+  std::shared_ptr<LedLayer> boot_layer;
+  std::shared_ptr<BootSequence> boot;
+  if (!absl::GetFlag(FLAGS_boot_recording).empty() ||
+      !absl::GetFlag(FLAGS_boot_effect).empty()) {
+    // Above the capture it stands in for, below everything else.
+    boot_layer = compositor->AddLayer(
+        "boot", LayerSettings(5, 1.0f, BlendMode::REPLACE, true));
+    BootSequence::Options boot_options;
+    boot_options.recording = absl::GetFlag(FLAGS_boot_recording);
+    boot_options.effect = absl::GetFlag(FLAGS_boot_effect);
+    boot_options.crossfade =
+        absl::Milliseconds(absl::GetFlag(FLAGS_boot_crossfade_ms));
+    boot_options.live_frames = absl::GetFlag(FLAGS_boot_live_frames);
+    boot = BootSequence::Create(boot_layer, mapping_coordinates, boot_options);
+    if (boot == nullptr) {
+      std::cerr << "Failed to create boot sequence" << std::endl;
+      return 1;
+    }
+    led_output->AddSink(boot);
+  }
+  std::shared_ptr<NetworkInputSource> network_source;
+  if (absl::GetFlag(FLAGS_network_input)) {
+    // Enabled by the source while frames are arriving.
+    auto network_layer = compositor->AddLayer(
+        "network", LayerSettings(20, 1.0f, BlendMode::REPLACE, false));
+    NetworkInputSource::Options network_options;
+    network_options.bind_address = absl::GetFlag(FLAGS_network_bind_address);
+    network_options.ddp_port = absl::GetFlag(FLAGS_ddp_port);
+    network_options.artnet_port = absl::GetFlag(FLAGS_artnet_port);
+    network_options.e131_port = absl::GetFlag(FLAGS_e131_port);
+    network_options.artnet_universe = absl::GetFlag(FLAGS_artnet_universe);
+    network_options.e131_universe = absl::GetFlag(FLAGS_e131_universe);
+    network_options.universe_channels =
+        absl::GetFlag(FLAGS_network_universe_channels);
+    network_options.timeout =
+        absl::Milliseconds(absl::GetFlag(FLAGS_network_timeout_ms));
+    network_source = NetworkInputSource::Create(network_layer, network_options);
+    if (network_source == nullptr || !network_source->Start()) {
+      std::cerr << "Failed to start network input" << std::endl;
+      return 1;
+    }
+  }
+  auto override_layer = compositor->AddLayer(
+      "override", LayerSettings(30, 1.0f, BlendMode::REPLACE, false));
+  auto status_layer = compositor->AddLayer(
+      "status", LayerSettings(40, 1.0f, BlendMode::REPLACE, false));
+
+  LedOutputLoop::Options loop_options;
+  loop_options.fps = absl::GetFlag(FLAGS_output_fps);
+  loop_options.control_socket = absl::GetFlag(FLAGS_control_socket);
+  loop_options.clock_sync = clock_sync;
+  loop_options.governor = governor;
+  if (realtime) {
+    loop_options.thread_schedule =
+        GetThreadSchedule(absl::GetFlag(FLAGS_output_thread_cpu),
+                          absl::GetFlag(FLAGS_output_thread_priority));
+    loop_options.count_allocations_after_frames = kRealtimeWarmupFrames;
+    loop_options.fail_on_allocation = absl::GetFlag(FLAGS_fail_on_allocation);
+  }
+  auto output_loop =
+      LedOutputLoop::Create(compositor, led_output, loop_options);
+  if (output_loop == nullptr) {
+    std::cerr << "Failed to create output loop" << std::endl;
     return 1;
   }
+  if (boot != nullptr) {
+    output_loop->AddRenderedLayer(
+        boot_layer, [boot](float seconds, absl::Span<uint8_t> frame) {
+          boot->Render(seconds, frame);
+        });
+  }
+  if (effect_engine != nullptr) {
+    output_loop->AddRenderedLayer(
+        effect_layer,
+        [effect_engine](float seconds, absl::Span<uint8_t> frame) {
+          effect_engine->Render(seconds, frame);
+        });
+  }
+  std::shared_ptr<ThermalMonitor> thermal_monitor;
+  if (absl::GetFlag(FLAGS_thermal)) {
+    ThermalMonitor::Options thermal_options;
+    thermal_options.sysfs_root = absl::GetFlag(FLAGS_thermal_sysfs_root);
+    thermal_options.shed_celsius = absl::GetFlag(FLAGS_thermal_shed_celsius);
+    thermal_options.step_celsius = absl::GetFlag(FLAGS_thermal_step_celsius);
+    thermal_monitor = ThermalMonitor::Create(thermal_options);
+    if (thermal_monitor == nullptr) {
+      std::cerr << "Failed to create thermal monitor" << std::endl;
+      return 1;
+    }
+    // Polled on the output thread, which is awake every frame anyway.
+    output_loop->reactor()->AddTimer(
+        absl::ToChronoNanoseconds(thermal_options.poll_period),
+        [thermal_monitor]() {
+          AllocationCounter::Pause pause;
+          thermal_monitor->Poll();
+        });
+    output_loop->AddCommandHandler(
+        [thermal_monitor](absl::string_view command, std::string *reply) {
+          if (command != "thermal") {
+            return false;
+          }
+          const ThermalMonitor::Reading reading = thermal_monitor->reading();
+          *reply = absl::StrFormat(
+              "level %s %.1f C cpu %d MHz limit %d MHz throttled %d "
+              "decisions %d",
+              ThermalMonitor::LevelName(reading.level), reading.celsius,
+              reading.frequency_khz / 1000, reading.limit_frequency_khz / 1000,
+              reading.throttled, reading.decisions);
+          return true;
+        });
+  }
+  if (governor != nullptr) {
+    output_loop->AddCommandHandler(
+        [governor](absl::string_view command, std::string *reply) {
+          if (command != "power") {
+            return false;
+          }
+          const FrameRateGovernor::Estimate estimate = governor->estimate();
+          *reply = absl::StrFormat(
+              "fps %.1f target %.1f motion %.2f audio %.3f cpu %.2f cores "
+              "%.2f W leds %.2f W",
+              estimate.fps, governor->fps(), estimate.motion,
+              estimate.audio_energy, estimate.cpu_load, estimate.cpu_watts,
+              estimate.led_watts);
+          return true;
+        });
+  }
+  output_loop->AddCommandHandler(
+      [override_layer, status_layer](absl::string_view command,
+                                     std::string *reply) {
+        return HandleIndicatorCommand(override_layer.get(), status_layer.get(),
+                                      command, reply);
+      });
 
-  std::shared_ptr<VcCaptureSource> capture_source;
+  if (!capture) {
+    return output_loop->Run();
+  }
+
+  // Capture publishes to its layer on this thread, while the output loop
+  // composites and sends at its own rate. Output starts first, so that the
+  // boot animation and effects light the suit while the capture comes up.
+  int output_status = 0;
+  std::thread output_thread(
+      [&output_loop, &output_status]() { output_status = output_loop->Run(); });
+  auto stop_output = [&output_loop, &output_thread]() {
+    output_loop->Stop();
+    output_thread.join();
+  };
+
+  auto image_buffer_receiver = std::make_shared<SamplingImageBufferReceiver>(
+      capture_layer,
+      LedSampler(LedSampler::ScaleCoordinates(
+                     mapping_coordinates, absl::GetFlag(FLAGS_raster_width),
+                     absl::GetFlag(FLAGS_raster_height)),
+                 absl::GetFlag(FLAGS_clamp_threshold), thread_pool,
+                 absl::GetFlag(FLAGS_segment_leds)),
+      boot);
+
+  std::shared_ptr<ImageBufferReceiverInterface> capture_receiver =
+      image_buffer_receiver;
+  std::shared_ptr<VisualInterestProcessor> visual_interest_processor;
   if (absl::GetFlag(FLAGS_enable_projectm_controller)) {
-    auto projectm_controller = ProjectmController::Create();
+    auto projectm_controller = ProjectmController::Create(
+        absl::GetFlag(FLAGS_projectm_control_socket));
 
     if (projectm_controller == nullptr) {
       std::cerr << "Failed to create projectm controller" << std::endl;
+      stop_output();
       return 1;
     }
 
@@ -355,25 +1004,50 @@ int main(int argc, char *argv[]) {
     config.visual_interest_threshold =
         absl::GetFlag(FLAGS_visual_interest_threshold);
     config.cooldown_duration = absl::GetFlag(FLAGS_cooldown_duration);
-    auto visual_interest_processor =
+    if (realtime) {
+      config.thread_schedule =
+          GetThreadSchedule(absl::GetFlag(FLAGS_analysis_thread_cpu),
+                            absl::GetFlag(FLAGS_analysis_thread_priority));
+    }
+    if (absl::GetFlag(FLAGS_use_points_of_interest)) {
+      for (const auto &point : mapping.points_of_interest()) {
+        if (!point.has_center()) {
+          std::cerr << "Point of interest missing center" << std::endl;
+          continue;
+        }
+        VisualInterestProcessor::RegionOfInterest region;
+        region.x = point.center().x();
+        region.y = point.center().y();
+        region.radius_x = point.radius_x();
+        region.radius_y = point.radius_y();
+        region.weight = point.weight();
+        config.regions_of_interest.push_back(region);
+      }
+    }
+    visual_interest_processor =
         std::make_shared<VisualInterestProcessor>(config, projectm_controller);
 
     if (visual_interest_processor == nullptr) {
       std::cerr << "Failed to create visual interest processor" << std::endl;
     }
 
-    auto image_buffer_receiver_multiplexer =
-        std::shared_ptr<ImageBufferReceiverMultiplexer>(
-            new ImageBufferReceiverMultiplexer(
-                {image_buffer_receiver, visual_interest_processor}));
-
-    capture_source = VcCaptureSource::Create(image_buffer_receiver_multiplexer);
-  } else {
-    capture_source = VcCaptureSource::Create(image_buffer_receiver);
+    capture_receiver = std::shared_ptr<ImageBufferReceiverMultiplexer>(
+        new ImageBufferReceiverMultiplexer(
+            {image_buffer_receiver, visual_interest_processor}));
   }
 
+  // At boot the display may not be up yet; with a boot animation to cover
+  // for it, keep trying until it is.
+  std::shared_ptr<VcCaptureSource> capture_source;
+  while ((capture_source = VcCaptureSource::Create(capture_receiver)) ==
+             nullptr &&
+         boot != nullptr) {
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(absl::GetFlag(FLAGS_capture_retry_ms)));
+  }
   if (capture_source == nullptr) {
     std::cerr << "Failed to create capture source" << std::endl;
+    stop_output();
     return 1;
   }
 
@@ -381,13 +1055,44 @@ int main(int argc, char *argv[]) {
       absl::GetFlag(FLAGS_raster_x), absl::GetFlag(FLAGS_raster_y),
       absl::GetFlag(FLAGS_raster_width), absl::GetFlag(FLAGS_raster_height));
 
-  while (1) {
+  if (realtime) {
+    ApplyThreadSchedule(
+        "capture",
+        GetThreadSchedule(absl::GetFlag(FLAGS_capture_thread_cpu),
+                          absl::GetFlag(FLAGS_capture_thread_priority)));
+  }
+
+  int status = 0;
+  int warmup_captures = realtime ? kRealtimeWarmupFrames : -1;
+  const auto thermal_capture_period = std::chrono::microseconds(
+      1000000 / std::max(absl::GetFlag(FLAGS_thermal_capture_fps), 1));
+  FrameRateGovernor::Clock::time_point last_capture;
+  while (status == 0) {
+    if (warmup_captures >= 0 && warmup_captures-- == 0) {
+      AllocationCounter::SetCounting(true);
+    }
+    if (governor != nullptr) {
+      // Capture follows the output rate; faster would only be discarded.
+      governor->WaitForNextFrame(last_capture);
+    }
+    if (thermal_monitor != nullptr) {
+      if (thermal_monitor->AtLeast(ThermalMonitor::Level::REDUCED_RATE)) {
+        std::this_thread::sleep_until(last_capture + thermal_capture_period);
+      }
+      if (visual_interest_processor != nullptr) {
+        visual_interest_processor->set_paused(
+            thermal_monitor->AtLeast(ThermalMonitor::Level::NO_ANALYSIS));
+      }
+    }
+    if (governor != nullptr || thermal_monitor != nullptr) {
+      last_capture = FrameRateGovernor::Clock::now();
+    }
     if (!capture_source->Capture()) {
-      return 1;
+      status = 1;
     }
   }
-
-  return 0;
+  stop_output();
+  return status != 0 ? status : output_status;
 }
 }  // namespace led_driver
 
@@ -0,0 +1,41 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef LED_FRAME_SINK_H_
+#define LED_FRAME_SINK_H_
+
+#include <cstdint>
+
+#include "absl/types/span.h"
+
+namespace led_driver {
+
+// Receives LED data exactly as it is sent to the LED controller: corrected,
+// with red and green transposed, and without the address header.
+struct LedFrameSinkInterface {
+  virtual ~LedFrameSinkInterface() {}
+
+  // Invoked on the output thread for every frame; must not block for long.
+  virtual bool Receive(absl::Span<const uint8_t> led_data) = 0;
+};
+
+}  // namespace led_driver
+
+#endif  // LED_FRAME_SINK_H_
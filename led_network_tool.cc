@@ -0,0 +1,531 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Generates DDP, Art-Net or E1.31 test frames, for exercising a network input
+// without a lighting desk. With `--output_sink`, the frames are instead sent
+// through a `NetworkOutputSink`, as `led_driver --network_output` does. With
+// `--loopback`, also receives them with a `NetworkInputSource` per destination
+// on the loopback interface, checks that every frame arrives intact and
+// reports the throughput and receive CPU time.
+//
+// Each frame is a ramp, `frame[i] = (i + n) & 0xFF` for frame `n`, so a torn
+// or misassembled frame is detected from its contents alone.
+//
+// Clock-synchronized presentation is checked with several processes: a sender
+// with `--output_sink --clock_sync_port --presentation_delay_ms`, and one
+// `--receive --clock_sync_server` process per destination. The sender's clock
+// can be skewed with `--test_clock_offset_ms` and `--test_clock_drift_ppm`,
+// given to every process, so that the receivers have something to estimate.
+// Each receiver reports how far from the presentation time it released each
+// frame, measured against the true, skewed, master clock.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "clock_sync.h"
+#include "led_compositor.h"
+#include "network_input_source.h"
+#include "network_output_sink.h"
+#include "network_protocol.h"
+
+extern "C" {
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+}
+
+ABSL_FLAG(std::string, protocol, "ddp", "One of ddp, artnet or e131");
+ABSL_FLAG(std::string, host, "127.0.0.1", "Address to send frames to");
+ABSL_FLAG(int, port, 0, "Port to send frames to; zero for the default");
+ABSL_FLAG(int, num_leds, 900, "LEDs per frame");
+ABSL_FLAG(int, fps, 100, "Frames per second to send");
+ABSL_FLAG(int, duration_s, 10, "Seconds to send frames for");
+ABSL_FLAG(int, universe, -1,
+          "First Art-Net or E1.31 universe; -1 for the receiver's default");
+ABSL_FLAG(int, universe_channels, 510, "Channels sent in each universe");
+ABSL_FLAG(bool, sync, false,
+          "If set, follows each Art-Net or E1.31 frame with a synchronization "
+          "packet");
+ABSL_FLAG(bool, loopback, false,
+          "If set, also receives and verifies the frames on this host");
+ABSL_FLAG(bool, output_sink, false,
+          "If set, sends DDP frames through the network output sink, split "
+          "between --sink_destinations destinations on successive ports");
+ABSL_FLAG(int, sink_destinations, 2,
+          "Number of destinations to split frames between with --output_sink");
+ABSL_FLAG(int, clock_sync_port, 0,
+          "If set, serves the sender's clock on this port");
+ABSL_FLAG(int, presentation_delay_ms, 0,
+          "With --output_sink, how far ahead of their presentation time frames "
+          "are sent");
+ABSL_FLAG(bool, receive, false,
+          "If set, receives DDP frames on --port for --duration_s, presenting "
+          "them on the clock of --clock_sync_server");
+ABSL_FLAG(std::string, clock_sync_server, "127.0.0.1:4100",
+          "host:port of the sender's clock, with --receive");
+ABSL_FLAG(double, test_clock_offset_ms, 0,
+          "Offset of the sender's clock from the real clock");
+ABSL_FLAG(double, test_clock_drift_ppm, 0,
+          "Drift of the sender's clock from the real clock");
+
+namespace led_driver {
+
+namespace np = network_protocol;
+
+namespace {
+
+constexpr uint16_t kE131SyncAddress = 64000;
+constexpr uint8_t kCid[16] = {'l', 'e', 'd', '_', 'n', 'e', 't', 'w',
+                              'o', 'r', 'k', '_', 't', 'o', 'o', 'l'};
+
+enum class Protocol { DDP, ARTNET, E131 };
+
+// Receives one destination's frames in loopback mode.
+struct Receiver {
+  std::shared_ptr<LedCompositor> compositor;
+  std::shared_ptr<NetworkInputSource> source;
+  std::vector<uint8_t> frame;
+};
+
+// Sends each frame as a batch of packets with one sendmmsg call.
+class PacketGenerator {
+ public:
+  PacketGenerator(Protocol protocol, int frame_length, int first_universe,
+                  int universe_channels, bool sync)
+      : protocol_(protocol),
+        frame_length_(frame_length),
+        first_universe_(first_universe),
+        universe_channels_(universe_channels),
+        sync_(sync) {
+    const int chunk = protocol_ == Protocol::DDP ? np::kDdpMaxDataLength
+                                                 : universe_channels_;
+    const int max_packets = (frame_length_ + chunk - 1) / chunk + 1;
+    buffers_.resize(max_packets * np::kMaxPacketLength);
+    iovecs_.resize(max_packets);
+    messages_.resize(max_packets);
+  }
+
+  bool Connect(const std::string &host, int port) {
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1) {
+      std::cerr << "Invalid host: " << host << std::endl;
+      return false;
+    }
+    fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd_ < 0 || connect(fd_, reinterpret_cast<sockaddr *>(&address),
+                           sizeof(address)) < 0) {
+      std::cerr << "Failed to connect to " << host << ":" << port << ": "
+                << strerror(errno) << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  ~PacketGenerator() {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  // Sends `frame`. Returns the number of packets sent, or -1.
+  int Send(absl::Span<const uint8_t> frame) {
+    int count = 0;
+    if (protocol_ == Protocol::DDP) {
+      for (int offset = 0; offset < frame_length_;
+           offset += np::kDdpMaxDataLength) {
+        const int length =
+            std::min<int>(np::kDdpMaxDataLength, frame_length_ - offset);
+        ddp_sequence_ = ddp_sequence_ % 15 + 1;
+        const size_t packet_length = np::WriteDdpPacket(
+            ddp_sequence_, offset, offset + length == frame_length_, nullptr,
+            frame.subspan(offset, length), Packet(count));
+        AddPacket(count++, packet_length);
+      }
+    } else {
+      ++sequence_;
+      for (int offset = 0, universe = first_universe_; offset < frame_length_;
+           offset += universe_channels_, ++universe) {
+        const int length =
+            std::min<int>(universe_channels_, frame_length_ - offset);
+        auto channels = frame.subspan(offset, length);
+        const size_t packet_length =
+            protocol_ == Protocol::ARTNET
+                ? np::WriteArtDmxPacket(universe, sequence_, channels,
+                                        Packet(count))
+                : np::WriteE131DataPacket(kCid, universe, sequence_,
+                                          sync_ ? kE131SyncAddress : 0,
+                                          channels, Packet(count));
+        AddPacket(count++, packet_length);
+      }
+      if (sync_) {
+        AddPacket(count, protocol_ == Protocol::ARTNET
+                             ? np::WriteArtSyncPacket(Packet(count))
+                             : np::WriteE131SyncPacket(kCid, kE131SyncAddress,
+                                                       sequence_,
+                                                       Packet(count)));
+        ++count;
+      }
+    }
+
+    int sent = 0;
+    while (sent < count) {
+      int result = sendmmsg(fd_, messages_.data() + sent, count - sent, 0);
+      if (result < 0) {
+        std::cerr << "Failed to send frame: " << strerror(errno) << std::endl;
+        return -1;
+      }
+      sent += result;
+    }
+    return count;
+  }
+
+ private:
+  uint8_t *Packet(int index) {
+    return buffers_.data() + index * np::kMaxPacketLength;
+  }
+
+  void AddPacket(int index, size_t length) {
+    iovecs_[index].iov_base = Packet(index);
+    iovecs_[index].iov_len = length;
+    memset(&messages_[index], 0, sizeof(messages_[index]));
+    messages_[index].msg_hdr.msg_iov = &iovecs_[index];
+    messages_[index].msg_hdr.msg_iovlen = 1;
+  }
+
+  const Protocol protocol_;
+  const int frame_length_;
+  const int first_universe_;
+  const int universe_channels_;
+  const bool sync_;
+
+  int fd_ = -1;
+  uint8_t sequence_ = 0;
+  uint8_t ddp_sequence_ = 0;
+  std::vector<uint8_t> buffers_;
+  std::vector<iovec> iovecs_;
+  std::vector<mmsghdr> messages_;
+};
+
+void FillFrame(int frame_index, absl::Span<uint8_t> frame) {
+  for (size_t i = 0; i < frame.size(); ++i) {
+    frame[i] = (i + frame_index) & 0xFF;
+  }
+}
+
+// Whether `frame` is a whole ramp, as written by `FillFrame`.
+bool IsIntactFrame(absl::Span<const uint8_t> frame) {
+  for (size_t i = 1; i < frame.size(); ++i) {
+    if (frame[i] != ((frame[0] + i) & 0xFF)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The sender's clock, skewed by the test flags.
+int64_t TestMasterNowNs() {
+  const int64_t now_ns = MonotonicNowNs();
+  return now_ns +
+         static_cast<int64_t>(absl::GetFlag(FLAGS_test_clock_offset_ms) * 1e6 +
+                              absl::GetFlag(FLAGS_test_clock_drift_ppm) * 1e-6 *
+                                  now_ns);
+}
+
+int Receive() {
+  auto clock_sync = ClockSyncClient::Create(
+      absl::GetFlag(FLAGS_clock_sync_server), ClockSyncClient::Options());
+  if (clock_sync == nullptr) {
+    return 1;
+  }
+  FramePresenter::Options presenter_options;
+  presenter_options.report_period = absl::ZeroDuration();
+  FramePresenter presenter(clock_sync, presenter_options);
+
+  int64_t skew_sum_ns = 0;
+  int64_t skew_max_ns = 0;
+  int presented = 0;
+  int unscheduled = 0;
+  NetworkInputSource::Options options;
+  options.bind_address = absl::GetFlag(FLAGS_host);
+  options.ddp_port = absl::GetFlag(FLAGS_port) > 0 ? absl::GetFlag(FLAGS_port)
+                                                   : options.ddp_port;
+  options.artnet_port = 0;
+  options.e131_port = 0;
+  options.num_leds = absl::GetFlag(FLAGS_num_leds);
+  options.report_period = absl::ZeroDuration();
+  options.frame_callback = [&](absl::Span<const uint8_t> frame,
+                               absl::optional<uint32_t> timecode) {
+    if (!timecode.has_value() || !clock_sync->estimate().synchronized) {
+      ++unscheduled;
+      return;
+    }
+    presenter.Present(timecode);
+    const int64_t master_now_ns = TestMasterNowNs();
+    const int64_t skew_ns = std::abs(
+        master_now_ns - np::FromDdpTimecode(*timecode, master_now_ns));
+    skew_sum_ns += skew_ns;
+    skew_max_ns = std::max(skew_max_ns, skew_ns);
+    ++presented;
+  };
+  auto source = NetworkInputSource::Create(nullptr, options);
+  if (source == nullptr || !source->Start()) {
+    std::cerr << "Failed to start network input" << std::endl;
+    return 1;
+  }
+  absl::SleepFor(absl::Seconds(absl::GetFlag(FLAGS_duration_s)));
+  source->Stop();
+
+  const ClockSyncClient::Estimate estimate = clock_sync->estimate();
+  std::cout << "Port " << options.ddp_port << ": estimated offset "
+            << estimate.offset_ns / 1e6 << " ms, drift "
+            << estimate.drift * 1e6 << " ppm; presented " << presented
+            << " frames with skew mean "
+            << (presented > 0 ? skew_sum_ns / presented / 1000 : 0)
+            << " us, max " << skew_max_ns / 1000 << " us; " << unscheduled
+            << " unscheduled" << std::endl;
+  return presented > 0 ? 0 : 1;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  absl::ParseCommandLine(argc, argv);
+  if (absl::GetFlag(FLAGS_receive)) {
+    return Receive();
+  }
+
+  const std::string protocol_name = absl::GetFlag(FLAGS_protocol);
+  Protocol protocol;
+  NetworkInputSource::Options options;
+  int default_port;
+  if (protocol_name == "ddp") {
+    protocol = Protocol::DDP;
+    default_port = options.ddp_port;
+  } else if (protocol_name == "artnet") {
+    protocol = Protocol::ARTNET;
+    default_port = options.artnet_port;
+  } else if (protocol_name == "e131") {
+    protocol = Protocol::E131;
+    default_port = options.e131_port;
+  } else {
+    std::cerr << "Unknown protocol: " << protocol_name << std::endl;
+    return 1;
+  }
+  const bool use_sink = absl::GetFlag(FLAGS_output_sink);
+  if (use_sink && protocol != Protocol::DDP) {
+    std::cerr << "--output_sink only sends DDP" << std::endl;
+    return 1;
+  }
+  const int port =
+      absl::GetFlag(FLAGS_port) > 0 ? absl::GetFlag(FLAGS_port) : default_port;
+  if (absl::GetFlag(FLAGS_universe) >= 0) {
+    options.artnet_universe = absl::GetFlag(FLAGS_universe);
+    options.e131_universe = absl::GetFlag(FLAGS_universe);
+  }
+  const int first_universe = protocol == Protocol::ARTNET
+                                 ? options.artnet_universe
+                                 : options.e131_universe;
+  const int num_leds = absl::GetFlag(FLAGS_num_leds);
+  const int frame_length = num_leds * 3;
+
+  // The sink splits the frame evenly between destinations on successive
+  // ports.
+  const int num_destinations =
+      use_sink ? std::clamp(absl::GetFlag(FLAGS_sink_destinations), 1,
+                            num_leds)
+               : 1;
+  std::vector<NetworkOutputSink::Destination> destinations;
+  for (int i = 0; i < num_destinations; ++i) {
+    NetworkOutputSink::Destination destination;
+    destination.host = absl::GetFlag(FLAGS_host);
+    destination.port = port + i;
+    destination.offset = num_leds * i / num_destinations;
+    destination.count =
+        num_leds * (i + 1) / num_destinations - destination.offset;
+    destinations.push_back(destination);
+  }
+
+  // In loopback mode, receive each destination with a compositor holding just
+  // the network layer, so that frames are read back exactly as the output
+  // would see them.
+  std::vector<Receiver> receivers;
+  if (absl::GetFlag(FLAGS_loopback)) {
+    for (const auto &destination : destinations) {
+      Receiver receiver;
+      receiver.compositor = std::make_shared<LedCompositor>(destination.count);
+      LedLayer::Settings settings;
+      settings.enabled = false;
+      auto layer = receiver.compositor->AddLayer("network", settings);
+
+      options.bind_address = destination.host;
+      options.ddp_port = protocol == Protocol::DDP ? destination.port : 0;
+      options.artnet_port = protocol == Protocol::ARTNET ? port : 0;
+      options.e131_port = protocol == Protocol::E131 ? port : 0;
+      options.universe_channels = absl::GetFlag(FLAGS_universe_channels);
+      options.report_period = absl::ZeroDuration();
+      receiver.source = NetworkInputSource::Create(layer, options);
+      if (receiver.source == nullptr || !receiver.source->Start()) {
+        std::cerr << "Failed to start network input" << std::endl;
+        return 1;
+      }
+      receiver.frame.resize(destination.count * 3);
+      receivers.push_back(std::move(receiver));
+    }
+  }
+
+  std::shared_ptr<ClockSyncServer> clock_sync_server;
+  if (absl::GetFlag(FLAGS_clock_sync_port) > 0) {
+    clock_sync_server = ClockSyncServer::Create(
+        absl::GetFlag(FLAGS_clock_sync_port), TestMasterNowNs);
+    if (clock_sync_server == nullptr) {
+      return 1;
+    }
+  }
+
+  std::unique_ptr<PacketGenerator> generator;
+  std::shared_ptr<NetworkOutputSink> sink;
+  if (use_sink) {
+    NetworkOutputSink::Options sink_options;
+    sink_options.destinations = destinations;
+    sink_options.presentation_delay =
+        absl::Milliseconds(absl::GetFlag(FLAGS_presentation_delay_ms));
+    sink_options.clock = TestMasterNowNs;
+    sink = NetworkOutputSink::Create(num_leds, sink_options);
+    if (sink == nullptr) {
+      return 1;
+    }
+  } else {
+    generator = std::make_unique<PacketGenerator>(
+        protocol, frame_length, first_universe,
+        absl::GetFlag(FLAGS_universe_channels), absl::GetFlag(FLAGS_sync));
+    if (!generator->Connect(absl::GetFlag(FLAGS_host), port)) {
+      return 1;
+    }
+  }
+
+  std::vector<uint8_t> frame(frame_length);
+  using Clock = std::chrono::steady_clock;
+  const Clock::duration period = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(1.0 / std::max(absl::GetFlag(FLAGS_fps),
+                                                   1)));
+  const int num_frames =
+      absl::GetFlag(FLAGS_duration_s) * absl::GetFlag(FLAGS_fps);
+
+  uint64_t packets = 0;
+  int intact_frames = 0;
+  int torn_frames = 0;
+  int missing_frames = 0;
+  Clock::duration send_time{0};
+  const absl::Time start_time = absl::Now();
+  Clock::time_point deadline = Clock::now();
+  for (int i = 0; i < num_frames; ++i) {
+    FillFrame(i, absl::MakeSpan(frame));
+    const Clock::time_point send_start = Clock::now();
+    if (sink != nullptr) {
+      sink->Receive(frame);
+    } else {
+      const int sent = generator->Send(frame);
+      if (sent < 0) {
+        return 1;
+      }
+      packets += sent;
+    }
+    send_time += Clock::now() - send_start;
+
+    deadline += period;
+    std::this_thread::sleep_until(deadline);
+
+    for (Receiver &receiver : receivers) {
+      receiver.compositor->Composite(absl::MakeSpan(receiver.frame));
+      if (std::all_of(receiver.frame.begin(), receiver.frame.end(),
+                      [](uint8_t value) { return value == 0; })) {
+        // Nothing has arrived yet, so the layer is still disabled.
+        ++missing_frames;
+      } else if (IsIntactFrame(receiver.frame)) {
+        ++intact_frames;
+      } else {
+        ++torn_frames;
+      }
+    }
+  }
+  const absl::Duration elapsed = absl::Now() - start_time;
+
+  if (sink != nullptr) {
+    const NetworkOutputSink::Stats stats = sink->stats();
+    packets = stats.packets;
+    std::cout << "Sink sent " << stats.bytes * 8 / 1e6 /
+                                     absl::ToDoubleSeconds(elapsed)
+              << " Mbit/s, " << stats.dropped_frames << " frames dropped"
+              << std::endl;
+  }
+  std::cout << "Sent " << num_frames << " frames in " << packets
+            << " packets over " << elapsed << " ("
+            << num_frames / absl::ToDoubleSeconds(elapsed) << " FPS, "
+            << std::chrono::duration<double, std::micro>(send_time).count() /
+                   std::max(num_frames, 1)
+            << " us per frame)" << std::endl;
+
+  bool complete = true;
+  for (Receiver &receiver : receivers) {
+    // Let the last packets drain.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    receiver.source->Stop();
+    const NetworkInputSource::Stats stats = receiver.source->stats();
+    std::cout << "Received " << stats.frames << " frames in " << stats.packets
+              << " packets and " << stats.batches << " batches ("
+              << static_cast<double>(stats.packets) /
+                     std::max<uint64_t>(stats.batches, 1)
+              << " packets per batch), " << stats.out_of_order
+              << " out of order, " << stats.invalid << " invalid" << std::endl;
+    std::cout << "Receive CPU: " << stats.cpu_time << " ("
+              << 100.0 * absl::FDivDuration(stats.cpu_time, elapsed) << "%)"
+              << std::endl;
+    complete &= stats.frames >= static_cast<uint64_t>(num_frames);
+  }
+  if (!receivers.empty()) {
+    std::cout << "Checked " << intact_frames + torn_frames << " frames: "
+              << torn_frames << " torn, " << missing_frames
+              << " checks before the first frame" << std::endl;
+    if (torn_frames > 0 || !complete) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+}  // namespace led_driver
+
+int main(int argc, char *argv[]) { return led_driver::main(argc, argv); }
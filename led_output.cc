@@ -0,0 +1,198 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "led_output.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "absl/time/clock.h"
+
+namespace led_driver {
+namespace {
+constexpr uint32_t kFlickerModulus = 0x3;
+constexpr size_t kHeaderLength = 2;
+
+const std::string kDevice = "/dev/spidev0.0";
+constexpr SpiDriver::ClockPolarity kClockPolarity =
+    SpiDriver::ClockPolarity::IDLE_LOW;
+constexpr SpiDriver::ClockPhase kClockPhase =
+    SpiDriver::ClockPhase::SAMPLE_LEADING;
+constexpr int kBitsPerWord = 8;
+constexpr int kSpeedHz = 15600000;
+constexpr int kDelayUs = 0;
+}  // namespace
+
+std::shared_ptr<SpiDriver> CreateLedSpiDriver() {
+  return SpiDriver::Create(kDevice, kClockPolarity, kClockPhase, kBitsPerWord,
+                           kSpeedHz, kDelayUs);
+}
+
+LedOutput::LedOutput(std::shared_ptr<SpiDriver> spi_driver, Options options)
+    : spi_driver_(std::move(spi_driver)),
+      options_(std::move(options)),
+      output_buffer_(kHeaderLength + options_.num_leds * kLedChannels, 0),
+      segment_leds_(options_.thread_pool != nullptr
+                        ? std::max(options_.segment_leds, 1)
+                        : std::max(options_.num_leds, 1)),
+      over_threshold_(LedSegments::MaxCount(options_.num_leds, segment_leds_)) {
+  // LED data address + mode.
+  output_buffer_[0] = 0x80;
+  output_buffer_[1] = 0x00;
+}
+
+void LedOutput::Process(absl::Span<const uint8_t> frame,
+                        absl::Span<uint8_t> pixels, bool correct) {
+  ForEachSegment(pixels, [this, frame, pixels](int segment, int begin,
+                                               int end) {
+    absl::Span<uint8_t> segment_pixels =
+        pixels.subspan(begin * kLedChannels, (end - begin) * kLedChannels);
+    const size_t offset = std::min<size_t>(frame.size(), begin * kLedChannels);
+    const size_t copied =
+        std::min(frame.size() - offset, segment_pixels.size());
+    memcpy(segment_pixels.data(), frame.data() + offset, copied);
+    memset(segment_pixels.data() + copied, 0, segment_pixels.size() - copied);
+
+    size_t num_over_threshold = 0;
+    for (uint8_t value : segment_pixels) {
+      if (value > options_.flicker_threshold) {
+        ++num_over_threshold;
+      }
+    }
+    over_threshold_[segment].value = num_over_threshold;
+  });
+
+  // If more than `flicker_ratio` of the channels are over the threshold, only
+  // every fourth LED is lit, rotating each frame.
+  ++flicker_counter_;
+  size_t num_over_threshold = 0;
+  const LedSegments segments(pixels.data(), options_.num_leds, segment_leds_);
+  for (int segment = 0; segment < segments.count(); ++segment) {
+    num_over_threshold += over_threshold_[segment].value;
+  }
+  const bool compensate =
+      num_over_threshold >
+      static_cast<size_t>(pixels.size() * options_.flicker_ratio);
+  const uint32_t lit_phase = flicker_counter_ & kFlickerModulus;
+
+  // Audio modulation is applied to the sampled colors, before they are
+  // corrected for the LEDs, using the latest audio features.
+  AudioModulator::Modulation modulation;
+  modulation.identity = true;
+  if (options_.audio_modulator != nullptr) {
+    modulation = options_.audio_modulator->Prepare(absl::Now());
+  }
+
+  ForEachSegment(pixels, [this, pixels, compensate, lit_phase, &modulation,
+                          correct](int segment, int begin, int end) {
+    absl::Span<uint8_t> segment_pixels =
+        pixels.subspan(begin * kLedChannels, (end - begin) * kLedChannels);
+    if (compensate) {
+      for (int i = begin; i < end; ++i) {
+        if ((i & kFlickerModulus) != lit_phase) {
+          memset(&pixels[i * kLedChannels], 0, kLedChannels);
+        }
+      }
+    }
+    ScalePixelValues(segment_pixels.data(), options_.intensity, end - begin);
+    AudioModulator::Modulate(modulation, segment_pixels);
+    if (correct) {
+      CorrectSegment(segment_pixels);
+    }
+  });
+}
+
+void LedOutput::Correct(absl::Span<uint8_t> pixels) const {
+  ForEachSegment(pixels, [this, pixels](int segment, int begin, int end) {
+    CorrectSegment(
+        pixels.subspan(begin * kLedChannels, (end - begin) * kLedChannels));
+  });
+}
+
+void LedOutput::CorrectSegment(absl::Span<uint8_t> pixels) const {
+  const int num_pixels = pixels.size() / kLedChannels;
+  corrector_.CorrectPixelsInPlace(pixels.data(), num_pixels);
+  TransposeRedGreen(pixels.data(), num_pixels);
+}
+
+bool LedOutput::Render(absl::Span<const uint8_t> frame,
+                       absl::Span<uint8_t> led_data) {
+  if (led_data.size() != static_cast<size_t>(options_.num_leds) *
+                             kLedChannels) {
+    return false;
+  }
+  Process(frame, led_data, true);
+  return true;
+}
+
+bool LedOutput::Transfer(absl::Span<const uint8_t> pixels) {
+  if (options_.spi_output != nullptr) {
+    return options_.spi_output->Receive(pixels);
+  }
+  if (spi_driver_ != nullptr) {
+    return spi_driver_->Transfer(output_buffer_);
+  }
+  return true;
+}
+
+bool LedOutput::Send(absl::Span<const uint8_t> frame) {
+  const size_t length = options_.num_leds * kLedChannels;
+  absl::Span<uint8_t> pixels(&output_buffer_[kHeaderLength], length);
+  // Input sinks need the frame between processing and correction; otherwise
+  // each segment is corrected while it is still in cache.
+  Process(frame, pixels, input_sinks_.empty());
+
+  bool result = true;
+  if (!input_sinks_.empty()) {
+    for (const auto &sink : input_sinks_) {
+      result &= sink->Receive(pixels);
+    }
+    Correct(pixels);
+  }
+  if (options_.presentation_delay > absl::ZeroDuration()) {
+    const auto presentation_time =
+        std::chrono::steady_clock::now() +
+        absl::ToChronoNanoseconds(options_.presentation_delay);
+    for (const auto &sink : sinks_) {
+      result &= sink->Receive(pixels);
+    }
+    std::this_thread::sleep_until(presentation_time);
+    result &= Transfer(pixels);
+  } else {
+    result &= Transfer(pixels);
+    for (const auto &sink : sinks_) {
+      result &= sink->Receive(pixels);
+    }
+  }
+
+  if (options_.audio_modulator != nullptr) {
+    options_.audio_modulator->FrameShown(
+        absl::Now(), options_.audio_source != nullptr
+                         ? options_.audio_source->GetLatency()
+                         : absl::InfiniteDuration());
+  }
+  return result;
+}
+
+}  // namespace led_driver
@@ -0,0 +1,173 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef LED_OUTPUT_H_
+#define LED_OUTPUT_H_
+
+#include <cstdint>
+
+#include <memory>
+#include <vector>
+
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "audio_modulator.h"
+#include "audio_source.h"
+#include "led_frame_sink.h"
+#include "led_segments.h"
+#include "pixel_utils.h"
+#include "spi_driver.h"
+#include "thread_pool.h"
+
+namespace led_driver {
+
+// Creates the SPI driver for the LED controller. Returns nullptr on failure.
+std::shared_ptr<SpiDriver> CreateLedSpiDriver();
+
+// The final stage of the LED pipeline, shared by every content source. Takes
+// frames of RGB triplets in mapping order, applies the full-white flicker
+// compensation, intensity scaling, audio modulation and color correction, and
+// transfers them to the LED controller. With a thread pool, each stage runs on
+// segments of the frame in parallel, in place in the wire buffer.
+class LedOutput {
+ public:
+  static constexpr int kLedChannels = 3;
+
+  struct Options {
+    int num_leds = 900;
+
+    // Scale factor for LED intensity, in [0, 1].
+    float intensity = 1.0f;
+
+    // If more than `flicker_ratio` of the channels exceed `flicker_threshold`,
+    // only every fourth LED is lit, rotating each frame, to limit the current
+    // drawn by full-white frames.
+    int flicker_threshold = 200;
+    float flicker_ratio = 0.8f;
+
+    // If positive, frames are passed to the sinks this long before they are
+    // transferred, so that remote controllers given the same delay latch
+    // them at the same instant.
+    absl::Duration presentation_delay;
+
+    // Optional audio modulation, and the source whose latency it reports.
+    std::shared_ptr<AudioModulator> audio_modulator;
+    std::shared_ptr<AudioSourceInterface> audio_source;
+
+    // If set, LED data is transferred through this, such as a
+    // `MultiSpiOutput`, instead of the SPI driver, when the driver would have
+    // transferred it.
+    std::shared_ptr<LedFrameSinkInterface> spi_output;
+
+    // If set, frames are processed in segments of about `segment_leds` LEDs
+    // on this pool.
+    std::shared_ptr<ThreadPool> thread_pool;
+    int segment_leds = 4096;
+  };
+
+  // If neither `spi_driver` nor `options.spi_output` is set, frames are only
+  // passed to the sinks.
+  LedOutput(std::shared_ptr<SpiDriver> spi_driver, Options options);
+
+  // Adds a sink which receives a copy of every frame sent. Must be called
+  // before frames are sent.
+  void AddSink(std::shared_ptr<LedFrameSinkInterface> sink) {
+    sinks_.push_back(std::move(sink));
+  }
+
+  // Adds a sink which receives every frame as RGB, after intensity scaling
+  // and audio modulation but before color correction.
+  void AddInputSink(std::shared_ptr<LedFrameSinkInterface> sink) {
+    input_sinks_.push_back(std::move(sink));
+  }
+
+  // Sends a frame of `num_leds()` RGB triplets. Frames which are shorter are
+  // padded with black. Must only be called from one thread at a time.
+  bool Send(absl::Span<const uint8_t> frame);
+
+  // Applies every stage of `Send` to `frame` without transferring it, writing
+  // the LED data, as it would be sent, to `led_data`. Returns false unless
+  // `led_data` holds exactly `num_leds()` triplets. Shares the flicker state
+  // with `Send`, so must not be called concurrently with it.
+  bool Render(absl::Span<const uint8_t> frame, absl::Span<uint8_t> led_data);
+
+  int num_leds() const { return options_.num_leds; }
+
+ private:
+  // A count for each segment, on a cache line of its own.
+  struct alignas(LedSegments::kCacheLineSize) SegmentCount {
+    size_t value;
+  };
+
+  // Copies `frame` into `pixels`, padding it with black, and applies the
+  // flicker compensation, intensity scaling and audio modulation; and with
+  // `correct`, the color correction too.
+  void Process(absl::Span<const uint8_t> frame, absl::Span<uint8_t> pixels,
+               bool correct);
+
+  // Corrects `pixels` for the LEDs and transposes red and green.
+  void Correct(absl::Span<uint8_t> pixels) const;
+  void CorrectSegment(absl::Span<uint8_t> pixels) const;
+
+  // Transfers the output buffer, whose LED data is `pixels`, to the LEDs.
+  bool Transfer(absl::Span<const uint8_t> pixels);
+
+  // Runs `body(segment, begin, end)` for each segment of `pixels`, on the
+  // thread pool if there is one.
+  template <typename F>
+  void ForEachSegment(absl::Span<uint8_t> pixels, F &&body) const {
+    const LedSegments segments(pixels.data(), options_.num_leds,
+                               segment_leds_);
+    if (options_.thread_pool == nullptr) {
+      for (int segment = 0; segment < segments.count(); ++segment) {
+        body(segment, segments.begin(segment), segments.end(segment));
+      }
+      return;
+    }
+    options_.thread_pool->ParallelFor(
+        segments.count(), [&segments, &body](int segment) {
+          body(segment, segments.begin(segment), segments.end(segment));
+        });
+  }
+
+  std::shared_ptr<SpiDriver> spi_driver_;
+  const Options options_;
+  std::vector<std::shared_ptr<LedFrameSinkInterface>> sinks_;
+  std::vector<std::shared_ptr<LedFrameSinkInterface>> input_sinks_;
+
+  // LED data address and mode, followed by the LED data.
+  std::vector<uint8_t> output_buffer_;
+
+  uint32_t flicker_counter_ = 0;
+
+  // The whole frame is one segment without a thread pool.
+  const int segment_leds_;
+  // Channels over the flicker threshold in each segment.
+  std::vector<SegmentCount> over_threshold_;
+
+  const ColorCorrector corrector_{
+      {.gamma = {2.8f, 2.8f, 2.8f},
+       .peak_brightness = {(390.0f + 420.0f) / 2, (660.0f + 720.0f) / 2,
+                           (180.0f + 200.0f) / 2}}};
+};
+
+}  // namespace led_driver
+
+#endif  // LED_OUTPUT_H_
@@ -0,0 +1,238 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "led_output_loop.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#include "allocation_counter.h"
+
+extern "C" {
+#include <sys/epoll.h>
+}
+
+namespace led_driver {
+
+bool LedOutputLoop::Initialize() {
+  frame_.resize(led_output_->num_leds() * LedOutput::kLedChannels, 0);
+
+  reactor_ = EventReactor::Create();
+  if (reactor_ == nullptr) {
+    std::cerr << "Failed to create output event reactor" << std::endl;
+    return false;
+  }
+
+  if (!options_.control_socket.empty()) {
+    control_server_ = ControlChannelServer::Create(options_.control_socket);
+    if (control_server_ == nullptr) {
+      std::cerr << "Failed to create control channel on "
+                << options_.control_socket << std::endl;
+      return false;
+    }
+    const ControlChannelServer::CommandHandlerType command_handler =
+        [this](absl::string_view command) { return HandleCommand(command); };
+    if (!reactor_->AddFd(control_server_->fd(), EPOLLIN,
+                         [this, command_handler](uint32_t /*events*/) {
+                           AllocationCounter::Pause pause;
+                           control_server_->Poll(command_handler);
+                         })) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void LedOutputLoop::AddRenderedLayer(std::shared_ptr<LedLayer> layer,
+                                     RenderFunctionType render) {
+  rendered_layers_.emplace_back(std::move(layer), std::move(render));
+}
+
+void LedOutputLoop::AddCommandHandler(CommandHandlerType handler) {
+  command_handlers_.push_back(std::move(handler));
+}
+
+std::string LedOutputLoop::HandleCommand(absl::string_view command) {
+  std::string reply;
+  for (const auto &handler : command_handlers_) {
+    if (handler(command, &reply)) {
+      return reply;
+    }
+  }
+  return compositor_->HandleCommand(command);
+}
+
+int LedOutputLoop::Run() {
+  ApplyThreadSchedule("led_output", options_.thread_schedule);
+
+  using Clock = EventReactor::Clock;
+  const Clock::duration period = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(1.0 / std::max(options_.fps, 1)));
+
+  const Clock::time_point start = Clock::now();
+  Clock::time_point deadline = start;
+  int late_frames = 0;
+  int frames = 0;
+  Clock::duration busy_time{0};
+  const int64_t period_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(period).count();
+  int64_t boundary_ns = 0;
+  int64_t skew_sum_ns = 0;
+  int64_t skew_max_ns = 0;
+  int synchronized_frames = 0;
+  int64_t total_frames = 0;
+  uint64_t allocations_reported = 0;
+  int status = 0;
+  const std::shared_ptr<FrameRateGovernor> governor =
+      options_.clock_sync == nullptr ? options_.governor : nullptr;
+
+  // Each frame reschedules the frame timer for the next deadline, which the
+  // governor and clock sync can move.
+  EventReactor::TimerId frame_timer = EventReactor::kNoTimer;
+  frame_timer = reactor_->AddTimer(period, [&]() {
+    if (options_.count_allocations_after_frames > 0 &&
+        total_frames++ == options_.count_allocations_after_frames) {
+      AllocationCounter::SetCounting(true);
+    }
+
+    const Clock::time_point frame_start = Clock::now();
+    if (boundary_ns != 0) {
+      const int64_t skew_ns =
+          std::abs(options_.clock_sync->MasterNowNs() - boundary_ns);
+      skew_sum_ns += skew_ns;
+      skew_max_ns = std::max(skew_max_ns, skew_ns);
+      ++synchronized_frames;
+      boundary_ns = 0;
+    }
+
+    const float seconds =
+        std::chrono::duration<float>(deadline - start).count();
+    for (auto &rendered_layer : rendered_layers_) {
+      if (!rendered_layer.first->enabled()) {
+        continue;
+      }
+      rendered_layer.second(seconds, rendered_layer.first->back());
+      rendered_layer.first->Publish();
+    }
+
+    compositor_->Composite(absl::MakeSpan(frame_));
+    if (!led_output_->Send(frame_)) {
+      std::cerr << "Failed to send frame" << std::endl;
+      status = 1;
+      reactor_->Stop();
+      return;
+    }
+
+    const Clock::time_point frame_end = Clock::now();
+    busy_time += frame_end - frame_start;
+    ++frames;
+
+    if (options_.fail_on_allocation && AllocationCounter::count() != 0) {
+      std::cerr << "Output allocated " << AllocationCounter::count()
+                << " times in steady state" << std::endl;
+      status = 1;
+      reactor_->Stop();
+      return;
+    }
+
+    const Clock::duration frame_period =
+        governor != nullptr ? governor->period() : period;
+    deadline += frame_period;
+    if (frame_end > deadline) {
+      // Skip the missed deadlines rather than rushing to catch up.
+      ++late_frames;
+      deadline += ((frame_end - deadline) / frame_period + 1) * frame_period;
+    }
+    if (options_.clock_sync != nullptr &&
+        options_.clock_sync->estimate().synchronized) {
+      // Start the next frame on the next period boundary of the master
+      // clock instead.
+      const int64_t master_now_ns = options_.clock_sync->MasterNowNs();
+      boundary_ns = (master_now_ns / period_ns + 1) * period_ns;
+      deadline = Clock::time_point(std::chrono::nanoseconds(
+          options_.clock_sync->ToLocalNs(boundary_ns)));
+    }
+    reactor_->Reschedule(frame_timer, deadline);
+  });
+  reactor_->Reschedule(frame_timer, start);
+
+  EventReactor::TimerId report_timer = EventReactor::kNoTimer;
+  if (options_.report_period > absl::ZeroDuration()) {
+    report_timer = reactor_->AddTimer(
+        absl::ToChronoNanoseconds(options_.report_period), [&]() {
+          if (frames == 0) {
+            return;
+          }
+          std::cout << "Output: "
+                    << std::chrono::duration<double, std::micro>(busy_time)
+                               .count() /
+                           frames
+                    << " us per frame, " << late_frames << " late of "
+                    << frames << " frames";
+          if (synchronized_frames > 0) {
+            std::cout << ", sync skew mean "
+                      << skew_sum_ns / synchronized_frames / 1000
+                      << " us, max " << skew_max_ns / 1000 << " us";
+          }
+          if (governor != nullptr) {
+            const FrameRateGovernor::Estimate estimate = governor->estimate();
+            std::cout << ", governed to " << estimate.fps << " fps, CPU "
+                      << estimate.cpu_watts << " W, LEDs "
+                      << estimate.led_watts << " W";
+          }
+          if (AllocationCounter::counting()) {
+            std::cout << ", "
+                      << AllocationCounter::count() - allocations_reported
+                      << " allocations";
+            allocations_reported = AllocationCounter::count();
+          }
+          std::cout << std::endl;
+          frames = 0;
+          late_frames = 0;
+          busy_time = Clock::duration{0};
+          skew_sum_ns = 0;
+          skew_max_ns = 0;
+          synchronized_frames = 0;
+        });
+  }
+
+  EventReactor::TimerId audio_timer = EventReactor::kNoTimer;
+  if (governor != nullptr && governor->watches_audio()) {
+    // Wakes at the highest rate to check for onsets, which start the next
+    // frame at once.
+    audio_timer = reactor_->AddTimer(governor->min_period(), [&]() {
+      if (governor->PollAudio()) {
+        deadline = Clock::now();
+        reactor_->Reschedule(frame_timer, deadline);
+      }
+    });
+  }
+
+  reactor_->Run();
+
+  reactor_->Cancel(frame_timer);
+  reactor_->Cancel(report_timer);
+  reactor_->Cancel(audio_timer);
+  return status;
+}
+
+}  // namespace led_driver
@@ -0,0 +1,153 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef LED_OUTPUT_LOOP_H_
+#define LED_OUTPUT_LOOP_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "clock_sync.h"
+#include "control_channel.h"
+#include "event_reactor.h"
+#include "frame_rate_governor.h"
+#include "led_compositor.h"
+#include "led_output.h"
+#include "realtime.h"
+
+namespace led_driver {
+
+// Drives the LED output at a fixed frame rate: renders the layers which are
+// rendered on demand, composites all the layers, and sends the result. Frames
+// are paced against absolute deadlines, so render and transfer time don't
+// accumulate as drift. The loop runs on an `EventReactor`, which sleeps until
+// the next frame deadline, control command or other task is due. Control
+// commands are handled between frames, so layers can be reconfigured without
+// interrupting output.
+class LedOutputLoop {
+ public:
+  struct Options {
+    int fps = 60;
+
+    // Unix socket to accept control commands on; empty to disable.
+    std::string control_socket;
+
+    // Period at which to log frame timing; zero to disable.
+    absl::Duration report_period = absl::Seconds(10);
+
+    // If set, frames start on multiples of the frame period on the master
+    // clock once it is synchronized, so that nodes rendering their own
+    // content switch frames together.
+    std::shared_ptr<ClockSyncClient> clock_sync;
+
+    // If set, sets the frame rate instead of `fps`, and is polled for audio
+    // onsets while the loop waits for the next frame. It should also be a
+    // sink on the output. Ignored when `clock_sync` is set, since nodes must
+    // share a frame rate to switch frames together.
+    std::shared_ptr<FrameRateGovernor> governor;
+
+    // Scheduling for the thread which calls `Run`.
+    ThreadSchedule thread_schedule;
+
+    // If positive, heap allocations on the output thread are counted after
+    // this many frames, when every per-frame buffer should have been
+    // allocated, and reported with the frame timing. Control commands aren't
+    // counted.
+    int count_allocations_after_frames = 0;
+
+    // Whether `Run` fails as soon as an allocation is counted, for checking
+    // the output path in CI.
+    bool fail_on_allocation = false;
+  };
+
+  // Renders a layer's frame at `seconds` since the loop started.
+  using RenderFunctionType =
+      std::function<void(float seconds, absl::Span<uint8_t> frame)>;
+
+  // Handles a control command. Returns false if the command isn't recognized,
+  // so that the next handler can try it.
+  using CommandHandlerType =
+      std::function<bool(absl::string_view command, std::string *reply)>;
+
+  template <typename... A>
+  static std::shared_ptr<LedOutputLoop> Create(A &&... args) {
+    auto loop = std::shared_ptr<LedOutputLoop>(
+        new LedOutputLoop(std::forward<A>(args)...));
+    if (!loop->Initialize()) {
+      return nullptr;
+    }
+    return loop;
+  }
+
+  // Renders `layer` with `render` before each composite. Must be called
+  // before `Run`.
+  void AddRenderedLayer(std::shared_ptr<LedLayer> layer,
+                        RenderFunctionType render);
+
+  // Adds a control command handler. Handlers are tried in the order added,
+  // before the compositor's own commands. Must be called before `Run`.
+  void AddCommandHandler(CommandHandlerType handler);
+
+  // The reactor which runs the loop, for running other periodic tasks on the
+  // output thread rather than on threads of their own. Tasks share the
+  // thread with the output, so they must be short, and once allocations are
+  // counted, mustn't allocate unless they pause the count.
+  EventReactor *reactor() const { return reactor_.get(); }
+
+  // Runs until `Stop` is called or a frame fails to send. Returns the exit
+  // status.
+  int Run();
+
+  // Safe to call from any thread.
+  void Stop() { reactor_->Stop(); }
+
+ private:
+  LedOutputLoop(std::shared_ptr<LedCompositor> compositor,
+                std::shared_ptr<LedOutput> led_output, Options options)
+      : compositor_(std::move(compositor)),
+        led_output_(std::move(led_output)),
+        options_(std::move(options)) {}
+
+  bool Initialize();
+
+  std::string HandleCommand(absl::string_view command);
+
+  std::shared_ptr<LedCompositor> compositor_;
+  std::shared_ptr<LedOutput> led_output_;
+  const Options options_;
+
+  std::shared_ptr<EventReactor> reactor_;
+  std::shared_ptr<ControlChannelServer> control_server_;
+  std::vector<std::pair<std::shared_ptr<LedLayer>, RenderFunctionType>>
+      rendered_layers_;
+  std::vector<CommandHandlerType> command_handlers_;
+
+  std::vector<uint8_t> frame_;
+};
+
+}  // namespace led_driver
+
+#endif  // LED_OUTPUT_LOOP_H_
@@ -0,0 +1,79 @@
+# LED Suit Driver - Embedded host driver software for Kevin's LED suit controller.
+# Copyright (C) 2019-2020 Kevin Balke
+#
+# This file is part of LED Suit Driver.
+#
+# LED Suit Driver is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# LED Suit Driver is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+"""Compares the per-frame cost of driving the LED pipeline from Python with
+the same loop run entirely in C++.
+
+Each frame is sampled from a captured image and rendered (or, with --send,
+sent to the LEDs), reading and writing NumPy arrays in place.
+"""
+
+import time
+
+import numpy
+from absl import app
+from absl import flags
+
+import led_driver.pywrap_led_pipeline as led_pipeline
+
+flags.DEFINE_integer("num_leds", 900, "LEDs in the synthetic mapping")
+flags.DEFINE_integer("raster_width", 100, "Width of the synthetic image")
+flags.DEFINE_integer("raster_height", 100, "Height of the synthetic image")
+flags.DEFINE_integer("iterations", 20000, "Frames to time in each loop")
+flags.DEFINE_bool("send", False,
+                  "Whether to send frames over SPI, rather than only render "
+                  "them")
+
+FLAGS = flags.FLAGS
+
+
+def main(argv):
+    random = numpy.random.RandomState(1)
+    coordinates = random.random_sample(
+        (FLAGS.num_leds, 2)).astype(numpy.float32)
+    image = random.randint(0, 256,
+                           (FLAGS.raster_height, FLAGS.raster_width, 3),
+                           dtype=numpy.uint8)
+    row_stride = image.strides[0]
+
+    sampler = led_pipeline.LedSampler(coordinates, FLAGS.raster_width,
+                                      FLAGS.raster_height, 0)
+    output = led_pipeline.LedOutput(FLAGS.num_leds, 1.0, FLAGS.send)
+    frame = numpy.zeros((FLAGS.num_leds, 3), dtype=numpy.uint8)
+    led_data = numpy.zeros_like(frame)
+
+    start = time.perf_counter()
+    for _ in range(FLAGS.iterations):
+        sampler.Sample(image, row_stride, frame)
+        if FLAGS.send:
+            output.Send(frame)
+        else:
+            output.Render(frame, led_data)
+    python_ns = (time.perf_counter() - start) * 1e9 / FLAGS.iterations
+
+    native_ns = led_pipeline.TimeNativeFrames(sampler, output, image,
+                                              row_stride, FLAGS.iterations,
+                                              FLAGS.send)
+
+    print("Python: {:.0f} ns per frame, C++: {:.0f} ns per frame, "
+          "overhead {:.0f} ns ({:.1f}x)".format(python_ns, native_ns,
+                                               python_ns - native_ns,
+                                               python_ns / native_ns))
+
+
+if __name__ == "__main__":
+    app.run(main)
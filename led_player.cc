@@ -0,0 +1,188 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Plays an LED recording made by `led_driver --record_file` or
+// `led_recording_tool`. The recording is mapped into memory, and each frame is
+// decoded and copied into the SPI buffer at its timestamp, so playback needs no
+// capture, rendering or color processing.
+//
+// With `--network_input`, instead shows the frames sent by another
+// renderer's `led_driver --network_output` as they arrive. Those frames are
+// already corrected, so they too are only copied into the SPI buffer. With
+// `--clock_sync_server`, they are held until the presentation time the
+// renderer gave them, so that every controller latches them together.
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/time/time.h"
+#include "clock_sync.h"
+#include "led_output.h"
+#include "led_recording.h"
+#include "network_input_source.h"
+
+ABSL_FLAG(std::string, recording, "", "LED recording to play");
+ABSL_FLAG(bool, loop, true, "Whether to loop the recording");
+ABSL_FLAG(float, speed, 1.0f, "Playback speed");
+ABSL_FLAG(bool, network_input, false,
+          "If set, shows DDP frames from another renderer's network output "
+          "instead of playing a recording");
+ABSL_FLAG(std::string, network_bind_address, "0.0.0.0",
+          "Address to receive network frames on");
+ABSL_FLAG(int, ddp_port, 4048, "UDP port to receive DDP frames on");
+ABSL_FLAG(int, num_leds, 900, "LEDs per network frame");
+ABSL_FLAG(std::string, clock_sync_server, "",
+          "host:port of the renderer's clock sync server. If set, network "
+          "frames are shown at the presentation time they carry");
+
+namespace led_driver {
+
+namespace {
+int ReceiveNetwork(std::shared_ptr<SpiDriver> spi_driver) {
+  std::shared_ptr<ClockSyncClient> clock_sync;
+  if (!absl::GetFlag(FLAGS_clock_sync_server).empty()) {
+    clock_sync = ClockSyncClient::Create(absl::GetFlag(FLAGS_clock_sync_server),
+                                         ClockSyncClient::Options());
+    if (clock_sync == nullptr) {
+      std::cerr << "Failed to create clock sync client" << std::endl;
+      return 1;
+    }
+  }
+  auto presenter = std::make_shared<FramePresenter>(clock_sync,
+                                                    FramePresenter::Options());
+
+  NetworkInputSource::Options options;
+  options.bind_address = absl::GetFlag(FLAGS_network_bind_address);
+  options.ddp_port = absl::GetFlag(FLAGS_ddp_port);
+  options.artnet_port = 0;
+  options.e131_port = 0;
+  options.num_leds = absl::GetFlag(FLAGS_num_leds);
+
+  // LED data address + mode.
+  auto output_buffer = std::make_shared<std::vector<uint8_t>>(
+      2 + options.num_leds * LedOutput::kLedChannels, 0);
+  (*output_buffer)[0] = 0x80;
+  (*output_buffer)[1] = 0x00;
+
+  // Frames are transferred on the source's thread, at their presentation
+  // time if they have one.
+  options.frame_callback = [spi_driver, presenter, output_buffer](
+                               absl::Span<const uint8_t> frame,
+                               absl::optional<uint32_t> timecode) {
+    memcpy(output_buffer->data() + 2, frame.data(),
+           std::min(frame.size(), output_buffer->size() - 2));
+    presenter->Present(timecode);
+    spi_driver->Transfer(*output_buffer);
+  };
+  auto source = NetworkInputSource::Create(nullptr, options);
+  if (source == nullptr || !source->Start()) {
+    std::cerr << "Failed to start network input" << std::endl;
+    return 1;
+  }
+  while (true) {
+    std::this_thread::sleep_for(std::chrono::seconds(60));
+  }
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  absl::ParseCommandLine(argc, argv);
+
+  if (absl::GetFlag(FLAGS_network_input)) {
+    auto spi_driver = CreateLedSpiDriver();
+    if (spi_driver == nullptr) {
+      std::cerr << "Failed to create SPI driver" << std::endl;
+      return 1;
+    }
+    return ReceiveNetwork(std::move(spi_driver));
+  }
+
+  auto reader = LedRecordingReader::Create(absl::GetFlag(FLAGS_recording));
+  if (reader == nullptr) {
+    std::cerr << "Failed to open recording" << std::endl;
+    return 1;
+  }
+  if (reader->stage() != LedRecordingFormat::kStageOutput) {
+    std::cerr << "Recording holds uncorrected frames; bake it without --raw "
+                 "to play it"
+              << std::endl;
+    return 1;
+  }
+
+  auto spi_driver = CreateLedSpiDriver();
+  if (spi_driver == nullptr) {
+    std::cerr << "Failed to create SPI driver" << std::endl;
+    return 1;
+  }
+
+  // LED data address + mode.
+  std::vector<uint8_t> output_buffer(2 + reader->frame_length(), 0);
+  output_buffer[0] = 0x80;
+  output_buffer[1] = 0x00;
+
+  using Clock = std::chrono::steady_clock;
+  const float speed = std::max(absl::GetFlag(FLAGS_speed), 0.01f);
+  Clock::time_point start = Clock::now();
+  absl::Duration last_timestamp;
+  int frames = 0;
+
+  while (true) {
+    if (!reader->Next()) {
+      if (!absl::GetFlag(FLAGS_loop) || frames == 0) {
+        break;
+      }
+      // Start the next pass one average frame interval after the last frame.
+      const absl::Duration interval =
+          frames > 1 ? last_timestamp / (frames - 1) : absl::ZeroDuration();
+      start += std::chrono::microseconds(
+          absl::ToInt64Microseconds((last_timestamp + interval) / speed));
+      reader->Rewind();
+      frames = 0;
+      continue;
+    }
+    ++frames;
+    last_timestamp = reader->timestamp();
+
+    std::this_thread::sleep_until(
+        start + std::chrono::microseconds(
+                    absl::ToInt64Microseconds(reader->timestamp() / speed)));
+
+    const absl::Span<const uint8_t> frame = reader->frame();
+    memcpy(&output_buffer[2], frame.data(), frame.size());
+    if (!spi_driver->Transfer(output_buffer)) {
+      std::cerr << "Failed to transfer frame" << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
+}  // namespace led_driver
+
+extern "C" {
+int main(int argc, char *argv[]) { return led_driver::main(argc, argv); }
+}
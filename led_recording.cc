@@ -0,0 +1,402 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "led_recording.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#include "absl/time/clock.h"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace led_driver {
+namespace {
+constexpr int kHashBits = 12;
+constexpr size_t kMinMatch = 4;
+constexpr size_t kMaxOffset = 65535;
+
+uint32_t Load32(const uint8_t *pointer) {
+  uint32_t value;
+  memcpy(&value, pointer, sizeof(value));
+  return value;
+}
+
+uint32_t Hash(uint32_t value) {
+  return (value * 2654435761u) >> (32 - kHashBits);
+}
+
+// Writes the continuation bytes of a length which didn't fit in its nibble.
+uint8_t *WriteLength(uint8_t *output, size_t length) {
+  for (; length >= 255; length -= 255) {
+    *output++ = 255;
+  }
+  *output++ = static_cast<uint8_t>(length);
+  return output;
+}
+
+uint8_t *WriteSequence(uint8_t *output, const uint8_t *literals,
+                       size_t literal_length, size_t offset,
+                       size_t match_length) {
+  uint8_t *token = output++;
+  *token = static_cast<uint8_t>(std::min<size_t>(literal_length, 15) << 4);
+  if (literal_length >= 15) {
+    output = WriteLength(output, literal_length - 15);
+  }
+  // Sequences may have no literals, and `literals` may then be null.
+  if (literal_length > 0) {
+    memcpy(output, literals, literal_length);
+    output += literal_length;
+  }
+
+  if (match_length > 0) {
+    *output++ = offset & 0xFF;
+    *output++ = (offset >> 8) & 0xFF;
+    const size_t length = match_length - kMinMatch;
+    *token |= static_cast<uint8_t>(std::min<size_t>(length, 15));
+    if (length >= 15) {
+      output = WriteLength(output, length - 15);
+    }
+  }
+  return output;
+}
+
+// Reads the continuation bytes of a length. Returns false if they run past
+// `end`.
+bool ReadLength(const uint8_t **input, const uint8_t *end, size_t *length) {
+  uint8_t byte;
+  do {
+    if (*input >= end) {
+      return false;
+    }
+    byte = *(*input)++;
+    *length += byte;
+  } while (byte == 255);
+  return true;
+}
+}  // namespace
+
+constexpr char LedRecordingFormat::kMagic[8];
+
+size_t LzCompressBound(size_t size) { return size + size / 255 + 16; }
+
+size_t LzCompress(absl::Span<const uint8_t> input, uint8_t *output,
+                  std::vector<int32_t> *hash_table) {
+  hash_table->assign(1 << kHashBits, -1);
+  const uint8_t *const source = input.data();
+  const size_t size = input.size();
+  uint8_t *const output_start = output;
+
+  size_t anchor = 0;
+  size_t position = 0;
+  while (position + kMinMatch <= size) {
+    const uint32_t sequence = Load32(source + position);
+    int32_t &entry = (*hash_table)[Hash(sequence)];
+    const int32_t candidate = entry;
+    entry = static_cast<int32_t>(position);
+
+    if (candidate < 0 || position - candidate > kMaxOffset ||
+        Load32(source + candidate) != sequence) {
+      ++position;
+      continue;
+    }
+
+    size_t length = kMinMatch;
+    while (position + length < size &&
+           source[candidate + length] == source[position + length]) {
+      ++length;
+    }
+    output = WriteSequence(output, source + anchor, position - anchor,
+                           position - candidate, length);
+    position += length;
+    anchor = position;
+  }
+
+  output = WriteSequence(output, source + anchor, size - anchor, 0, 0);
+  return output - output_start;
+}
+
+bool LzDecompress(absl::Span<const uint8_t> input,
+                  absl::Span<uint8_t> output) {
+  const uint8_t *in = input.data();
+  const uint8_t *const in_end = in + input.size();
+  uint8_t *out = output.data();
+  uint8_t *const out_end = out + output.size();
+
+  while (in < in_end) {
+    const uint8_t token = *in++;
+
+    size_t literal_length = token >> 4;
+    if (literal_length == 15 && !ReadLength(&in, in_end, &literal_length)) {
+      return false;
+    }
+    if (literal_length > static_cast<size_t>(in_end - in) ||
+        literal_length > static_cast<size_t>(out_end - out)) {
+      return false;
+    }
+    if (literal_length > 0) {
+      memcpy(out, in, literal_length);
+      in += literal_length;
+      out += literal_length;
+    }
+
+    // The last sequence has no match.
+    if (in == in_end) {
+      break;
+    }
+
+    if (in_end - in < 2) {
+      return false;
+    }
+    const size_t offset = in[0] | (in[1] << 8);
+    in += 2;
+    size_t match_length = token & 0xF;
+    if (match_length == 15 && !ReadLength(&in, in_end, &match_length)) {
+      return false;
+    }
+    match_length += kMinMatch;
+    if (offset == 0 || offset > static_cast<size_t>(out - output.data()) ||
+        match_length > static_cast<size_t>(out_end - out)) {
+      return false;
+    }
+
+    // Byte by byte, since the match may overlap the bytes it produces.
+    const uint8_t *match = out - offset;
+    for (size_t i = 0; i < match_length; ++i) {
+      out[i] = match[i];
+    }
+    out += match_length;
+  }
+  return out == out_end;
+}
+
+std::shared_ptr<LedRecordingWriter> LedRecordingWriter::Create(
+    const std::string &path, size_t frame_length, int keyframe_interval,
+    uint32_t stage) {
+  auto writer = std::shared_ptr<LedRecordingWriter>(
+      new LedRecordingWriter(path, frame_length, keyframe_interval, stage));
+  if (!writer->Initialize()) {
+    return nullptr;
+  }
+  return writer;
+}
+
+LedRecordingWriter::LedRecordingWriter(std::string path, size_t frame_length,
+                                       int keyframe_interval,
+                                       uint32_t stage)
+    : path_(std::move(path)),
+      frame_length_(frame_length),
+      keyframe_interval_(std::max(keyframe_interval, 1)),
+      stage_(stage),
+      previous_frame_(frame_length, 0),
+      delta_(frame_length, 0),
+      compressed_(LzCompressBound(frame_length), 0) {}
+
+LedRecordingWriter::~LedRecordingWriter() {
+  if (file_ != nullptr) {
+    fclose(file_);
+  }
+}
+
+bool LedRecordingWriter::Initialize() {
+  file_ = fopen(path_.c_str(), "wb");
+  if (file_ == nullptr) {
+    std::cerr << "Failed to open recording " << path_ << ": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+
+  LedRecordingFormat::Header header{};
+  memcpy(header.magic, LedRecordingFormat::kMagic, sizeof(header.magic));
+  header.frame_length = frame_length_;
+  header.keyframe_interval = keyframe_interval_;
+  header.stage = stage_;
+  if (fwrite(&header, sizeof(header), 1, file_) != 1) {
+    std::cerr << "Failed to write recording header" << std::endl;
+    return false;
+  }
+  bytes_written_ = sizeof(header);
+  return true;
+}
+
+bool LedRecordingWriter::Receive(absl::Span<const uint8_t> led_data) {
+  const absl::Time now = absl::Now();
+  if (start_time_ == absl::InfinitePast()) {
+    start_time_ = now;
+  }
+  return Write(led_data, now - start_time_);
+}
+
+bool LedRecordingWriter::Write(absl::Span<const uint8_t> frame,
+                               absl::Duration timestamp) {
+  if (frame.size() != frame_length_) {
+    std::cerr << "Recording expects frames of " << frame_length_
+              << " bytes, got " << frame.size() << std::endl;
+    return false;
+  }
+
+  LedRecordingFormat::FrameHeader frame_header{};
+  frame_header.timestamp_us = absl::ToInt64Microseconds(timestamp);
+
+  absl::Span<const uint8_t> payload = frame;
+  if (frames_written_ % keyframe_interval_ == 0) {
+    frame_header.flags |= LedRecordingFormat::kKeyframe;
+  } else {
+    for (size_t i = 0; i < frame_length_; ++i) {
+      delta_[i] = frame[i] ^ previous_frame_[i];
+    }
+    payload = delta_;
+  }
+  std::copy(frame.begin(), frame.end(), previous_frame_.begin());
+
+  const size_t compressed_length =
+      LzCompress(payload, compressed_.data(), &hash_table_);
+  if (compressed_length < payload.size()) {
+    payload = absl::MakeConstSpan(compressed_.data(), compressed_length);
+  } else {
+    frame_header.flags |= LedRecordingFormat::kStored;
+  }
+  frame_header.payload_length = payload.size();
+
+  if (fwrite(&frame_header, sizeof(frame_header), 1, file_) != 1 ||
+      fwrite(payload.data(), 1, payload.size(), file_) != payload.size()) {
+    std::cerr << "Failed to write to recording " << path_ << std::endl;
+    return false;
+  }
+  // Flush at keyframes, so an interrupted recording is still playable.
+  if (frame_header.flags & LedRecordingFormat::kKeyframe) {
+    fflush(file_);
+  }
+
+  ++frames_written_;
+  bytes_written_ += sizeof(frame_header) + payload.size();
+  return true;
+}
+
+std::shared_ptr<LedRecordingReader> LedRecordingReader::Create(
+    const std::string &path) {
+  auto reader =
+      std::shared_ptr<LedRecordingReader>(new LedRecordingReader(path));
+  if (!reader->Initialize()) {
+    return nullptr;
+  }
+  return reader;
+}
+
+LedRecordingReader::~LedRecordingReader() {
+  if (data_ != nullptr) {
+    munmap(const_cast<uint8_t *>(data_), size_);
+  }
+}
+
+bool LedRecordingReader::Initialize() {
+  const int fd = open(path_.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Failed to open recording " << path_ << ": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 ||
+      static_cast<size_t>(file_stat.st_size) <
+          sizeof(LedRecordingFormat::Header)) {
+    std::cerr << "Recording " << path_ << " is too short" << std::endl;
+    close(fd);
+    return false;
+  }
+  size_ = file_stat.st_size;
+  void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    std::cerr << "Failed to map recording " << path_ << ": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+  data_ = static_cast<const uint8_t *>(data);
+  madvise(data, size_, MADV_SEQUENTIAL);
+
+  memcpy(&header_, data_, sizeof(header_));
+  if (memcmp(header_.magic, LedRecordingFormat::kMagic,
+             sizeof(header_.magic)) != 0) {
+    std::cerr << path_ << " is not an LED recording" << std::endl;
+    return false;
+  }
+  if (header_.stage != LedRecordingFormat::kStageOutput &&
+      header_.stage != LedRecordingFormat::kStageInput) {
+    std::cerr << "Recording " << path_ << " has unknown stage "
+              << header_.stage << std::endl;
+    return false;
+  }
+  frame_.resize(header_.frame_length, 0);
+  scratch_.resize(header_.frame_length, 0);
+  Rewind();
+  return true;
+}
+
+void LedRecordingReader::Rewind() {
+  offset_ = sizeof(LedRecordingFormat::Header);
+  timestamp_ = absl::ZeroDuration();
+}
+
+bool LedRecordingReader::Next() {
+  LedRecordingFormat::FrameHeader frame_header;
+  if (size_ - offset_ < sizeof(frame_header)) {
+    return false;
+  }
+  memcpy(&frame_header, data_ + offset_, sizeof(frame_header));
+  if (size_ - offset_ - sizeof(frame_header) < frame_header.payload_length) {
+    std::cerr << "Recording " << path_ << " is truncated" << std::endl;
+    return false;
+  }
+  const absl::Span<const uint8_t> payload(
+      data_ + offset_ + sizeof(frame_header), frame_header.payload_length);
+
+  const bool keyframe = frame_header.flags & LedRecordingFormat::kKeyframe;
+  absl::Span<uint8_t> target =
+      keyframe ? absl::MakeSpan(frame_) : absl::MakeSpan(scratch_);
+  if (frame_header.flags & LedRecordingFormat::kStored) {
+    if (payload.size() != target.size()) {
+      std::cerr << "Recording " << path_ << " is corrupt" << std::endl;
+      return false;
+    }
+    std::copy(payload.begin(), payload.end(), target.begin());
+  } else if (!LzDecompress(payload, target)) {
+    std::cerr << "Recording " << path_ << " is corrupt" << std::endl;
+    return false;
+  }
+  if (!keyframe) {
+    for (size_t i = 0; i < frame_.size(); ++i) {
+      frame_[i] ^= scratch_[i];
+    }
+  }
+
+  offset_ += sizeof(frame_header) + frame_header.payload_length;
+  timestamp_ = absl::Microseconds(frame_header.timestamp_us);
+  return true;
+}
+
+}  // namespace led_driver
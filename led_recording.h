@@ -0,0 +1,181 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef LED_RECORDING_H_
+#define LED_RECORDING_H_
+
+#include <cstdint>
+#include <cstdio>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "led_frame_sink.h"
+
+namespace led_driver {
+
+// A streaming recording of LED frames. All fields are native endian, so a
+// recording only reads back correctly on hosts of the byte order it was
+// written with.
+//
+//   Header:  char magic[8] = "LEDREC01"
+//            uint32 frame_length      Bytes per frame.
+//            uint32 keyframe_interval Frames between keyframes.
+//            uint32 stage             kStageOutput or kStageInput.
+//            uint32 reserved
+//   Frames:  uint32 payload_length
+//            uint32 flags             kKeyframe, kStored.
+//            int64  timestamp_us      Since the start of the recording.
+//            uint8  payload[payload_length]
+//
+// Keyframes hold the frame itself; other frames hold the XOR of the frame with
+// the previous one, which is mostly zero. The payload is then LZ compressed,
+// unless it is flagged `kStored`, in which case it is left as is. The first
+// frame is always a keyframe.
+struct LedRecordingFormat {
+  static constexpr char kMagic[8] = {'L', 'E', 'D', 'R', 'E', 'C', '0', '1'};
+  static constexpr uint32_t kKeyframe = 1 << 0;
+  static constexpr uint32_t kStored = 1 << 1;
+
+  // Frames exactly as sent to the LEDs: corrected, with red and green
+  // transposed, as recorded by `--record_file` and baked through the output
+  // stage. Or RGB frames from before color correction, as baked with
+  // `led_recording_tool --raw`, for a layer which the output corrects.
+  // Recordings from before the stage field are zero there, and hold output.
+  static constexpr uint32_t kStageOutput = 0;
+  static constexpr uint32_t kStageInput = 1;
+
+  struct Header {
+    char magic[8];
+    uint32_t frame_length;
+    uint32_t keyframe_interval;
+    uint32_t stage;
+    uint32_t reserved;
+  };
+
+  struct FrameHeader {
+    uint32_t payload_length;
+    uint32_t flags;
+    int64_t timestamp_us;
+  };
+};
+
+// Writes a recording. As a sink on the LED output, records every frame sent,
+// timestamped from the first.
+class LedRecordingWriter : public LedFrameSinkInterface {
+ public:
+  static std::shared_ptr<LedRecordingWriter> Create(const std::string &path,
+                                                    size_t frame_length,
+                                                    int keyframe_interval,
+                                                    uint32_t stage);
+
+  ~LedRecordingWriter() override;
+
+  bool Receive(absl::Span<const uint8_t> led_data) override;
+
+  // Appends a frame at `timestamp` from the start of the recording.
+  bool Write(absl::Span<const uint8_t> frame, absl::Duration timestamp);
+
+  uint64_t frames_written() const { return frames_written_; }
+  uint64_t bytes_written() const { return bytes_written_; }
+
+ private:
+  LedRecordingWriter(std::string path, size_t frame_length,
+                     int keyframe_interval, uint32_t stage);
+
+  bool Initialize();
+
+  const std::string path_;
+  const size_t frame_length_;
+  const int keyframe_interval_;
+  const uint32_t stage_;
+
+  FILE *file_ = nullptr;
+  absl::Time start_time_ = absl::InfinitePast();
+
+  std::vector<uint8_t> previous_frame_;
+  std::vector<uint8_t> delta_;
+  std::vector<uint8_t> compressed_;
+  std::vector<int32_t> hash_table_;
+
+  uint64_t frames_written_ = 0;
+  uint64_t bytes_written_ = 0;
+};
+
+// Reads a recording through a read-only mapping of the file, so that frames
+// are decoded straight out of the page cache.
+class LedRecordingReader {
+ public:
+  static std::shared_ptr<LedRecordingReader> Create(const std::string &path);
+
+  ~LedRecordingReader();
+
+  size_t frame_length() const { return header_.frame_length; }
+  // `LedRecordingFormat::kStageOutput` or `kStageInput`.
+  uint32_t stage() const { return header_.stage; }
+
+  // Decodes the next frame. Returns false at the end of the recording, or if
+  // the next frame is corrupt.
+  bool Next();
+
+  // The most recently decoded frame, and its timestamp.
+  absl::Span<const uint8_t> frame() const { return frame_; }
+  absl::Duration timestamp() const { return timestamp_; }
+
+  // Returns to the first frame.
+  void Rewind();
+
+  size_t file_size() const { return size_; }
+
+ private:
+  explicit LedRecordingReader(std::string path) : path_(std::move(path)) {}
+
+  bool Initialize();
+
+  const std::string path_;
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+  size_t offset_ = 0;
+
+  LedRecordingFormat::Header header_{};
+  std::vector<uint8_t> frame_;
+  std::vector<uint8_t> scratch_;
+  absl::Duration timestamp_;
+};
+
+// LZ compression of a block, in the style of LZ4: a sequence of literal runs
+// and back-references of at least four bytes, up to 64KiB back. Runs of a
+// repeated byte, such as the zeros of a frame delta, become a single
+// back-reference. `hash_table` is scratch space; it is resized as needed.
+// Returns the compressed size. `output` must hold `LzCompressBound(size)`.
+size_t LzCompressBound(size_t size);
+size_t LzCompress(absl::Span<const uint8_t> input, uint8_t *output,
+                  std::vector<int32_t> *hash_table);
+
+// Decompresses exactly `output.size()` bytes. Returns false if `input` is
+// malformed.
+bool LzDecompress(absl::Span<const uint8_t> input, absl::Span<uint8_t> output);
+
+}  // namespace led_driver
+
+#endif  // LED_RECORDING_H_
@@ -0,0 +1,167 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Bakes raw LED frames into an LED recording, or reports on a recording.
+//
+// Frames for baking are RGB triplets in mapping order, as written by
+// `bake_recording.py`. They pass through the same flicker compensation,
+// intensity scaling and color correction as live output, so the recording
+// plays back exactly as `led_driver` would have shown them. With `--raw`, they
+// are stored as they are instead, for `led_driver --boot_recording`, whose
+// output corrects them.
+
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "led_output.h"
+#include "led_recording.h"
+
+ABSL_FLAG(std::string, bake_input, "",
+          "Raw RGB frames to bake into a recording; - for stdin");
+ABSL_FLAG(std::string, output, "", "Recording to write when baking");
+ABSL_FLAG(float, fps, 30.0f, "Frame rate of the baked frames");
+ABSL_FLAG(int, num_leds, 900, "LEDs per frame");
+ABSL_FLAG(float, intensity, 1.0f, "Scale factor for LED intensity");
+ABSL_FLAG(int, keyframe_interval, 60, "Frames between keyframes");
+ABSL_FLAG(bool, raw, false,
+          "If set, bakes the frames uncorrected, for led_driver "
+          "--boot_recording, rather than as sent to the LEDs for led_player");
+ABSL_FLAG(std::string, info, "",
+          "If set, reports the size and decode cost of this recording");
+
+namespace led_driver {
+
+namespace {
+
+// Writes frames from the output stage with timestamps at a fixed frame rate.
+class BakeSink : public LedFrameSinkInterface {
+ public:
+  BakeSink(std::shared_ptr<LedRecordingWriter> writer, float fps)
+      : writer_(std::move(writer)), period_(absl::Seconds(1) / fps) {}
+
+  bool Receive(absl::Span<const uint8_t> led_data) override {
+    return writer_->Write(led_data, period_ * frame_index_++);
+  }
+
+ private:
+  std::shared_ptr<LedRecordingWriter> writer_;
+  const absl::Duration period_;
+  int64_t frame_index_ = 0;
+};
+
+int Bake() {
+  const std::string input_path = absl::GetFlag(FLAGS_bake_input);
+  FILE *input = input_path == "-" ? stdin : fopen(input_path.c_str(), "rb");
+  if (input == nullptr) {
+    std::cerr << "Failed to open " << input_path << std::endl;
+    return 1;
+  }
+
+  LedOutput::Options options;
+  options.num_leds = absl::GetFlag(FLAGS_num_leds);
+  options.intensity = absl::GetFlag(FLAGS_intensity);
+  const size_t frame_length = options.num_leds * LedOutput::kLedChannels;
+
+  const bool raw = absl::GetFlag(FLAGS_raw);
+  auto writer = LedRecordingWriter::Create(
+      absl::GetFlag(FLAGS_output), frame_length,
+      absl::GetFlag(FLAGS_keyframe_interval),
+      raw ? LedRecordingFormat::kStageInput : LedRecordingFormat::kStageOutput);
+  if (writer == nullptr) {
+    return 1;
+  }
+  auto bake_sink = std::make_shared<BakeSink>(writer, absl::GetFlag(FLAGS_fps));
+  LedOutput led_output(nullptr, options);
+  led_output.AddSink(bake_sink);
+
+  std::vector<uint8_t> frame(frame_length);
+  while (fread(frame.data(), 1, frame.size(), input) == frame.size()) {
+    if (!(raw ? bake_sink->Receive(frame) : led_output.Send(frame))) {
+      return 1;
+    }
+  }
+  if (input != stdin) {
+    fclose(input);
+  }
+
+  std::cout << "Baked " << writer->frames_written() << " frames into "
+            << writer->bytes_written() << " bytes ("
+            << static_cast<double>(writer->bytes_written()) /
+                   std::max<uint64_t>(writer->frames_written(), 1)
+            << " bytes per frame, of " << frame_length << ")" << std::endl;
+  return 0;
+}
+
+int Info() {
+  auto reader = LedRecordingReader::Create(absl::GetFlag(FLAGS_info));
+  if (reader == nullptr) {
+    return 1;
+  }
+
+  int frames = 0;
+  const absl::Time start = absl::Now();
+  while (reader->Next()) {
+    ++frames;
+  }
+  const absl::Duration decode_time = absl::Now() - start;
+
+  std::cout << frames << " frames of " << reader->frame_length()
+            << " bytes over " << absl::FormatDuration(reader->timestamp())
+            << ", " << reader->file_size() << " bytes ("
+            << static_cast<double>(reader->file_size()) /
+                   std::max(frames, 1)
+            << " bytes per frame), "
+            << (reader->stage() == LedRecordingFormat::kStageInput
+                    ? "uncorrected"
+                    : "corrected")
+            << ", decoded in "
+            << absl::FormatDuration(decode_time / std::max(frames, 1))
+            << " per frame" << std::endl;
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  absl::ParseCommandLine(argc, argv);
+
+  if (!absl::GetFlag(FLAGS_info).empty()) {
+    return Info();
+  }
+  if (absl::GetFlag(FLAGS_bake_input).empty() ||
+      absl::GetFlag(FLAGS_output).empty()) {
+    std::cerr << "Either --info, or --bake_input and --output, are required"
+              << std::endl;
+    return 1;
+  }
+  return Bake();
+}
+}  // namespace led_driver
+
+extern "C" {
+int main(int argc, char *argv[]) { return led_driver::main(argc, argv); }
+}
@@ -0,0 +1,92 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "led_sampler.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "led_segments.h"
+
+namespace led_driver {
+
+LedSampler::LedSampler(std::vector<Coordinate> coordinates,
+                       int clamp_threshold,
+                       std::shared_ptr<ThreadPool> thread_pool,
+                       int segment_leds)
+    : coordinates_(std::move(coordinates)),
+      clamp_threshold_(clamp_threshold),
+      thread_pool_(std::move(thread_pool)),
+      segment_leds_(segment_leds) {}
+
+std::vector<LedSampler::Coordinate> LedSampler::ScaleCoordinates(
+    absl::Span<const std::pair<float, float>> normalized, int raster_width,
+    int raster_height) {
+  std::vector<Coordinate> coordinates;
+  coordinates.reserve(normalized.size());
+  for (const auto &sample : normalized) {
+    coordinates.emplace_back(
+        static_cast<ssize_t>(sample.first * (raster_width - 1)),
+        static_cast<ssize_t>(sample.second * (raster_height - 1)));
+  }
+  return coordinates;
+}
+
+void LedSampler::Sample(absl::Span<const uint8_t> image, ssize_t row_stride,
+                        absl::Span<uint8_t> frame) const {
+  const int num_leds = frame.size() / kLedChannels;
+  std::fill(frame.begin() + num_leds * kLedChannels, frame.end(), 0);
+  if (thread_pool_ == nullptr) {
+    SampleRange(image, row_stride, frame, 0, num_leds);
+    return;
+  }
+  const LedSegments segments(frame.data(), num_leds, segment_leds_);
+  thread_pool_->ParallelFor(
+      segments.count(), [this, image, row_stride, frame, &segments](int i) {
+        SampleRange(image, row_stride, frame, segments.begin(i),
+                    segments.end(i));
+      });
+}
+
+void LedSampler::SampleRange(absl::Span<const uint8_t> image,
+                             ssize_t row_stride, absl::Span<uint8_t> frame,
+                             int begin, int end) const {
+  std::fill(frame.begin() + begin * kLedChannels,
+            frame.begin() + end * kLedChannels, 0);
+  const size_t count =
+      std::min(coordinates_.size(), static_cast<size_t>(end));
+  uint8_t *output = frame.data() + begin * kLedChannels;
+  for (size_t i = begin; i < count; ++i, output += kLedChannels) {
+    const Coordinate &coordinate = coordinates_[i];
+    const ssize_t pixel_index =
+        coordinate.first * kLedChannels + coordinate.second * row_stride;
+    if (coordinate.first < 0 || coordinate.second < 0 ||
+        static_cast<size_t>(pixel_index) + kLedChannels > image.size()) {
+      continue;
+    }
+    const uint8_t *pixel = image.data() + pixel_index;
+    if (pixel[0] >= clamp_threshold_ || pixel[1] >= clamp_threshold_ ||
+        pixel[2] >= clamp_threshold_) {
+      memcpy(output, pixel, kLedChannels);
+    }
+  }
+}
+
+}  // namespace led_driver
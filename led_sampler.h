@@ -0,0 +1,80 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef LED_SAMPLER_H_
+#define LED_SAMPLER_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/types/span.h"
+#include "thread_pool.h"
+
+namespace led_driver {
+
+// The first stage of the LED pipeline: samples a captured RGB image at the
+// mapping coordinates, producing a frame of RGB triplets in mapping order.
+class LedSampler {
+ public:
+  static constexpr int kLedChannels = 3;
+
+  // Pixel column and row.
+  using Coordinate = std::pair<ssize_t, ssize_t>;
+
+  // Samples whose channels are all below `clamp_threshold` are left black.
+  // With a thread pool, frames are sampled in segments of about
+  // `segment_leds` LEDs in parallel.
+  explicit LedSampler(std::vector<Coordinate> coordinates,
+                      int clamp_threshold = 0,
+                      std::shared_ptr<ThreadPool> thread_pool = nullptr,
+                      int segment_leds = 4096);
+
+  // Scales mapping coordinates, normalized to [0, 1], to a raster of the given
+  // size.
+  static std::vector<Coordinate> ScaleCoordinates(
+      absl::Span<const std::pair<float, float>> normalized, int raster_width,
+      int raster_height);
+
+  // Samples `image`, packed RGB rows `row_stride` bytes apart, into `frame`.
+  // The whole frame is written: LEDs beyond the mapping, or sampling outside
+  // the image, are black.
+  void Sample(absl::Span<const uint8_t> image, ssize_t row_stride,
+              absl::Span<uint8_t> frame) const;
+
+  int num_leds() const { return coordinates_.size(); }
+
+ private:
+  // Samples LEDs [`begin`, `end`) of `frame`.
+  void SampleRange(absl::Span<const uint8_t> image, ssize_t row_stride,
+                   absl::Span<uint8_t> frame, int begin, int end) const;
+
+  const std::vector<Coordinate> coordinates_;
+  const int clamp_threshold_;
+  std::shared_ptr<ThreadPool> thread_pool_;
+  const int segment_leds_;
+};
+
+}  // namespace led_driver
+
+#endif  // LED_SAMPLER_H_
@@ -0,0 +1,220 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Benchmarks sampling and processing frames of tens of thousands of LEDs,
+// split into segments on thread pools of one to `--max_threads` threads, on
+// synthetic mappings. Each pool's output is checked against a single thread's,
+// and, when built with `--define allocation_checks=true`, that no frame
+// allocates. Exits non-zero if any check fails. With `--mapping_dir`, the synthetic mappings are also written out, for
+// use with `led_driver --mapping_file`.
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "allocation_counter.h"
+#include "led_driver/led_mapping.pb.h"
+#include "led_output.h"
+#include "led_sampler.h"
+#include "thread_pool.h"
+
+ABSL_FLAG(std::string, led_counts, "10000,30000,100000",
+          "Comma-separated LED counts of the synthetic mappings");
+ABSL_FLAG(int, max_threads, 4, "Largest thread pool to time");
+ABSL_FLAG(int, segment_leds, 4096, "LEDs in each segment");
+ABSL_FLAG(int, frames, 200, "Frames to time per LED count and pool size");
+ABSL_FLAG(int, raster_width, 640, "Width of the synthetic captured image");
+ABSL_FLAG(int, raster_height, 480, "Height of the synthetic captured image");
+ABSL_FLAG(std::string, mapping_dir, "",
+          "If set, directory to write each synthetic mapping to, as "
+          "synthetic_<count>.binaryproto");
+
+namespace led_driver {
+
+namespace {
+
+// Distinct images to cycle through, so that frames aren't all the same.
+constexpr int kImageCount = 4;
+
+// Lays `num_leds` samples out as a suit of vertical strips, each snaking up
+// and down the raster, with a little jitter, as a large mapping would be.
+ledsuit::mapping::Mapping GenerateMapping(int num_leds) {
+  ledsuit::mapping::Mapping mapping;
+  const int num_strips = std::max(1, static_cast<int>(std::sqrt(num_leds)));
+  const int strip_leds = (num_leds + num_strips - 1) / num_strips;
+  uint32_t noise = 12345;
+  for (int i = 0; i < num_leds; ++i) {
+    const int strip = i / strip_leds;
+    int position = i % strip_leds;
+    if (strip % 2 == 1) {
+      position = strip_leds - 1 - position;
+    }
+    noise = noise * 1664525 + 1013904223;
+    const float jitter = (static_cast<float>(noise >> 8) / (1 << 24) - 0.5f) /
+                         (4 * num_strips);
+    auto *sample = mapping.add_samples();
+    sample->set_x(std::clamp((strip + 0.5f) / num_strips + jitter, 0.0f, 1.0f));
+    sample->set_y((position + 0.5f) / strip_leds);
+  }
+  return mapping;
+}
+
+// Fills a packed RGB image with a moving pattern of gradients.
+void FillImage(int frame, int width, int height, std::vector<uint8_t> *image) {
+  for (int y = 0; y < height; ++y) {
+    uint8_t *row = image->data() + y * width * LedSampler::kLedChannels;
+    for (int x = 0; x < width; ++x) {
+      row[x * 3] = x + frame;
+      row[x * 3 + 1] = y * 2 + frame;
+      row[x * 3 + 2] = (x ^ y) + frame * 3;
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  absl::ParseCommandLine(argc, argv);
+  if (!AllocationCounter::kEnabled) {
+    std::cout << "Allocations aren't counted or checked without --define "
+                 "allocation_checks=true"
+              << std::endl;
+  }
+
+  const int width = absl::GetFlag(FLAGS_raster_width);
+  const int height = absl::GetFlag(FLAGS_raster_height);
+  const int frames = absl::GetFlag(FLAGS_frames);
+  const int segment_leds = absl::GetFlag(FLAGS_segment_leds);
+  const ssize_t row_stride = width * LedSampler::kLedChannels;
+  std::vector<std::vector<uint8_t>> images(kImageCount);
+  for (int i = 0; i < kImageCount; ++i) {
+    images[i].resize(row_stride * height);
+    FillImage(i * 16, width, height, &images[i]);
+  }
+  bool ok = true;
+  std::cout << std::thread::hardware_concurrency() << " cores" << std::endl;
+
+  for (absl::string_view count_text :
+       absl::StrSplit(absl::GetFlag(FLAGS_led_counts), ',')) {
+    int num_leds;
+    if (!absl::SimpleAtoi(count_text, &num_leds) || num_leds <= 0) {
+      std::cerr << "Invalid LED count: " << count_text << std::endl;
+      return 1;
+    }
+
+    const ledsuit::mapping::Mapping mapping = GenerateMapping(num_leds);
+    if (!absl::GetFlag(FLAGS_mapping_dir).empty()) {
+      const std::string path =
+          absl::StrCat(absl::GetFlag(FLAGS_mapping_dir), "/synthetic_",
+                       num_leds, ".binaryproto");
+      std::ofstream output(path, std::ios::binary);
+      if (!mapping.SerializeToOstream(&output)) {
+        std::cerr << "Failed to write " << path << std::endl;
+        return 1;
+      }
+    }
+    std::vector<std::pair<float, float>> normalized;
+    for (const auto &sample : mapping.samples()) {
+      normalized.emplace_back(sample.x(), sample.y());
+    }
+    const std::vector<LedSampler::Coordinate> coordinates =
+        LedSampler::ScaleCoordinates(normalized, width, height);
+
+    const size_t frame_length = num_leds * LedOutput::kLedChannels;
+    std::vector<uint8_t> frame(frame_length);
+    std::vector<uint8_t> led_data(frame_length);
+    std::vector<uint8_t> expected(frame_length);
+    double single_thread_us = 0;
+
+    for (int threads = 1; threads <= absl::GetFlag(FLAGS_max_threads);
+         ++threads) {
+      auto thread_pool =
+          threads > 1 ? std::make_shared<ThreadPool>(threads) : nullptr;
+      const LedSampler sampler(coordinates, 0, thread_pool, segment_leds);
+      LedOutput::Options options;
+      options.num_leds = num_leds;
+      options.thread_pool = thread_pool;
+      options.segment_leds = segment_leds;
+      LedOutput output(nullptr, options);
+
+      // Checks the first frame against a single thread's.
+      sampler.Sample(images[0], row_stride, absl::MakeSpan(frame));
+      output.Render(frame, absl::MakeSpan(led_data));
+      if (threads == 1) {
+        expected = led_data;
+      } else if (led_data != expected) {
+        std::cerr << num_leds << " LEDs on " << threads
+                  << " threads differ from a single thread" << std::endl;
+        ok = false;
+      }
+
+      const uint64_t allocations_before = AllocationCounter::count();
+      AllocationCounter::SetCounting(true);
+      const absl::Time start = absl::Now();
+      for (int i = 0; i < frames; ++i) {
+        sampler.Sample(images[i % images.size()], row_stride,
+                       absl::MakeSpan(frame));
+        output.Render(frame, absl::MakeSpan(led_data));
+      }
+      const double frame_us =
+          absl::ToDoubleMicroseconds(absl::Now() - start) /
+          std::max(frames, 1);
+      AllocationCounter::SetCounting(false);
+      const uint64_t allocations =
+          AllocationCounter::count() - allocations_before;
+
+      if (threads == 1) {
+        single_thread_us = frame_us;
+      }
+      std::cout << num_leds << " LEDs, " << threads << " thread"
+                << (threads > 1 ? "s" : "") << ": " << frame_us
+                << " us per frame (" << 1e6 / frame_us << " fps), speedup "
+                << single_thread_us / frame_us << "x";
+      if (AllocationCounter::kEnabled) {
+        std::cout << ", " << allocations << " allocations";
+      }
+      std::cout << std::endl;
+      if (AllocationCounter::kEnabled && allocations != 0) {
+        std::cerr << "Processing allocated in steady state" << std::endl;
+        ok = false;
+      }
+    }
+  }
+  return ok ? 0 : 1;
+}
+}  // namespace led_driver
+
+extern "C" {
+int main(int argc, char *argv[]) { return led_driver::main(argc, argv); }
+}
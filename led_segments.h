@@ -0,0 +1,79 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef LED_SEGMENTS_H_
+#define LED_SEGMENTS_H_
+
+#include <algorithm>
+#include <cstdint>
+
+namespace led_driver {
+
+// Splits a frame of RGB triplets into segments of about `segment_leds` LEDs,
+// to be processed in parallel. Every boundary falls on a cache line boundary
+// of the frame's memory, so that threads writing neighbouring segments never
+// share a line. The first segment absorbs the LEDs before the first boundary.
+class LedSegments {
+ public:
+  static constexpr uintptr_t kCacheLineSize = 64;
+  // The shortest run of LEDs to fill whole cache lines: 64 triplets fill 3.
+  static constexpr int kLineRunLeds = kCacheLineSize;
+
+  LedSegments(const uint8_t *frame, int num_leds, int segment_leds)
+      : num_leds_(num_leds),
+        segment_leds_(
+            std::max(kLineRunLeds, (segment_leds + kLineRunLeds - 1) /
+                                       kLineRunLeds * kLineRunLeds)) {
+    // The LEDs before the first line boundary, `lead`, satisfy
+    // 3 * lead = -frame (mod 64), and 43 is the inverse of 3 modulo 64.
+    const uintptr_t misalignment =
+        (kCacheLineSize - reinterpret_cast<uintptr_t>(frame) % kCacheLineSize) %
+        kCacheLineSize;
+    lead_ = static_cast<int>(misalignment * 43 % kCacheLineSize);
+    count_ = std::max(
+        1, (num_leds_ - lead_ + segment_leds_ - 1) / segment_leds_);
+  }
+
+  int count() const { return count_; }
+
+  // The LEDs of `segment`, [begin, end).
+  int begin(int segment) const {
+    return segment == 0 ? 0 : std::min(lead_ + segment * segment_leds_,
+                                       num_leds_);
+  }
+  int end(int segment) const {
+    return std::min(lead_ + (segment + 1) * segment_leds_, num_leds_);
+  }
+
+  // The most segments any frame of `num_leds` can be split into.
+  static int MaxCount(int num_leds, int segment_leds) {
+    return std::max(1, num_leds / std::max(segment_leds, 1) + 1);
+  }
+
+ private:
+  int num_leds_;
+  int segment_leds_;
+  int lead_;
+  int count_;
+};
+
+}  // namespace led_driver
+
+#endif  // LED_SEGMENTS_H_
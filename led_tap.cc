@@ -0,0 +1,280 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "led_tap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <utility>
+
+#include "absl/time/clock.h"
+#include "clock_sync.h"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace led_driver {
+namespace {
+
+// How long a reader stays attached after it last read.
+constexpr int64_t kReaderTimeoutNs = 1000000000;
+
+// Readers renew `reader_deadline_ns` in the shared header, so they map the
+// tap read-write. Group members, such as a previewer run by another user, may
+// attach.
+constexpr mode_t kTapMode = 0660;
+
+size_t SlotStride(size_t frame_length) {
+  const size_t length = sizeof(LedTapFormat::SlotHeader) + frame_length;
+  return (length + LedTapFormat::kSlotAlignment - 1) /
+         LedTapFormat::kSlotAlignment * LedTapFormat::kSlotAlignment;
+}
+
+static_assert(sizeof(LedTapFormat::Header) <= LedTapFormat::kHeaderLength,
+              "Tap header does not fit");
+static_assert(sizeof(LedTapFormat::SlotHeader) == 32,
+              "Unexpected tap slot header layout");
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "Tap counters must be lock free to be shared");
+
+}  // namespace
+
+constexpr char LedTapFormat::kMagic[8];
+
+std::shared_ptr<LedTapWriter> LedTapWriter::Create(const std::string &name,
+                                                   size_t frame_length,
+                                                   uint32_t stage,
+                                                   int slot_count) {
+  auto writer = std::shared_ptr<LedTapWriter>(
+      new LedTapWriter(name, frame_length, stage, slot_count));
+  if (!writer->Initialize()) {
+    return nullptr;
+  }
+  return writer;
+}
+
+LedTapWriter::LedTapWriter(std::string name, size_t frame_length,
+                           uint32_t stage, int slot_count)
+    : name_(std::move(name)),
+      frame_length_(frame_length),
+      stage_(stage),
+      slot_count_(slot_count) {}
+
+LedTapWriter::~LedTapWriter() {
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+    shm_unlink(name_.c_str());
+  }
+}
+
+bool LedTapWriter::Initialize() {
+  if (slot_count_ < 2) {
+    std::cerr << "A tap needs at least two slots" << std::endl;
+    return false;
+  }
+  slot_stride_ = SlotStride(frame_length_);
+  size_ = LedTapFormat::kHeaderLength + slot_count_ * slot_stride_;
+
+  const int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT, kTapMode);
+  if (fd < 0) {
+    std::cerr << "Failed to open tap " << name_ << ": " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  // The umask usually strips group write from the mode above, and a tap left
+  // by an earlier run keeps the mode it was created with.
+  if (fchmod(fd, kTapMode) != 0) {
+    std::cerr << "Failed to share tap " << name_ << " with its group: "
+              << strerror(errno) << std::endl;
+  }
+  if (ftruncate(fd, size_) != 0) {
+    std::cerr << "Failed to size tap " << name_ << ": " << strerror(errno)
+              << std::endl;
+    close(fd);
+    return false;
+  }
+  void *data =
+      mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    std::cerr << "Failed to map tap " << name_ << ": " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  data_ = static_cast<uint8_t *>(data);
+
+  // Readers check the magic last, so it is cleared while the layout changes.
+  memset(data_, 0, size_);
+  header_ = new (data_) LedTapFormat::Header();
+  header_->header_length = LedTapFormat::kHeaderLength;
+  header_->slot_count = slot_count_;
+  header_->frame_length = frame_length_;
+  header_->slot_stride = slot_stride_;
+  header_->stage = stage_;
+  for (int i = 0; i < slot_count_; ++i) {
+    new (data_ + LedTapFormat::kHeaderLength + i * slot_stride_)
+        LedTapFormat::SlotHeader();
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(header_->magic, LedTapFormat::kMagic, sizeof(header_->magic));
+  return true;
+}
+
+bool LedTapWriter::Receive(absl::Span<const uint8_t> led_data) {
+  const uint64_t frame_number = frame_number_++;
+  // Without a reader, this is all the tap costs.
+  const int64_t now_ns = MonotonicNowNs();
+  if (header_->reader_deadline_ns.load(std::memory_order_relaxed) < now_ns) {
+    return true;
+  }
+
+  uint8_t *slot = data_ + LedTapFormat::kHeaderLength +
+                  (frame_number % slot_count_) * slot_stride_;
+  auto *slot_header = reinterpret_cast<LedTapFormat::SlotHeader *>(slot);
+  const uint32_t sequence =
+      slot_header->sequence.load(std::memory_order_relaxed);
+  slot_header->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  slot_header->frame_number = frame_number;
+  slot_header->timestamp_ns = now_ns;
+  slot_header->unix_time_us = absl::ToUnixMicros(absl::Now());
+  const size_t length = std::min(led_data.size(), frame_length_);
+  uint8_t *frame = slot + sizeof(LedTapFormat::SlotHeader);
+  memcpy(frame, led_data.data(), length);
+  memset(frame + length, 0, frame_length_ - length);
+
+  slot_header->sequence.store(sequence + 2, std::memory_order_release);
+  header_->frames_published.store(frame_number + 1,
+                                  std::memory_order_release);
+  return true;
+}
+
+std::shared_ptr<LedTapReader> LedTapReader::Create(const std::string &name) {
+  auto reader = std::shared_ptr<LedTapReader>(new LedTapReader(name));
+  if (!reader->Initialize()) {
+    return nullptr;
+  }
+  return reader;
+}
+
+LedTapReader::~LedTapReader() {
+  if (data_ != nullptr) {
+    munmap(const_cast<uint8_t *>(data_), size_);
+  }
+}
+
+bool LedTapReader::Initialize() {
+  // The reader deadline is written, so the object is mapped read-write.
+  const int fd = shm_open(name_.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    std::cerr << "Failed to open tap " << name_ << ": " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 ||
+      static_cast<size_t>(file_stat.st_size) < LedTapFormat::kHeaderLength) {
+    std::cerr << "Tap " << name_ << " is too short" << std::endl;
+    close(fd);
+    return false;
+  }
+  size_ = file_stat.st_size;
+  void *data =
+      mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    std::cerr << "Failed to map tap " << name_ << ": " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  data_ = static_cast<const uint8_t *>(data);
+  header_ = static_cast<LedTapFormat::Header *>(data);
+
+  if (memcmp(header_->magic, LedTapFormat::kMagic,
+             sizeof(header_->magic)) != 0) {
+    std::cerr << name_ << " is not an LED tap" << std::endl;
+    return false;
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (header_->slot_count == 0 ||
+      header_->slot_stride <
+          sizeof(LedTapFormat::SlotHeader) + header_->frame_length ||
+      header_->header_length +
+              static_cast<size_t>(header_->slot_count) *
+                  header_->slot_stride >
+          size_) {
+    std::cerr << "Tap " << name_ << " is corrupt" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool LedTapReader::Read(std::vector<uint8_t> *frame, uint64_t *frame_number,
+                        int64_t *timestamp_ns) {
+  header_->reader_deadline_ns.store(MonotonicNowNs() + kReaderTimeoutNs,
+                                    std::memory_order_relaxed);
+
+  const uint64_t published =
+      header_->frames_published.load(std::memory_order_acquire);
+  if (published == 0 || published - 1 == last_frame_number_) {
+    return false;
+  }
+  const uint64_t latest = published - 1;
+  const uint8_t *slot = data_ + header_->header_length +
+                        (latest % header_->slot_count) * header_->slot_stride;
+  const auto *slot_header =
+      reinterpret_cast<const LedTapFormat::SlotHeader *>(slot);
+
+  frame->resize(header_->frame_length);
+  // The writer only reuses the slot after `slot_count` more frames, so a
+  // retry almost never happens, but it must not be relied upon.
+  for (int attempt = 0; attempt < 4; ++attempt) {
+    const uint32_t before =
+        slot_header->sequence.load(std::memory_order_acquire);
+    if (before & 1) {
+      continue;
+    }
+    const uint64_t number = slot_header->frame_number;
+    const int64_t timestamp = slot_header->timestamp_ns;
+    memcpy(frame->data(), slot + sizeof(LedTapFormat::SlotHeader),
+           frame->size());
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot_header->sequence.load(std::memory_order_relaxed) != before) {
+      continue;
+    }
+    if (number != latest) {
+      return false;
+    }
+    last_frame_number_ = latest;
+    *frame_number = number;
+    *timestamp_ns = timestamp;
+    return true;
+  }
+  return false;
+}
+
+}  // namespace led_driver
@@ -0,0 +1,152 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef LED_TAP_H_
+#define LED_TAP_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/types/span.h"
+#include "led_frame_sink.h"
+
+namespace led_driver {
+
+// A POSIX shared memory ring of the latest LED frames, for observers such as
+// previewers, recorders and analysis tools. All fields are native endian.
+//
+//   Header:  char   magic[8] = "LEDTAP01"
+//            uint32 header_length     Offset of the first slot.
+//            uint32 slot_count
+//            uint32 frame_length      Bytes of LED data per frame.
+//            uint32 slot_stride       Bytes per slot.
+//            uint32 stage             kStageInput or kStageOutput.
+//            uint32 reserved
+//            uint64 frames_published  Frame number of the latest slot, + 1.
+//            int64  reader_deadline_ns
+//   Slots:   uint32 sequence          Seqlock: odd while being written.
+//            uint32 reserved
+//            uint64 frame_number      Counts every frame sent, read or not.
+//            int64  timestamp_ns      CLOCK_MONOTONIC.
+//            int64  unix_time_us
+//            uint8  data[frame_length]
+//
+// Frame `n` is written to slot `n % slot_count`. Readers keep
+// `reader_deadline_ns` a little ahead of CLOCK_MONOTONIC while they are
+// attached; when it has passed, the writer skips publishing altogether, so an
+// unobserved tap costs the output a clock read and an atomic load per frame.
+struct LedTapFormat {
+  static constexpr char kMagic[8] = {'L', 'E', 'D', 'T', 'A', 'P', '0', '1'};
+
+  // Frames from before color correction, as RGB, or exactly as sent to the
+  // LEDs: corrected, with red and green transposed.
+  static constexpr uint32_t kStageInput = 0;
+  static constexpr uint32_t kStageOutput = 1;
+
+  struct Header {
+    char magic[8];
+    uint32_t header_length;
+    uint32_t slot_count;
+    uint32_t frame_length;
+    uint32_t slot_stride;
+    uint32_t stage;
+    uint32_t reserved;
+    std::atomic<uint64_t> frames_published;
+    std::atomic<int64_t> reader_deadline_ns;
+  };
+
+  struct SlotHeader {
+    std::atomic<uint32_t> sequence;
+    uint32_t reserved;
+    uint64_t frame_number;
+    int64_t timestamp_ns;
+    int64_t unix_time_us;
+  };
+
+  static constexpr size_t kHeaderLength = 64;
+  static constexpr size_t kSlotAlignment = 64;
+};
+
+// Publishes frames to a tap. Creates, or takes over, the shared memory object
+// `name`, such as "/led_driver_tap", and removes it when destroyed.
+class LedTapWriter : public LedFrameSinkInterface {
+ public:
+  static std::shared_ptr<LedTapWriter> Create(const std::string &name,
+                                              size_t frame_length,
+                                              uint32_t stage,
+                                              int slot_count = 4);
+
+  ~LedTapWriter() override;
+
+  bool Receive(absl::Span<const uint8_t> led_data) override;
+
+ private:
+  LedTapWriter(std::string name, size_t frame_length, uint32_t stage,
+               int slot_count);
+
+  bool Initialize();
+
+  const std::string name_;
+  const size_t frame_length_;
+  const uint32_t stage_;
+  const int slot_count_;
+  size_t slot_stride_ = 0;
+
+  uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+  LedTapFormat::Header *header_ = nullptr;
+  uint64_t frame_number_ = 0;
+};
+
+// Reads the latest frame from a tap, keeping the writer publishing while it
+// is attached.
+class LedTapReader {
+ public:
+  static std::shared_ptr<LedTapReader> Create(const std::string &name);
+
+  ~LedTapReader();
+
+  size_t frame_length() const { return header_->frame_length; }
+  uint32_t stage() const { return header_->stage; }
+
+  // Copies the latest frame into `frame`, if it is newer than the one read
+  // before. Returns false if there is no new frame. Also renews the reader
+  // deadline, so must be called at least every second or so.
+  bool Read(std::vector<uint8_t> *frame, uint64_t *frame_number,
+            int64_t *timestamp_ns);
+
+ private:
+  explicit LedTapReader(std::string name) : name_(std::move(name)) {}
+
+  bool Initialize();
+
+  const std::string name_;
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+  LedTapFormat::Header *header_ = nullptr;
+  uint64_t last_frame_number_ = UINT64_MAX;
+};
+
+}  // namespace led_driver
+
+#endif  // LED_TAP_H_
@@ -0,0 +1,105 @@
+# LED Suit Driver - Embedded host driver software for Kevin's LED suit controller.
+# Copyright (C) 2019-2020 Kevin Balke
+#
+# This file is part of LED Suit Driver.
+#
+# LED Suit Driver is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# LED Suit Driver is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+"""Reads the latest LED frames published by `led_driver --led_tap`.
+
+See led_tap.h for the layout of the shared memory object.
+"""
+
+import mmap
+import os
+import struct
+import time
+
+_MAGIC = b"LEDTAP01"
+_HEADER = struct.Struct("=8sIIIIII")
+_FRAMES_PUBLISHED = struct.Struct("=Q")
+_READER_DEADLINE = struct.Struct("=q")
+_FRAMES_PUBLISHED_OFFSET = 32
+_READER_DEADLINE_OFFSET = 40
+_SLOT_HEADER = struct.Struct("=IIQqq")
+
+STAGE_INPUT = 0
+STAGE_OUTPUT = 1
+
+# How long the writer keeps publishing after the last read.
+_READER_TIMEOUT_NS = 1000000000
+
+
+class LedTap(object):
+    def __init__(self, name):
+        fd = os.open(os.path.join("/dev/shm", name.lstrip("/")), os.O_RDWR)
+        try:
+            self.map = mmap.mmap(fd, 0)
+        finally:
+            os.close(fd)
+        (magic, self.header_length, self.slot_count, self.frame_length,
+         self.slot_stride, self.stage, _) = _HEADER.unpack_from(self.map, 0)
+        if magic != _MAGIC:
+            raise ValueError("{} is not an LED tap".format(name))
+        self.last_frame_number = None
+
+    def Close(self):
+        self.map.close()
+
+    def Read(self):
+        """Returns (frame_number, timestamp_ns, data) for the latest frame, or
+        None if there is no frame newer than the last one read.
+
+        Must be called at least every second or so, or the writer stops
+        publishing.
+        """
+        _READER_DEADLINE.pack_into(
+            self.map, _READER_DEADLINE_OFFSET,
+            time.clock_gettime_ns(time.CLOCK_MONOTONIC) + _READER_TIMEOUT_NS)
+
+        published, = _FRAMES_PUBLISHED.unpack_from(self.map,
+                                                   _FRAMES_PUBLISHED_OFFSET)
+        if published == 0 or published - 1 == self.last_frame_number:
+            return None
+        latest = published - 1
+        slot = (self.header_length +
+                (latest % self.slot_count) * self.slot_stride)
+        data_offset = slot + _SLOT_HEADER.size
+
+        for _ in range(4):
+            (before, _, frame_number, timestamp_ns,
+             _) = _SLOT_HEADER.unpack_from(self.map, slot)
+            if before & 1:
+                continue
+            data = self.map[data_offset:data_offset + self.frame_length]
+            after, = struct.unpack_from("=I", self.map, slot)
+            if after != before:
+                continue
+            if frame_number != latest:
+                return None
+            self.last_frame_number = latest
+            return frame_number, timestamp_ns, data
+        return None
+
+    def ReadColors(self):
+        """Like Read, but returns a list of (r, g, b) tuples, one per LED."""
+        frame = self.Read()
+        if frame is None:
+            return None
+        data = frame[2]
+        if self.stage == STAGE_OUTPUT:
+            # Frames sent to the LEDs have red and green transposed.
+            return [(data[i + 1], data[i], data[i + 2])
+                    for i in range(0, len(data) - 2, 3)]
+        return [(data[i], data[i + 1], data[i + 2])
+                for i in range(0, len(data) - 2, 3)]
@@ -0,0 +1,340 @@
+# LED Suit Driver - Embedded host driver software for Kevin's LED suit controller.
+# Copyright (C) 2019-2020 Kevin Balke
+#
+# This file is part of LED Suit Driver.
+#
+# LED Suit Driver is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# LED Suit Driver is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+
+# Works out how large a raster the visualizer needs to render for a mapping.
+# led_driver samples one pixel per LED, so a raster finer than the LEDs are
+# spaced renders detail they can't show, which point sampling aliases, while a
+# coarser one leaves neighboring LEDs sharing a pixel. The smallest raster at
+# which every LED gets a pixel of its own is the one to render. For example:
+#
+#   mapping_analyzer.py --mapping_file=mapping.binaryproto \
+#       --regions=glasses:0:72,hat:300:85,line:600:105
+#
+# Reports each LED's nearest-neighbor spacing, in pixels of the current raster,
+# and its footprint, the area it samples, in pixels of the recommended raster,
+# for the whole mapping, each point of interest and each region, with the
+# raster each of them needs. LEDs with a footprint below one pixel are listed.
+
+import math
+
+import numpy
+from led_driver.led_mapping_pb2 import Mapping
+from absl import app
+from absl import flags
+
+flags.DEFINE_string("mapping_file", "mapping.binaryproto",
+                    "File containing the LED mapping")
+flags.DEFINE_integer("raster_width", 50,
+                     "Width of the raster currently rendered, in pixels")
+flags.DEFINE_integer("raster_height", 50,
+                     "Height of the raster currently rendered, in pixels")
+flags.DEFINE_float(
+    "aspect", None,
+    "Height over width of the recommended raster; defaults to that of the "
+    "current raster")
+flags.DEFINE_float(
+    "coverage", 1.0,
+    "Fraction of the LEDs which must each get a pixel of their own. Lower "
+    "values let the densest few share, for a smaller raster")
+flags.DEFINE_string(
+    "regions", "",
+    "Comma-separated LED index ranges to report on, as name:start:count")
+flags.DEFINE_integer("max_width", 4096, "Largest raster width to consider")
+flags.DEFINE_bool("per_led", False, "Also report every LED")
+
+FLAGS = flags.FLAGS
+
+# LEDs closer than this, in normalized coordinates, are at the same position,
+# like the padding which fills out a driver port, and are left out.
+DUPLICATE_DISTANCE = 1e-6
+
+# Footprints are counted on up to this many subpixels, in tiles of this many
+# pixels square.
+FOOTPRINT_SAMPLES = 1 << 22
+FOOTPRINT_TILE = 16
+
+
+def LoadMapping(path):
+    mapping = Mapping()
+    with open(path, "rb") as mapping_file:
+        mapping.ParseFromString(mapping_file.read())
+    samples = numpy.array([(sample.x, sample.y) for sample in mapping.samples],
+                          dtype=numpy.float64).reshape(-1, 2)
+    return samples, list(mapping.points_of_interest)
+
+
+def FindDuplicates(points):
+    # Marks every LED at the position of an earlier one.
+    keys = numpy.round(points / DUPLICATE_DISTANCE).astype(numpy.int64)
+    _, first = numpy.unique(keys, axis=0, return_index=True)
+    duplicate = numpy.ones(len(points), dtype=bool)
+    duplicate[first] = False
+    return duplicate
+
+
+def NearestNeighborDistances(points):
+    # Distance from each point to its nearest neighbor, found with a uniform
+    # grid so that large mappings don't need every pair.
+    count = len(points)
+    if count < 2:
+        return numpy.full(count, numpy.inf)
+    low = points.min(axis=0)
+    extent = numpy.maximum(points.max(axis=0) - low, DUPLICATE_DISTANCE)
+    cell_size = math.sqrt(extent[0] * extent[1] / count) or max(extent)
+    cells = numpy.floor((points - low) / cell_size).astype(numpy.int64)
+    grid = {}
+    for index, cell in enumerate(map(tuple, cells)):
+        grid.setdefault(cell, []).append(index)
+    max_ring = int(max(extent) / cell_size) + 2
+
+    distances = numpy.full(count, numpy.inf)
+    for index in range(count):
+        cell_x, cell_y = cells[index]
+        best = numpy.inf
+        for ring in range(max_ring + 1):
+            # Points beyond this ring are at least `ring` cells away.
+            if best <= (ring - 1) * cell_size:
+                break
+            candidates = []
+            for dx in range(-ring, ring + 1):
+                for dy in range(-ring, ring + 1):
+                    if max(abs(dx), abs(dy)) == ring:
+                        candidates.extend(
+                            grid.get((cell_x + dx, cell_y + dy), ()))
+            candidates = [c for c in candidates if c != index]
+            if candidates:
+                offsets = points[candidates] - points[index]
+                best = min(best,
+                           numpy.sqrt((offsets * offsets).sum(axis=1)).min())
+        distances[index] = best
+    return distances
+
+
+def PixelCoordinates(points, width, height):
+    # As led_driver's LedSampler::ScaleCoordinates.
+    return numpy.stack(
+        ((points[:, 0] * (width - 1)).astype(numpy.int64),
+         (points[:, 1] * (height - 1)).astype(numpy.int64)),
+        axis=1)
+
+
+def SharingPixel(points, width, height):
+    # Marks every LED whose pixel another LED samples too.
+    pixels = PixelCoordinates(points, width, height)
+    _, inverse, counts = numpy.unique(pixels,
+                                      axis=0,
+                                      return_inverse=True,
+                                      return_counts=True)
+    return counts[inverse.reshape(-1)] > 1
+
+
+def Footprints(points, width, height):
+    # Each LED's sampling area: the part of the raster nearer to it than to
+    # any other LED, its Voronoi cell, in pixels. `points` are in pixels of
+    # the raster. Counted on a grid of subpixels, tile by tile, comparing
+    # each tile only with the LEDs that can be nearest to some of it.
+    count = len(points)
+    areas = numpy.zeros(count)
+    if count == 0:
+        return areas
+    subpixels = int(
+        min(max(math.sqrt(FOOTPRINT_SAMPLES / (width * height)), 1), 4))
+    tile = FOOTPRINT_TILE
+    half_diagonal = tile / math.sqrt(2.0)
+    offsets = (numpy.arange(tile * subpixels) + 0.5) / subpixels - 0.5
+    tile_x, tile_y = numpy.meshgrid(numpy.arange(0, width, tile),
+                                    numpy.arange(0, height, tile))
+    corners = numpy.stack((tile_x.ravel(), tile_y.ravel()), axis=1)
+    for corner in corners:
+        xs = corner[0] + offsets[offsets < width - corner[0] - 0.5]
+        ys = corner[1] + offsets[offsets < height - corner[1] - 0.5]
+        center = corner - 0.5 + tile / 2.0
+        distances = numpy.sqrt(((points - center)**2).sum(axis=1))
+        # Any subpixel is within half_diagonal of the center, so its nearest
+        # LED is within nearest + 2 * half_diagonal of the center.
+        candidates = numpy.flatnonzero(
+            distances <= distances.min() + 2.0 * half_diagonal)
+        grid_x, grid_y = numpy.meshgrid(xs, ys)
+        dx = grid_x.ravel()[:, None] - points[candidates, 0]
+        dy = grid_y.ravel()[:, None] - points[candidates, 1]
+        nearest = candidates[(dx * dx + dy * dy).argmin(axis=1)]
+        areas += numpy.bincount(nearest, minlength=count)
+    return areas / (subpixels * subpixels)
+
+
+def HeightFor(width, aspect):
+    return max(int(round((width - 1) * aspect)) + 1, 2)
+
+
+def SmallestRaster(points, unique, members, spacing, aspect, coverage,
+                   max_width):
+    # The smallest raster at `aspect` at which at least `coverage` of the LEDs
+    # in `members` get a pixel of their own from the other `unique` LEDs.
+    # Spacing below a pixel guarantees sharing, so the search starts where the
+    # spacing allows.
+    if not members.any():
+        return None
+    finite = spacing[members & numpy.isfinite(spacing)]
+    width = 2
+    if len(finite):
+        needed = numpy.quantile(finite, 1.0 - coverage)
+        width = max(int(math.ceil(1.0 / max(needed, 1e-9))) + 1, 2)
+    allowed = int(math.floor(members.sum() * (1.0 - coverage) + 1e-9))
+    while width <= max_width:
+        height = HeightFor(width, aspect)
+        shared = SharingPixel(points[unique], width,
+                              height)[members[unique]].sum()
+        if shared <= allowed:
+            return width, height
+        width += 1
+    return None
+
+
+def Quantiles(values):
+    finite = values[numpy.isfinite(values)]
+    if not len(finite):
+        return "-"
+    return "{:.2f} / {:.2f} / {:.2f}".format(finite.min(),
+                                             numpy.quantile(finite, 0.05),
+                                             numpy.median(finite))
+
+
+def ParseRegions(spec, count):
+    regions = []
+    for entry in filter(None, spec.split(",")):
+        fields = entry.split(":")
+        if len(fields) != 3:
+            raise app.UsageError(
+                "Region {} isn't name:start:count".format(entry))
+        name, start, length = fields[0], int(fields[1]), int(fields[2])
+        members = numpy.zeros(count, dtype=bool)
+        members[max(start, 0):min(start + length, count)] = True
+        regions.append((name, members))
+    return regions
+
+
+def PointOfInterestRegions(samples, points_of_interest):
+    regions = []
+    for index, point in enumerate(points_of_interest):
+        radius = numpy.maximum(
+            numpy.array((point.radius_x, point.radius_y)), DUPLICATE_DISTANCE)
+        offsets = (samples - numpy.array(
+            (point.center.x, point.center.y))) / radius
+        regions.append(("poi{}".format(index),
+                        (offsets * offsets).sum(axis=1) <= 1.0))
+    return regions
+
+
+def main(argv):
+    samples, points_of_interest = LoadMapping(FLAGS.mapping_file)
+    count = len(samples)
+    if count == 0:
+        raise app.UsageError("{} has no samples".format(FLAGS.mapping_file))
+    aspect = FLAGS.aspect
+    if aspect is None:
+        aspect = (FLAGS.raster_height - 1) / max(FLAGS.raster_width - 1, 1)
+    coverage = min(max(FLAGS.coverage, 0.0), 1.0)
+
+    duplicate = FindDuplicates(samples)
+    unique = ~duplicate
+
+    # Spacing is measured on the raster's axes, in pixels of the current
+    # raster, so the recommended raster's scale is relative to it.
+    scale = numpy.array((FLAGS.raster_width - 1, FLAGS.raster_height - 1),
+                        dtype=numpy.float64)
+    aspect_points = samples * numpy.array((1.0, aspect))
+    spacing = numpy.full(count, numpy.inf)
+    spacing[unique] = NearestNeighborDistances(aspect_points[unique])
+    current_spacing = numpy.full(count, numpy.inf)
+    current_spacing[unique] = NearestNeighborDistances(samples[unique] * scale)
+    current_sharing = SharingPixel(samples[unique], FLAGS.raster_width,
+                                   FLAGS.raster_height)
+    sharing = numpy.zeros(count, dtype=bool)
+    sharing[unique] = current_sharing
+
+    print("{} LEDs, {} at the position of another and left out".format(
+        count, duplicate.sum()))
+    print("Current raster {}x{}: {} LEDs share a pixel".format(
+        FLAGS.raster_width, FLAGS.raster_height, sharing.sum()))
+    print()
+
+    regions = [("all", numpy.ones(count, dtype=bool))]
+    regions += PointOfInterestRegions(samples, points_of_interest)
+    regions += ParseRegions(FLAGS.regions, count)
+
+    rasters = [
+        SmallestRaster(samples, unique, members & unique, spacing, aspect,
+                       coverage, FLAGS.max_width) for _, members in regions
+    ]
+    recommended = rasters[0]
+
+    # Footprints are measured at the raster to render.
+    footprint_raster = recommended or (FLAGS.raster_width,
+                                       FLAGS.raster_height)
+    footprint = numpy.full(count, numpy.nan)
+    footprint[unique] = Footprints(
+        samples[unique] * (numpy.array(footprint_raster) - 1),
+        *footprint_raster)
+    small = unique & (footprint < 1.0)
+
+    print("{:<12} {:>6} {:>8} {:>22} {:>10} {:>12} {:>22} {:>6}".format(
+        "region", "leds", "sharing", "spacing min/p5/median", "needs",
+        "pixels", "footprint min/p5/med", "<1px"))
+    for (name, members), raster in zip(regions, rasters):
+        members = members & unique
+        needs = "{}x{}".format(*raster) if raster else "-"
+        pixels = raster[0] * raster[1] if raster else 0
+        print("{:<12} {:>6} {:>8} {:>22} {:>10} {:>12} {:>22} {:>6}".format(
+            name, members.sum(), (sharing & members).sum(),
+            Quantiles(current_spacing[members]), needs, pixels,
+            Quantiles(footprint[members]), (small & members).sum()))
+
+    print()
+    print("Spacing is to the nearest LED, in pixels of the current raster.")
+    print("Footprint is the area nearer to an LED than to any other, in "
+          "pixels of the {}x{} raster.".format(*footprint_raster))
+    current_pixels = FLAGS.raster_width * FLAGS.raster_height
+    if recommended is None:
+        print("No raster up to {} wide gives {:.0%} of the LEDs a pixel of "
+              "their own".format(FLAGS.max_width, coverage))
+    else:
+        width, height = recommended
+        print("Recommended raster: {}x{}, {} pixels, {:.0%} of the current "
+              "{}".format(width, height, width * height,
+                          width * height / current_pixels, current_pixels))
+        print("  --raster_width={} --raster_height={}".format(width, height))
+    if small.any():
+        print("{} LEDs have a footprint below one pixel at {}x{}: {}".format(
+            small.sum(), footprint_raster[0], footprint_raster[1],
+            " ".join(str(index) for index in numpy.flatnonzero(small))))
+
+    if FLAGS.per_led:
+        print()
+        print("{:>6} {:>8} {:>8} {:>10} {:>8} {:>10}".format(
+            "led", "x", "y", "spacing", "sharing", "footprint"))
+        for index in range(count):
+            if duplicate[index]:
+                continue
+            print("{:>6} {:>8.4f} {:>8.4f} {:>10.2f} {:>8} {:>10.2f}{}".format(
+                index, samples[index, 0], samples[index, 1],
+                current_spacing[index], "yes" if sharing[index] else "",
+                footprint[index], " <1px" if small[index] else ""))
+
+
+if __name__ == "__main__":
+    app.run(main)
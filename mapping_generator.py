@@ -23,6 +23,7 @@ import watchdog.observers
 import os
 import importlib.util
 from led_driver.led_mapping_pb2 import Mapping
+from led_driver import led_tap
 from absl import app
 from absl import flags
 
@@ -35,6 +36,13 @@ flags.DEFINE_bool("export_only", False,
                   "Only export the mapping, and then exit")
 flags.DEFINE_integer("border_size", 20,
                      "Pixels to add around the sampling array")
+flags.DEFINE_float(
+    "default_roi_radius", 64,
+    "Radius, in pixels, of points of interest which do not specify one")
+flags.DEFINE_string(
+    "led_tap", None,
+    "Shared memory tap published by led_driver --led_tap, such as "
+    "/led_driver_tap. If set, samples are filled with the live LED colors")
 
 FLAGS = flags.FLAGS
 
@@ -56,10 +64,14 @@ class GenerateModifiedHandler(watchdog.events.FileSystemEventHandler):
 
 
 class MappingGenerator(object):
-    def __init__(self, screen, border_size, generate_file, export_file):
+    def __init__(self, screen, border_size, generate_file, export_file,
+                 default_roi_radius, tap=None):
+        self.tap = tap
+        self.colors = []
         self.generate_file = generate_file
         self.export_file = export_file
         self.border_size = border_size
+        self.default_roi_radius = default_roi_radius
         self.ReloadHandler()
         self.modified_handler = GenerateModifiedHandler(
             self.generate_file, self.ReloadHandler)
@@ -83,9 +95,12 @@ class MappingGenerator(object):
 
     def Tick(self):
         self.screen.fill((0, ) * 3)
+        if self.tap:
+            colors = self.tap.ReadColors()
+            if colors is not None:
+                self.colors = colors
         self.DrawSamples(self.generate_module.GenerateSampling())
-        self.DrawPointsOfInterest(
-            self.generate_module.GeneratePointsOfInterest())
+        self.DrawPointsOfInterest(self.GenerateRegionsOfInterest())
 
     def ReloadHandler(self):
         self.generate_module = self.ReloadGenerateScript()
@@ -99,9 +114,19 @@ class MappingGenerator(object):
         generate_spec.loader.exec_module(generate_module)
         return generate_module
 
+    def GenerateRegionsOfInterest(self):
+        if hasattr(self.generate_module, "GenerateRegionsOfInterest"):
+            return [(numpy.array(center), radius, weight)
+                    for center, radius, weight in
+                    self.generate_module.GenerateRegionsOfInterest()]
+        return [(numpy.array(center), self.default_roi_radius, 1.0)
+                for center in self.generate_module.GeneratePointsOfInterest()]
+
     def DrawSample(self, index, coordinate):
         x, y = coordinate.astype(numpy.int32)
 
+        if index < len(self.colors):
+            pygame.draw.circle(self.screen, self.colors[index], (x, y), 16)
         pygame.draw.circle(self.screen, (255, ) * 3, (x, y), 16, 1)
         text_raster = self.font.render(str(index), True, (255, ) * 3)
 
@@ -109,10 +134,11 @@ class MappingGenerator(object):
             (x, y)) - (numpy.array(text_raster.get_size()) / 2)).astype(
                 numpy.int32))
 
-    def DrawPointOfInterest(self, index, coordinate):
+    def DrawPointOfInterest(self, index, coordinate, radius):
         x, y = coordinate.astype(numpy.int32)
 
         pygame.draw.circle(self.screen, (255, 0, 0), (x, y), 16, 1)
+        pygame.draw.circle(self.screen, (127, 0, 0), (x, y), int(radius), 1)
         text_raster = self.font.render("I{:d}".format(index), True,
                                        (255, ) * 3)
 
@@ -137,9 +163,9 @@ class MappingGenerator(object):
         for i, sample in enumerate(samples_flattened):
             self.DrawSample(i, sample)
 
-    def DrawPointsOfInterest(self, samples):
-        for i, sample in enumerate(samples):
-            self.DrawPointOfInterest(i, sample)
+    def DrawPointsOfInterest(self, regions):
+        for i, (center, radius, _) in enumerate(regions):
+            self.DrawPointOfInterest(i, center, radius)
 
     def ExportMapping(self):
         samples = numpy.array(list(self.generate_module.GenerateSampling()))
@@ -153,21 +179,26 @@ class MappingGenerator(object):
             coordinate = mapping.samples.add()
             coordinate.x, coordinate.y = normalized_sample
 
-        with open(self.export_file, 'wb') as export_file:
-            export_file.write(mapping.SerializeToString())
+        regions = self.GenerateRegionsOfInterest()
+        for i, (center, radius, weight) in enumerate(regions):
+            normalized_center = numpy.divide(center - min_sample,
+                                             range_sample)
+            normalized_radius = numpy.divide((radius, radius), range_sample)
 
-        points_of_interest = numpy.array(
-            list(self.generate_module.GeneratePointsOfInterest()))
+            point_of_interest = mapping.points_of_interest.add()
+            (point_of_interest.center.x,
+             point_of_interest.center.y) = normalized_center
+            (point_of_interest.radius_x,
+             point_of_interest.radius_y) = normalized_radius
+            point_of_interest.weight = weight
 
-        if points_of_interest.size > 0:
-          normalized_points_of_interest = numpy.divide(
-              points_of_interest - min_sample, range_sample)
+            screen_coord = (normalized_center - numpy.array((0.5, 0.5))) * 2
+            screen_coord = screen_coord * numpy.array((1, -1))
+            print("%Point of interest {:4d}: {:s}".format(
+                i, str(screen_coord)))
 
-          for i, point_of_interest in enumerate(normalized_points_of_interest):
-              screen_coord = (point_of_interest - numpy.array((0.5, 0.5))) * 2
-              screen_coord = screen_coord * numpy.array((1, -1))
-              print("%Point of interest {:4d}: {:s}".format(
-                  i, str(screen_coord)))
+        with open(self.export_file, 'wb') as export_file:
+            export_file.write(mapping.SerializeToString())
 
 
 def main(argv):
@@ -178,9 +209,15 @@ def main(argv):
     else:
         screen = None
 
+    tap = None
+    if FLAGS.led_tap and not FLAGS.export_only:
+        tap = led_tap.LedTap(FLAGS.led_tap)
+
     mapping_generator = MappingGenerator(screen, FLAGS.border_size,
                                          FLAGS.generate_file,
-                                         FLAGS.export_file)
+                                         FLAGS.export_file,
+                                         FLAGS.default_roi_radius,
+                                         tap)
 
     if FLAGS.export_only:
         print("Exported mapping file, exiting")
@@ -0,0 +1,194 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "multi_spi_output.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+
+namespace led_driver {
+
+namespace {
+// LED data address and mode, as for the single SPI device.
+constexpr size_t kHeaderLength = 2;
+constexpr int kLedChannels = 3;
+}  // namespace
+
+bool MultiSpiOutput::ParseDevices(absl::string_view spec,
+                                  std::vector<Device> *devices) {
+  devices->clear();
+  for (absl::string_view entry :
+       absl::StrSplit(spec, ',', absl::SkipWhitespace())) {
+    std::vector<absl::string_view> fields = absl::StrSplit(entry, ':');
+    Device device;
+    device.path = std::string(fields[0]);
+    bool valid = !device.path.empty() && fields.size() != 2 &&
+                 fields.size() <= 5;
+    if (valid && fields.size() > 2) {
+      valid &= absl::SimpleAtoi(fields[1], &device.offset) &&
+               absl::SimpleAtoi(fields[2], &device.count);
+    }
+    if (valid && fields.size() > 3) {
+      valid &= absl::SimpleAtoi(fields[3], &device.mode) && device.mode >= 0 &&
+               device.mode <= 3;
+    }
+    if (valid && fields.size() > 4) {
+      valid &= absl::SimpleAtoi(fields[4], &device.speed_hz) &&
+               device.speed_hz > 0;
+    }
+    if (!valid) {
+      std::cerr << "Invalid SPI device \"" << entry
+                << "\", expected device[:offset:count[:mode[:speed_hz]]]"
+                << std::endl;
+      return false;
+    }
+    devices->push_back(std::move(device));
+  }
+  return !devices->empty();
+}
+
+MultiSpiOutput::~MultiSpiOutput() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  frame_ready_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+}
+
+bool MultiSpiOutput::Initialize() {
+  for (const Device &device : options_.devices) {
+    Bus bus;
+    bus.offset = std::clamp(device.offset, 0, num_leds_);
+    bus.count = device.count > 0
+                    ? std::min(device.count, num_leds_ - bus.offset)
+                    : num_leds_ - bus.offset;
+    if (bus.count <= 0) {
+      std::cerr << "SPI segment for " << device.path << " is empty"
+                << std::endl;
+      return false;
+    }
+    bus.pending.resize(kHeaderLength + bus.count * kLedChannels, 0);
+    bus.pending[0] = 0x80;
+    bus.pending[1] = 0x00;
+    bus.sending = bus.pending;
+
+    auto driver = SpiDriver::Create(
+        device.path,
+        (device.mode & 2) ? SpiDriver::ClockPolarity::IDLE_HIGH
+                          : SpiDriver::ClockPolarity::IDLE_LOW,
+        (device.mode & 1) ? SpiDriver::ClockPhase::SAMPLE_TRAILING
+                          : SpiDriver::ClockPhase::SAMPLE_LEADING,
+        device.bits_per_word, device.speed_hz, device.delay_us);
+    if (driver == nullptr) {
+      std::cerr << "Failed to open SPI device " << device.path << std::endl;
+      return false;
+    }
+    drivers_.push_back(std::move(driver));
+    buses_.push_back(std::move(bus));
+  }
+
+  for (size_t bus = 0; bus < buses_.size(); ++bus) {
+    threads_.emplace_back(&MultiSpiOutput::TransmitThread, this, bus);
+  }
+  return true;
+}
+
+bool MultiSpiOutput::Receive(absl::Span<const uint8_t> led_data) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  bool result = true;
+  ++frame_;
+  ++stats_.frames;
+  for (Bus &bus : buses_) {
+    if (bus.has_pending) {
+      ++stats_.skipped_frames;
+    }
+    result &= !bus.failed;
+    bus.failed = false;
+
+    uint8_t *segment = &bus.pending[kHeaderLength];
+    const size_t length = bus.count * kLedChannels;
+    const size_t begin =
+        std::min(led_data.size(), static_cast<size_t>(bus.offset) *
+                                      kLedChannels);
+    const size_t copied = std::min(led_data.size() - begin, length);
+    memcpy(segment, led_data.data() + begin, copied);
+    memset(segment + copied, 0, length - copied);
+    bus.has_pending = true;
+  }
+  frame_ready_.notify_all();
+
+  if (options_.barrier) {
+    frame_sent_.wait(lock, [this]() {
+      return quit_ ||
+             std::all_of(buses_.begin(), buses_.end(), [this](const Bus &bus) {
+               return bus.sent_frame == frame_;
+             });
+    });
+    for (Bus &bus : buses_) {
+      result &= !bus.failed;
+      bus.failed = false;
+    }
+  }
+  return result;
+}
+
+MultiSpiOutput::Stats MultiSpiOutput::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void MultiSpiOutput::TransmitThread(int index) {
+  ApplyThreadSchedule(absl::StrCat("spi ", index).c_str(),
+                      options_.thread_schedule);
+  Bus &bus = buses_[index];
+  SpiDriver &driver = *drivers_[index];
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    frame_ready_.wait(lock,
+                      [this, &bus]() { return quit_ || bus.has_pending; });
+    if (quit_) {
+      return;
+    }
+    bus.pending.swap(bus.sending);
+    bus.has_pending = false;
+    const uint64_t frame = frame_;
+    lock.unlock();
+
+    const bool transferred = driver.Transfer(bus.sending);
+
+    lock.lock();
+    if (!transferred) {
+      bus.failed = true;
+      ++stats_.failed_transfers;
+    }
+    bus.sent_frame = frame;
+    frame_sent_.notify_all();
+  }
+}
+
+}  // namespace led_driver
@@ -0,0 +1,149 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef MULTI_SPI_OUTPUT_H_
+#define MULTI_SPI_OUTPUT_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "led_frame_sink.h"
+#include "realtime.h"
+#include "spi_driver.h"
+
+namespace led_driver {
+
+// Sends each frame of LED data over several SPI devices at once, each driving
+// its own segment of the mapping from its own controller. Every device has a
+// transmit thread, so that the transfers overlap. As a sink, receives frames
+// once they are corrected, in place of `LedOutput`'s own SPI driver.
+class MultiSpiOutput : public LedFrameSinkInterface {
+ public:
+  struct Device {
+    // A spidev node, or a name starting with `SpiDriver::kLoopbackPrefix`.
+    std::string path;
+
+    // The first LED of the segment, and the number of LEDs; zero for the
+    // rest of the frame.
+    int offset = 0;
+    int count = 0;
+
+    // SPI mode, from 0 to 3: clock polarity in bit 1 and phase in bit 0.
+    int mode = 0;
+    int speed_hz = 15600000;
+    int bits_per_word = 8;
+    int delay_us = 0;
+  };
+
+  struct Options {
+    std::vector<Device> devices;
+
+    // If set, each frame is started on every device at once, and `Receive`
+    // waits until every device has latched it, so that the buses never show
+    // different frames. Otherwise `Receive` only hands the frame to the
+    // transmit threads, and a device still busy with the previous frame
+    // skips to the latest.
+    bool barrier = true;
+
+    // Scheduling for the transmit threads.
+    ThreadSchedule thread_schedule;
+  };
+
+  struct Stats {
+    uint64_t frames = 0;
+    // Frames replaced before a busy device could send them.
+    uint64_t skipped_frames = 0;
+    uint64_t failed_transfers = 0;
+  };
+
+  // Parses a comma-separated list of `device[:offset:count[:mode[:speed_hz]]]`
+  // devices. Returns false on a malformed list.
+  static bool ParseDevices(absl::string_view spec,
+                           std::vector<Device> *devices);
+
+  template <typename... A>
+  static std::shared_ptr<MultiSpiOutput> Create(A &&... args) {
+    auto output = std::shared_ptr<MultiSpiOutput>(
+        new MultiSpiOutput(std::forward<A>(args)...));
+    if (!output->Initialize()) {
+      return nullptr;
+    }
+    return output;
+  }
+
+  ~MultiSpiOutput() override;
+
+  // Sends `led_data`, `num_leds` triplets as they go on the wire, to every
+  // device's segment. Returns false if a transfer of the previous frame
+  // failed, or, with the barrier, of this one.
+  bool Receive(absl::Span<const uint8_t> led_data) override;
+
+  Stats stats() const;
+
+  // The driver of each device, in order.
+  const std::vector<std::shared_ptr<SpiDriver>> &drivers() const {
+    return drivers_;
+  }
+
+ private:
+  // One device's buffers. `pending` and `sending` each hold the controller's
+  // header followed by the segment's LED data.
+  struct Bus {
+    int offset;
+    int count;
+    std::vector<uint8_t> pending;
+    std::vector<uint8_t> sending;
+    bool has_pending = false;
+    bool failed = false;
+    uint64_t sent_frame = 0;
+  };
+
+  MultiSpiOutput(int num_leds, Options options)
+      : num_leds_(num_leds), options_(std::move(options)) {}
+
+  bool Initialize();
+  void TransmitThread(int bus);
+
+  const int num_leds_;
+  const Options options_;
+  std::vector<std::shared_ptr<SpiDriver>> drivers_;
+  std::vector<std::thread> threads_;
+
+  // Guards the buses, the frame count and the stats.
+  mutable std::mutex mutex_;
+  std::condition_variable frame_ready_;
+  std::condition_variable frame_sent_;
+  std::vector<Bus> buses_;
+  uint64_t frame_ = 0;
+  bool quit_ = false;
+  Stats stats_;
+};
+
+}  // namespace led_driver
+
+#endif  // MULTI_SPI_OUTPUT_H_
@@ -0,0 +1,557 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "network_input_source.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include "absl/time/clock.h"
+#include "periodic.h"
+
+extern "C" {
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+}
+
+namespace led_driver {
+
+namespace np = network_protocol;
+
+namespace {
+// Senders fall back to unsynchronized output when synchronization packets
+// stop for this long.
+constexpr absl::Duration kSyncTimeout = absl::Seconds(4);
+
+// Sequence numbers this far behind the last one are taken as a restarted
+// sender rather than a late packet.
+constexpr int kSequenceWindow = 20;
+
+constexpr int kLedChannels = 3;
+constexpr int kReceiveBufferBytes = 1 << 20;
+constexpr int kPollTimeoutMs = 100;
+
+// DDP destinations which address a display rather than configuration.
+bool IsDdpDisplayDestination(uint8_t destination) {
+  return destination == 0 || destination == np::kDdpDestinationDisplay ||
+         destination == 0xFF;
+}
+
+int64_t ThreadCpuTimeNs() {
+  timespec time;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+  return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+}  // namespace
+
+NetworkInputSource::~NetworkInputSource() {
+  Stop();
+  for (int fd : {ddp_fd_, artnet_fd_, e131_fd_}) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+bool NetworkInputSource::Initialize() {
+  if (options_.universe_channels <= 0 ||
+      options_.universe_channels > np::kDmxUniverseChannels) {
+    std::cerr << "Invalid universe size: " << options_.universe_channels
+              << std::endl;
+    return false;
+  }
+
+  if (layer_ == nullptr && options_.frame_callback == nullptr) {
+    std::cerr << "Network input has nowhere to send frames" << std::endl;
+    return false;
+  }
+  frame_.assign(layer_ != nullptr ? layer_->back().size()
+                                  : options_.num_leds * kLedChannels,
+                0);
+  num_universes_ = (frame_.size() + options_.universe_channels - 1) /
+                   options_.universe_channels;
+  for (UniverseState *state : {&artnet_state_, &e131_state_}) {
+    state->received.assign(num_universes_, 0);
+    state->sequence.assign(num_universes_, -1);
+  }
+  artnet_state_.first_universe = options_.artnet_universe;
+  e131_state_.first_universe = options_.e131_universe;
+
+  buffers_.resize(kBatchSize * np::kMaxPacketLength);
+  for (int i = 0; i < kBatchSize; ++i) {
+    iovecs_[i].iov_base = buffers_.data() + i * np::kMaxPacketLength;
+    iovecs_[i].iov_len = np::kMaxPacketLength;
+    memset(&messages_[i], 0, sizeof(messages_[i]));
+    messages_[i].msg_hdr.msg_iov = &iovecs_[i];
+    messages_[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  if (options_.ddp_port > 0) {
+    ddp_fd_ = OpenSocket(options_.ddp_port, false);
+    if (ddp_fd_ < 0) {
+      return false;
+    }
+  }
+  if (options_.artnet_port > 0) {
+    artnet_fd_ = OpenSocket(options_.artnet_port, false);
+    if (artnet_fd_ < 0) {
+      return false;
+    }
+  }
+  if (options_.e131_port > 0) {
+    e131_fd_ = OpenSocket(options_.e131_port, true);
+    if (e131_fd_ < 0) {
+      return false;
+    }
+  }
+  if (ddp_fd_ < 0 && artnet_fd_ < 0 && e131_fd_ < 0) {
+    std::cerr << "No network input protocols are enabled" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int NetworkInputSource::OpenSocket(int port, bool join_e131_groups) {
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  if (inet_pton(AF_INET, options_.bind_address.c_str(), &address.sin_addr) !=
+      1) {
+    std::cerr << "Invalid bind address: " << options_.bind_address
+              << std::endl;
+    return -1;
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    std::cerr << "Failed to create UDP socket: " << strerror(errno)
+              << std::endl;
+    return -1;
+  }
+
+  const int enable = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  // A larger buffer absorbs bursts while the thread is descheduled; the
+  // kernel may clamp it.
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &kReceiveBufferBytes,
+             sizeof(kReceiveBufferBytes));
+
+  if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+    std::cerr << "Failed to bind UDP port " << port << ": " << strerror(errno)
+              << std::endl;
+    close(fd);
+    return -1;
+  }
+
+  if (join_e131_groups && address.sin_addr.s_addr == htonl(INADDR_ANY)) {
+    // Each E1.31 universe is multicast to 239.255.<high>.<low>.
+    for (int i = 0; i < num_universes_; ++i) {
+      const int universe = options_.e131_universe + i;
+      ip_mreq request;
+      memset(&request, 0, sizeof(request));
+      request.imr_multiaddr.s_addr =
+          htonl((239 << 24) | (255 << 16) | (universe & 0xFFFF));
+      request.imr_interface.s_addr = htonl(INADDR_ANY);
+      if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request,
+                     sizeof(request)) < 0) {
+        std::cerr << "Failed to join E1.31 multicast group for universe "
+                  << universe << ", only unicast will be received: "
+                  << strerror(errno) << std::endl;
+        break;
+      }
+    }
+  }
+
+  std::cout << "Listening for LED data on UDP port " << port << std::endl;
+  return fd;
+}
+
+bool NetworkInputSource::Start() {
+  if (running_.exchange(true)) {
+    return true;
+  }
+  receive_thread_ = std::thread(&NetworkInputSource::ReceiveThread, this);
+  return true;
+}
+
+void NetworkInputSource::Stop() {
+  running_.store(false);
+  if (receive_thread_.joinable()) {
+    receive_thread_.join();
+  }
+}
+
+NetworkInputSource::Stats NetworkInputSource::stats() const {
+  Stats stats;
+  stats.packets = packets_.load(std::memory_order_relaxed);
+  stats.batches = batches_.load(std::memory_order_relaxed);
+  stats.frames = frames_.load(std::memory_order_relaxed);
+  stats.out_of_order = out_of_order_.load(std::memory_order_relaxed);
+  stats.invalid = invalid_.load(std::memory_order_relaxed);
+  stats.cpu_time =
+      absl::Nanoseconds(cpu_time_ns_.load(std::memory_order_relaxed));
+  return stats;
+}
+
+void NetworkInputSource::ReceiveThread() {
+  std::array<pollfd, 3> poll_fds;
+  std::array<Protocol, 3> protocols;
+  int num_fds = 0;
+  for (const auto &socket : {std::make_pair(ddp_fd_, Protocol::DDP),
+                             std::make_pair(artnet_fd_, Protocol::ARTNET),
+                             std::make_pair(e131_fd_, Protocol::E131)}) {
+    if (socket.first >= 0) {
+      poll_fds[num_fds] = {socket.first, POLLIN, 0};
+      protocols[num_fds] = socket.second;
+      ++num_fds;
+    }
+  }
+
+  const int64_t start_cpu_time_ns = ThreadCpuTimeNs();
+  Periodic<int64_t> report_timer(
+      std::max<int64_t>(absl::ToInt64Milliseconds(options_.report_period), 1),
+      absl::ToUnixMillis(absl::Now()));
+  Stats last_report = stats();
+  absl::Time last_report_time = absl::Now();
+
+  while (running_.load()) {
+    int result = poll(poll_fds.data(), num_fds, kPollTimeoutMs);
+    if (result < 0 && errno != EINTR) {
+      std::cerr << "Failed to poll network input: " << strerror(errno)
+                << std::endl;
+      break;
+    }
+    for (int i = 0; result > 0 && i < num_fds; ++i) {
+      if (poll_fds[i].revents & POLLIN) {
+        ReceiveBatches(poll_fds[i].fd, protocols[i]);
+      }
+    }
+
+    const absl::Time now = absl::Now();
+    if (layer_active_ && now - last_frame_ > options_.timeout) {
+      if (layer_ != nullptr) {
+        layer_->set_enabled(false);
+      }
+      layer_active_ = false;
+      std::cout << "Network input stopped" << std::endl;
+    }
+    cpu_time_ns_.store(ThreadCpuTimeNs() - start_cpu_time_ns,
+                       std::memory_order_relaxed);
+
+    if (options_.report_period > absl::ZeroDuration() &&
+        report_timer.IsDue(absl::ToUnixMillis(now))) {
+      const Stats current = stats();
+      const uint64_t packets = current.packets - last_report.packets;
+      const uint64_t batches = current.batches - last_report.batches;
+      std::cout << "Network: " << packets << " packets in " << batches
+                << " batches, " << current.frames - last_report.frames
+                << " frames, "
+                << current.out_of_order - last_report.out_of_order
+                << " out of order, " << current.invalid - last_report.invalid
+                << " invalid, "
+                << 100.0 * absl::FDivDuration(
+                               current.cpu_time - last_report.cpu_time,
+                               now - last_report_time)
+                << "% CPU" << std::endl;
+      last_report = current;
+      last_report_time = now;
+    }
+  }
+}
+
+void NetworkInputSource::ReceiveBatches(int fd, Protocol protocol) {
+  while (true) {
+    int count = recvmmsg(fd, messages_.data(), kBatchSize, MSG_DONTWAIT,
+                         nullptr);
+    if (count <= 0) {
+      if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        std::cerr << "Failed to receive network input: " << strerror(errno)
+                  << std::endl;
+      }
+      return;
+    }
+    batches_.fetch_add(1, std::memory_order_relaxed);
+    packets_.fetch_add(count, std::memory_order_relaxed);
+
+    const absl::Time now = absl::Now();
+    for (int i = 0; i < count; ++i) {
+      if (messages_[i].msg_hdr.msg_flags & MSG_TRUNC) {
+        invalid_.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      absl::Span<const uint8_t> packet(
+          buffers_.data() + i * np::kMaxPacketLength, messages_[i].msg_len);
+      switch (protocol) {
+        case Protocol::DDP:
+          HandleDdp(packet, now);
+          break;
+        case Protocol::ARTNET:
+          HandleArtNet(packet, now);
+          break;
+        case Protocol::E131:
+          HandleE131(packet, now);
+          break;
+      }
+    }
+
+    if (count < kBatchSize) {
+      return;
+    }
+  }
+}
+
+void NetworkInputSource::HandleDdp(absl::Span<const uint8_t> packet,
+                                   absl::Time now) {
+  if (packet.size() < np::kDdpHeaderLength ||
+      (packet[0] & np::kDdpVersionMask) != np::kDdpVersion1) {
+    invalid_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  const uint8_t flags = packet[0];
+  if ((flags & (np::kDdpFlagQuery | np::kDdpFlagReply)) ||
+      !IsDdpDisplayDestination(packet[3])) {
+    return;
+  }
+
+  const size_t header_length =
+      np::kDdpHeaderLength +
+      ((flags & np::kDdpFlagTimecode) ? np::kDdpTimecodeLength : 0);
+  const uint32_t offset = np::ReadBigEndian32(packet.data() + 4);
+  const uint16_t length = np::ReadBigEndian16(packet.data() + 8);
+  if (packet.size() < header_length + length) {
+    invalid_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  // Sequence numbers cycle through 1 to 15, leaving too little room to tell a
+  // late packet from a new one; only duplicates are dropped.
+  const uint8_t sequence = packet[1] & np::kDdpSequenceMask;
+  if (sequence != 0 && sequence == ddp_sequence_) {
+    out_of_order_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  ddp_sequence_ = sequence;
+  if (flags & np::kDdpFlagTimecode) {
+    frame_timecode_ =
+        np::ReadBigEndian32(packet.data() + np::kDdpHeaderLength);
+  }
+
+  if (offset < frame_.size()) {
+    memcpy(frame_.data() + offset, packet.data() + header_length,
+           std::min<size_t>(length, frame_.size() - offset));
+  }
+
+  // Senders which never push are taken to end each frame with the packet
+  // which fills the last LED.
+  if (flags & np::kDdpFlagPush) {
+    ddp_push_seen_ = true;
+    PublishFrame(now);
+  } else if (!ddp_push_seen_ && offset + length >= frame_.size()) {
+    PublishFrame(now);
+  }
+}
+
+void NetworkInputSource::HandleArtNet(absl::Span<const uint8_t> packet,
+                                      absl::Time now) {
+  if (packet.size() < np::kArtSyncLength ||
+      memcmp(packet.data(), np::kArtNetId, sizeof(np::kArtNetId)) != 0) {
+    invalid_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  const uint16_t opcode = packet[8] | (packet[9] << 8);
+  if (opcode == np::kArtNetOpSync) {
+    HandleSync(&artnet_state_, now);
+    return;
+  }
+  if (opcode != np::kArtNetOpDmx) {
+    // Polls and other management packets aren't answered.
+    return;
+  }
+  if (packet.size() < np::kArtDmxHeaderLength) {
+    invalid_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  const uint16_t length = np::ReadBigEndian16(packet.data() + 16);
+  if (packet.size() < np::kArtDmxHeaderLength + length) {
+    invalid_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  const int universe = packet[14] | ((packet[15] & 0x7F) << 8);
+  // A sequence of zero disables sequence checking.
+  const int sequence = packet[12] == 0 ? -1 : packet[12];
+  HandleUniverse(&artnet_state_, universe, sequence,
+                 packet.subspan(np::kArtDmxHeaderLength, length), now);
+}
+
+void NetworkInputSource::HandleE131(absl::Span<const uint8_t> packet,
+                                    absl::Time now) {
+  if (packet.size() < np::kE131SyncLength ||
+      memcmp(packet.data() + 4, np::kE131AcnId, sizeof(np::kE131AcnId)) != 0) {
+    invalid_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  const uint32_t root_vector =
+      np::ReadBigEndian32(packet.data() + np::kE131RootVectorOffset);
+  const uint32_t framing_vector =
+      np::ReadBigEndian32(packet.data() + np::kE131FramingVectorOffset);
+  if (root_vector == np::kE131RootVectorExtended &&
+      framing_vector == np::kE131FramingVectorSync) {
+    const uint16_t sync_address = np::ReadBigEndian16(
+        packet.data() + np::kE131SyncPacketAddressOffset);
+    if (sync_address == e131_sync_address_) {
+      HandleSync(&e131_state_, now);
+    }
+    return;
+  }
+  if (root_vector != np::kE131RootVectorData ||
+      framing_vector != np::kE131FramingVectorData) {
+    // Universe discovery isn't needed.
+    return;
+  }
+
+  if (packet.size() < np::kE131DataHeaderLength ||
+      packet[117] != np::kE131DmpVector ||
+      packet[118] != np::kE131AddressType) {
+    invalid_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  const uint8_t options = packet[np::kE131OptionsOffset];
+  if ((options & (np::kE131OptionPreview | np::kE131OptionTerminated)) ||
+      packet[np::kE131StartCodeOffset] != 0) {
+    // Preview data, terminated streams and alternate start codes aren't
+    // meant for output.
+    return;
+  }
+
+  const uint16_t property_count =
+      np::ReadBigEndian16(packet.data() + np::kE131PropertyCountOffset);
+  if (property_count == 0 ||
+      packet.size() < np::kE131DataHeaderLength + property_count - 1) {
+    invalid_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  // Data without a synchronization address is shown as it completes.
+  const uint16_t sync_address =
+      np::ReadBigEndian16(packet.data() + np::kE131SyncAddressOffset);
+  e131_sync_address_ = sync_address;
+  if (sync_address == 0) {
+    e131_state_.synchronized = false;
+  }
+
+  const int universe =
+      np::ReadBigEndian16(packet.data() + np::kE131UniverseOffset);
+  HandleUniverse(&e131_state_, universe, packet[np::kE131SequenceOffset],
+                 packet.subspan(np::kE131DataHeaderLength, property_count - 1),
+                 now);
+}
+
+void NetworkInputSource::HandleUniverse(UniverseState *state, int universe,
+                                        int sequence,
+                                        absl::Span<const uint8_t> channels,
+                                        absl::Time now) {
+  const int index = universe - state->first_universe;
+  if (index < 0 || index >= num_universes_) {
+    return;
+  }
+
+  if (sequence >= 0) {
+    const int last_sequence = state->sequence[index];
+    const int8_t delta = static_cast<int8_t>(sequence - last_sequence);
+    if (last_sequence >= 0 && delta <= 0 && delta > -kSequenceWindow) {
+      out_of_order_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    state->sequence[index] = sequence;
+  }
+
+  if (state->synchronized && now - state->last_sync > kSyncTimeout) {
+    state->synchronized = false;
+  }
+
+  if (state->received[index] && !state->synchronized) {
+    // The sender has moved on to the next frame without completing this one.
+    PublishFrame(now);
+    ResetUniverses(state);
+  }
+
+  const size_t offset = index * options_.universe_channels;
+  const size_t length = std::min<size_t>(
+      {channels.size(), static_cast<size_t>(options_.universe_channels),
+       frame_.size() - offset});
+  memcpy(frame_.data() + offset, channels.data(), length);
+
+  if (!state->received[index]) {
+    state->received[index] = 1;
+    ++state->received_count;
+  }
+  if (!state->synchronized && state->received_count == num_universes_) {
+    PublishFrame(now);
+    ResetUniverses(state);
+  }
+}
+
+void NetworkInputSource::HandleSync(UniverseState *state, absl::Time now) {
+  state->synchronized = true;
+  state->last_sync = now;
+  if (state->received_count > 0) {
+    PublishFrame(now);
+    ResetUniverses(state);
+  }
+}
+
+void NetworkInputSource::ResetUniverses(UniverseState *state) {
+  std::fill(state->received.begin(), state->received.end(), 0);
+  state->received_count = 0;
+}
+
+void NetworkInputSource::PublishFrame(absl::Time now) {
+  frames_.fetch_add(1, std::memory_order_relaxed);
+  last_frame_ = now;
+  const bool started = !layer_active_;
+  if (started) {
+    layer_active_ = true;
+    std::cout << "Network input started" << std::endl;
+  }
+
+  if (options_.frame_callback != nullptr) {
+    options_.frame_callback(frame_, frame_timecode_);
+  }
+  frame_timecode_.reset();
+  if (layer_ != nullptr) {
+    absl::Span<uint8_t> back = layer_->back();
+    std::copy(frame_.begin(), frame_.end(), back.begin());
+    layer_->Publish();
+    if (started) {
+      layer_->set_enabled(true);
+    }
+  }
+}
+
+}  // namespace led_driver
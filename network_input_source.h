@@ -0,0 +1,202 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef NETWORK_INPUT_SOURCE_H_
+#define NETWORK_INPUT_SOURCE_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/types/optional.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "led_compositor.h"
+#include "network_protocol.h"
+
+extern "C" {
+#include <sys/socket.h>
+#include <sys/uio.h>
+}
+
+namespace led_driver {
+
+// Receives LED frames over UDP as DDP, Art-Net or E1.31 and publishes them to
+// a layer, so they reach the output without passing through a raster or
+// sampling. Packets are read in batches with recvmmsg into preallocated
+// buffers, and universes are reassembled in place into a persistent frame, so
+// the receive thread never allocates.
+//
+// A frame is published when DDP marks it with the push flag, when every
+// universe of the frame has arrived, or when a universe repeats before the
+// frame is complete. Once an ArtSync or E1.31 synchronization packet has been
+// seen, universes are instead held until the next synchronization packet.
+// Packets which arrive out of order are dropped.
+//
+// The layer is enabled when frames start arriving and disabled when they
+// stop for `timeout`, so that the layers below show through. The layer may be
+// null if frames are only wanted by a callback.
+class NetworkInputSource {
+ public:
+  // Receives a complete frame, and the DDP timecode it is to be shown at, if
+  // it had one.
+  using FrameCallbackType = std::function<void(
+      absl::Span<const uint8_t> frame, absl::optional<uint32_t> timecode)>;
+
+  struct Options {
+    // Address to bind to. E1.31 multicast groups are joined when binding to
+    // the wildcard address.
+    std::string bind_address = "0.0.0.0";
+
+    // Ports to listen on; zero disables a protocol.
+    int ddp_port = network_protocol::kDdpPort;
+    int artnet_port = network_protocol::kArtNetPort;
+    int e131_port = network_protocol::kE131Port;
+
+    // The universes which hold the first LED for each protocol. Successive
+    // universes hold successive LEDs.
+    int artnet_universe = 0;
+    int e131_universe = 1;
+
+    // Number of channels used from each universe, so that LEDs don't straddle
+    // universes. 510 is 170 RGB LEDs.
+    int universe_channels = 510;
+
+    absl::Duration timeout = absl::Seconds(2);
+
+    // If set, also receives each frame on the receive thread as it is
+    // published. Without a layer, frames then hold `num_leds` LEDs.
+    FrameCallbackType frame_callback;
+    int num_leds = 0;
+
+    // Period at which to log packet statistics; zero to disable.
+    absl::Duration report_period = absl::Seconds(10);
+  };
+
+  struct Stats {
+    uint64_t packets = 0;
+    uint64_t batches = 0;
+    uint64_t frames = 0;
+    uint64_t out_of_order = 0;
+    uint64_t invalid = 0;
+
+    // CPU time used by the receive thread.
+    absl::Duration cpu_time;
+  };
+
+  template <typename... A>
+  static std::shared_ptr<NetworkInputSource> Create(A &&... args) {
+    auto source = std::shared_ptr<NetworkInputSource>(
+        new NetworkInputSource(std::forward<A>(args)...));
+    if (!source->Initialize()) {
+      return nullptr;
+    }
+    return source;
+  }
+
+  ~NetworkInputSource();
+
+  bool Start();
+  void Stop();
+
+  Stats stats() const;
+
+ private:
+  static constexpr int kBatchSize = 32;
+
+  enum class Protocol { DDP, ARTNET, E131 };
+
+  // The state of one universe-based protocol.
+  struct UniverseState {
+    int first_universe = 0;
+    std::vector<uint8_t> received;
+    // The last sequence number of each universe, or -1.
+    std::vector<int> sequence;
+    int received_count = 0;
+    bool synchronized = false;
+    absl::Time last_sync = absl::InfinitePast();
+  };
+
+  NetworkInputSource(std::shared_ptr<LedLayer> layer, Options options)
+      : layer_(std::move(layer)), options_(std::move(options)) {}
+
+  bool Initialize();
+  int OpenSocket(int port, bool join_e131_groups);
+
+  void ReceiveThread();
+
+  // Reads and handles packets from `fd` until none are left.
+  void ReceiveBatches(int fd, Protocol protocol);
+
+  void HandleDdp(absl::Span<const uint8_t> packet, absl::Time now);
+  void HandleArtNet(absl::Span<const uint8_t> packet, absl::Time now);
+  void HandleE131(absl::Span<const uint8_t> packet, absl::Time now);
+
+  // Copies one universe's channels into the frame, publishing the frame first
+  // if the universe repeats. A negative `sequence` isn't checked.
+  void HandleUniverse(UniverseState *state, int universe, int sequence,
+                      absl::Span<const uint8_t> channels, absl::Time now);
+  void HandleSync(UniverseState *state, absl::Time now);
+  void ResetUniverses(UniverseState *state);
+  void PublishFrame(absl::Time now);
+
+  std::shared_ptr<LedLayer> layer_;
+  const Options options_;
+
+  int ddp_fd_ = -1;
+  int artnet_fd_ = -1;
+  int e131_fd_ = -1;
+
+  // Receive buffers for one batch.
+  std::vector<uint8_t> buffers_;
+  std::array<mmsghdr, kBatchSize> messages_;
+  std::array<iovec, kBatchSize> iovecs_;
+
+  std::vector<uint8_t> frame_;
+  int num_universes_ = 0;
+  UniverseState artnet_state_;
+  UniverseState e131_state_;
+  uint16_t e131_sync_address_ = 0;
+  uint8_t ddp_sequence_ = 0;
+  bool ddp_push_seen_ = false;
+  absl::optional<uint32_t> frame_timecode_;
+  absl::Time last_frame_ = absl::InfinitePast();
+  bool layer_active_ = false;
+
+  std::atomic<uint64_t> packets_{0};
+  std::atomic<uint64_t> batches_{0};
+  std::atomic<uint64_t> frames_{0};
+  std::atomic<uint64_t> out_of_order_{0};
+  std::atomic<uint64_t> invalid_{0};
+  std::atomic<int64_t> cpu_time_ns_{0};
+
+  std::atomic<bool> running_{false};
+  std::thread receive_thread_;
+};
+
+}  // namespace led_driver
+
+#endif  // NETWORK_INPUT_SOURCE_H_
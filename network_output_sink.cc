@@ -0,0 +1,244 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "network_output_sink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+
+extern "C" {
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+}
+
+namespace led_driver {
+
+namespace np = network_protocol;
+
+namespace {
+constexpr int kLedChannels = 3;
+constexpr int kSendBufferBytes = 1 << 20;
+
+bool ResolveAddress(const std::string &host, int port, sockaddr_in *address) {
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  addrinfo *result = nullptr;
+  int error = getaddrinfo(host.c_str(), nullptr, &hints, &result);
+  if (error != 0 || result == nullptr) {
+    std::cerr << "Failed to resolve " << host << ": " << gai_strerror(error)
+              << std::endl;
+    return false;
+  }
+  memcpy(address, result->ai_addr, sizeof(*address));
+  address->sin_port = htons(port);
+  freeaddrinfo(result);
+  return true;
+}
+}  // namespace
+
+bool NetworkOutputSink::ParseDestinations(
+    absl::string_view spec, std::vector<Destination> *destinations) {
+  destinations->clear();
+  for (absl::string_view entry :
+       absl::StrSplit(spec, ',', absl::SkipWhitespace())) {
+    std::vector<absl::string_view> fields = absl::StrSplit(entry, ':');
+    Destination destination;
+    destination.host = std::string(fields[0]);
+    bool valid = !destination.host.empty() && fields.size() != 3 &&
+                 fields.size() <= 5;
+    if (valid && fields.size() > 1) {
+      valid &= absl::SimpleAtoi(fields[1], &destination.port);
+    }
+    if (valid && fields.size() > 3) {
+      valid &= absl::SimpleAtoi(fields[2], &destination.offset) &&
+               absl::SimpleAtoi(fields[3], &destination.count);
+    }
+    if (valid && fields.size() > 4) {
+      valid &= absl::SimpleAtoi(fields[4], &destination.remote_offset);
+    }
+    if (!valid) {
+      std::cerr << "Invalid network output destination \"" << entry
+                << "\", expected host[:port[:offset:count[:remote_offset]]]"
+                << std::endl;
+      return false;
+    }
+    destinations->push_back(std::move(destination));
+  }
+  return !destinations->empty();
+}
+
+NetworkOutputSink::~NetworkOutputSink() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+bool NetworkOutputSink::Initialize() {
+  fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0) {
+    std::cerr << "Failed to create UDP socket: " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &kSendBufferBytes,
+             sizeof(kSendBufferBytes));
+
+  size_t max_packets = 0;
+  for (const Destination &destination : options_.destinations) {
+    const int offset = std::clamp(destination.offset, 0, num_leds_);
+    const int count = destination.count > 0
+                          ? std::min(destination.count, num_leds_ - offset)
+                          : num_leds_ - offset;
+    if (count <= 0 || destination.remote_offset < 0) {
+      std::cerr << "Network output segment for " << destination.host
+                << " is empty" << std::endl;
+      return false;
+    }
+
+    Segment segment;
+    if (!ResolveAddress(destination.host, destination.port,
+                        &segment.address)) {
+      return false;
+    }
+    segment.offset = offset * kLedChannels;
+    segment.length = count * kLedChannels;
+    segment.remote_offset = destination.remote_offset * kLedChannels;
+    segments_.push_back(segment);
+    max_packets += (segment.length + np::kDdpMaxDataLength - 1) /
+                   np::kDdpMaxDataLength;
+
+    std::cout << "Sending LEDs " << offset << " to " << offset + count - 1
+              << " to " << destination.host << ":" << destination.port
+              << std::endl;
+  }
+  if (segments_.empty()) {
+    std::cerr << "No network output destinations" << std::endl;
+    return false;
+  }
+
+  buffers_.resize(max_packets * np::kMaxPacketLength);
+  iovecs_.resize(max_packets);
+  messages_.resize(max_packets);
+  for (size_t i = 0; i < max_packets; ++i) {
+    iovecs_[i].iov_base = buffers_.data() + i * np::kMaxPacketLength;
+    memset(&messages_[i], 0, sizeof(messages_[i]));
+    messages_[i].msg_hdr.msg_iov = &iovecs_[i];
+    messages_[i].msg_hdr.msg_iovlen = 1;
+    messages_[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+  }
+  previous_frame_.assign(num_leds_ * kLedChannels, 0);
+  return true;
+}
+
+bool NetworkOutputSink::Receive(absl::Span<const uint8_t> led_data) {
+  const size_t frame_length = std::min(led_data.size(), previous_frame_.size());
+  const bool keyframe = frames_since_keyframe_ == 0;
+  frames_since_keyframe_ =
+      (frames_since_keyframe_ + 1) % std::max(options_.keyframe_interval, 1);
+
+  uint32_t timecode;
+  const uint32_t *timecode_pointer = nullptr;
+  if (options_.presentation_delay > absl::ZeroDuration()) {
+    timecode = np::ToDdpTimecode(
+        options_.clock() +
+        absl::ToInt64Nanoseconds(options_.presentation_delay));
+    timecode_pointer = &timecode;
+  }
+
+  int count = 0;
+  uint64_t bytes = 0;
+  for (Segment &segment : segments_) {
+    const size_t segment_end =
+        std::min(segment.offset + segment.length, frame_length);
+    for (size_t offset = segment.offset; offset < segment_end;
+         offset += np::kDdpMaxDataLength) {
+      const size_t length =
+          std::min<size_t>(np::kDdpMaxDataLength, segment_end - offset);
+      const bool last = offset + length == segment_end;
+      if (!keyframe && !last &&
+          memcmp(led_data.data() + offset, previous_frame_.data() + offset,
+                 length) == 0) {
+        continue;
+      }
+
+      segment.sequence = segment.sequence % 15 + 1;
+      uint8_t *packet = static_cast<uint8_t *>(iovecs_[count].iov_base);
+      // Only the pushed packet needs the timecode, since it releases the
+      // frame.
+      iovecs_[count].iov_len = np::WriteDdpPacket(
+          segment.sequence, segment.remote_offset + (offset - segment.offset),
+          last, last ? timecode_pointer : nullptr,
+          led_data.subspan(offset, length), packet);
+      messages_[count].msg_hdr.msg_name = &segment.address;
+      ++count;
+    }
+  }
+
+  int sent = 0;
+  while (sent < count) {
+    int result =
+        sendmmsg(fd_, messages_.data() + sent, count - sent, MSG_DONTWAIT);
+    if (result < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != last_errno_) {
+        // Logged once per distinct error, since it repeats every frame while
+        // a destination is unreachable.
+        std::cerr << "Failed to send network output: " << strerror(errno)
+                  << std::endl;
+      }
+      last_errno_ = errno;
+      // Resend everything next frame, since the receivers missed packets.
+      dropped_frames_.fetch_add(1, std::memory_order_relaxed);
+      frames_since_keyframe_ = 0;
+      break;
+    }
+    sent += result;
+    last_errno_ = 0;
+  }
+  for (int i = 0; i < sent; ++i) {
+    bytes += iovecs_[i].iov_len;
+  }
+
+  memcpy(previous_frame_.data(), led_data.data(), frame_length);
+  frames_.fetch_add(1, std::memory_order_relaxed);
+  packets_.fetch_add(sent, std::memory_order_relaxed);
+  bytes_.fetch_add(bytes, std::memory_order_relaxed);
+
+  // A missing remote controller mustn't stop the local output.
+  return true;
+}
+
+NetworkOutputSink::Stats NetworkOutputSink::stats() const {
+  Stats stats;
+  stats.frames = frames_.load(std::memory_order_relaxed);
+  stats.packets = packets_.load(std::memory_order_relaxed);
+  stats.bytes = bytes_.load(std::memory_order_relaxed);
+  stats.dropped_frames = dropped_frames_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+}  // namespace led_driver
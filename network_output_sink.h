@@ -0,0 +1,151 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef NETWORK_OUTPUT_SINK_H_
+#define NETWORK_OUTPUT_SINK_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "clock_sync.h"
+#include "led_frame_sink.h"
+#include "network_protocol.h"
+
+extern "C" {
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+}
+
+namespace led_driver {
+
+// Sends every frame to remote LED controllers as DDP, so that one renderer
+// can drive several suits. Each destination receives a segment of the frame,
+// which it places at its own offset. All the packets of a frame, for every
+// destination, are sent with one sendmmsg call from preallocated buffers, and
+// never block the output: frames which don't fit in the socket buffer are
+// dropped.
+//
+// Frames are delta encoded: only the packets whose data changed since the
+// previous frame are sent, along with the final packet of each segment, which
+// carries the push flag. Every `keyframe_interval` frames the whole segment is
+// sent, so receivers recover from lost packets.
+class NetworkOutputSink : public LedFrameSinkInterface {
+ public:
+  struct Destination {
+    std::string host;
+    int port = network_protocol::kDdpPort;
+
+    // The segment of the frame sent, in LEDs. A count of zero sends the rest
+    // of the frame.
+    int offset = 0;
+    int count = 0;
+
+    // The LED the segment is placed at by the receiver.
+    int remote_offset = 0;
+  };
+
+  struct Options {
+    std::vector<Destination> destinations;
+    int keyframe_interval = 30;
+
+    // If positive, each frame carries a DDP timecode this far after it is
+    // sent, on `clock`, so that synchronized receivers can all show it at
+    // that instant.
+    absl::Duration presentation_delay;
+    std::function<int64_t()> clock = MonotonicNowNs;
+  };
+
+  struct Stats {
+    uint64_t frames = 0;
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t dropped_frames = 0;
+  };
+
+  // Parses a comma-separated list of `host[:port[:offset:count[:remote]]]`
+  // destinations. Returns false on a malformed list.
+  static bool ParseDestinations(absl::string_view spec,
+                                std::vector<Destination> *destinations);
+
+  template <typename... A>
+  static std::shared_ptr<NetworkOutputSink> Create(A &&... args) {
+    auto sink = std::shared_ptr<NetworkOutputSink>(
+        new NetworkOutputSink(std::forward<A>(args)...));
+    if (!sink->Initialize()) {
+      return nullptr;
+    }
+    return sink;
+  }
+
+  ~NetworkOutputSink() override;
+
+  bool Receive(absl::Span<const uint8_t> led_data) override;
+
+  Stats stats() const;
+
+ private:
+  // A destination resolved to channel offsets and an address.
+  struct Segment {
+    sockaddr_in address;
+    size_t offset;
+    size_t length;
+    uint32_t remote_offset;
+    uint8_t sequence = 0;
+  };
+
+  NetworkOutputSink(int num_leds, Options options)
+      : num_leds_(num_leds), options_(std::move(options)) {}
+
+  bool Initialize();
+
+  const int num_leds_;
+  const Options options_;
+
+  int fd_ = -1;
+  std::vector<Segment> segments_;
+
+  // The previous frame, to find the packets which changed.
+  std::vector<uint8_t> previous_frame_;
+  int frames_since_keyframe_ = 0;
+  int last_errno_ = 0;
+
+  // One frame's packets for every destination.
+  std::vector<uint8_t> buffers_;
+  std::vector<iovec> iovecs_;
+  std::vector<mmsghdr> messages_;
+
+  std::atomic<uint64_t> frames_{0};
+  std::atomic<uint64_t> packets_{0};
+  std::atomic<uint64_t> bytes_{0};
+  std::atomic<uint64_t> dropped_frames_{0};
+};
+
+}  // namespace led_driver
+
+#endif  // NETWORK_OUTPUT_SINK_H_
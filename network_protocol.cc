@@ -0,0 +1,153 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "network_protocol.h"
+
+#include <cstring>
+
+namespace led_driver {
+namespace network_protocol {
+
+namespace {
+constexpr uint16_t kE131FlagsMask = 0x7000;
+constexpr uint8_t kE131DefaultPriority = 100;
+constexpr char kE131SourceName[] = "LED Suit Driver";
+constexpr int64_t kNanosecondsPerSecond = 1000000000;
+
+// Converts a time to 16.16 fixed point seconds, without wrapping.
+uint64_t ToTicks(int64_t time_ns) {
+  const uint64_t seconds = time_ns / kNanosecondsPerSecond;
+  const uint64_t nanoseconds = time_ns % kNanosecondsPerSecond;
+  return (seconds << 16) +
+         ((nanoseconds << 16) + kNanosecondsPerSecond / 2) /
+             kNanosecondsPerSecond;
+}
+
+// Writes the E1.31 root layer shared by data and synchronization packets.
+void WriteE131RootLayer(const uint8_t cid[16], uint32_t vector, size_t length,
+                        uint8_t *packet) {
+  WriteBigEndian16(0x0010, packet);
+  WriteBigEndian16(0x0000, packet + 2);
+  memcpy(packet + 4, kE131AcnId, sizeof(kE131AcnId));
+  WriteBigEndian16(kE131FlagsMask | (length - 16), packet + 16);
+  WriteBigEndian32(vector, packet + kE131RootVectorOffset);
+  memcpy(packet + 22, cid, 16);
+  WriteBigEndian16(kE131FlagsMask | (length - 38), packet + 38);
+}
+}  // namespace
+
+uint32_t ToDdpTimecode(int64_t time_ns) {
+  return static_cast<uint32_t>(ToTicks(time_ns));
+}
+
+int64_t FromDdpTimecode(uint32_t timecode, int64_t reference_ns) {
+  const uint64_t reference_ticks = ToTicks(reference_ns);
+  const int32_t delta =
+      static_cast<int32_t>(timecode - static_cast<uint32_t>(reference_ticks));
+  const uint64_t ticks = reference_ticks + delta;
+  return static_cast<int64_t>(ticks >> 16) * kNanosecondsPerSecond +
+         (((ticks & 0xFFFF) * kNanosecondsPerSecond + 0x8000) >> 16);
+}
+
+size_t WriteDdpPacket(uint8_t sequence, uint32_t offset, bool push,
+                      const uint32_t *timecode,
+                      absl::Span<const uint8_t> data, uint8_t *packet) {
+  packet[0] = kDdpVersion1 | (push ? kDdpFlagPush : 0) |
+              (timecode != nullptr ? kDdpFlagTimecode : 0);
+  packet[1] = sequence & kDdpSequenceMask;
+  packet[2] = kDdpTypeRgb8;
+  packet[3] = kDdpDestinationDisplay;
+  WriteBigEndian32(offset, packet + 4);
+  WriteBigEndian16(data.size(), packet + 8);
+  size_t header_length = kDdpHeaderLength;
+  if (timecode != nullptr) {
+    WriteBigEndian32(*timecode, packet + header_length);
+    header_length += kDdpTimecodeLength;
+  }
+  memcpy(packet + header_length, data.data(), data.size());
+  return header_length + data.size();
+}
+
+size_t WriteArtDmxPacket(uint16_t universe, uint8_t sequence,
+                         absl::Span<const uint8_t> data, uint8_t *packet) {
+  // ArtDmx lengths must be even.
+  const size_t length = (data.size() + 1) & ~size_t{1};
+  memcpy(packet, kArtNetId, sizeof(kArtNetId));
+  packet[8] = kArtNetOpDmx & 0xFF;
+  packet[9] = kArtNetOpDmx >> 8;
+  WriteBigEndian16(kArtNetProtocolVersion, packet + 10);
+  packet[12] = sequence;
+  packet[13] = 0;
+  packet[14] = universe & 0xFF;
+  packet[15] = (universe >> 8) & 0x7F;
+  WriteBigEndian16(length, packet + 16);
+  memcpy(packet + kArtDmxHeaderLength, data.data(), data.size());
+  if (length != data.size()) {
+    packet[kArtDmxHeaderLength + data.size()] = 0;
+  }
+  return kArtDmxHeaderLength + length;
+}
+
+size_t WriteE131DataPacket(const uint8_t cid[16], uint16_t universe,
+                           uint8_t sequence, uint16_t sync_address,
+                           absl::Span<const uint8_t> data, uint8_t *packet) {
+  const size_t length = kE131DataHeaderLength + data.size();
+  WriteE131RootLayer(cid, kE131RootVectorData, length, packet);
+  WriteBigEndian32(kE131FramingVectorData, packet + kE131FramingVectorOffset);
+  memset(packet + 44, 0, 64);
+  memcpy(packet + 44, kE131SourceName, sizeof(kE131SourceName));
+  packet[108] = kE131DefaultPriority;
+  WriteBigEndian16(sync_address, packet + kE131SyncAddressOffset);
+  packet[kE131SequenceOffset] = sequence;
+  packet[kE131OptionsOffset] = 0;
+  WriteBigEndian16(universe, packet + kE131UniverseOffset);
+  WriteBigEndian16(kE131FlagsMask | (length - 115), packet + 115);
+  packet[117] = kE131DmpVector;
+  packet[118] = kE131AddressType;
+  WriteBigEndian16(0, packet + 119);
+  WriteBigEndian16(1, packet + 121);
+  WriteBigEndian16(data.size() + 1, packet + kE131PropertyCountOffset);
+  packet[kE131StartCodeOffset] = 0;
+  memcpy(packet + kE131DataHeaderLength, data.data(), data.size());
+  return length;
+}
+
+size_t WriteArtSyncPacket(uint8_t *packet) {
+  memcpy(packet, kArtNetId, sizeof(kArtNetId));
+  packet[8] = kArtNetOpSync & 0xFF;
+  packet[9] = kArtNetOpSync >> 8;
+  WriteBigEndian16(kArtNetProtocolVersion, packet + 10);
+  packet[12] = 0;
+  packet[13] = 0;
+  return kArtSyncLength;
+}
+
+size_t WriteE131SyncPacket(const uint8_t cid[16], uint16_t sync_address,
+                           uint8_t sequence, uint8_t *packet) {
+  WriteE131RootLayer(cid, kE131RootVectorExtended, kE131SyncLength, packet);
+  WriteBigEndian32(kE131FramingVectorSync, packet + kE131FramingVectorOffset);
+  packet[kE131SyncSequenceOffset] = sequence;
+  WriteBigEndian16(sync_address, packet + kE131SyncPacketAddressOffset);
+  WriteBigEndian16(0, packet + 47);
+  return kE131SyncLength;
+}
+
+}  // namespace network_protocol
+}  // namespace led_driver
@@ -0,0 +1,149 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef NETWORK_PROTOCOL_H_
+#define NETWORK_PROTOCOL_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "absl/types/span.h"
+
+namespace led_driver {
+
+// Packet layouts of the UDP lighting protocols: DDP (Distributed Display
+// Protocol), Art-Net 4 and E1.31 (Streaming ACN). Multi-byte fields are big
+// endian unless noted.
+namespace network_protocol {
+
+constexpr int kDdpPort = 4048;
+constexpr int kArtNetPort = 6454;
+constexpr int kE131Port = 5568;
+
+// Largest packet any of the protocols sends.
+constexpr size_t kMaxPacketLength = 1472;
+
+// DDP: a 10 byte header (14 with a timecode) followed by channel data at an
+// arbitrary byte offset into the frame. The push flag marks the last packet of
+// a frame.
+constexpr size_t kDdpHeaderLength = 10;
+constexpr size_t kDdpTimecodeLength = 4;
+constexpr size_t kDdpMaxDataLength = 1440;
+constexpr uint8_t kDdpVersionMask = 0xC0;
+constexpr uint8_t kDdpVersion1 = 0x40;
+constexpr uint8_t kDdpFlagTimecode = 0x10;
+constexpr uint8_t kDdpFlagStorage = 0x08;
+constexpr uint8_t kDdpFlagReply = 0x04;
+constexpr uint8_t kDdpFlagQuery = 0x02;
+constexpr uint8_t kDdpFlagPush = 0x01;
+constexpr uint8_t kDdpSequenceMask = 0x0F;
+constexpr uint8_t kDdpTypeRgb8 = 0x0B;
+constexpr uint8_t kDdpDestinationDisplay = 0x01;
+
+// Art-Net: ArtDmx carries up to 512 channels of one universe; ArtSync
+// releases the universes received since the last one. The opcode and
+// universe are little endian.
+constexpr char kArtNetId[8] = {'A', 'r', 't', '-', 'N', 'e', 't', '\0'};
+constexpr uint16_t kArtNetOpDmx = 0x5000;
+constexpr uint16_t kArtNetOpSync = 0x5200;
+constexpr uint16_t kArtNetProtocolVersion = 14;
+constexpr size_t kArtDmxHeaderLength = 18;
+constexpr size_t kArtSyncLength = 14;
+
+// E1.31: a data packet has a fixed 126 byte header of root, framing and DMP
+// layers, ending with the DMX start code. A synchronization packet releases
+// the universes which named its address as their synchronization address.
+constexpr uint8_t kE131AcnId[12] = {'A', 'S', 'C', '-', 'E', '1',
+                                    '.', '1', '7', 0,   0,   0};
+constexpr uint32_t kE131RootVectorData = 0x00000004;
+constexpr uint32_t kE131RootVectorExtended = 0x00000008;
+constexpr uint32_t kE131FramingVectorData = 0x00000002;
+constexpr uint32_t kE131FramingVectorSync = 0x00000001;
+constexpr uint8_t kE131DmpVector = 0x02;
+constexpr uint8_t kE131AddressType = 0xA1;
+constexpr uint8_t kE131OptionPreview = 0x80;
+constexpr uint8_t kE131OptionTerminated = 0x40;
+constexpr size_t kE131DataHeaderLength = 126;
+constexpr size_t kE131SyncLength = 49;
+
+// Offsets of the E1.31 fields used when parsing.
+constexpr size_t kE131RootVectorOffset = 18;
+constexpr size_t kE131FramingVectorOffset = 40;
+constexpr size_t kE131SyncAddressOffset = 109;
+constexpr size_t kE131SequenceOffset = 111;
+constexpr size_t kE131OptionsOffset = 112;
+constexpr size_t kE131UniverseOffset = 113;
+constexpr size_t kE131PropertyCountOffset = 123;
+constexpr size_t kE131StartCodeOffset = 125;
+constexpr size_t kE131SyncSequenceOffset = 44;
+constexpr size_t kE131SyncPacketAddressOffset = 45;
+
+constexpr int kDmxUniverseChannels = 512;
+
+inline uint16_t ReadBigEndian16(const uint8_t *data) {
+  return (data[0] << 8) | data[1];
+}
+
+inline uint32_t ReadBigEndian32(const uint8_t *data) {
+  return (static_cast<uint32_t>(data[0]) << 24) | (data[1] << 16) |
+         (data[2] << 8) | data[3];
+}
+
+inline void WriteBigEndian16(uint16_t value, uint8_t *data) {
+  data[0] = value >> 8;
+  data[1] = value & 0xFF;
+}
+
+inline void WriteBigEndian32(uint32_t value, uint8_t *data) {
+  data[0] = value >> 24;
+  data[1] = (value >> 16) & 0xFF;
+  data[2] = (value >> 8) & 0xFF;
+  data[3] = value & 0xFF;
+}
+
+// DDP timecodes are the middle 32 bits of an NTP timestamp: seconds and
+// fractions of a second in 16.16 fixed point, wrapping every 18 hours. They
+// are converted from and to nanoseconds on the sender's clock; unwrapping
+// takes the time closest to `reference_ns`.
+uint32_t ToDdpTimecode(int64_t time_ns);
+int64_t FromDdpTimecode(uint32_t timecode, int64_t reference_ns);
+
+// Each of these writes a complete packet carrying `data` into `packet`, which
+// must hold the header plus the data, and returns the packet length. DDP
+// packets only carry a timecode if `timecode` isn't null.
+size_t WriteDdpPacket(uint8_t sequence, uint32_t offset, bool push,
+                      const uint32_t *timecode,
+                      absl::Span<const uint8_t> data, uint8_t *packet);
+size_t WriteArtDmxPacket(uint16_t universe, uint8_t sequence,
+                         absl::Span<const uint8_t> data, uint8_t *packet);
+size_t WriteE131DataPacket(const uint8_t cid[16], uint16_t universe,
+                           uint8_t sequence, uint16_t sync_address,
+                           absl::Span<const uint8_t> data, uint8_t *packet);
+
+// These write synchronization packets, which hold no data.
+size_t WriteArtSyncPacket(uint8_t *packet);
+size_t WriteE131SyncPacket(const uint8_t cid[16], uint16_t sync_address,
+                           uint8_t sequence, uint8_t *packet);
+
+}  // namespace network_protocol
+
+}  // namespace led_driver
+
+#endif  // NETWORK_PROTOCOL_H_
@@ -21,6 +21,8 @@
 #ifndef PIXEL_UTILS_H_
 #define PIXEL_UTILS_H_
 
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstdint>
 
@@ -69,20 +71,20 @@ class ColorCorrector {
   std::array<std::array<uint8_t, 256>, kNumChannels> color_table_{};
 };
 
-void TransposeRedGreenPixel(uint8_t *pixel) {
+inline void TransposeRedGreenPixel(uint8_t *pixel) {
   uint8_t temp = *pixel;
   *pixel = *(pixel + 1);
   *(pixel + 1) = temp;
 }
 
-void TransposeRedGreen(uint8_t *pixels, ssize_t num_pixels) {
+inline void TransposeRedGreen(uint8_t *pixels, ssize_t num_pixels) {
   while (num_pixels--) {
     TransposeRedGreenPixel(pixels);
     pixels += 3;
   }
 }
 
-void ScalePixelValue(uint8_t *pixel, float scale) {
+inline void ScalePixelValue(uint8_t *pixel, float scale) {
   if (scale < 0 || scale > 1) {
     return;
   }
@@ -91,7 +93,8 @@ void ScalePixelValue(uint8_t *pixel, float scale) {
   }
 }
 
-void ScalePixelValues(uint8_t *pixels, float scale, ssize_t num_pixels) {
+inline void ScalePixelValues(uint8_t *pixels, float scale,
+                             ssize_t num_pixels) {
   while (num_pixels--) {
     ScalePixelValue(pixels, scale);
     pixels += 3;
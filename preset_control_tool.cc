@@ -0,0 +1,139 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Sends preset commands to `projectm_sdl_test` over its control channel and
+// reports the round trip latency. With `--serve`, instead acts as a fake
+// renderer which acknowledges commands, so that the channel can be exercised
+// without a display or projectM.
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "control_channel.h"
+
+ABSL_FLAG(std::string, control_socket, "/tmp/projectm_control.sock",
+          "Unix socket the renderer accepts commands on");
+ABSL_FLAG(std::string, command, "next", "Command to send to the renderer");
+ABSL_FLAG(int, count, 1, "Number of times to send the command");
+ABSL_FLAG(int, timeout_ms, 100, "Acknowledgement timeout, in milliseconds");
+ABSL_FLAG(bool, serve, false,
+          "If set, acts as a fake renderer instead of sending commands");
+ABSL_FLAG(int, render_period_ms, 16,
+          "Period of the fake renderer's loop, in milliseconds");
+
+namespace led_driver {
+
+namespace {
+
+int Serve() {
+  auto server =
+      ControlChannelServer::Create(absl::GetFlag(FLAGS_control_socket));
+  if (server == nullptr) {
+    std::cerr << "Failed to create control channel server" << std::endl;
+    return 1;
+  }
+
+  int preset_index = 0;
+  auto handler = [&preset_index](absl::string_view command) -> std::string {
+    std::cout << "Received \"" << command << "\"" << std::endl;
+    if (command == "next" || command == "random") {
+      ++preset_index;
+    } else if (command == "previous") {
+      --preset_index;
+    } else if (command != "current" &&
+               !absl::StartsWith(command, "select ")) {
+      return absl::StrCat("error unknown command: ", command);
+    }
+    return absl::StrCat("ok fake_preset_", preset_index);
+  };
+
+  // Poll from a paced loop, as the real render loop does.
+  const absl::Duration period =
+      absl::Milliseconds(absl::GetFlag(FLAGS_render_period_ms));
+  absl::Time next_frame = absl::Now();
+  while (true) {
+    server->Poll(handler);
+    next_frame += period;
+    absl::SleepFor(next_frame - absl::Now());
+  }
+  return 0;
+}
+
+int Send() {
+  auto client = ControlChannelClient::Create(
+      absl::GetFlag(FLAGS_control_socket),
+      absl::Milliseconds(absl::GetFlag(FLAGS_timeout_ms)));
+  if (client == nullptr) {
+    std::cerr << "Failed to create control channel client" << std::endl;
+    return 1;
+  }
+
+  const int count = absl::GetFlag(FLAGS_count);
+  int acknowledged = 0;
+  absl::Duration total = absl::ZeroDuration();
+  absl::Duration min = absl::InfiniteDuration();
+  absl::Duration max = absl::ZeroDuration();
+  for (int i = 0; i < count; ++i) {
+    std::string reply;
+    if (!client->Send(absl::GetFlag(FLAGS_command), &reply)) {
+      std::cerr << "Command " << i << " was not acknowledged" << std::endl;
+      continue;
+    }
+    ++acknowledged;
+    const absl::Duration round_trip = client->last_round_trip();
+    total += round_trip;
+    min = std::min(min, round_trip);
+    max = std::max(max, round_trip);
+    std::cout << "Reply: " << reply << " ("
+              << absl::ToDoubleMilliseconds(round_trip) << " ms)" << std::endl;
+  }
+
+  if (acknowledged == 0) {
+    return 1;
+  }
+  std::cout << acknowledged << "/" << count
+            << " acknowledged; round trip min/avg/max = "
+            << absl::ToDoubleMilliseconds(min) << "/"
+            << absl::ToDoubleMilliseconds(total / acknowledged) << "/"
+            << absl::ToDoubleMilliseconds(max) << " ms" << std::endl;
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  absl::ParseCommandLine(argc, argv);
+  if (absl::GetFlag(FLAGS_serve)) {
+    return Serve();
+  }
+  return Send();
+}
+}  // namespace led_driver
+
+extern "C" {
+int main(int argc, char *argv[]) { return led_driver::main(argc, argv); }
+}
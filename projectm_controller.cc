@@ -20,23 +20,166 @@
 
 #include "projectm_controller.h"
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+
+extern "C" {
+#include <X11/Xatom.h>
+#include <sys/epoll.h>
+}
+
 namespace led_driver {
 
+namespace {
+// How long to wait for the renderer to acknowledge a command.
+constexpr absl::Duration kControlTimeout = absl::Milliseconds(100);
+
+// How often to retry connecting to the X server until it's up.
+constexpr std::chrono::seconds kConnectRetryPeriod(1);
+
+// Windows can be destroyed between the event announcing them and the request
+// following them, which isn't worth exiting over, as Xlib's default handler
+// does.
+int IgnoreXError(Display *display, XErrorEvent *event) { return 0; }
+}  // namespace
+
 bool ProjectmController::Initialize() {
-  xdo_ = xdo_new(nullptr);
-  if (xdo_ == nullptr) {
-    std::cerr << "Connection to X server failed" << std::endl;
+  if (!control_socket_path_.empty()) {
+    control_channel_ =
+        ControlChannelClient::Create(control_socket_path_, kControlTimeout);
+    if (control_channel_ == nullptr) {
+      std::cerr << "Failed to create control channel client" << std::endl;
+    }
+  }
+
+  // The discovery thread and the callers each use a connection of their own.
+  XInitThreads();
+
+  reactor_ = EventReactor::Create();
+  if (reactor_ == nullptr) {
+    std::cerr << "Failed to create projectM discovery reactor" << std::endl;
     return false;
   }
+  connect_timer_ = reactor_->AddTimer(kConnectRetryPeriod, [this]() {
+    if (ConnectToX()) {
+      reactor_->Cancel(connect_timer_);
+    }
+  });
+  // The first attempt is made at once.
+  reactor_->Reschedule(connect_timer_, EventReactor::Clock::now());
+  discovery_thread_ = std::thread([this]() { reactor_->Run(); });
+  return true;
+}
 
+ProjectmController::~ProjectmController() {
+  if (reactor_ != nullptr) {
+    reactor_->Stop();
+  }
+  if (discovery_thread_.joinable()) {
+    discovery_thread_.join();
+  }
+  if (display_ != nullptr) {
+    XCloseDisplay(display_);
+  }
+  if (xdo_ != nullptr) {
+    xdo_free(xdo_);
+  }
+}
+
+bool ProjectmController::ConnectToX() {
+  Display *display = XOpenDisplay(nullptr);
+  if (display == nullptr) {
+    if (!waiting_logged_) {
+      std::cerr << "X server not up yet; retrying in the background"
+                << std::endl;
+      waiting_logged_ = true;
+    }
+    return false;
+  }
+  xdo_t *xdo = xdo_new(nullptr);
+  if (xdo == nullptr) {
+    XCloseDisplay(display);
+    return false;
+  }
+
+  XSetErrorHandler(IgnoreXError);
+  display_ = display;
+  net_wm_name_ = XInternAtom(display_, "_NET_WM_NAME", False);
+  XSelectInput(display_, DefaultRootWindow(display_), SubstructureNotifyMask);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    xdo_ = xdo;
+  }
+  std::cout << "Connected to X server; watching for projectM windows"
+            << std::endl;
+
+  if (!reactor_->AddFd(ConnectionNumber(display_), EPOLLIN,
+                       [this](uint32_t /*events*/) { HandleXEvents(); })) {
+    std::cerr << "Failed to watch X events; projectM windows are only "
+                 "searched for once"
+              << std::endl;
+  }
+  // Windows which were up before the events were selected.
+  FindProjectmWindows();
+  HandleXEvents();
+  return true;
+}
+
+void ProjectmController::HandleXEvents() {
+  bool search = false;
+  while (XPending(display_) > 0) {
+    XEvent event;
+    XNextEvent(display_, &event);
+    Window window = None;
+    switch (event.type) {
+      case CreateNotify:
+        // Windows are often named after they're created, and window managers
+        // reparent them into frames, so follow the names and children of
+        // every new window.
+        XSelectInput(display_, event.xcreatewindow.window,
+                     PropertyChangeMask | SubstructureNotifyMask);
+        break;
+      case MapNotify:
+        search = true;
+        break;
+      case PropertyNotify:
+        if (event.xproperty.atom == XA_WM_NAME ||
+            event.xproperty.atom == net_wm_name_) {
+          search = true;
+        }
+        break;
+      case UnmapNotify:
+        window = event.xunmap.window;
+        break;
+      case DestroyNotify:
+        window = event.xdestroywindow.window;
+        break;
+      default:
+        break;
+    }
+    if (window != None) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      search |= std::find(projectm_windows_.begin(), projectm_windows_.end(),
+                          window) != projectm_windows_.end();
+    }
+  }
+  if (search) {
+    FindProjectmWindows();
+  }
+}
+
+bool ProjectmController::FindProjectmWindows() {
   xdo_search_t search_params = {0};
   search_params.winname = "projectM";
   search_params.max_depth = 2;
   search_params.searchmask = SEARCH_NAME | SEARCH_ONLYVISIBLE;
   search_params.limit = 0;
 
+  std::lock_guard<std::mutex> lock(mutex_);
   std::shared_ptr<Window> return_windows;
   unsigned int num_return_windows;
 
@@ -48,26 +191,51 @@ bool ProjectmController::Initialize() {
       std::cerr << "Failed to search windows" << std::endl;
       return false;
     }
-    return_windows.reset(return_windows_raw);
+    return_windows.reset(return_windows_raw, free);
   }
 
-  std::cout << "Found " << num_return_windows << " windows" << std::endl;
+  if (num_return_windows != projectm_windows_.size()) {
+    std::cout << "Found " << num_return_windows << " windows" << std::endl;
+  }
 
   projectm_windows_.resize(num_return_windows);
   std::copy(return_windows.get(), return_windows.get() + num_return_windows,
             projectm_windows_.begin());
 
+  return num_return_windows > 0;
+}
+
+bool ProjectmController::SendCommand(const std::string &command) {
+  if (control_channel_ == nullptr) {
+    return false;
+  }
+
+  std::string reply;
+  if (!control_channel_->Send(command, &reply)) {
+    return false;
+  }
+  std::cerr << "Renderer acknowledged \"" << command << "\" in "
+            << absl::ToDoubleMilliseconds(control_channel_->last_round_trip())
+            << " ms: " << reply << std::endl;
   return true;
 }
 
-bool ProjectmController::TriggerNextPreset() {
+bool ProjectmController::SendKeysequence(const char *keysequence) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (xdo_ == nullptr || projectm_windows_.empty()) {
+    // Still being discovered in the background.
+    return false;
+  }
+
   for (auto &window : projectm_windows_) {
     std::cerr << "Sending stroke to " << window << std::endl;
     if (xdo_focus_window(xdo_, window)) {
       std::cerr << "Failed to focus window";
+      // The window may have gone away; its events will prompt another
+      // search.
       return false;
     }
-    if (xdo_send_keysequence_window(xdo_, window, "r", 12000)) {
+    if (xdo_send_keysequence_window(xdo_, window, keysequence, 12000)) {
       std::cerr << "Failed to send key sequence";
       return false;
     }
@@ -76,4 +244,22 @@ bool ProjectmController::TriggerNextPreset() {
   return false;
 }
 
+bool ProjectmController::TriggerNextPreset() {
+  if (SendCommand("next")) {
+    return true;
+  }
+  return SendKeysequence("r");
+}
+
+bool ProjectmController::TriggerRandomPreset() {
+  if (SendCommand("random")) {
+    return true;
+  }
+  return SendKeysequence("r");
+}
+
+bool ProjectmController::SelectPreset(int index) {
+  return SendCommand(absl::StrCat("select ", index));
+}
+
 }  // namespace led_driver
@@ -21,15 +21,28 @@
 #ifndef PROJECTM_CONTROLLER_H_
 #define PROJECTM_CONTROLLER_H_
 
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
+#include "control_channel.h"
+#include "event_reactor.h"
+
 extern "C" {
 #include "xdo.h"
 }
 
 namespace led_driver {
 
+// Steers projectM's preset selection, over its control channel or by sending
+// keystrokes to its window. The X server and projectM's windows are found in
+// the background, so creating a controller doesn't wait for the visualizer to
+// come up: a thread retries the connection to X until it succeeds, then
+// follows window creation, naming and destruction events to keep the list of
+// projectM windows current.
 class ProjectmController {
 public:
   template <typename... A>
@@ -42,14 +55,62 @@ public:
     return projectm_controller;
   }
 
+  ~ProjectmController();
+
+  // Advances to another preset. This is sent over the control channel when the
+  // renderer is listening on it, and falls back to sending a keystroke to the
+  // projectM window otherwise.
   bool TriggerNextPreset();
 
+  // Selects a random preset. Requires the control channel.
+  bool TriggerRandomPreset();
+
+  // Selects the preset at `index`. Requires the control channel.
+  bool SelectPreset(int index);
+
 private:
-  ProjectmController() {}
+  // If `control_socket_path` is empty, only the xdo backend is used.
+  ProjectmController(std::string control_socket_path = "")
+      : control_socket_path_(std::move(control_socket_path)) {}
 
   bool Initialize();
 
-  xdo_t *xdo_;
+  // Sends `command` over the control channel, logging the round trip time.
+  bool SendCommand(const std::string &command);
+
+  // Connects to the X server and starts following window events. Returns
+  // false if the server isn't up yet. Runs on the discovery thread.
+  bool ConnectToX();
+
+  // Handles the pending X events, searching for projectM windows again if any
+  // could have changed the result. Runs on the discovery thread.
+  void HandleXEvents();
+
+  // Searches for visible projectM windows.
+  bool FindProjectmWindows();
+
+  // Sends `keysequence` to the first projectM window.
+  bool SendKeysequence(const char *keysequence);
+
+  std::string control_socket_path_;
+  std::shared_ptr<ControlChannelClient> control_channel_;
+
+  // Runs the discovery thread.
+  std::shared_ptr<EventReactor> reactor_;
+  EventReactor::TimerId connect_timer_ = EventReactor::kNoTimer;
+  bool waiting_logged_ = false;
+  std::thread discovery_thread_;
+
+  // The discovery thread's own connection, for window events. Xlib
+  // connections can't be shared between threads, so keystrokes go over
+  // `xdo_`'s.
+  Display *display_ = nullptr;
+  Atom net_wm_name_ = None;
+
+  // Guards the keystroke connection and the windows found, which are used by
+  // both the discovery thread and the callers.
+  std::mutex mutex_;
+  xdo_t *xdo_ = nullptr;
   std::vector<Window> projectm_windows_;
 };
 
@@ -28,18 +28,23 @@
 #include <fstream>
 #include <iostream>
 #include <memory>
-#include <mutex>
-#include <queue>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/strip.h"
 #include "absl/types/span.h"
+#include "control_channel.h"
 #include "libprojectm/projectM.hpp"
+#include "absl/time/clock.h"
+#include "audio_source_factory.h"
 #include "performance_timer.h"
-#include "pulseaudio_interface.h"
+#include "spsc_ring_buffer.h"
+#include "thermal_monitor.h"
 
 ABSL_FLAG(std::string, preset_path, "/usr/share/projectM/presets",
           "Path where preset files are located");
@@ -51,6 +56,25 @@ ABSL_FLAG(std::string, pulseaudio_server, "",
           "PulseAudio server to connect to");
 ABSL_FLAG(std::string, pulseaudio_source, "",
           "PulseAudio source device to capture audio from");
+ABSL_FLAG(std::string, audio_source, "pulseaudio",
+          "Audio source to capture from: pulseaudio, alsa or file");
+ABSL_FLAG(std::string, alsa_device, "default",
+          "ALSA device to capture audio from when --audio_source=alsa");
+ABSL_FLAG(std::string, audio_file, "",
+          "WAV or raw float file to replay when --audio_source=file");
+ABSL_FLAG(bool, audio_file_loop, true,
+          "Whether to loop the file when --audio_source=file");
+ABSL_FLAG(int, audio_fragment_frames, 256,
+          "Requested audio fragment size, in frames. Smaller fragments reduce "
+          "latency at the cost of more wakeups");
+ABSL_FLAG(int, audio_target_latency_ms, 20,
+          "Requested upper bound on audio buffered by the source");
+ABSL_FLAG(int, audio_callback_batch_frames, 0,
+          "Frames to accumulate before handing audio to the render loop; 0 "
+          "hands over each fragment as it arrives");
+ABSL_FLAG(int, audio_stats_period_s, 10,
+          "Period at which to log the audio latency and callback rate; 0 to "
+          "disable");
 ABSL_FLAG(std::string, whitelist_file, "",
           "Text file to write the preset whitelist to");
 ABSL_FLAG(std::string, blacklist_file, "",
@@ -63,8 +87,28 @@ ABSL_FLAG(int, window_width, 100, "ProjectM window width");
 ABSL_FLAG(int, window_height, 100, "ProjectM window height");
 ABSL_FLAG(int, window_x, 0, "ProjectM window position in X");
 ABSL_FLAG(int, window_y, 0, "ProjectM window position in Y");
+ABSL_FLAG(int, texture_size, 256, "ProjectM render texture size");
+ABSL_FLAG(int, multisample_samples, 0,
+          "Samples per pixel for multisample antialiasing; zero to disable");
 ABSL_FLAG(int, late_frames_to_skip_preset, 20,
           "Number of late frames required to skip preset");
+ABSL_FLAG(int, audio_ring_capacity, 1 << 16,
+          "Capacity, in samples, of the ring buffer between the audio source "
+          "and the render loop");
+ABSL_FLAG(std::string, control_socket, "/tmp/projectm_control.sock",
+          "Unix socket to accept preset commands on; empty to disable");
+ABSL_FLAG(bool, thermal, false,
+          "Shed work as the SoC heats up, before the firmware throttles the "
+          "clock: render at --thermal_fps, then without antialiasing, then at "
+          "half the texture size");
+ABSL_FLAG(std::string, thermal_sysfs_root, "/sys",
+          "Root of the sysfs tree to read the temperature and clock from");
+ABSL_FLAG(float, thermal_shed_celsius, 70.0f,
+          "Temperature at which to start shedding work");
+ABSL_FLAG(float, thermal_step_celsius, 2.5f,
+          "Rise in temperature which sheds each further level of work");
+ABSL_FLAG(int, thermal_fps, 30,
+          "Frame rate once the temperature passes --thermal_shed_celsius");
 
 namespace led_driver {
 
@@ -91,24 +135,20 @@ struct CallbackData {
   int channel_count;
 };
 
-std::mutex audio_queue_mutex;
-std::queue<std::pair<std::shared_ptr<CallbackData>, std::vector<const float>>>
-    audio_queue;
-
-void AddAudioData(std::shared_ptr<CallbackData> callback_data,
+void AddAudioData(const CallbackData &callback_data,
                   absl::Span<const float> samples) {
-  switch (callback_data->channel_count) {
+  switch (callback_data.channel_count) {
   case 1:
-    callback_data->projectm->pcm()->addPCMfloat(samples.data(),
-                                                samples.length());
+    callback_data.projectm->pcm()->addPCMfloat(samples.data(),
+                                               samples.length());
     break;
   case 2:
-    callback_data->projectm->pcm()->addPCMfloat_2ch(samples.data(),
-                                                    samples.length());
+    callback_data.projectm->pcm()->addPCMfloat_2ch(samples.data(),
+                                                   samples.length());
     break;
   default:
     std::cerr << "Unsupported PCM channel count: "
-              << callback_data->channel_count << std::endl;
+              << callback_data.channel_count << std::endl;
     SDL_Quit();
   }
 }
@@ -131,6 +171,28 @@ void AddPresetToList(std::shared_ptr<projectM> projectm, std::string filename) {
 
   blacklist_stream << GetCurrentPresetUrl(projectm) << std::endl;
 }
+
+// Handles a command received over the control channel.
+std::string HandleControlCommand(std::shared_ptr<projectM> projectm,
+                                 absl::string_view command) {
+  if (command == "next") {
+    projectm->selectNext(true);
+  } else if (command == "previous") {
+    projectm->selectPrevious(true);
+  } else if (command == "random") {
+    projectm->selectRandom(true);
+  } else if (absl::ConsumePrefix(&command, "select ")) {
+    unsigned int index;
+    if (!absl::SimpleAtoi(command, &index) ||
+        index >= projectm->getPlaylistSize()) {
+      return "error invalid preset index";
+    }
+    projectm->selectPreset(index, true);
+  } else if (command != "current") {
+    return absl::StrCat("error unknown command: ", command);
+  }
+  return absl::StrCat("ok ", GetCurrentPresetUrl(projectm));
+}
 } // namespace
 
 extern "C" int main(int argc, char *argv[]) {
@@ -143,6 +205,12 @@ extern "C" int main(int argc, char *argv[]) {
       return 1;
     }
 
+    const int multisample_samples = absl::GetFlag(FLAGS_multisample_samples);
+    if (multisample_samples > 0) {
+      SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 1);
+      SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, multisample_samples);
+    }
+
     window.reset(SDL_CreateWindow(
         "ProjectM", absl::GetFlag(FLAGS_window_x), absl::GetFlag(FLAGS_window_y),
         absl::GetFlag(FLAGS_window_width), absl::GetFlag(FLAGS_window_height),
@@ -177,7 +245,7 @@ extern "C" int main(int argc, char *argv[]) {
     settings.shuffleEnabled = true;
     settings.softCutRatingsEnabled = true;
     settings.easterEgg = 5.0f;
-    settings.textureSize = 256;
+    settings.textureSize = absl::GetFlag(FLAGS_texture_size);
 
     settings.presetURL = absl::GetFlag(FLAGS_preset_path);
     settings.menuFontURL = absl::GetFlag(FLAGS_menu_font_path);
@@ -195,23 +263,76 @@ extern "C" int main(int argc, char *argv[]) {
     std::shared_ptr<projectM> projectm =
         std::make_shared<projectM>(settings, flags);
 
-    auto callback_data = std::make_shared<CallbackData>();
-    callback_data->projectm = projectm;
-    callback_data->channel_count = absl::GetFlag(FLAGS_channel_count);
-    auto pa_interface = std::make_shared<PulseAudioInterface>(
-        absl::GetFlag(FLAGS_pulseaudio_server),
-        absl::GetFlag(FLAGS_pulseaudio_source), "input_stream",
-        44100,
-        callback_data->channel_count,
-        [&callback_data](absl::Span<const float> samples) {
-          std::lock_guard<std::mutex> audio_queue_lock(audio_queue_mutex);
-          audio_queue.push(std::make_pair(
-              callback_data,
-              std::vector<const float>(samples.begin(), samples.end())));
+    CallbackData callback_data;
+    callback_data.projectm = projectm;
+    callback_data.channel_count = absl::GetFlag(FLAGS_channel_count);
+
+    // Samples are handed from the audio thread to the render loop through a
+    // preallocated ring, so the audio callback never allocates or blocks.
+    SpscRingBuffer<float> audio_ring(absl::GetFlag(FLAGS_audio_ring_capacity));
+    uint64_t reported_overflow_writes = 0;
+
+    AudioSourceConfig audio_config;
+    audio_config.type = absl::GetFlag(FLAGS_audio_source);
+    audio_config.pulseaudio_server = absl::GetFlag(FLAGS_pulseaudio_server);
+    audio_config.device = (audio_config.type == "alsa")
+                              ? absl::GetFlag(FLAGS_alsa_device)
+                              : absl::GetFlag(FLAGS_pulseaudio_source);
+    audio_config.file = absl::GetFlag(FLAGS_audio_file);
+    audio_config.loop = absl::GetFlag(FLAGS_audio_file_loop);
+    audio_config.options.sampling_rate = 44100;
+    audio_config.options.channel_count = callback_data.channel_count;
+    audio_config.options.fragment_frames =
+        absl::GetFlag(FLAGS_audio_fragment_frames);
+    audio_config.options.target_latency =
+        absl::Milliseconds(absl::GetFlag(FLAGS_audio_target_latency_ms));
+    audio_config.options.callback_batch_frames =
+        absl::GetFlag(FLAGS_audio_callback_batch_frames);
+
+    auto audio_source = CreateAudioSource(
+        audio_config, [&audio_ring](absl::Span<const float> samples) {
+          audio_ring.Write(samples);
         });
-    pa_interface->Initialize();
+    if (audio_source == nullptr || !audio_source->Start()) {
+      std::cerr << "Failed to start audio source" << std::endl;
+      return 1;
+    }
 
-    pa_interface->Start();
+    const absl::Duration audio_stats_period =
+        absl::Seconds(absl::GetFlag(FLAGS_audio_stats_period_s));
+    absl::Time next_audio_stats = absl::Now() + audio_stats_period;
+    uint64_t last_audio_callback_count = 0;
+
+    std::shared_ptr<ControlChannelServer> control_server;
+    if (!absl::GetFlag(FLAGS_control_socket).empty()) {
+      control_server =
+          ControlChannelServer::Create(absl::GetFlag(FLAGS_control_socket));
+      if (control_server == nullptr) {
+        std::cerr << "Failed to create control channel; preset commands will "
+                     "only be accepted as keystrokes"
+                  << std::endl;
+      }
+    }
+    auto control_handler = [&projectm](absl::string_view command) {
+      return HandleControlCommand(projectm, command);
+    };
+
+    std::shared_ptr<ThermalMonitor> thermal_monitor;
+    if (absl::GetFlag(FLAGS_thermal)) {
+      ThermalMonitor::Options thermal_options;
+      thermal_options.sysfs_root = absl::GetFlag(FLAGS_thermal_sysfs_root);
+      thermal_options.shed_celsius = absl::GetFlag(FLAGS_thermal_shed_celsius);
+      thermal_options.step_celsius = absl::GetFlag(FLAGS_thermal_step_celsius);
+      thermal_monitor = ThermalMonitor::Create(thermal_options);
+      if (thermal_monitor == nullptr) {
+        std::cerr << "Failed to create thermal monitor" << std::endl;
+        return 1;
+      }
+      thermal_monitor->Start();
+    }
+    ThermalMonitor::Level applied_level = ThermalMonitor::Level::NORMAL;
+    bool reduced_resolution = false;
+    int target_frame_time_ms = kTargetFrameTimeMs;
 
     bool exit_event_received = false;
     PerformanceTimer<uint32_t> frame_timer;
@@ -219,15 +340,59 @@ extern "C" int main(int argc, char *argv[]) {
     int late_frames_to_skip_preset =
         absl::GetFlag(FLAGS_late_frames_to_skip_preset);
     while (!exit_event_received) {
+      if (thermal_monitor != nullptr &&
+          thermal_monitor->level() != applied_level) {
+        applied_level = thermal_monitor->level();
+        target_frame_time_ms =
+            thermal_monitor->AtLeast(ThermalMonitor::Level::REDUCED_RATE)
+                ? 1000 / std::max(absl::GetFlag(FLAGS_thermal_fps), 1)
+                : kTargetFrameTimeMs;
+        if (multisample_samples > 0) {
+          if (thermal_monitor->AtLeast(
+                  ThermalMonitor::Level::NO_ANTIALIASING)) {
+            glDisable(GL_MULTISAMPLE);
+          } else {
+            glEnable(GL_MULTISAMPLE);
+          }
+        }
+        // Changing the texture size rebuilds projectM's textures, so it is
+        // only done when the resolution actually changes.
+        if (thermal_monitor->AtLeast(
+                ThermalMonitor::Level::REDUCED_RESOLUTION) !=
+            reduced_resolution) {
+          reduced_resolution = !reduced_resolution;
+          const int texture_size = absl::GetFlag(FLAGS_texture_size);
+          projectm->changeTextureSize(reduced_resolution ? texture_size / 2
+                                                         : texture_size);
+        }
+        // Frames slowed by the change itself aren't the preset's fault.
+        late_frame_counter = 0;
+      }
       frame_timer.Start(SDL_GetTicks());
       glClearColor(0.0, 0.0, 0.0, 0.0);
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-      {
-        std::lock_guard<std::mutex> audio_queue_lock(audio_queue_mutex);
-        while (!audio_queue.empty()) {
-          AddAudioData(audio_queue.front().first, audio_queue.front().second);
-          audio_queue.pop();
-        }
+      audio_ring.Drain([&callback_data](absl::Span<const float> samples) {
+        AddAudioData(callback_data, samples);
+      });
+      if (audio_ring.overflow_writes() != reported_overflow_writes) {
+        reported_overflow_writes = audio_ring.overflow_writes();
+        std::cerr << "Audio ring overflowed; dropped "
+                  << audio_ring.overflow_values() << " samples in "
+                  << reported_overflow_writes << " writes so far" << std::endl;
+      }
+      if (audio_stats_period > absl::ZeroDuration() &&
+          absl::Now() >= next_audio_stats) {
+        next_audio_stats += audio_stats_period;
+        const uint64_t callback_count = audio_source->GetCallbackCount();
+        std::cerr << "Audio latency "
+                  << absl::FormatDuration(audio_source->GetLatency()) << ", "
+                  << (callback_count - last_audio_callback_count) /
+                         absl::ToDoubleSeconds(audio_stats_period)
+                  << " callbacks/s" << std::endl;
+        last_audio_callback_count = callback_count;
+      }
+      if (control_server != nullptr) {
+        control_server->Poll(control_handler);
       }
       projectm->renderFrame();
 
@@ -272,11 +437,11 @@ extern "C" int main(int argc, char *argv[]) {
       SDL_GL_SwapWindow(window.get());
 
       uint32_t frame_time = frame_timer.End(SDL_GetTicks());
-      if (frame_time >= kTargetFrameTimeMs) {
+      if (frame_time >= target_frame_time_ms) {
         if (late_frames_to_skip_preset <= 0) {
           continue;
         }
-        if (frame_time > (kTargetFrameTimeMs + 10)) {
+        if (frame_time > (target_frame_time_ms + 10)) {
           ++late_frame_counter;
           if (late_frame_counter >= late_frames_to_skip_preset) {
             std::cerr << "Had too many late frames in a row ("
@@ -291,9 +456,9 @@ extern "C" int main(int argc, char *argv[]) {
         late_frame_counter = 0;
       }
 
-      SDL_Delay(kTargetFrameTimeMs - frame_time);
+      SDL_Delay(target_frame_time_ms - frame_time);
     }
-    pa_interface->Stop();
+    audio_source->Stop();
   }
   SDL_Quit();
   return 0;
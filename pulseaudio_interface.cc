@@ -20,6 +20,7 @@
 
 #include "pulseaudio_interface.h"
 
+#include <algorithm>
 #include <iostream>
 
 namespace led_driver {
@@ -67,12 +68,24 @@ void PulseAudioInterface::StreamReadCallback(pa_stream *new_stream,
     return;
   }
 
+  if (data == nullptr) {
+    // A hole in the stream; there are no samples to deliver.
+    pa_stream_drop(new_stream);
+    return;
+  }
+
   if (kVerboseLogging) {
     std::cout << "Read " << length << " bytes from stream" << std::endl;
   }
 
-  sample_callback_(absl::Span<const float>(
-      reinterpret_cast<const float *>(data), length / sizeof(float)));
+  batcher_.Push(absl::Span<const float>(reinterpret_cast<const float *>(data),
+                                        length / sizeof(float)));
+
+  pa_usec_t latency_us;
+  int negative;
+  if (pa_stream_get_latency(new_stream, &latency_us, &negative) == 0) {
+    latency_us_.store(negative ? 0 : latency_us, std::memory_order_relaxed);
+  }
 
   if(pa_stream_drop(new_stream) != 0) {
     std::cerr << "Failed to drop frame from stream" << std::endl;
@@ -96,7 +109,9 @@ void PulseAudioInterface::StreamStateCallback(pa_stream *new_stream) {
       }
       std::cout << "Stream buffer attributes: maxlength="
                 << attributes->maxlength
-                << ", fragsize=" << attributes->fragsize << std::endl;
+                << ", fragsize=" << attributes->fragsize << " ("
+                << pa_bytes_to_usec(attributes->fragsize, &sample_spec_)
+                << " us)" << std::endl;
       break;
 
     case PA_STREAM_FAILED:
@@ -147,13 +162,25 @@ void PulseAudioInterface::ContextStateCallback(pa_context *new_context) {
       pa_stream_set_read_callback(
           stream_, PulseAudioInterface::StreamReadCallbackStatic, this);
 
-      buffer_attributes.maxlength = -1;
-      buffer_attributes.fragsize = 1;
-
-      std::cout << "Connecting recording stream" << std::endl;
-      if (pa_stream_connect_record(stream_, device_name_.c_str(),
-                                   &buffer_attributes,
-                                   PA_STREAM_ADJUST_LATENCY) < 0) {
+      // For recording streams, the fragment size is what the server tunes
+      // the source latency to.
+      buffer_attributes.fragsize =
+          options_.fragment_frames * pa_frame_size(&sample_spec_);
+      buffer_attributes.maxlength = std::max<uint32_t>(
+          2 * buffer_attributes.fragsize,
+          pa_usec_to_bytes(absl::ToInt64Microseconds(options_.target_latency),
+                           &sample_spec_));
+
+      std::cout << "Connecting recording stream with fragsize="
+                << buffer_attributes.fragsize
+                << ", maxlength=" << buffer_attributes.maxlength << std::endl;
+      if (pa_stream_connect_record(
+              stream_, device_name_.empty() ? nullptr : device_name_.c_str(),
+              &buffer_attributes,
+              static_cast<pa_stream_flags_t>(PA_STREAM_ADJUST_LATENCY |
+                                             PA_STREAM_INTERPOLATE_TIMING |
+                                             PA_STREAM_AUTO_TIMING_UPDATE)) <
+          0) {
         std::cerr << "Failed to connect recording stream: "
                   << pa_strerror(pa_context_errno(new_context)) << std::endl;
         MarkFailed();
@@ -23,36 +23,50 @@
 
 #include <pulse/pulseaudio.h>
 
+#include <atomic>
 #include <condition_variable>
 #include <cstring>
 #include <mutex>
 #include <string>
 
 #include "absl/types/span.h"
+#include "audio_source.h"
 
 namespace led_driver {
 
-class PulseAudioInterface {
+class PulseAudioInterface : public AudioSourceInterface {
  public:
-  using SampleCallbackType = std::function<void(absl::Span<const float>)>;
   PulseAudioInterface(std::string server_name, std::string device_name,
-                      std::string stream_name, int sampling_rate,
-                      int channel_count, SampleCallbackType sample_callback)
+                      std::string stream_name, AudioSourceOptions options,
+                      SampleCallbackType sample_callback)
       : server_name_(std::move(server_name)),
         device_name_(std::move(device_name)),
         stream_name_(std::move(stream_name)),
-        channel_count_(channel_count),
-        sample_callback_(std::move(sample_callback)) {
+        options_(std::move(options)),
+        batcher_(options_.callback_batch_frames * options_.channel_count,
+                 std::move(sample_callback)) {
     memset(&sample_spec_, 0, sizeof(sample_spec_));
     sample_spec_.format = PA_SAMPLE_FLOAT32LE;
-    sample_spec_.rate = sampling_rate;
-    sample_spec_.channels = channel_count_;
+    sample_spec_.rate = options_.sampling_rate;
+    sample_spec_.channels = options_.channel_count;
     succeeded_.store(false);
     marked_.store(false);
   }
-  bool Initialize();
-  bool Start();
-  void Stop();
+  bool Initialize() override;
+  bool Start() override;
+  void Stop() override;
+
+  absl::Duration GetLatency() const override {
+    int64_t latency_us = latency_us_.load(std::memory_order_relaxed);
+    if (latency_us < 0) {
+      return absl::InfiniteDuration();
+    }
+    return absl::Microseconds(latency_us);
+  }
+
+  uint64_t GetCallbackCount() const override {
+    return batcher_.callback_count();
+  }
 
   void MarkFailed() {
     std::unique_lock<std::mutex> lock(succeeded_mu_);
@@ -101,8 +115,10 @@ class PulseAudioInterface {
   std::string server_name_;
   std::string device_name_;
   std::string stream_name_;
-  int channel_count_;
-  SampleCallbackType sample_callback_;
+  AudioSourceOptions options_;
+  SampleBatcher batcher_;
+  // Latest capture latency reported by `pa_stream_get_latency`, or -1.
+  std::atomic<int64_t> latency_us_{-1};
   pa_sample_spec sample_spec_;
   pa_context *context_;
   pa_stream *stream_;
@@ -6,7 +6,8 @@ import os
 import time
 
 
-display_driver = led_driver.pywrap_display_driver.DisplayDriver('/dev/i2c-1')
+Driver = led_driver.pywrap_display_driver.DisplayDriver
+display_driver = Driver('/dev/i2c-1')
 display_driver.Initialize()
 
 
@@ -15,15 +16,26 @@ def GetIpAddress():
                     "substr($2, 1, length($2)-3); exit}'").read().strip()
 
 
-def DrawImage(image, offset, threshold):
+def ImagePixels(image):
+    # A NumPy array of the image's pixels, which Blit() reads in place.
+    if image.mode not in ('L', 'RGB'):
+        image = image.convert('L')
+    return np.asarray(image)
+
+
+def DrawImage(image, offset, threshold, dither=False):
+    # `image` is a PIL image, or the pixels returned by ImagePixels(), which
+    # saves converting the same image every frame.
+    pixels = image if isinstance(image, np.ndarray) else ImagePixels(image)
+    height, width = pixels.shape[:2]
     offset = (int(offset[0]), int(offset[1]))
-    cropped_image = image.crop(
-        (offset[0], offset[1], offset[0] + 128, offset[1] + 32))
-    for x in range(cropped_image.size[0]):
-        for y in range(cropped_image.size[1]):
-            display_driver.DrawPixel(x, y,
-                                     0 if cropped_image.getpixel((x, y)) > threshold
-                                     else 1)
+    if (offset[0] < 0 or offset[1] < 0 or offset[0] + 128 > width
+            or offset[1] + 32 > height):
+        display_driver.Clear()
+    display_driver.Blit(
+        pixels, width, height, pixels.strides[0],
+        1 if pixels.ndim == 2 else pixels.shape[2], -offset[0], -offset[1],
+        Driver.kOrdered if dither else Driver.kThreshold, threshold)
 
 
 def DrawText(text, offset, size=10, font=None):
@@ -62,11 +74,7 @@ def ScrollText(text, offset, seconds, framerate, size=10):
 
 
 def ClearDisplay():
-    for x in range(128):
-        for y in range(32):
-            display_driver.DrawPixel(
-                x, y, 1)
-
+    display_driver.Clear()
     display_driver.Update()
 
 
@@ -76,10 +84,11 @@ def DrawRotating(image, seconds, framerate, radius):
     vecs_xy = vecs.view('(2,)float')
     vecs_xy = vecs_xy + ((np.array(image.size) - np.array((128, 32))) / 2)
 
+    pixels = ImagePixels(image)
     frame_times = []
     for x, y in vecs_xy:
         frame_start_time = time.clock_gettime(0)
-        DrawImage(image, (int(x), int(y)), 0)
+        DrawImage(pixels, (int(x), int(y)), 0)
         display_driver.Update()
         frame_time = (time.clock_gettime(0) - frame_start_time)
 
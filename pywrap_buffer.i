@@ -0,0 +1,87 @@
+// Typemaps which pass Python buffers to absl::Span arguments in place,
+// without copying them. %include'd by the wrappers which take images and
+// frames.
+%include <stdint.i>
+%{
+#include "absl/types/span.h"
+
+namespace {
+
+// Holds a Python buffer for the duration of a call, so that frames are read
+// and written in place, without copying them.
+class BufferView {
+ public:
+  ~BufferView() {
+    if (view_.obj != nullptr) {
+      PyBuffer_Release(&view_);
+    }
+  }
+
+  // Accepts any C-contiguous buffer, such as bytes, bytearray, memoryview or a
+  // NumPy array, of items of `item_size` bytes.
+  bool Acquire(PyObject *object, bool writable, Py_ssize_t item_size) {
+    const int flags = PyBUF_C_CONTIGUOUS | PyBUF_FORMAT |
+                      (writable ? PyBUF_WRITABLE : 0);
+    if (PyObject_GetBuffer(object, &view_, flags) != 0) {
+      return false;
+    }
+    if (view_.itemsize != item_size) {
+      PyErr_Format(PyExc_TypeError, "Expected items of %zd bytes, not %zd",
+                   item_size, view_.itemsize);
+      return false;
+    }
+    return true;
+  }
+
+  bool IsUint8() const { return HasFormat('B'); }
+  bool IsFloat() const { return HasFormat('f'); }
+
+  void *data() const { return view_.buf; }
+  size_t length() const { return view_.len / view_.itemsize; }
+
+ private:
+  bool HasFormat(char type) const {
+    const char *format = view_.format != nullptr ? view_.format : "B";
+    if (*format == '@' || *format == '=' || *format == '<') {
+      ++format;
+    }
+    return format[0] == type && format[1] == '\0';
+  }
+
+  Py_buffer view_{};
+};
+
+}  // namespace
+%}
+
+%typemap(in) absl::Span<const uint8_t> (BufferView buffer) {
+  if (!buffer.Acquire($input, false, 1)) SWIG_fail;
+  if (!buffer.IsUint8()) {
+    PyErr_SetString(PyExc_TypeError, "Expected a buffer of uint8");
+    SWIG_fail;
+  }
+  $1 = absl::Span<const uint8_t>(static_cast<const uint8_t *>(buffer.data()),
+                                 buffer.length());
+}
+%typemap(in) absl::Span<uint8_t> (BufferView buffer) {
+  if (!buffer.Acquire($input, true, 1)) SWIG_fail;
+  if (!buffer.IsUint8()) {
+    PyErr_SetString(PyExc_TypeError, "Expected a buffer of uint8");
+    SWIG_fail;
+  }
+  $1 = absl::Span<uint8_t>(static_cast<uint8_t *>(buffer.data()),
+                           buffer.length());
+}
+%typemap(in) absl::Span<const float> (BufferView buffer) {
+  if (!buffer.Acquire($input, false, sizeof(float))) SWIG_fail;
+  if (!buffer.IsFloat()) {
+    PyErr_SetString(PyExc_TypeError, "Expected a buffer of float32");
+    SWIG_fail;
+  }
+  $1 = absl::Span<const float>(static_cast<const float *>(buffer.data()),
+                               buffer.length());
+}
+%typemap(typecheck, precedence=SWIG_TYPECHECK_POINTER)
+    absl::Span<const uint8_t>, absl::Span<uint8_t>, absl::Span<const float> {
+  $1 = PyObject_CheckBuffer($input);
+}
@@ -1,6 +1,7 @@
 %module DisplayDriver
 %include <std_string.i>
 %include <std_pair.i>
+%include "pywrap_buffer.i"
 %{
 #include "led_driver/display_driver.h"
 %}
@@ -9,11 +10,16 @@ namespace led_driver {
 class DisplayDriver {
 public:
   enum Color;
+  enum Dither { kThreshold = 0, kOrdered };
 
   DisplayDriver(std::string i2c_dev);
-  bool Initialize() const;
+  bool Initialize();
   std::pair<int, int> GetSize() const;
   bool DrawPixel(int x, int y, Color color);
-  bool Update() const;
+  bool Blit(absl::Span<const uint8_t> image, int width, int height, int stride,
+            int channels, int x, int y, Dither dither, int threshold);
+  void Clear();
+  bool Update();
+  void Invalidate();
 };
 } // namespace led_driver
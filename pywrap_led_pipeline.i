@@ -0,0 +1,107 @@
+%module LedPipeline
+%include "pywrap_buffer.i"
+%{
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "absl/time/clock.h"
+#include "led_driver/led_output.h"
+#include "led_driver/led_sampler.h"
+%}
+
+%apply long { ssize_t };
+
+// The SPI transfer blocks for the length of a frame; other Python threads
+// may prepare the next frame meanwhile.
+%exception led_driver::LedOutput::Send {
+  Py_BEGIN_ALLOW_THREADS
+  $action
+  Py_END_ALLOW_THREADS
+}
+
+%exception led_driver::LedOutput::LedOutput {
+  $action
+  if (PyErr_Occurred()) SWIG_fail;
+}
+
+namespace led_driver {
+
+class LedSampler {
+public:
+  void Sample(absl::Span<const uint8_t> image, ssize_t row_stride,
+              absl::Span<uint8_t> frame) const;
+  int num_leds() const;
+};
+
+class LedOutput {
+public:
+  static const int kLedChannels = 3;
+
+  bool Send(absl::Span<const uint8_t> frame);
+  bool Render(absl::Span<const uint8_t> frame, absl::Span<uint8_t> led_data);
+  int num_leds() const;
+};
+
+} // namespace led_driver
+
+%extend led_driver::LedSampler {
+  // `coordinates` holds the mapping's normalized (x, y) pairs, as float32.
+  LedSampler(absl::Span<const float> coordinates, int raster_width,
+             int raster_height, int clamp_threshold) {
+    std::vector<std::pair<float, float>> normalized;
+    for (size_t i = 0; i + 1 < coordinates.size(); i += 2) {
+      normalized.emplace_back(coordinates[i], coordinates[i + 1]);
+    }
+    return new led_driver::LedSampler(
+        led_driver::LedSampler::ScaleCoordinates(normalized, raster_width,
+                                                 raster_height),
+        clamp_threshold);
+  }
+}
+
+%extend led_driver::LedOutput {
+  // Without `use_spi`, frames are only rendered, for use off the Pi.
+  LedOutput(int num_leds, float intensity, bool use_spi) {
+    std::shared_ptr<led_driver::SpiDriver> spi_driver;
+    if (use_spi) {
+      spi_driver = led_driver::CreateLedSpiDriver();
+      if (spi_driver == nullptr) {
+        PyErr_SetString(PyExc_IOError, "Failed to open the LED SPI device");
+        return nullptr;
+      }
+    }
+    led_driver::LedOutput::Options options;
+    options.num_leds = num_leds;
+    options.intensity = intensity;
+    return new led_driver::LedOutput(std::move(spi_driver), options);
+  }
+}
+
+%inline %{
+namespace led_driver {
+
+// Runs `iterations` frames through `sampler` and `output` from C++, for
+// comparison with the same loop driven from Python. Frames are sent if `send`
+// is set, and otherwise only rendered. Returns the mean time per frame, in
+// nanoseconds.
+double TimeNativeFrames(const LedSampler &sampler, LedOutput &output,
+                        absl::Span<const uint8_t> image, ssize_t row_stride,
+                        int iterations, bool send) {
+  std::vector<uint8_t> frame(output.num_leds() * LedOutput::kLedChannels);
+  std::vector<uint8_t> led_data(frame.size());
+  const absl::Time start = absl::Now();
+  for (int i = 0; i < iterations; ++i) {
+    sampler.Sample(image, row_stride, absl::MakeSpan(frame));
+    if (send) {
+      output.Send(frame);
+    } else {
+      output.Render(frame, absl::MakeSpan(led_data));
+    }
+  }
+  return absl::ToDoubleNanoseconds(absl::Now() - start) /
+         std::max(iterations, 1);
+}
+
+}  // namespace led_driver
+%}
@@ -0,0 +1,182 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "real_fft.h"
+
+#include <cmath>
+#include <iostream>
+
+#include "simd_float4.h"
+
+namespace led_driver {
+
+constexpr int RealFft::kMinSize;
+constexpr int RealFft::kMaxSize;
+
+bool RealFft::IsValidSize(int size) {
+  return size >= kMinSize && size <= kMaxSize && (size & (size - 1)) == 0;
+}
+
+bool RealFft::Initialize() {
+  // The bit reversal and butterflies only cover powers of two; any other size
+  // would index past the scratch buffers.
+  if (!IsValidSize(size_)) {
+    std::cerr << "FFT size " << size_ << " isn't a power of two from "
+              << kMinSize << " to " << kMaxSize << std::endl;
+    return false;
+  }
+  bit_reverse_.resize(half_);
+  twiddle_real_.resize(half_ - 1);
+  twiddle_imaginary_.resize(half_ - 1);
+  split_real_.resize(half_ + 1);
+  split_imaginary_.resize(half_ + 1);
+  real_.resize(half_);
+  imaginary_.resize(half_);
+  output_real_.resize(half_ + 1);
+  output_imaginary_.resize(half_ + 1);
+
+  int bits = 0;
+  while ((1 << bits) < half_) {
+    ++bits;
+  }
+  for (int i = 0; i < half_; ++i) {
+    int reversed = 0;
+    for (int bit = 0; bit < bits; ++bit) {
+      if (i & (1 << bit)) {
+        reversed |= 1 << (bits - 1 - bit);
+      }
+    }
+    bit_reverse_[i] = reversed;
+  }
+
+  for (int h = 1; h < half_; h *= 2) {
+    for (int j = 0; j < h; ++j) {
+      const double angle = -M_PI * j / h;
+      twiddle_real_[h - 1 + j] = std::cos(angle);
+      twiddle_imaginary_[h - 1 + j] = std::sin(angle);
+    }
+  }
+
+  for (int k = 0; k <= half_; ++k) {
+    const double angle = -2 * M_PI * k / size_;
+    split_real_[k] = std::cos(angle);
+    split_imaginary_[k] = std::sin(angle);
+  }
+  return true;
+}
+
+void RealFft::ComplexTransform() {
+  float *re = real_.data();
+  float *im = imaginary_.data();
+
+  for (int h = 1; h < half_; h *= 2) {
+    const float *w_re = &twiddle_real_[h - 1];
+    const float *w_im = &twiddle_imaginary_[h - 1];
+    for (int block = 0; block < half_; block += 2 * h) {
+      float *a_re = re + block;
+      float *a_im = im + block;
+      float *b_re = a_re + h;
+      float *b_im = a_im + h;
+
+      if (h >= 4) {
+        for (int j = 0; j < h; j += 4) {
+          const Float4 wr = Load4(w_re + j);
+          const Float4 wi = Load4(w_im + j);
+          const Float4 br = Load4(b_re + j);
+          const Float4 bi = Load4(b_im + j);
+          const Float4 tr = br * wr - bi * wi;
+          const Float4 ti = MultiplyAdd4(br, wi, bi * wr);
+          const Float4 ar = Load4(a_re + j);
+          const Float4 ai = Load4(a_im + j);
+          Store4(a_re + j, ar + tr);
+          Store4(a_im + j, ai + ti);
+          Store4(b_re + j, ar - tr);
+          Store4(b_im + j, ai - ti);
+        }
+      } else {
+        for (int j = 0; j < h; ++j) {
+          const float tr = b_re[j] * w_re[j] - b_im[j] * w_im[j];
+          const float ti = b_re[j] * w_im[j] + b_im[j] * w_re[j];
+          b_re[j] = a_re[j] - tr;
+          b_im[j] = a_im[j] - ti;
+          a_re[j] += tr;
+          a_im[j] += ti;
+        }
+      }
+    }
+  }
+}
+
+void RealFft::Transform(const float *input, const float *window, float *real,
+                        float *imaginary) {
+  // Pack even samples into the real part and odd samples into the imaginary
+  // part, in bit-reversed order.
+  for (int k = 0; k < half_; ++k) {
+    const int index = bit_reverse_[k];
+    if (window != nullptr) {
+      real_[index] = input[2 * k] * window[2 * k];
+      imaginary_[index] = input[2 * k + 1] * window[2 * k + 1];
+    } else {
+      real_[index] = input[2 * k];
+      imaginary_[index] = input[2 * k + 1];
+    }
+  }
+
+  ComplexTransform();
+
+  // Split the transform of the packed sequence into the transform of the real
+  // input.
+  for (int k = 0; k <= half_; ++k) {
+    const int forward = (k == half_) ? 0 : k;
+    const int backward = (k == 0) ? 0 : half_ - k;
+    const float z_re = real_[forward];
+    const float z_im = imaginary_[forward];
+    const float zc_re = real_[backward];
+    const float zc_im = -imaginary_[backward];
+
+    const float even_re = 0.5f * (z_re + zc_re);
+    const float even_im = 0.5f * (z_im + zc_im);
+    const float odd_re = 0.5f * (z_im - zc_im);
+    const float odd_im = -0.5f * (z_re - zc_re);
+
+    const float w_re = split_real_[k];
+    const float w_im = split_imaginary_[k];
+    real[k] = even_re + w_re * odd_re - w_im * odd_im;
+    imaginary[k] = even_im + w_re * odd_im + w_im * odd_re;
+  }
+}
+
+void RealFft::PowerSpectrum(const float *input, const float *window,
+                            float *power) {
+  Transform(input, window, output_real_.data(), output_imaginary_.data());
+
+  int k = 0;
+  for (; k + 4 <= half_ + 1; k += 4) {
+    const Float4 re = Load4(&output_real_[k]);
+    const Float4 im = Load4(&output_imaginary_[k]);
+    Store4(power + k, MultiplyAdd4(re, re, im * im));
+  }
+  for (; k <= half_; ++k) {
+    power[k] = output_real_[k] * output_real_[k] +
+               output_imaginary_[k] * output_imaginary_[k];
+  }
+}
+
+}  // namespace led_driver
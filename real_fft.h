@@ -0,0 +1,96 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef REAL_FFT_H_
+#define REAL_FFT_H_
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace led_driver {
+
+// Forward FFT of real input. An N-point real transform is computed as an
+// N/2-point complex radix-2 transform of the even/odd samples, followed by a
+// split step. All tables and scratch buffers are allocated at construction,
+// so transforms never allocate.
+class RealFft {
+ public:
+  static constexpr int kMinSize = 8;
+  static constexpr int kMaxSize = 1 << 16;
+
+  // Whether `size` is a power of two in [kMinSize, kMaxSize].
+  static bool IsValidSize(int size);
+
+  // Returns null if `size` isn't valid.
+  template <typename... A>
+  static std::shared_ptr<RealFft> Create(A &&... args) {
+    auto fft = std::shared_ptr<RealFft>(new RealFft(std::forward<A>(args)...));
+    if (!fft->Initialize()) {
+      return nullptr;
+    }
+    return fft;
+  }
+
+  int size() const { return size_; }
+
+  // The number of output bins, `size() / 2 + 1`.
+  int num_bins() const { return half_ + 1; }
+
+  // Transforms `size()` samples of `input`, multiplied by `window` if it is
+  // non-null, into `num_bins()` complex bins of `real` and `imaginary`.
+  void Transform(const float *input, const float *window, float *real,
+                 float *imaginary);
+
+  // As `Transform`, but writes the power (squared magnitude) of each bin.
+  void PowerSpectrum(const float *input, const float *window, float *power);
+
+ private:
+  explicit RealFft(int size) : size_(size), half_(size / 2) {}
+
+  bool Initialize();
+
+  // In-place complex FFT of `real_` and `imaginary_`, which must already be in
+  // bit-reversed order.
+  void ComplexTransform();
+
+  const int size_;
+  const int half_;
+
+  std::vector<int> bit_reverse_;
+
+  // Twiddle factors for each butterfly stage, concatenated. The stage with
+  // half-width `h` starts at index `h - 1`.
+  std::vector<float> twiddle_real_;
+  std::vector<float> twiddle_imaginary_;
+
+  // exp(-2 pi i k / size) for the split step.
+  std::vector<float> split_real_;
+  std::vector<float> split_imaginary_;
+
+  std::vector<float> real_;
+  std::vector<float> imaginary_;
+  std::vector<float> output_real_;
+  std::vector<float> output_imaginary_;
+};
+
+}  // namespace led_driver
+
+#endif  // REAL_FFT_H_
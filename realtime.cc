@@ -0,0 +1,78 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "realtime.h"
+
+#include <cstring>
+#include <iostream>
+
+extern "C" {
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+}
+
+namespace led_driver {
+
+bool ApplyThreadSchedule(const char *name, const ThreadSchedule &schedule) {
+  // Thread names are limited to 15 characters.
+  char thread_name[16];
+  strncpy(thread_name, name, sizeof(thread_name) - 1);
+  thread_name[sizeof(thread_name) - 1] = '\0';
+  pthread_setname_np(pthread_self(), thread_name);
+
+  bool result = true;
+  if (schedule.cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(schedule.cpu, &cpus);
+    const int error =
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (error != 0) {
+      std::cerr << "Failed to pin the " << name << " thread to CPU "
+                << schedule.cpu << ": " << strerror(error) << std::endl;
+      result = false;
+    }
+  }
+  if (schedule.priority > 0) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = schedule.priority;
+    const int error =
+        pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (error != 0) {
+      std::cerr << "Failed to give the " << name
+                << " thread SCHED_FIFO priority " << schedule.priority << ": "
+                << strerror(error) << std::endl;
+      result = false;
+    }
+  }
+  return result;
+}
+
+bool LockMemory() {
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    std::cerr << "Failed to lock memory: " << strerror(errno) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace led_driver
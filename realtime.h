@@ -0,0 +1,49 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef REALTIME_H_
+#define REALTIME_H_
+
+namespace led_driver {
+
+// Scheduling for one of the driver's threads, so that capture and output
+// don't share cores, or wait behind, Xorg and projectM.
+struct ThreadSchedule {
+  // CPU to pin the thread to; negative to leave it unpinned.
+  int cpu = -1;
+
+  // SCHED_FIFO priority, from 1 to 99; zero to leave the thread on the
+  // default scheduler.
+  int priority = 0;
+};
+
+// Applies `schedule` to the calling thread, and names it `name`. Failures,
+// usually for want of CAP_SYS_NICE, are logged, and leave the thread as it
+// was.
+bool ApplyThreadSchedule(const char *name, const ThreadSchedule &schedule);
+
+// Locks all current and future memory into RAM, so that the real-time threads
+// never stall on page faults. Thread stacks are locked in full as they are
+// created.
+bool LockMemory();
+
+}  // namespace led_driver
+
+#endif  // REALTIME_H_
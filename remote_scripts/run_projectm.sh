@@ -33,7 +33,8 @@ set -o pipefail
 
 # Size of the visualizations. Larger values increase the computational cost of
 # rendering the visualizations. Since the output is aggressively downsampled for
-# display on the LED array, ~100x100 should be sufficient.
+# display on the LED array, ~100x100 should be sufficient. mapping_analyzer.py
+# reports the smallest size at which each LED samples a pixel of its own.
 RASTER_WIDTH=50
 RASTER_HEIGHT=50
 # Whether or not to run the LED driver module.
@@ -85,6 +86,21 @@ function ctrl_c() {
 
 trap ctrl_c INT
 
+if [[ $RUN_SPI_DRIVER != 0 ]]; then
+  # Started before the visualizer stack, which takes a while to come up: the
+  # driver shows the boot effect until the capture is live, then crossfades to
+  # it. It finds the X server and projectM windows in the background.
+  /home/pi/led_driver --intensity=1 \
+    --enable_projectm_controller=false \
+    --boot_effect=plasma \
+    --mapping_file=/home/pi/mapping.binaryproto \
+    --raster_x=0 \
+    --raster_y=0 \
+    --raster_width=$RASTER_WIDTH \
+    --raster_height=$RASTER_HEIGHT &
+  SPI_DRIVER_PID=$!
+fi
+
 # Default to microphone.
 source_type="microphone"
 SOURCE_ARG=""
@@ -178,19 +194,6 @@ if [[ $RUN_PROJECTM != 0 ]]; then
   xdotool mousemove $(($RASTER_WIDTH + 50)) $(($RASTER_HEIGHT + 50))
 fi
 
-if [[ $RUN_SPI_DRIVER != 0 ]]; then
-  sleep 5
-
-  /home/pi/led_driver --intensity=1 \
-    --enable_projectm_controller=false \
-    --mapping_file=/home/pi/mapping.binaryproto \
-    --raster_x=0 \
-    --raster_y=0 \
-    --raster_width=$RASTER_WIDTH \
-    --raster_height=$RASTER_HEIGHT &
-  SPI_DRIVER_PID=$!
-fi
-
 wait $XINIT_PID
 if [[ $RUN_SPI_DRIVER != 0 ]]; then
   wait $SPI_DRIVER_PID
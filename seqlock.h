@@ -0,0 +1,77 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef SEQLOCK_H_
+#define SEQLOCK_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace led_driver {
+
+// Publishes snapshots of a trivially copyable value from a single writer to
+// any number of readers. Writes never block or wait on readers; readers retry
+// if a write was in progress while they were copying.
+template <typename T>
+class SeqlockSnapshot {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "SeqlockSnapshot requires a trivially copyable type");
+
+ public:
+  SeqlockSnapshot() { memset(&value_, 0, sizeof(value_)); }
+
+  // Writer side. Must only be called from one thread at a time.
+  void Publish(const T &value) {
+    const uint32_t sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&value_, &value, sizeof(T));
+    sequence_.store(sequence + 2, std::memory_order_release);
+  }
+
+  // Reader side. Returns a consistent copy of the latest published value.
+  T Read() const {
+    T value;
+    uint32_t before;
+    uint32_t after;
+    do {
+      before = sequence_.load(std::memory_order_acquire);
+      memcpy(&value, &value_, sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = sequence_.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return value;
+  }
+
+  // The number of values published so far.
+  uint32_t version() const {
+    return sequence_.load(std::memory_order_acquire) / 2;
+  }
+
+ private:
+  std::atomic<uint32_t> sequence_{0};
+  T value_;
+};
+
+}  // namespace led_driver
+
+#endif  // SEQLOCK_H_
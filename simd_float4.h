@@ -0,0 +1,199 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef SIMD_FLOAT4_H_
+#define SIMD_FLOAT4_H_
+
+// A thin wrapper over four-wide float vectors, backed by NEON on the Pi, SSE
+// on x86 hosts, and plain arrays elsewhere.
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define LED_DRIVER_SIMD_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define LED_DRIVER_SIMD_SSE 1
+#endif
+
+namespace led_driver {
+
+struct Float4 {
+#if defined(LED_DRIVER_SIMD_NEON)
+  float32x4_t v;
+#elif defined(LED_DRIVER_SIMD_SSE)
+  __m128 v;
+#else
+  float v[4];
+#endif
+};
+
+inline Float4 Load4(const float *pointer) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  return {vld1q_f32(pointer)};
+#elif defined(LED_DRIVER_SIMD_SSE)
+  return {_mm_loadu_ps(pointer)};
+#else
+  return {{pointer[0], pointer[1], pointer[2], pointer[3]}};
+#endif
+}
+
+inline void Store4(float *pointer, Float4 a) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  vst1q_f32(pointer, a.v);
+#elif defined(LED_DRIVER_SIMD_SSE)
+  _mm_storeu_ps(pointer, a.v);
+#else
+  for (int i = 0; i < 4; ++i) pointer[i] = a.v[i];
+#endif
+}
+
+inline Float4 Splat4(float value) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  return {vdupq_n_f32(value)};
+#elif defined(LED_DRIVER_SIMD_SSE)
+  return {_mm_set1_ps(value)};
+#else
+  return {{value, value, value, value}};
+#endif
+}
+
+inline Float4 operator+(Float4 a, Float4 b) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  return {vaddq_f32(a.v, b.v)};
+#elif defined(LED_DRIVER_SIMD_SSE)
+  return {_mm_add_ps(a.v, b.v)};
+#else
+  return {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}};
+#endif
+}
+
+inline Float4 operator-(Float4 a, Float4 b) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  return {vsubq_f32(a.v, b.v)};
+#elif defined(LED_DRIVER_SIMD_SSE)
+  return {_mm_sub_ps(a.v, b.v)};
+#else
+  return {{a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]}};
+#endif
+}
+
+inline Float4 operator*(Float4 a, Float4 b) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  return {vmulq_f32(a.v, b.v)};
+#elif defined(LED_DRIVER_SIMD_SSE)
+  return {_mm_mul_ps(a.v, b.v)};
+#else
+  return {{a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]}};
+#endif
+}
+
+inline Float4 Min4(Float4 a, Float4 b) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  return {vminq_f32(a.v, b.v)};
+#elif defined(LED_DRIVER_SIMD_SSE)
+  return {_mm_min_ps(a.v, b.v)};
+#else
+  Float4 result;
+  for (int i = 0; i < 4; ++i) result.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i];
+  return result;
+#endif
+}
+
+inline Float4 Max4(Float4 a, Float4 b) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  return {vmaxq_f32(a.v, b.v)};
+#elif defined(LED_DRIVER_SIMD_SSE)
+  return {_mm_max_ps(a.v, b.v)};
+#else
+  Float4 result;
+  for (int i = 0; i < 4; ++i) result.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i];
+  return result;
+#endif
+}
+
+inline Float4 Abs4(Float4 a) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  return {vabsq_f32(a.v)};
+#elif defined(LED_DRIVER_SIMD_SSE)
+  return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)};
+#else
+  Float4 result;
+  for (int i = 0; i < 4; ++i) result.v[i] = a.v[i] < 0 ? -a.v[i] : a.v[i];
+  return result;
+#endif
+}
+
+// Returns the fractional part of each lane, a - floor(a), for lanes within
+// the range of int32.
+inline Float4 Fract4(Float4 a) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  float32x4_t truncated = vcvtq_f32_s32(vcvtq_s32_f32(a.v));
+  // Truncation rounds negative values up; step those back down by one.
+  uint32x4_t too_large = vcgtq_f32(truncated, a.v);
+  float32x4_t floor = vsubq_f32(
+      truncated, vreinterpretq_f32_u32(vandq_u32(
+                     too_large, vreinterpretq_u32_f32(vdupq_n_f32(1.0f)))));
+  return {vsubq_f32(a.v, floor)};
+#elif defined(LED_DRIVER_SIMD_SSE)
+  __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+  // Truncation rounds negative values up; step those back down by one.
+  __m128 too_large = _mm_cmpgt_ps(truncated, a.v);
+  __m128 floor = _mm_sub_ps(truncated, _mm_and_ps(too_large, _mm_set1_ps(1.0f)));
+  return {_mm_sub_ps(a.v, floor)};
+#else
+  Float4 result;
+  for (int i = 0; i < 4; ++i) {
+    float truncated = static_cast<float>(static_cast<int>(a.v[i]));
+    if (truncated > a.v[i]) truncated -= 1.0f;
+    result.v[i] = a.v[i] - truncated;
+  }
+  return result;
+#endif
+}
+
+// Returns a * b + c.
+inline Float4 MultiplyAdd4(Float4 a, Float4 b, Float4 c) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  return {vmlaq_f32(c.v, a.v, b.v)};
+#else
+  return a * b + c;
+#endif
+}
+
+// Returns sin(2 pi turns), to within about 0.001, using a parabolic
+// approximation with one refinement step.
+inline Float4 SinTurns4(Float4 turns) {
+  // Wrap into [-0.5, 0.5).
+  const Float4 u = Fract4(turns + Splat4(0.5f)) - Splat4(0.5f);
+  // 8u - 16u|u| matches sine at the zeros and peaks.
+  const Float4 y = Splat4(8.0f) * u - Splat4(16.0f) * u * Abs4(u);
+  return MultiplyAdd4(Splat4(0.225f), y * Abs4(y) - y, y);
+}
+
+// Returns the sum of the four lanes.
+inline float HorizontalSum4(Float4 a) {
+  float lanes[4];
+  Store4(lanes, a);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+}  // namespace led_driver
+
+#endif  // SIMD_FLOAT4_H_
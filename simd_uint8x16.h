@@ -0,0 +1,209 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef SIMD_UINT8X16_H_
+#define SIMD_UINT8X16_H_
+
+#include <cstdint>
+
+// Sixteen-wide unsigned byte vectors for blending LED data and packing display
+// images, backed by NEON on the Pi, SSE2 on x86 hosts, and plain arrays
+// elsewhere.
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define LED_DRIVER_SIMD_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define LED_DRIVER_SIMD_SSE 1
+#endif
+
+namespace led_driver {
+
+struct Uint8x16 {
+#if defined(LED_DRIVER_SIMD_NEON)
+  uint8x16_t v;
+#elif defined(LED_DRIVER_SIMD_SSE)
+  __m128i v;
+#else
+  uint8_t v[16];
+#endif
+};
+
+// Scalar equivalents of the vector operations, for the tails of buffers.
+inline uint8_t Lerp8(uint8_t a, uint8_t b, uint16_t alpha) {
+  return (a * (256 - alpha) + b * alpha) >> 8;
+}
+
+inline uint8_t Multiply8(uint8_t a, uint8_t b) { return (a * b + 255) >> 8; }
+
+inline uint8_t AddSaturate8(uint8_t a, uint8_t b) {
+  const int sum = a + b;
+  return sum > 255 ? 255 : sum;
+}
+
+inline Uint8x16 Load16(const uint8_t *pointer) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  return {vld1q_u8(pointer)};
+#elif defined(LED_DRIVER_SIMD_SSE)
+  return {_mm_loadu_si128(reinterpret_cast<const __m128i *>(pointer))};
+#else
+  Uint8x16 result;
+  for (int i = 0; i < 16; ++i) result.v[i] = pointer[i];
+  return result;
+#endif
+}
+
+inline void Store16(uint8_t *pointer, Uint8x16 a) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  vst1q_u8(pointer, a.v);
+#elif defined(LED_DRIVER_SIMD_SSE)
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(pointer), a.v);
+#else
+  for (int i = 0; i < 16; ++i) pointer[i] = a.v[i];
+#endif
+}
+
+inline Uint8x16 Splat16(uint8_t value) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  return {vdupq_n_u8(value)};
+#elif defined(LED_DRIVER_SIMD_SSE)
+  return {_mm_set1_epi8(static_cast<char>(value))};
+#else
+  Uint8x16 result;
+  for (int i = 0; i < 16; ++i) result.v[i] = value;
+  return result;
+#endif
+}
+
+inline Uint8x16 AddSaturate16(Uint8x16 a, Uint8x16 b) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  return {vqaddq_u8(a.v, b.v)};
+#elif defined(LED_DRIVER_SIMD_SSE)
+  return {_mm_adds_epu8(a.v, b.v)};
+#else
+  Uint8x16 result;
+  for (int i = 0; i < 16; ++i) result.v[i] = AddSaturate8(a.v[i], b.v[i]);
+  return result;
+#endif
+}
+
+// Returns a + (b - a) * alpha / 256, for alpha in [0, 256].
+inline Uint8x16 Lerp16(Uint8x16 a, Uint8x16 b, uint16_t alpha) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  const uint16_t inverse = 256 - alpha;
+  uint16x8_t low = vmulq_n_u16(vmovl_u8(vget_low_u8(a.v)), inverse);
+  uint16x8_t high = vmulq_n_u16(vmovl_u8(vget_high_u8(a.v)), inverse);
+  low = vmlaq_n_u16(low, vmovl_u8(vget_low_u8(b.v)), alpha);
+  high = vmlaq_n_u16(high, vmovl_u8(vget_high_u8(b.v)), alpha);
+  return {vcombine_u8(vshrn_n_u16(low, 8), vshrn_n_u16(high, 8))};
+#elif defined(LED_DRIVER_SIMD_SSE)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i inverse = _mm_set1_epi16(256 - alpha);
+  const __m128i weight = _mm_set1_epi16(alpha);
+  const __m128i low = _mm_srli_epi16(
+      _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a.v, zero), inverse),
+                    _mm_mullo_epi16(_mm_unpacklo_epi8(b.v, zero), weight)),
+      8);
+  const __m128i high = _mm_srli_epi16(
+      _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a.v, zero), inverse),
+                    _mm_mullo_epi16(_mm_unpackhi_epi8(b.v, zero), weight)),
+      8);
+  return {_mm_packus_epi16(low, high)};
+#else
+  Uint8x16 result;
+  for (int i = 0; i < 16; ++i) result.v[i] = Lerp8(a.v[i], b.v[i], alpha);
+  return result;
+#endif
+}
+
+// Returns approximately a * b / 255, exact at 0 and 255.
+inline Uint8x16 Multiply16(Uint8x16 a, Uint8x16 b) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  const uint16x8_t bias = vdupq_n_u16(255);
+  const uint16x8_t low =
+      vaddq_u16(vmull_u8(vget_low_u8(a.v), vget_low_u8(b.v)), bias);
+  const uint16x8_t high =
+      vaddq_u16(vmull_u8(vget_high_u8(a.v), vget_high_u8(b.v)), bias);
+  return {vcombine_u8(vshrn_n_u16(low, 8), vshrn_n_u16(high, 8))};
+#elif defined(LED_DRIVER_SIMD_SSE)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bias = _mm_set1_epi16(255);
+  const __m128i low = _mm_srli_epi16(
+      _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a.v, zero),
+                                    _mm_unpacklo_epi8(b.v, zero)),
+                    bias),
+      8);
+  const __m128i high = _mm_srli_epi16(
+      _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a.v, zero),
+                                    _mm_unpackhi_epi8(b.v, zero)),
+                    bias),
+      8);
+  return {_mm_packus_epi16(low, high)};
+#else
+  Uint8x16 result;
+  for (int i = 0; i < 16; ++i) result.v[i] = Multiply8(a.v[i], b.v[i]);
+  return result;
+#endif
+}
+
+// Returns 0xFF in each lane where a > b, and 0 elsewhere.
+inline Uint8x16 Greater16(Uint8x16 a, Uint8x16 b) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  return {vcgtq_u8(a.v, b.v)};
+#elif defined(LED_DRIVER_SIMD_SSE)
+  // SSE2 only compares signed bytes; flipping the sign bits orders unsigned
+  // bytes the same way.
+  const __m128i sign = _mm_set1_epi8(static_cast<char>(0x80));
+  return {_mm_cmpgt_epi8(_mm_xor_si128(a.v, sign), _mm_xor_si128(b.v, sign))};
+#else
+  Uint8x16 result;
+  for (int i = 0; i < 16; ++i) result.v[i] = a.v[i] > b.v[i] ? 0xFF : 0;
+  return result;
+#endif
+}
+
+inline Uint8x16 And16(Uint8x16 a, Uint8x16 b) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  return {vandq_u8(a.v, b.v)};
+#elif defined(LED_DRIVER_SIMD_SSE)
+  return {_mm_and_si128(a.v, b.v)};
+#else
+  Uint8x16 result;
+  for (int i = 0; i < 16; ++i) result.v[i] = a.v[i] & b.v[i];
+  return result;
+#endif
+}
+
+inline Uint8x16 Or16(Uint8x16 a, Uint8x16 b) {
+#if defined(LED_DRIVER_SIMD_NEON)
+  return {vorrq_u8(a.v, b.v)};
+#elif defined(LED_DRIVER_SIMD_SSE)
+  return {_mm_or_si128(a.v, b.v)};
+#else
+  Uint8x16 result;
+  for (int i = 0; i < 16; ++i) result.v[i] = a.v[i] | b.v[i];
+  return result;
+#endif
+}
+
+}  // namespace led_driver
+
+#endif  // SIMD_UINT8X16_H_
@@ -0,0 +1,220 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "spectral_analyzer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#include "absl/time/clock.h"
+#include "simd_float4.h"
+
+namespace led_driver {
+namespace {
+// Sums `values[0, count)` four at a time. `count` must be a multiple of four.
+float SumOfSquares(const float *values, int count) {
+  Float4 sum = Splat4(0.0f);
+  for (int i = 0; i < count; i += 4) {
+    const Float4 value = Load4(values + i);
+    sum = MultiplyAdd4(value, value, sum);
+  }
+  return HorizontalSum4(sum);
+}
+
+// Sums the positive differences `current - previous` over `[0, count)`.
+float PositiveFlux(const float *current, const float *previous, int count) {
+  const Float4 zero = Splat4(0.0f);
+  Float4 sum = zero;
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    sum = sum + Max4(Load4(current + i) - Load4(previous + i), zero);
+  }
+  float flux = HorizontalSum4(sum);
+  for (; i < count; ++i) {
+    flux += std::max(current[i] - previous[i], 0.0f);
+  }
+  return flux;
+}
+}  // namespace
+
+SpectralAnalyzer::SpectralAnalyzer(Config config)
+    : config_(std::move(config)),
+      hop_size_(config_.hop_size > 0 ? config_.hop_size
+                                     : config_.fft_size / 2) {
+  memset(&current_, 0, sizeof(current_));
+}
+
+bool SpectralAnalyzer::Initialize() {
+  // The history is a ring indexed with a mask, so it too needs the FFT size
+  // to be a power of two; `RealFft` checks that before building any tables.
+  fft_ = RealFft::Create(config_.fft_size);
+  if (fft_ == nullptr) {
+    return false;
+  }
+  if (config_.channel_count < 1) {
+    std::cerr << "Audio analysis needs at least one channel" << std::endl;
+    return false;
+  }
+  window_.resize(config_.fft_size);
+  history_.resize(config_.fft_size);
+  samples_until_analysis_ = hop_size_;
+  frame_.resize(config_.fft_size);
+  power_.resize(fft_->num_bins());
+  magnitude_.resize(fft_->num_bins());
+  previous_magnitude_.resize(fft_->num_bins());
+
+  current_.num_bands = std::min(std::max(config_.num_bands, 1),
+                                SpectralFeatures::kMaxBands);
+
+  // Hann window.
+  for (int i = 0; i < config_.fft_size; ++i) {
+    window_[i] = 0.5f - 0.5f * std::cos(2 * M_PI * i / config_.fft_size);
+  }
+
+  // Logarithmically spaced bands, skipping the DC bin. Every band covers at
+  // least one bin, as long as there are enough bins.
+  const int num_bins = fft_->num_bins();
+  const float bin_width =
+      static_cast<float>(config_.sampling_rate) / config_.fft_size;
+  const float ratio = config_.max_frequency / config_.min_frequency;
+  band_start_.resize(current_.num_bands + 1);
+  for (int i = 0; i <= current_.num_bands; ++i) {
+    const float frequency = config_.min_frequency *
+                            std::pow(ratio, static_cast<float>(i) /
+                                                current_.num_bands);
+    int bin = static_cast<int>(std::lround(frequency / bin_width));
+    if (i > 0) {
+      bin = std::max(bin, band_start_[i - 1] + 1);
+    }
+    band_start_[i] = std::min(std::max(bin, 1), num_bins);
+  }
+  band_peak_.assign(current_.num_bands, 0.0f);
+
+  beat_bins_ = std::min(
+      std::max(static_cast<int>(config_.beat_max_frequency / bin_width), 1),
+      num_bins - 1);
+  return true;
+}
+
+void SpectralAnalyzer::Process(absl::Span<const float> samples) {
+  const int channels = config_.channel_count;
+  const float scale = 1.0f / channels;
+  const int mask = config_.fft_size - 1;
+
+  for (size_t frame = 0; frame + channels <= samples.size();
+       frame += channels) {
+    float mono = 0.0f;
+    for (int channel = 0; channel < channels; ++channel) {
+      mono += samples[frame + channel];
+    }
+    history_[history_index_] = mono * scale;
+    history_index_ = (history_index_ + 1) & mask;
+    ++samples_processed_;
+
+    if (--samples_until_analysis_ == 0) {
+      Analyze();
+      samples_until_analysis_ = hop_size_;
+    }
+  }
+}
+
+void SpectralAnalyzer::Analyze() {
+  const absl::Time start = absl::Now();
+  const int64_t stream_time_ns =
+      samples_processed_ * 1'000'000'000 / config_.sampling_rate;
+  const int fft_size = config_.fft_size;
+  const int num_bins = fft_->num_bins();
+  const float rate = config_.adaptation_rate;
+
+  // Unroll the history ring, oldest sample first.
+  const int tail = fft_size - history_index_;
+  memcpy(frame_.data(), &history_[history_index_], tail * sizeof(float));
+  memcpy(frame_.data() + tail, history_.data(),
+         history_index_ * sizeof(float));
+
+  current_.rms = std::sqrt(SumOfSquares(frame_.data(), fft_size) / fft_size);
+
+  fft_->PowerSpectrum(frame_.data(), window_.data(), power_.data());
+  for (int bin = 0; bin < num_bins; ++bin) {
+    magnitude_[bin] = std::sqrt(power_[bin]);
+  }
+
+  // Band energies, normalized against their decaying peaks.
+  for (int band = 0; band < current_.num_bands; ++band) {
+    float energy = 0.0f;
+    for (int bin = band_start_[band]; bin < band_start_[band + 1]; ++bin) {
+      energy += power_[bin];
+    }
+    band_peak_[band] =
+        std::max(energy, band_peak_[band] * config_.band_peak_decay);
+    current_.band_energy[band] =
+        band_peak_[band] > 1e-12f ? energy / band_peak_[band] : 0.0f;
+  }
+
+  // Onsets, from positive spectral flux against an adaptive threshold.
+  const float flux =
+      PositiveFlux(magnitude_.data(), previous_magnitude_.data(), num_bins) /
+      num_bins;
+  std::copy(magnitude_.begin(), magnitude_.end(), previous_magnitude_.begin());
+
+  const float threshold =
+      flux_mean_ + config_.onset_sensitivity * std::sqrt(flux_variance_);
+  current_.onset_strength = threshold > 1e-9f ? flux / threshold : 0.0f;
+  if (current_.onset_strength > 1.0f &&
+      stream_time_ns - current_.last_onset_ns >=
+          absl::ToInt64Nanoseconds(config_.min_onset_interval)) {
+    ++current_.onset_count;
+    current_.last_onset_ns = stream_time_ns;
+  }
+  const float deviation = flux - flux_mean_;
+  flux_mean_ += rate * deviation;
+  flux_variance_ = (1 - rate) * (flux_variance_ + rate * deviation * deviation);
+
+  // Beats, from bass energy against its running mean. Beats aren't reported
+  // until the mean has had a chance to settle.
+  float bass = 0.0f;
+  for (int bin = 1; bin <= beat_bins_; ++bin) {
+    bass += power_[bin];
+  }
+  const int64_t beat_interval_ns = stream_time_ns - current_.last_beat_ns;
+  if (current_.analysis_count * rate > 1.0f &&
+      bass > config_.beat_threshold * bass_mean_ && bass > 1e-9f &&
+      beat_interval_ns >= absl::ToInt64Nanoseconds(config_.min_beat_interval)) {
+    if (current_.beat_count > 0 && beat_interval_ns <= 2'000'000'000) {
+      const float bpm = 60e9f / beat_interval_ns;
+      current_.bpm =
+          current_.bpm == 0.0f ? bpm : current_.bpm + 0.2f * (bpm - current_.bpm);
+    }
+    ++current_.beat_count;
+    current_.last_beat_ns = stream_time_ns;
+  }
+  bass_mean_ += rate * (bass - bass_mean_);
+
+  ++current_.analysis_count;
+  current_.stream_time_ns = stream_time_ns;
+  current_.timestamp_ns = absl::ToUnixNanos(start);
+  current_.analysis_time_ns = absl::ToInt64Nanoseconds(absl::Now() - start);
+  features_.Publish(current_);
+}
+
+}  // namespace led_driver
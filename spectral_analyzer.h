@@ -0,0 +1,185 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef SPECTRAL_ANALYZER_H_
+#define SPECTRAL_ANALYZER_H_
+
+#include <cstdint>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "real_fft.h"
+#include "seqlock.h"
+
+namespace led_driver {
+
+// The most recent audio features, as published by `SpectralAnalyzer`.
+struct SpectralFeatures {
+  static constexpr int kMaxBands = 16;
+
+  // The number of analyses performed. Zero means no audio has been analysed.
+  uint64_t analysis_count;
+
+  // When the most recent analysis was published, in Unix nanoseconds.
+  int64_t timestamp_ns;
+
+  // The position of the end of the analysed window in the audio stream, from
+  // the sample count. Onset and beat times are on this clock, so they stay
+  // accurate however late the audio is delivered. Readers should detect new
+  // onsets and beats by watching the counts.
+  int64_t stream_time_ns;
+
+  // Energy in each logarithmically spaced band, normalized against a decaying
+  // per-band peak to roughly [0, 1].
+  int num_bands;
+  float band_energy[kMaxBands];
+
+  // RMS level of the analysed window.
+  float rms;
+
+  // Positive spectral flux, relative to its adaptive threshold. Values above 1
+  // are onsets. Onset and beat times are stream times.
+  float onset_strength;
+  uint64_t onset_count;
+  int64_t last_onset_ns;
+
+  // Bass beats, and the tempo estimated from the intervals between them.
+  uint64_t beat_count;
+  int64_t last_beat_ns;
+  float bpm;
+
+  // How long the most recent analysis took.
+  int64_t analysis_time_ns;
+};
+
+// Computes band energies, onsets and beats from PCM audio. `Process` is meant
+// to be called from the audio callback thread: all buffers are allocated at
+// construction, so it never allocates, locks or blocks. Features are published
+// through a seqlock, so readers on other threads never block the audio thread.
+class SpectralAnalyzer {
+ public:
+  struct Config {
+    int sampling_rate = 44100;
+    int channel_count = 2;
+
+    // The FFT size, which must be a power of two from `RealFft::kMinSize` to
+    // `RealFft::kMaxSize`, and how many samples to advance between analyses.
+    // A hop size of zero means half the FFT size.
+    int fft_size = 1024;
+    int hop_size = 0;
+
+    // The bands span this frequency range logarithmically.
+    int num_bands = 8;
+    float min_frequency = 40.0f;
+    float max_frequency = 16000.0f;
+
+    // Per-analysis decay of the band peaks used for normalization.
+    float band_peak_decay = 0.995f;
+
+    // An onset is detected when the spectral flux exceeds its running mean by
+    // this many running standard deviations.
+    float onset_sensitivity = 2.0f;
+    absl::Duration min_onset_interval = absl::Milliseconds(50);
+
+    // A beat is detected when the energy below `beat_max_frequency` exceeds
+    // its running mean by this factor.
+    float beat_max_frequency = 150.0f;
+    float beat_threshold = 1.4f;
+    absl::Duration min_beat_interval = absl::Milliseconds(250);
+
+    // Rate of the running averages, per analysis.
+    float adaptation_rate = 0.05f;
+  };
+
+  // Returns null if the configuration is invalid.
+  template <typename... A>
+  static std::shared_ptr<SpectralAnalyzer> Create(A &&... args) {
+    auto analyzer = std::shared_ptr<SpectralAnalyzer>(
+        new SpectralAnalyzer(std::forward<A>(args)...));
+    if (!analyzer->Initialize()) {
+      return nullptr;
+    }
+    return analyzer;
+  }
+
+  SpectralAnalyzer(const SpectralAnalyzer &) = delete;
+  SpectralAnalyzer &operator=(const SpectralAnalyzer &) = delete;
+
+  // Consumes interleaved samples with `channel_count` channels. Runs an
+  // analysis, and publishes the result, each time `hop_size` new samples have
+  // arrived.
+  void Process(absl::Span<const float> samples);
+
+  // Returns the latest features. Safe to call from any thread.
+  SpectralFeatures Read() const { return features_.Read(); }
+
+  // The number of analyses published so far. Safe to call from any thread.
+  uint32_t version() const { return features_.version(); }
+
+  const Config &config() const { return config_; }
+
+ private:
+  explicit SpectralAnalyzer(Config config);
+
+  bool Initialize();
+
+  // Analyses the latest `fft_size` samples of `history_`.
+  void Analyze();
+
+  const Config config_;
+  const int hop_size_;
+
+  std::shared_ptr<RealFft> fft_;
+  std::vector<float> window_;
+
+  // Downmixed samples, as a ring of `fft_size` samples.
+  std::vector<float> history_;
+  int history_index_ = 0;
+  int samples_until_analysis_ = 0;
+  int64_t samples_processed_ = 0;
+
+  // Scratch buffers, and the previous magnitude spectrum.
+  std::vector<float> frame_;
+  std::vector<float> power_;
+  std::vector<float> magnitude_;
+  std::vector<float> previous_magnitude_;
+
+  // The first bin of each band; band `i` spans bins [band_start_[i],
+  // band_start_[i + 1]).
+  std::vector<int> band_start_;
+  std::vector<float> band_peak_;
+  int beat_bins_ = 0;
+
+  float flux_mean_ = 0.0f;
+  float flux_variance_ = 0.0f;
+  float bass_mean_ = 0.0f;
+
+  // Published features, and the working copy they are built in.
+  SpectralFeatures current_;
+  SeqlockSnapshot<SpectralFeatures> features_;
+};
+
+}  // namespace led_driver
+
+#endif  // SPECTRAL_ANALYZER_H_
@@ -0,0 +1,195 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Benchmarks `RealFft` and `SpectralAnalyzer` at the FFT sizes the driver
+// uses. Each size is first checked against a direct DFT; the analyzer is then
+// fed a synthetic 120 BPM kick drum, and the tempo it detects is reported, as
+// are the allocations it makes when built with `--define
+// allocation_checks=true`. Exits non-zero if any check fails.
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "allocation_counter.h"
+#include "real_fft.h"
+#include "spectral_analyzer.h"
+
+ABSL_FLAG(int, iterations, 20000, "Number of transforms to time per size");
+ABSL_FLAG(int, sampling_rate, 44100, "Sampling rate of the synthetic audio");
+ABSL_FLAG(int, frames_per_callback, 256,
+          "Audio frames delivered by each simulated callback");
+ABSL_FLAG(double, audio_seconds, 8, "Length of the synthetic audio");
+
+namespace led_driver {
+
+namespace {
+
+// Returns the largest error of `fft` against a direct DFT, relative to the
+// largest output magnitude.
+double CheckTransform(RealFft &fft) {
+  const int size = fft.size();
+  std::vector<float> input(size);
+  for (int i = 0; i < size; ++i) {
+    input[i] = std::sin(0.37 * i) + 0.5 * std::cos(2.1 * i + 0.3) +
+               ((i * 7919) % 13) / 13.0 - 0.5;
+  }
+  std::vector<float> real(fft.num_bins());
+  std::vector<float> imaginary(fft.num_bins());
+  fft.Transform(input.data(), nullptr, real.data(), imaginary.data());
+
+  double max_error = 0;
+  double max_magnitude = 0;
+  for (int k = 0; k < fft.num_bins(); ++k) {
+    double expected_real = 0;
+    double expected_imaginary = 0;
+    for (int n = 0; n < size; ++n) {
+      const double angle = -2 * M_PI * k * n / size;
+      expected_real += input[n] * std::cos(angle);
+      expected_imaginary += input[n] * std::sin(angle);
+    }
+    max_error = std::max(max_error, std::hypot(real[k] - expected_real,
+                                               imaginary[k] -
+                                                   expected_imaginary));
+    max_magnitude =
+        std::max(max_magnitude, std::hypot(expected_real, expected_imaginary));
+  }
+  return max_error / max_magnitude;
+}
+
+// Generates stereo audio: a decaying 60 Hz kick at `bpm` over quiet noise.
+std::vector<float> GenerateKickTrack(int sampling_rate, double seconds,
+                                     double bpm) {
+  const int frames = static_cast<int>(sampling_rate * seconds);
+  const int beat_period = static_cast<int>(sampling_rate * 60 / bpm);
+  std::vector<float> samples(frames * 2);
+  uint32_t noise = 12345;
+  for (int i = 0; i < frames; ++i) {
+    const double t = static_cast<double>(i % beat_period) / sampling_rate;
+    noise = noise * 1664525 + 1013904223;
+    const float value = 0.8 * std::exp(-t * 25) * std::sin(2 * M_PI * 60 * t) +
+                        0.02 * (static_cast<float>(noise >> 8) / (1 << 24) -
+                                0.5f);
+    samples[2 * i] = value;
+    samples[2 * i + 1] = value;
+  }
+  return samples;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  absl::ParseCommandLine(argc, argv);
+  if (!AllocationCounter::kEnabled) {
+    std::cout << "Allocations aren't counted or checked without --define "
+                 "allocation_checks=true"
+              << std::endl;
+  }
+
+  const int iterations = absl::GetFlag(FLAGS_iterations);
+  const int sampling_rate = absl::GetFlag(FLAGS_sampling_rate);
+  const int frames_per_callback = absl::GetFlag(FLAGS_frames_per_callback);
+  const std::vector<float> track = GenerateKickTrack(
+      sampling_rate, absl::GetFlag(FLAGS_audio_seconds), 120);
+  bool ok = true;
+  float sink = 0;
+
+  // Sizes the bit reversal can't handle must be refused, not transformed past
+  // the end of the tables.
+  for (int size : {0, 4, 1000, 3 << 10, 2 * RealFft::kMaxSize}) {
+    if (RealFft::Create(size) != nullptr) {
+      std::cerr << "Accepted a " << size << "-point FFT" << std::endl;
+      ok = false;
+    }
+  }
+
+  for (int size : {512, 1024, 2048}) {
+    auto fft = RealFft::Create(size);
+    const double error = CheckTransform(*fft);
+    if (error > 1e-4) {
+      std::cerr << size << "-point FFT has relative error " << error
+                << std::endl;
+      ok = false;
+    }
+
+    std::vector<float> input(size, 0.25f);
+    std::vector<float> window(size, 1.0f);
+    std::vector<float> power(fft->num_bins());
+    absl::Time start = absl::Now();
+    for (int i = 0; i < iterations; ++i) {
+      input[i % size] = i;
+      fft->PowerSpectrum(input.data(), window.data(), power.data());
+      sink += power[1];
+    }
+    const absl::Duration fft_time = (absl::Now() - start) / iterations;
+
+    SpectralAnalyzer::Config config;
+    config.sampling_rate = sampling_rate;
+    config.channel_count = 2;
+    config.fft_size = size;
+    auto analyzer = SpectralAnalyzer::Create(config);
+
+    const uint64_t allocations_before = AllocationCounter::count();
+    AllocationCounter::SetCounting(true);
+    start = absl::Now();
+    const absl::Span<const float> samples(track);
+    for (size_t offset = 0; offset < samples.size();
+         offset += frames_per_callback * 2) {
+      analyzer->Process(samples.subspan(offset, frames_per_callback * 2));
+    }
+    const absl::Duration process_time = absl::Now() - start;
+    AllocationCounter::SetCounting(false);
+    const uint64_t allocations =
+        AllocationCounter::count() - allocations_before;
+
+    const SpectralFeatures features = analyzer->Read();
+    const double analysis_us =
+        absl::ToDoubleMicroseconds(process_time) / features.analysis_count;
+    const double hop_us = 1e6 * (size / 2) / sampling_rate;
+
+    std::cout << size << "-point: FFT "
+              << absl::ToDoubleMicroseconds(fft_time) * 1000 << " ns, "
+              << "analysis " << analysis_us * 1000 << " ns per hop ("
+              << 100 * analysis_us / hop_us << "% of real time), ";
+    if (AllocationCounter::kEnabled) {
+      std::cout << allocations << " allocations, ";
+    }
+    std::cout << features.beat_count << " beats, " << features.bpm
+              << " BPM, relative error " << error << std::endl;
+
+    if (AllocationCounter::kEnabled && allocations != 0) {
+      std::cerr << "Analyzer allocated on the audio thread" << std::endl;
+      ok = false;
+    }
+  }
+
+  std::cout << "(checksum " << sink << ")" << std::endl;
+  return ok ? 0 : 1;
+}
+}  // namespace led_driver
+
+extern "C" {
+int main(int argc, char *argv[]) { return led_driver::main(argc, argv); }
+}
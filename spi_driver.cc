@@ -20,9 +20,15 @@
 
 #include "spi_driver.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <thread>
+
+#include "absl/strings/match.h"
 
 extern "C" {
 #include <fcntl.h>
@@ -36,6 +42,11 @@ constexpr uint32_t kDeviceOpenMode = O_RDWR;
 }  // namespace
 
 bool SpiDriver::Initialize() {
+    if (absl::StartsWith(device_, kLoopbackPrefix)) {
+        loopback_ = true;
+        return true;
+    }
+
     fd_ = open(device_.c_str(), kDeviceOpenMode);
     if (fd_ < 0) {
         std::cerr << "Failed to open device " << device_ << "; `open` returned "
@@ -88,6 +99,22 @@ SpiDriver::~SpiDriver() {
 }
 
 bool SpiDriver::Transfer(const std::vector<uint8_t>& buffer) {
+    if (loopback_) {
+        const auto end =
+            std::chrono::steady_clock::now() +
+            std::chrono::nanoseconds(static_cast<int64_t>(buffer.size()) *
+                                     bits_per_word_ * 1000000000 /
+                                     std::max<uint32_t>(speed_hz_, 1)) +
+            std::chrono::microseconds(delay_us_);
+        {
+            std::lock_guard<std::mutex> lock(loopback_mutex_);
+            loopback_data_.assign(buffer.begin(), buffer.end());
+            ++loopback_transfers_;
+        }
+        std::this_thread::sleep_until(end);
+        return true;
+    }
+
     // Configure the SPI transfer IOCTL block.
     struct spi_ioc_transfer transfer_config;
     memset(&transfer_config, 0, sizeof(transfer_config));
@@ -107,4 +134,14 @@ bool SpiDriver::Transfer(const std::vector<uint8_t>& buffer) {
     return true;
 }
 
+std::vector<uint8_t> SpiDriver::loopback_data() const {
+    std::lock_guard<std::mutex> lock(loopback_mutex_);
+    return loopback_data_;
+}
+
+uint64_t SpiDriver::loopback_transfers() const {
+    std::lock_guard<std::mutex> lock(loopback_mutex_);
+    return loopback_transfers_;
+}
+
 }  // namespace led_driver
@@ -21,7 +21,9 @@
 #ifndef SPI_DRIVER_H
 #define SPI_DRIVER_H
 
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
@@ -61,6 +63,20 @@ class SpiDriver {
     // Transfers a buffer of data to the SPI slave device.
     bool Transfer(const std::vector<uint8_t>& buffer);
 
+    // Devices named with this prefix use the loopback backend, which opens
+    // no device but keeps a copy of the last buffer transferred, and takes as
+    // long to transfer it as the bus would at `speed_hz`.
+    static constexpr char kLoopbackPrefix[] = "loopback";
+
+    bool loopback() const { return loopback_; }
+
+    // The last buffer transferred over the loopback backend, and the number
+    // of transfers made.
+    std::vector<uint8_t> loopback_data() const;
+    uint64_t loopback_transfers() const;
+
+    const std::string& device() const { return device_; }
+
    private:
     SpiDriver(std::string device, ClockPolarity polarity, ClockPhase phase,
               int bits_per_word, int speed_hz, int delay_us)
@@ -75,7 +91,7 @@ class SpiDriver {
     bool Initialize();
 
     // The file descriptor of the underlying devfs SPI device.
-    int fd_;
+    int fd_ = -1;
 
     // The devfs node path name for the underlying SPI device.
     std::string device_;
@@ -89,6 +105,12 @@ class SpiDriver {
     // The number of microseconds to delay in between transactions for this SPI
     // device.
     uint16_t delay_us_;
+
+    // Whether this is the loopback backend, and what it was last sent.
+    bool loopback_ = false;
+    mutable std::mutex loopback_mutex_;
+    std::vector<uint8_t> loopback_data_;
+    uint64_t loopback_transfers_ = 0;
 };
 
 }  // namespace led_driver
@@ -0,0 +1,167 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Runs the output path over several loopback SPI devices, each taking as long
+// as its bus would, and checks that every device was sent its own segment of
+// each frame, with and without the barrier. Reports the frame time against a
+// single device driving every LED. Exits non-zero if any check fails.
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "led_frame_sink.h"
+#include "led_output.h"
+#include "multi_spi_output.h"
+
+ABSL_FLAG(int, num_leds, 3000, "LEDs to drive");
+ABSL_FLAG(int, devices, 3, "Loopback devices to split the LEDs across");
+ABSL_FLAG(int, speed_hz, 15600000, "Clock rate of each simulated bus");
+ABSL_FLAG(int, frames, 100, "Frames to send in each configuration");
+
+namespace led_driver {
+
+namespace {
+
+// Keeps a copy of the last frame of LED data.
+class LastFrameSink : public LedFrameSinkInterface {
+ public:
+  bool Receive(absl::Span<const uint8_t> led_data) override {
+    frame.assign(led_data.begin(), led_data.end());
+    return true;
+  }
+
+  std::vector<uint8_t> frame;
+};
+
+// Sends `frames` frames over `num_devices` loopback devices. Returns the mean
+// time per frame, or a negative time if a check failed.
+double RunDevices(int num_leds, int num_devices, bool barrier, int frames) {
+  MultiSpiOutput::Options spi_options;
+  spi_options.barrier = barrier;
+  const int device_leds = (num_leds + num_devices - 1) / num_devices;
+  for (int i = 0; i < num_devices; ++i) {
+    MultiSpiOutput::Device device;
+    device.path = absl::StrCat(SpiDriver::kLoopbackPrefix, i);
+    device.offset = i * device_leds;
+    device.count = std::min(device_leds, num_leds - device.offset);
+    device.speed_hz = absl::GetFlag(FLAGS_speed_hz);
+    spi_options.devices.push_back(device);
+  }
+  auto spi_output = MultiSpiOutput::Create(num_leds, spi_options);
+  if (spi_output == nullptr) {
+    return -1;
+  }
+
+  LedOutput::Options output_options;
+  output_options.num_leds = num_leds;
+  output_options.spi_output = spi_output;
+  LedOutput output(nullptr, output_options);
+  auto last_frame = std::make_shared<LastFrameSink>();
+  output.AddSink(last_frame);
+
+  std::vector<uint8_t> frame(num_leds * LedOutput::kLedChannels);
+  const absl::Time start = absl::Now();
+  for (int i = 0; i < frames; ++i) {
+    for (size_t j = 0; j < frame.size(); ++j) {
+      frame[j] = (j * 7 + i * 13) & 0x7F;
+    }
+    if (!output.Send(frame)) {
+      std::cerr << "Send failed" << std::endl;
+      return -1;
+    }
+  }
+  const double frame_us =
+      absl::ToDoubleMicroseconds(absl::Now() - start) / frames;
+
+  // Without the barrier the last transfers may still be in flight.
+  if (!barrier) {
+    absl::SleepFor(absl::Milliseconds(100));
+  }
+  const MultiSpiOutput::Stats stats = spi_output->stats();
+  bool ok = true;
+  for (int i = 0; i < num_devices; ++i) {
+    const MultiSpiOutput::Device &device = spi_options.devices[i];
+    const auto &driver = spi_output->drivers()[i];
+    const std::vector<uint8_t> sent = driver->loopback_data();
+    const size_t length = device.count * LedOutput::kLedChannels;
+    if (sent.size() != 2 + length || sent[0] != 0x80 || sent[1] != 0x00 ||
+        memcmp(sent.data() + 2,
+               last_frame->frame.data() +
+                   device.offset * LedOutput::kLedChannels,
+               length) != 0) {
+      std::cerr << device.path << " wasn't sent its segment of the last frame"
+                << std::endl;
+      ok = false;
+    }
+    if (barrier && driver->loopback_transfers() != static_cast<uint64_t>(
+                                                       frames)) {
+      std::cerr << device.path << " made " << driver->loopback_transfers()
+                << " transfers of " << frames << " frames" << std::endl;
+      ok = false;
+    }
+  }
+  std::cout << num_devices << " device" << (num_devices > 1 ? "s" : "")
+            << (barrier ? " with" : " without") << " barrier: " << frame_us
+            << " us per frame, " << stats.skipped_frames
+            << " frames skipped by busy devices" << std::endl;
+  return ok ? frame_us : -1;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  absl::ParseCommandLine(argc, argv);
+
+  const int num_leds = absl::GetFlag(FLAGS_num_leds);
+  const int num_devices = absl::GetFlag(FLAGS_devices);
+  const int frames = absl::GetFlag(FLAGS_frames);
+  if (num_leds < num_devices || num_devices < 1 || frames < 1) {
+    std::cerr << "Need at least one frame, one device and an LED per device"
+              << std::endl;
+    return 1;
+  }
+
+  const double single_us = RunDevices(num_leds, 1, true, frames);
+  const double parallel_us = RunDevices(num_leds, num_devices, true, frames);
+  const double unsynchronized_us =
+      RunDevices(num_leds, num_devices, false, frames);
+  if (single_us < 0 || parallel_us < 0 || unsynchronized_us < 0) {
+    std::cout << "FAIL" << std::endl;
+    return 1;
+  }
+  std::cout << "PASS: " << num_devices << " buses send a frame "
+            << single_us / parallel_us << "x as fast as one" << std::endl;
+  return 0;
+}
+}  // namespace led_driver
+
+extern "C" {
+int main(int argc, char *argv[]) { return led_driver::main(argc, argv); }
+}
@@ -0,0 +1,148 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef SPSC_RING_BUFFER_H_
+#define SPSC_RING_BUFFER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "absl/types/span.h"
+
+namespace led_driver {
+
+// A preallocated, lock-free ring buffer with a single producer thread and a
+// single consumer thread. Neither side allocates or blocks after
+// construction.
+//
+// Writes are all-or-nothing: a write which doesn't fit is dropped in its
+// entirety and counted as overflow. As long as every write is a whole number
+// of frames, the consumer therefore never sees a partial frame, even across
+// the wrap point.
+template <typename T>
+class SpscRingBuffer {
+ public:
+  // `capacity` is rounded up to the next power of two.
+  explicit SpscRingBuffer(size_t capacity)
+      : capacity_(RoundUpToPowerOfTwo(capacity)),
+        mask_(capacity_ - 1),
+        buffer_(new T[capacity_]()) {}
+
+  SpscRingBuffer(const SpscRingBuffer &) = delete;
+  SpscRingBuffer &operator=(const SpscRingBuffer &) = delete;
+
+  // Producer side. Copies all of `values` into the ring, or none of them if
+  // there isn't enough free space. Returns whether the values were written.
+  bool Write(absl::Span<const T> values) {
+    const size_t write_index = write_index_.load(std::memory_order_relaxed);
+    if (write_index + values.size() - cached_read_index_ > capacity_) {
+      cached_read_index_ = read_index_.load(std::memory_order_acquire);
+      if (write_index + values.size() - cached_read_index_ > capacity_) {
+        overflow_writes_.fetch_add(1, std::memory_order_relaxed);
+        overflow_values_.fetch_add(values.size(), std::memory_order_relaxed);
+        return false;
+      }
+    }
+
+    const size_t start = write_index & mask_;
+    const size_t first_length = std::min(values.size(), capacity_ - start);
+    std::copy(values.begin(), values.begin() + first_length,
+              buffer_.get() + start);
+    std::copy(values.begin() + first_length, values.end(), buffer_.get());
+
+    write_index_.store(write_index + values.size(), std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Invokes `consumer` with everything currently readable, as
+  // at most two contiguous spans, and then releases the space back to the
+  // producer. Returns the number of values consumed.
+  template <typename F>
+  size_t Drain(F &&consumer) {
+    const size_t read_index = read_index_.load(std::memory_order_relaxed);
+    const size_t available =
+        write_index_.load(std::memory_order_acquire) - read_index;
+    if (available == 0) {
+      return 0;
+    }
+
+    const size_t start = read_index & mask_;
+    const size_t first_length = std::min(available, capacity_ - start);
+    consumer(absl::Span<const T>(buffer_.get() + start, first_length));
+    if (first_length < available) {
+      consumer(absl::Span<const T>(buffer_.get(), available - first_length));
+    }
+
+    read_index_.store(read_index + available, std::memory_order_release);
+    return available;
+  }
+
+  // The number of values currently readable. Only exact on the consumer
+  // thread.
+  size_t Size() const {
+    return write_index_.load(std::memory_order_acquire) -
+           read_index_.load(std::memory_order_relaxed);
+  }
+
+  size_t capacity() const { return capacity_; }
+
+  // The number of writes, and the number of values, which were dropped
+  // because the ring was full.
+  uint64_t overflow_writes() const {
+    return overflow_writes_.load(std::memory_order_relaxed);
+  }
+  uint64_t overflow_values() const {
+    return overflow_values_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static constexpr size_t kCacheLineSize = 64;
+
+  static size_t RoundUpToPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  const size_t capacity_;
+  const size_t mask_;
+  const std::unique_ptr<T[]> buffer_;
+
+  // Producer-owned state. The producer keeps its own copy of the read index
+  // so that it only touches the consumer's cache line when the ring looks
+  // full.
+  alignas(kCacheLineSize) std::atomic<size_t> write_index_{0};
+  size_t cached_read_index_ = 0;
+  std::atomic<uint64_t> overflow_writes_{0};
+  std::atomic<uint64_t> overflow_values_{0};
+
+  // Consumer-owned state. The alignment also pads the object out to a whole
+  // cache line, so nothing that follows it shares this line.
+  alignas(kCacheLineSize) std::atomic<size_t> read_index_{0};
+};
+
+}  // namespace led_driver
+
+#endif  // SPSC_RING_BUFFER_H_
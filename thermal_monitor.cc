@@ -0,0 +1,234 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "thermal_monitor.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "absl/strings/str_cat.h"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+namespace led_driver {
+
+namespace {
+// Raspberry Pi firmware throttling flags, from `get_throttled`: the clock is
+// capped, throttled, or held back by the soft temperature limit.
+constexpr int64_t kFirmwareThrottledMask = 0x2 | 0x4 | 0x8;
+
+int OpenSysfs(const std::string &path) {
+  return open(path.c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+// Rereads a sysfs attribute, without allocating, as an integer in `base`.
+bool ReadValue(int fd, int base, int64_t *value) {
+  if (fd < 0) {
+    return false;
+  }
+  char buffer[32];
+  const ssize_t length = pread(fd, buffer, sizeof(buffer) - 1, 0);
+  if (length <= 0) {
+    return false;
+  }
+  buffer[length] = '\0';
+  char *end;
+  *value = strtoll(buffer, &end, base);
+  return end != buffer;
+}
+
+void CloseIfOpen(int fd) {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+}  // namespace
+
+ThermalMonitor::~ThermalMonitor() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = false;
+  }
+  stop_.notify_all();
+  if (poll_thread_.joinable()) {
+    poll_thread_.join();
+  }
+  CloseIfOpen(temperature_fd_);
+  CloseIfOpen(frequency_fd_);
+  CloseIfOpen(max_frequency_fd_);
+  CloseIfOpen(limit_frequency_fd_);
+  CloseIfOpen(firmware_throttled_fd_);
+}
+
+bool ThermalMonitor::Initialize() {
+  const std::string temperature_path =
+      absl::StrCat(options_.sysfs_root, "/class/thermal/thermal_zone",
+                   options_.thermal_zone, "/temp");
+  temperature_fd_ = OpenSysfs(temperature_path);
+  if (temperature_fd_ < 0) {
+    std::cerr << "Failed to open " << temperature_path << ": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+
+  // Frequency and firmware state only refine the decision, and aren't
+  // available everywhere.
+  const std::string cpufreq_path =
+      absl::StrCat(options_.sysfs_root, "/devices/system/cpu/cpu",
+                   options_.cpu, "/cpufreq/");
+  frequency_fd_ = OpenSysfs(cpufreq_path + "scaling_cur_freq");
+  max_frequency_fd_ = OpenSysfs(cpufreq_path + "cpuinfo_max_freq");
+  limit_frequency_fd_ = OpenSysfs(cpufreq_path + "scaling_max_freq");
+  if (frequency_fd_ < 0) {
+    std::cerr << "No cpufreq state in " << cpufreq_path
+              << "; watching the temperature alone" << std::endl;
+  }
+  firmware_throttled_fd_ = OpenSysfs(absl::StrCat(
+      options_.sysfs_root, "/devices/platform/soc/soc:firmware/get_throttled"));
+  // A limit below the hardware maximum may have been set on purpose, so only
+  // a drop below the limit at startup counts as throttling.
+  ReadValue(limit_frequency_fd_, 10, &startup_limit_frequency_khz_);
+
+  int64_t millicelsius;
+  if (!ReadValue(temperature_fd_, 10, &millicelsius)) {
+    std::cerr << "Failed to read " << temperature_path << std::endl;
+    return false;
+  }
+  Poll();
+  return true;
+}
+
+void ThermalMonitor::Start() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (running_) {
+    return;
+  }
+  running_ = true;
+  poll_thread_ = std::thread(&ThermalMonitor::PollThread, this);
+}
+
+void ThermalMonitor::PollThread() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (running_) {
+    lock.unlock();
+    Poll();
+    lock.lock();
+    stop_.wait_for(lock, absl::ToChronoMilliseconds(options_.poll_period),
+                   [this]() { return !running_; });
+  }
+}
+
+int ThermalMonitor::LevelFor(float celsius, float margin) const {
+  const float threshold = options_.shed_celsius + margin;
+  if (celsius < threshold) {
+    return 0;
+  }
+  const int level =
+      1 + static_cast<int>((celsius - threshold) /
+                           std::max(options_.step_celsius, 0.1f));
+  return std::min(level, kLevelCount - 1);
+}
+
+bool ThermalMonitor::Poll() {
+  int64_t millicelsius;
+  if (!ReadValue(temperature_fd_, 10, &millicelsius)) {
+    return false;
+  }
+
+  Reading reading;
+  memset(&reading, 0, sizeof(reading));
+  reading.celsius = millicelsius / 1000.0f;
+  ReadValue(frequency_fd_, 10, &reading.frequency_khz);
+  ReadValue(max_frequency_fd_, 10, &reading.max_frequency_khz);
+  ReadValue(limit_frequency_fd_, 10, &reading.limit_frequency_khz);
+  int64_t firmware_throttled = 0;
+  // The firmware knows why the clock is held back; cpufreq only shows that
+  // the limit has dropped, so is used only where the firmware's flags aren't
+  // available.
+  if (ReadValue(firmware_throttled_fd_, 16, &firmware_throttled)) {
+    reading.throttled = (firmware_throttled & kFirmwareThrottledMask) != 0;
+  } else {
+    reading.throttled =
+        reading.limit_frequency_khz > 0 &&
+        reading.limit_frequency_khz < startup_limit_frequency_khz_;
+  }
+
+  // Sheds a level as soon as the temperature calls for it, but only restores
+  // one once the temperature is clear of its threshold. Throttling means
+  // shedding came too late, so sheds a level more.
+  const int extra = reading.throttled ? 1 : 0;
+  const int shed =
+      std::min(LevelFor(reading.celsius, 0) + extra, kLevelCount - 1);
+  const int keep =
+      std::min(LevelFor(reading.celsius, -options_.hysteresis_celsius) + extra,
+               kLevelCount - 1);
+  const int current = static_cast<int>(level());
+  int next = current;
+  if (shed > current) {
+    next = shed;
+  } else if (keep < current) {
+    next = keep;
+  }
+
+  const bool changed = next != current;
+  if (changed) {
+    ++decisions_;
+    level_.store(static_cast<Level>(next), std::memory_order_relaxed);
+  }
+  reading.level = static_cast<Level>(next);
+  reading.decisions = decisions_;
+  reading_.Publish(reading);
+
+  if (changed) {
+    std::cout << "thermal_level=" << next
+              << " name=" << LevelName(reading.level)
+              << " previous=" << LevelName(static_cast<Level>(current))
+              << " celsius=" << reading.celsius
+              << " frequency_mhz=" << reading.frequency_khz / 1000
+              << " limit_mhz=" << reading.limit_frequency_khz / 1000
+              << " throttled=" << reading.throttled
+              << " decisions=" << reading.decisions << std::endl;
+  }
+  return changed;
+}
+
+const char *ThermalMonitor::LevelName(Level level) {
+  switch (level) {
+    case Level::NORMAL:
+      return "normal";
+    case Level::REDUCED_RATE:
+      return "reduced_rate";
+    case Level::NO_ANTIALIASING:
+      return "no_antialiasing";
+    case Level::NO_ANALYSIS:
+      return "no_analysis";
+    case Level::REDUCED_RESOLUTION:
+      return "reduced_resolution";
+  }
+  return "unknown";
+}
+
+}  // namespace led_driver
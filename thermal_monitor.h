@@ -0,0 +1,149 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef THERMAL_MONITOR_H_
+#define THERMAL_MONITOR_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "absl/time/time.h"
+#include "seqlock.h"
+
+namespace led_driver {
+
+// Watches the SoC temperature and CPU clock in sysfs, and decides how much
+// work to shed to stay below the temperature at which the firmware throttles
+// the clock. Shedding is progressive: each level implies the ones before it,
+// and each process acts on the levels that apply to its own work. Every change
+// of level is logged as a `thermal_level` metric line.
+class ThermalMonitor {
+ public:
+  enum class Level : int {
+    NORMAL = 0,
+    // Capture and render at a lower frame rate.
+    REDUCED_RATE,
+    // Render without multisampling.
+    NO_ANTIALIASING,
+    // Pause analysis that only steers the show, like visual interest.
+    NO_ANALYSIS,
+    // Render at a lower resolution.
+    REDUCED_RESOLUTION,
+  };
+  static constexpr int kLevelCount = 5;
+
+  struct Options {
+    // Root of the sysfs tree, so that a fake one can stand in for tests.
+    std::string sysfs_root = "/sys";
+    int thermal_zone = 0;
+    int cpu = 0;
+
+    // Temperature at which to start shedding, and the rise which sheds each
+    // further level. The firmware starts throttling at 80 C.
+    float shed_celsius = 70.0f;
+    float step_celsius = 2.5f;
+
+    // How far below a level's threshold the temperature must fall before
+    // that level's work is restored.
+    float hysteresis_celsius = 2.0f;
+
+    absl::Duration poll_period = absl::Seconds(1);
+  };
+
+  struct Reading {
+    float celsius;
+    // Current CPU clock, the hardware maximum, and the limit imposed by the
+    // kernel, in kHz; zero where cpufreq is unavailable.
+    int64_t frequency_khz;
+    int64_t max_frequency_khz;
+    int64_t limit_frequency_khz;
+    // Whether the clock is being held back for thermal reasons: by the
+    // firmware's flags where available, and otherwise by the kernel's limit
+    // falling below the one set at startup.
+    bool throttled;
+    Level level;
+    // Number of changes of level so far.
+    int decisions;
+  };
+
+  template <typename... A>
+  static std::shared_ptr<ThermalMonitor> Create(A &&... args) {
+    auto monitor = std::shared_ptr<ThermalMonitor>(
+        new ThermalMonitor(std::forward<A>(args)...));
+    if (!monitor->Initialize()) {
+      return nullptr;
+    }
+    return monitor;
+  }
+
+  ~ThermalMonitor();
+
+  // Polls every `poll_period` on a thread of its own, until destroyed.
+  void Start();
+
+  // Reads sysfs once and updates the level. Returns true if it changed. Only
+  // for monitors which weren't started.
+  bool Poll();
+
+  Level level() const { return level_.load(std::memory_order_relaxed); }
+  bool AtLeast(Level level) const {
+    return static_cast<int>(this->level()) >= static_cast<int>(level);
+  }
+  Reading reading() const { return reading_.Read(); }
+
+  static const char *LevelName(Level level);
+
+ private:
+  explicit ThermalMonitor(Options options) : options_(std::move(options)) {}
+
+  bool Initialize();
+  void PollThread();
+
+  // The level the temperature calls for, with the thresholds raised by
+  // `margin`.
+  int LevelFor(float celsius, float margin) const;
+
+  const Options options_;
+  int temperature_fd_ = -1;
+  int frequency_fd_ = -1;
+  int max_frequency_fd_ = -1;
+  int limit_frequency_fd_ = -1;
+  int firmware_throttled_fd_ = -1;
+  int64_t startup_limit_frequency_khz_ = 0;
+
+  std::atomic<Level> level_{Level::NORMAL};
+  int decisions_ = 0;
+  SeqlockSnapshot<Reading> reading_;
+
+  std::mutex mutex_;
+  std::condition_variable stop_;
+  bool running_ = false;
+  std::thread poll_thread_;
+};
+
+}  // namespace led_driver
+
+#endif  // THERMAL_MONITOR_H_
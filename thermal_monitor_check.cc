@@ -0,0 +1,231 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+//
+
+// Runs `ThermalMonitor` against a fake sysfs tree in a temporary directory,
+// stepping the temperature and the cpufreq and firmware state, and checks that
+// the level rises and falls at its thresholds, with the hysteresis, and that
+// only a drop in the clock limit, or the firmware's flags, count as
+// throttling. Exits non-zero if any check fails.
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "absl/flags/parse.h"
+#include "absl/strings/str_cat.h"
+#include "thermal_monitor.h"
+
+extern "C" {
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace led_driver {
+
+namespace {
+
+using Level = ThermalMonitor::Level;
+
+constexpr char kTemperature[] = "class/thermal/thermal_zone0/temp";
+constexpr char kCpufreq[] = "devices/system/cpu/cpu0/cpufreq/";
+constexpr char kFirmwareThrottled[] =
+    "devices/platform/soc/soc:firmware/get_throttled";
+
+// A sysfs tree in a temporary directory, removed with everything written to
+// it.
+class FakeSysfs {
+ public:
+  ~FakeSysfs() {
+    for (auto it = files_.rbegin(); it != files_.rend(); ++it) {
+      unlink(it->c_str());
+    }
+    for (auto it = directories_.rbegin(); it != directories_.rend(); ++it) {
+      rmdir(it->c_str());
+    }
+  }
+
+  bool Initialize() {
+    char root[] = "/tmp/thermal_monitor_check.XXXXXX";
+    if (mkdtemp(root) == nullptr) {
+      std::cerr << "Failed to create a temporary directory: "
+                << strerror(errno) << std::endl;
+      return false;
+    }
+    root_ = root;
+    directories_.push_back(root_);
+    return true;
+  }
+
+  // Writes `value` to `path`, relative to the root, creating the directories
+  // on the way. The file is rewritten in place, so the monitor's open
+  // descriptor reads the new value, as it would from sysfs.
+  bool Write(const std::string &path, const std::string &value) {
+    std::string directory = root_;
+    for (size_t slash = path.find('/'); slash != std::string::npos;
+         slash = path.find('/', slash + 1)) {
+      directory = absl::StrCat(root_, "/", path.substr(0, slash));
+      if (mkdir(directory.c_str(), 0755) == 0) {
+        directories_.push_back(directory);
+      }
+    }
+    const std::string file_path = absl::StrCat(root_, "/", path);
+    if (access(file_path.c_str(), F_OK) != 0) {
+      files_.push_back(file_path);
+    }
+    std::ofstream file(file_path, std::ios::trunc);
+    file << value << "\n";
+    if (!file.good()) {
+      std::cerr << "Failed to write " << file_path << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  const std::string &root() const { return root_; }
+
+ private:
+  std::string root_;
+  std::vector<std::string> files_;
+  std::vector<std::string> directories_;
+};
+
+ThermalMonitor::Options CheckOptions(const std::string &sysfs_root) {
+  ThermalMonitor::Options options;
+  options.sysfs_root = sysfs_root;
+  options.shed_celsius = 70.0f;
+  options.step_celsius = 2.5f;
+  options.hysteresis_celsius = 2.0f;
+  return options;
+}
+
+// Sets the temperature, polls, and checks the level and throttling.
+bool Step(FakeSysfs *sysfs, ThermalMonitor *monitor, float celsius,
+          Level expected, bool expected_throttled, const char *what) {
+  if (!sysfs->Write(kTemperature,
+                    std::to_string(static_cast<int>(celsius * 1000)))) {
+    return false;
+  }
+  monitor->Poll();
+  const ThermalMonitor::Reading reading = monitor->reading();
+  const bool ok = monitor->level() == expected &&
+                  reading.throttled == expected_throttled;
+  std::cout << (ok ? "ok   " : "FAIL ") << what << ": " << celsius << " C, "
+            << ThermalMonitor::LevelName(monitor->level())
+            << (reading.throttled ? ", throttled" : "");
+  if (!ok) {
+    std::cout << "; expected " << ThermalMonitor::LevelName(expected)
+              << (expected_throttled ? ", throttled" : "");
+  }
+  std::cout << std::endl;
+  return ok;
+}
+
+// Without the firmware's flags: levels, hysteresis, and throttling from the
+// cpufreq limit, which starts below the hardware maximum on purpose.
+bool CheckCpufreq() {
+  FakeSysfs sysfs;
+  const std::string cpufreq = kCpufreq;
+  if (!sysfs.Initialize() || !sysfs.Write(kTemperature, "50000") ||
+      !sysfs.Write(cpufreq + "scaling_cur_freq", "1500000") ||
+      !sysfs.Write(cpufreq + "cpuinfo_max_freq", "1800000") ||
+      !sysfs.Write(cpufreq + "scaling_max_freq", "1500000")) {
+    return false;
+  }
+  auto monitor = ThermalMonitor::Create(CheckOptions(sysfs.root()));
+  if (monitor == nullptr) {
+    return false;
+  }
+
+  bool ok = true;
+  ok &= Step(&sysfs, monitor.get(), 50.0f, Level::NORMAL, false,
+             "cool, with the clock capped on purpose");
+  ok &= Step(&sysfs, monitor.get(), 70.5f, Level::REDUCED_RATE, false,
+             "past the shedding threshold");
+  ok &= Step(&sysfs, monitor.get(), 69.0f, Level::REDUCED_RATE, false,
+             "below the threshold, within the hysteresis");
+  ok &= Step(&sysfs, monitor.get(), 67.5f, Level::NORMAL, false,
+             "clear of the hysteresis");
+  ok &= Step(&sysfs, monitor.get(), 73.0f, Level::NO_ANTIALIASING, false,
+             "a step past the threshold");
+  ok &= Step(&sysfs, monitor.get(), 85.0f, Level::REDUCED_RESOLUTION, false,
+             "far past the threshold");
+  ok &= Step(&sysfs, monitor.get(), 71.5f, Level::NO_ANTIALIASING, false,
+             "falling, held a step up by the hysteresis");
+  ok &= Step(&sysfs, monitor.get(), 60.0f, Level::NORMAL, false, "cool again");
+
+  ok &= sysfs.Write(cpufreq + "scaling_max_freq", "1200000");
+  ok &= Step(&sysfs, monitor.get(), 60.0f, Level::REDUCED_RATE, true,
+             "limit dropped below the one at startup");
+  ok &= sysfs.Write(cpufreq + "scaling_max_freq", "1500000");
+  ok &= Step(&sysfs, monitor.get(), 60.0f, Level::NORMAL, false,
+             "limit restored");
+  return ok;
+}
+
+// With the firmware's flags, which take precedence over the cpufreq limit.
+bool CheckFirmware() {
+  FakeSysfs sysfs;
+  const std::string cpufreq = kCpufreq;
+  if (!sysfs.Initialize() || !sysfs.Write(kTemperature, "50000") ||
+      !sysfs.Write(cpufreq + "scaling_cur_freq", "1500000") ||
+      !sysfs.Write(cpufreq + "scaling_max_freq", "1500000") ||
+      !sysfs.Write(kFirmwareThrottled, "0x0")) {
+    return false;
+  }
+  auto monitor = ThermalMonitor::Create(CheckOptions(sysfs.root()));
+  if (monitor == nullptr) {
+    return false;
+  }
+
+  bool ok = true;
+  ok &= sysfs.Write(cpufreq + "scaling_max_freq", "1200000");
+  ok &= Step(&sysfs, monitor.get(), 50.0f, Level::NORMAL, false,
+             "limit dropped, firmware not throttling");
+  ok &= sysfs.Write(kFirmwareThrottled, "0x50004");
+  ok &= Step(&sysfs, monitor.get(), 50.0f, Level::REDUCED_RATE, true,
+             "firmware throttling");
+  ok &= sysfs.Write(kFirmwareThrottled, "0x50000");
+  ok &= Step(&sysfs, monitor.get(), 50.0f, Level::NORMAL, false,
+             "firmware throttled earlier, but not now");
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  absl::ParseCommandLine(argc, argv);
+
+  const bool cpufreq_ok = CheckCpufreq();
+  const bool firmware_ok = CheckFirmware();
+  if (!cpufreq_ok || !firmware_ok) {
+    std::cout << "FAIL" << std::endl;
+    return 1;
+  }
+  std::cout << "PASS" << std::endl;
+  return 0;
+}
+}  // namespace led_driver
+
+extern "C" {
+int main(int argc, char *argv[]) { return led_driver::main(argc, argv); }
+}
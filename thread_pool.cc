@@ -0,0 +1,146 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <string>
+
+namespace led_driver {
+
+namespace {
+uint64_t PackRange(uint32_t begin, uint32_t end) {
+  return (static_cast<uint64_t>(end) << 32) | begin;
+}
+}  // namespace
+
+ThreadPool::ThreadPool(int thread_count, ThreadSchedule schedule)
+    : shares_(std::max(thread_count, 1)) {
+  for (int worker = 1; worker < num_threads(); ++worker) {
+    ThreadSchedule worker_schedule = schedule;
+    if (schedule.cpu >= 0) {
+      worker_schedule.cpu = schedule.cpu + worker - 1;
+    }
+    threads_.emplace_back(&ThreadPool::WorkerThread, this, worker,
+                          worker_schedule);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  start_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::Run(int count, Task task, void *context) {
+  if (count <= 0) {
+    return;
+  }
+  if (threads_.empty() || count == 1) {
+    for (int i = 0; i < count; ++i) {
+      task(context, i);
+    }
+    return;
+  }
+
+  std::lock_guard<std::mutex> run_lock(run_mutex_);
+  const int num_shares = num_threads();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int share = 0; share < num_shares; ++share) {
+      shares_[share].range.store(
+          PackRange(static_cast<int64_t>(count) * share / num_shares,
+                    static_cast<int64_t>(count) * (share + 1) / num_shares),
+          std::memory_order_relaxed);
+    }
+    task_ = task;
+    context_ = context;
+    busy_workers_ = threads_.size();
+    ++generation_;
+  }
+  start_.notify_all();
+
+  Drain(0);
+
+  // Every iteration has been taken once every share is empty, and has run
+  // once the thread which took it is no longer busy.
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_.wait(lock, [this]() { return busy_workers_ == 0; });
+}
+
+void ThreadPool::WorkerThread(int worker, ThreadSchedule schedule) {
+  ApplyThreadSchedule(("pool " + std::to_string(worker)).c_str(), schedule);
+  uint64_t generation = 0;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    start_.wait(lock,
+                [&]() { return quit_ || generation_ != generation; });
+    if (quit_) {
+      return;
+    }
+    generation = generation_;
+    lock.unlock();
+    Drain(worker);
+    lock.lock();
+    if (--busy_workers_ == 0) {
+      done_.notify_one();
+    }
+  }
+}
+
+void ThreadPool::Drain(int worker) {
+  const int num_shares = num_threads();
+  int index;
+  while (Take(worker, true, &index)) {
+    task_(context_, index);
+  }
+  for (int offset = 1; offset < num_shares; ++offset) {
+    const int victim = (worker + offset) % num_shares;
+    while (Take(victim, false, &index)) {
+      task_(context_, index);
+    }
+  }
+}
+
+bool ThreadPool::Take(int share, bool from_front, int *index) {
+  std::atomic<uint64_t> &range = shares_[share].range;
+  uint64_t current = range.load(std::memory_order_acquire);
+  while (true) {
+    const uint32_t begin = current & 0xFFFFFFFF;
+    const uint32_t end = current >> 32;
+    if (begin >= end) {
+      return false;
+    }
+    const uint64_t next =
+        from_front ? PackRange(begin + 1, end) : PackRange(begin, end - 1);
+    if (range.compare_exchange_weak(current, next,
+                                    std::memory_order_acq_rel)) {
+      *index = from_front ? begin : end - 1;
+      return true;
+    }
+  }
+}
+
+}  // namespace led_driver
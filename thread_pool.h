@@ -0,0 +1,104 @@
+//
+// LED Suit Driver - Embedded host driver software for Kevin's LED suit
+// controller. Copyright (C) 2019-2020 Kevin Balke
+//
+// This file is part of LED Suit Driver.
+//
+// LED Suit Driver is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LED Suit Driver is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "realtime.h"
+
+namespace led_driver {
+
+// A small pool of threads which runs the iterations of a loop in parallel.
+// Each thread starts on a contiguous share of the iterations, and once its
+// own share runs out, steals from the far end of another's, so that uneven
+// iterations still balance. The calling thread takes a share of its own.
+class ThreadPool {
+ public:
+  // `thread_count` counts the calling thread, so a pool of one runs every
+  // loop inline. The calling thread is worker 0 and isn't pinned; worker `i`
+  // of the rest is pinned to CPU `schedule.cpu + i - 1`, if set.
+  explicit ThreadPool(int thread_count,
+                      ThreadSchedule schedule = ThreadSchedule());
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  int num_threads() const { return shares_.size(); }
+
+  // Runs `body(i)` for every `i` in [0, `count`), and returns once they have
+  // all run. Doesn't allocate. Loops from different threads run one at a
+  // time.
+  template <typename F>
+  void ParallelFor(int count, F &&body) {
+    using Body = std::remove_reference_t<F>;
+    Run(count,
+        [](void *context, int index) {
+          (*static_cast<Body *>(context))(index);
+        },
+        const_cast<void *>(static_cast<const void *>(&body)));
+  }
+
+ private:
+  using Task = void (*)(void *context, int index);
+
+  // The iterations left in one thread's share, with the next in the low 32
+  // bits and the end in the high 32 bits. The owner takes from the front and
+  // thieves from the back.
+  struct alignas(64) Share {
+    std::atomic<uint64_t> range{0};
+  };
+
+  void Run(int count, Task task, void *context);
+  void WorkerThread(int worker, ThreadSchedule schedule);
+
+  // Runs iterations from `worker`'s share, then from the others', until none
+  // are left.
+  void Drain(int worker);
+  bool Take(int share, bool from_front, int *index);
+
+  std::vector<Share> shares_;
+  std::vector<std::thread> threads_;
+
+  std::mutex run_mutex_;
+
+  // The current loop. Guarded by `mutex_`, and read by the workers between
+  // its start and the last of them finishing.
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+  Task task_ = nullptr;
+  void *context_ = nullptr;
+  uint64_t generation_ = 0;
+  int busy_workers_ = 0;
+  bool quit_ = false;
+};
+
+}  // namespace led_driver
+
+#endif  // THREAD_POOL_H_
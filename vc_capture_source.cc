@@ -55,6 +55,8 @@ bool VcCaptureSource::ConfigureCaptureRegion(int x, int y, int width,
         kImageBytesPerPixel * AlignTo(mode_info_.width, kVcBufferAlignment);
     capture_buffer_->buffer.resize(capture_buffer_->row_stride * height, 0);
     capture_buffer_->bytes_per_pixel = kImageBytesPerPixel;
+    capture_buffer_->width = width;
+    capture_buffer_->height = height;
 
     capture_configured_ = true;
     return true;
@@ -36,6 +36,9 @@ struct ImageBuffer {
   std::vector<uint8_t> buffer;
   ssize_t row_stride;
   ssize_t bytes_per_pixel;
+  // Dimensions of the captured region, in pixels.
+  ssize_t width;
+  ssize_t height;
 };
 
 // Interface for objects that can receive image buffers from a
@@ -18,6 +18,8 @@
 // along with LED Suit Driver.  If not, see <http://www.gnu.org/licenses/>.
 //
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 #include "visual_interest_processor.h"
@@ -35,15 +37,17 @@ VisualInterestProcessor::~VisualInterestProcessor() {
 
 void VisualInterestProcessor::Receive(
     std::shared_ptr<ImageBuffer> image_buffer) {
+  if (paused_.load()) {
+    return;
+  }
   if (periodic_timer_.IsDue(absl::ToUnixMillis(absl::Now()))) {
     if (write_mutex_.try_lock()) {
       if (current_image_.empty()) {
-        current_image_ = image_buffer->buffer;
-      }
-      if (!calculator_thread_.joinable()) {
-        std::cerr << "Creating calculation thread" << std::endl;
-        calculator_thread_ = std::thread(std::bind(
-            &VisualInterestProcessor::CalculateVisualInterestThread, this));
+        if (image_buffer->width != windows_width_ ||
+            image_buffer->height != windows_height_) {
+          ConfigureWindows(*image_buffer);
+        }
+        GatherWindows(*image_buffer);
       }
       data_ready_.notify_one();
       write_mutex_.unlock();
@@ -51,28 +55,121 @@ void VisualInterestProcessor::Receive(
   }
 }
 
+void VisualInterestProcessor::ConfigureWindows(
+    const ImageBuffer &image_buffer) {
+  windows_.clear();
+  windows_width_ = image_buffer.width;
+  windows_height_ = image_buffer.height;
+
+  for (const auto &region : config_.regions_of_interest) {
+    if (region.weight <= 0) {
+      continue;
+    }
+    const float center_x = region.x * (image_buffer.width - 1);
+    const float center_y = region.y * (image_buffer.height - 1);
+    const float radius_x = region.radius_x * (image_buffer.width - 1);
+    const float radius_y = region.radius_y * (image_buffer.height - 1);
+
+    const ssize_t x_min = std::clamp<ssize_t>(
+        std::floor(center_x - radius_x), 0, image_buffer.width - 1);
+    const ssize_t x_max = std::clamp<ssize_t>(std::ceil(center_x + radius_x),
+                                              0, image_buffer.width - 1);
+    const ssize_t y_min = std::clamp<ssize_t>(
+        std::floor(center_y - radius_y), 0, image_buffer.height - 1);
+    const ssize_t y_max = std::clamp<ssize_t>(std::ceil(center_y + radius_y),
+                                              0, image_buffer.height - 1);
+    if (x_max < x_min || y_max < y_min) {
+      continue;
+    }
+    windows_.push_back({x_min, y_min, x_max - x_min + 1, y_max - y_min + 1,
+                        region.weight});
+  }
+
+  // Without any usable region, analyses the whole raster, so that presets
+  // still follow the show.
+  if (windows_.empty()) {
+    if (!config_.regions_of_interest.empty()) {
+      std::cerr << "No region of interest has a positive weight and a window "
+                   "on the raster; analysing the whole raster"
+                << std::endl;
+    }
+    windows_.push_back({0, 0, image_buffer.width, image_buffer.height, 1.0f});
+  }
+
+  ssize_t offset = 0;
+  for (auto &window : windows_) {
+    window.offset = offset;
+    window.length = window.width * window.height * image_buffer.bytes_per_pixel;
+    offset += window.length;
+  }
+
+  current_image_.reserve(offset);
+  previous_image_.reserve(offset);
+
+  std::cerr << "Analysing " << windows_.size() << " windows totalling "
+            << offset << " bytes of each frame" << std::endl;
+
+  // The gathered layout changed, so the previous image can't be compared.
+  previous_image_.clear();
+}
+
+void VisualInterestProcessor::GatherWindows(const ImageBuffer &image_buffer) {
+  ssize_t total_length = 0;
+  for (const auto &window : windows_) {
+    total_length += window.length;
+  }
+  current_image_.resize(total_length);
+
+  auto output = current_image_.begin();
+  for (const auto &window : windows_) {
+    const ssize_t row_length = window.width * image_buffer.bytes_per_pixel;
+    for (ssize_t y = window.y; y < window.y + window.height; ++y) {
+      auto row = image_buffer.buffer.begin() + y * image_buffer.row_stride +
+                 window.x * image_buffer.bytes_per_pixel;
+      output = std::copy(row, row + row_length, output);
+    }
+  }
+}
+
 float VisualInterestProcessor::CalculateVisualInterest(
     std::vector<uint8_t> &raw_image) {
   if (previous_image_.size() != raw_image.size()) {
-    previous_image_ = raw_image;
+    previous_image_.swap(raw_image);
     return 0.0f;
   }
-  int64_t delta_energy = 0;
-  for (int i = 0; i < raw_image.size(); ++i) {
-    delta_energy += std::sqrt(std::abs(raw_image[i] - previous_image_[i]));
+
+  float weighted_energy = 0;
+  float total_weight = 0;
+  for (const auto &window : windows_) {
+    if (window.length == 0) {
+      continue;
+    }
+    int64_t delta_energy = 0;
+    for (ssize_t i = window.offset; i < window.offset + window.length; ++i) {
+      delta_energy += std::sqrt(std::abs(raw_image[i] - previous_image_[i]));
+    }
+    weighted_energy +=
+        window.weight * static_cast<float>(delta_energy) / window.length;
+    total_weight += window.weight;
   }
 
-  previous_image_ = raw_image;
-  return static_cast<float>(delta_energy) / raw_image.size();
+  previous_image_.swap(raw_image);
+  if (total_weight == 0) {
+    return 0.0f;
+  }
+  return weighted_energy / total_weight;
 }
 
 void VisualInterestProcessor::CalculateVisualInterestThread() {
+  ApplyThreadSchedule("visual_interest", config_.thread_schedule);
   while (1) {
     float visual_interest = 0;
     {
       std::unique_lock<std::mutex> write_lock(write_mutex_);
       data_ready_.wait(write_lock,
-                       [this]() { return !current_image_.empty(); });
+                       [this]() {
+                         return quit_thread_ || !current_image_.empty();
+                       });
       if (quit_thread_) {
         std::cerr << "Signaled to quit calculation thread";
         return;
@@ -85,6 +182,7 @@ void VisualInterestProcessor::CalculateVisualInterestThread() {
         continue;
       }
       visual_interest = CalculateVisualInterest(current_image_);
+      // Keeps the capacity, so the next gather doesn't allocate.
       current_image_.clear();
     }
     float average_interest = CalculateMovingAverage(visual_interest);
@@ -23,19 +23,33 @@
 
 #include <cstdint>
 
+#include <atomic>
 #include <condition_variable>
 #include <mutex>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include "absl/time/clock.h"
 #include "periodic.h"
 #include "projectm_controller.h"
+#include "realtime.h"
 #include "vc_capture_source.h"
 
 namespace led_driver {
 class VisualInterestProcessor : public ImageBufferReceiverInterface {
 public:
+  // A region of the source raster to analyse. The center and radii are
+  // normalized to the raster dimensions, as with the mapping samples.
+  struct RegionOfInterest {
+    float x = 0.5f;
+    float y = 0.5f;
+    float radius_x = 0.5f;
+    float radius_y = 0.5f;
+    // Relative weight of this region's contribution to the visual interest.
+    float weight = 1.0f;
+  };
+
   struct Config {
     // How often to calculate the visual interest.
     int64_t calculation_period_ms = 1000;
@@ -56,6 +70,14 @@ public:
     // advanced, the moving average buffer will be cleared and will not have new
     // values pushed until this many calculation periods have elapsed.
     ssize_t cooldown_duration = 10;
+
+    // Regions of the raster to analyse. Only the bounding windows of these
+    // regions are copied and compared between frames. If empty, the whole
+    // raster is analysed.
+    std::vector<RegionOfInterest> regions_of_interest;
+
+    // Scheduling for the calculation thread.
+    ThreadSchedule thread_schedule;
   };
 
   VisualInterestProcessor(
@@ -66,13 +88,41 @@ public:
                         absl::ToUnixMillis(absl::Now())),
         cooldown_counter_(0), quit_thread_(false) {
     ResetMovingAverage();
+    // Started up front, so that the capture thread never allocates it.
+    calculator_thread_ = std::thread(
+        &VisualInterestProcessor::CalculateVisualInterestThread, this);
   }
 
   ~VisualInterestProcessor() override;
 
   void Receive(std::shared_ptr<ImageBuffer> image_buffer) override;
 
+  // While paused, frames are ignored and no presets are skipped.
+  void set_paused(bool paused) { paused_.store(paused); }
+  bool paused() const { return paused_.load(); }
+
 private:
+  // A rectangular window of the raster, in pixels, and the offset of its
+  // pixels within the gathered image.
+  struct Window {
+    ssize_t x;
+    ssize_t y;
+    ssize_t width;
+    ssize_t height;
+    float weight;
+    ssize_t offset;
+    ssize_t length;
+  };
+
+  // Computes `windows_` for the dimensions of `image_buffer`.
+  void ConfigureWindows(const ImageBuffer &image_buffer);
+
+  // Copies the pixels within `windows_` out of `image_buffer` and into
+  // `current_image_`.
+  void GatherWindows(const ImageBuffer &image_buffer);
+
+  // Compares `raw_image` with the previous image, and then swaps it into
+  // `previous_image_`; `raw_image` is left holding the older image.
   float CalculateVisualInterest(std::vector<uint8_t> &raw_image);
 
   void CalculateVisualInterestThread();
@@ -87,6 +137,7 @@ private:
   float moving_average_;
   int moving_average_invocations_;
   int cooldown_counter_;
+  std::atomic<bool> paused_{false};
 
   std::mutex write_mutex_;
   // `current_image_` and `previous_image_` are guarded by `write_mutex_`.
@@ -94,6 +145,12 @@ private:
   std::vector<uint8_t> current_image_;
   std::vector<uint8_t> previous_image_;
 
+  // The windows to analyse, and the raster dimensions they were computed for.
+  // Guarded by `write_mutex_`.
+  std::vector<Window> windows_;
+  ssize_t windows_width_ = -1;
+  ssize_t windows_height_ = -1;
+
   std::thread calculator_thread_;
   std::condition_variable data_ready_;
 };